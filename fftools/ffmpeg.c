@@ -44,6 +44,7 @@
 #include "libavformat/avformat.h"
 #include "libavdevice/avdevice.h"
 #include "libswresample/swresample.h"
+#include "libswscale/swscale.h"
 #include "libavutil/opt.h"
 #include "libavutil/channel_layout.h"
 #include "libavutil/parseutils.h"
@@ -64,6 +65,8 @@
 #include "libavutil/time.h"
 #include "libavutil/thread.h"
 #include "libavutil/threadmessage.h"
+#include "libavutil/slicethread.h"
+#include "libavutil/murmur3.h"
 #include "libavcodec/mathops.h"
 #include "libavformat/os_support.h"
 
@@ -176,7 +179,9 @@ static int restore_tty;
 
 #if HAVE_THREADS
 static void free_input_threads(void);
+static void free_encoder_threads(void);
 #endif
+static void eagle_stop_analysis(void);
 
 /* sub2video hack:
    Convert subtitles to video with alpha to insert them in filter graphs.
@@ -499,6 +504,10 @@ static void ffmpeg_cleanup(int ret)
         av_log(NULL, AV_LOG_INFO, "bench: maxrss=%ikB\n", maxrss);
     }
 
+#if HAVE_THREADS
+    free_encoder_threads();
+#endif
+
     for (i = 0; i < nb_filtergraphs; i++) {
         FilterGraph *fg = filtergraphs[i];
         avfilter_graph_free(&fg->graph);
@@ -596,6 +605,7 @@ static void ffmpeg_cleanup(int ret)
 #if HAVE_THREADS
     free_input_threads();
 #endif
+    eagle_stop_analysis();
     for (i = 0; i < nb_input_files; i++) {
         avformat_close_input(&input_files[i]->ctx);
         av_freep(&input_files[i]);
@@ -624,6 +634,8 @@ static void ffmpeg_cleanup(int ret)
                    av_err2str(AVERROR(errno)));
     }
     av_freep(&vstats_filename);
+    av_freep(&eagle_search);
+    av_freep(&eagle_cache);
 
     av_freep(&input_streams);
     av_freep(&input_files);
@@ -697,7 +709,14 @@ static void close_all_output_streams(OutputStream *ost, OSTFinished this_stream,
     }
 }
 
-static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int unqueue)
+/*
+ * Write a packet to the muxer, or buffer it until the header is written.
+ * This may run on the encoder thread of ost, so errors are returned rather
+ * than exiting; if the muxer itself fails, ost->muxer_failed is set and the
+ * caller on the main thread finishes the output streams, see
+ * handle_output_error().
+ */
+static int write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int unqueue)
 {
     AVFormatContext *s = of->ctx;
     AVStream *st = ost->st;
@@ -714,7 +733,7 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
     if (!(st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && ost->encoding_needed) && !unqueue) {
         if (ost->frame_number >= ost->max_frames) {
             av_packet_unref(pkt);
-            return;
+            return 0;
         }
         ost->frame_number++;
     }
@@ -729,18 +748,19 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
                 av_log(NULL, AV_LOG_ERROR,
                        "Too many packets buffered for output stream %d:%d.\n",
                        ost->file_index, ost->st->index);
-                exit_program(1);
+                ret = AVERROR(ENOSPC);
+                goto fail;
             }
             ret = av_fifo_realloc2(ost->muxing_queue, new_size);
             if (ret < 0)
-                exit_program(1);
+                goto fail;
         }
         ret = av_packet_make_refcounted(pkt);
         if (ret < 0)
-            exit_program(1);
+            goto fail;
         av_packet_move_ref(&tmp_pkt, pkt);
         av_fifo_generic_write(ost->muxing_queue, &tmp_pkt, sizeof(tmp_pkt), NULL);
-        return;
+        return 0;
     }
 
     if ((st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && video_sync_method == VSYNC_DROP) ||
@@ -795,7 +815,8 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
                        ost->file_index, ost->st->index, ost->last_mux_dts, pkt->dts);
                 if (exit_on_error) {
                     av_log(NULL, AV_LOG_FATAL, "aborting.\n");
-                    exit_program(1);
+                    ret = AVERROR(EINVAL);
+                    goto fail;
                 }
                 av_log(s, loglevel, "changing to %"PRId64". This may result "
                        "in incorrect timestamps in the output file.\n",
@@ -826,10 +847,35 @@ static void write_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost, int u
     ret = av_interleaved_write_frame(s, pkt);
     if (ret < 0) {
         print_error("av_interleaved_write_frame()", ret);
-        main_return_code = 1;
-        close_all_output_streams(ost, MUXER_FINISHED | ENCODER_FINISHED, ENCODER_FINISHED);
+        ost->muxer_failed = 1;
     }
+fail:
     av_packet_unref(pkt);
+    return ret;
+}
+
+/* Handle an error returned by write_packet() or output_packet(), on the main
+ * thread: a failing muxer finishes the output streams, anything else is
+ * fatal. */
+static void handle_output_error(OutputStream *ost, int ret)
+{
+    if (!ost->muxer_failed)
+        exit_program(1);
+    main_return_code = 1;
+    close_all_output_streams(ost, MUXER_FINISHED | ENCODER_FINISHED, ENCODER_FINISHED);
+}
+
+/* Streams encoded on their own thread write to the muxers concurrently. */
+static AVMutex mux_lock = AV_MUTEX_INITIALIZER;
+
+static int mux_packet(OutputFile *of, AVPacket *pkt, OutputStream *ost)
+{
+    int ret;
+
+    ff_mutex_lock(&mux_lock);
+    ret = write_packet(of, pkt, ost, 0);
+    ff_mutex_unlock(&mux_lock);
+    return ret;
 }
 
 static void close_output_stream(OutputStream *ost)
@@ -853,9 +899,11 @@ static void close_output_stream(OutputStream *ost)
  * If eof is set, instead indicate EOF to all bitstream filters and
  * therefore flush any delayed packets to the output.  A blank packet
  * must be supplied in this case.
+ *
+ * Returns a negative error on failure, see write_packet().
  */
-static void output_packet(OutputFile *of, AVPacket *pkt,
-                          OutputStream *ost, int eof)
+static int output_packet(OutputFile *of, AVPacket *pkt,
+                         OutputStream *ost, int eof)
 {
     int ret = 0;
 
@@ -890,19 +938,20 @@ static void output_packet(OutputFile *of, AVPacket *pkt,
                 eof = 0;
             } else if (eof)
                 goto finish;
-            else
-                write_packet(of, pkt, ost, 0);
+            else if ((ret = mux_packet(of, pkt, ost)) < 0)
+                return ret;
         }
     } else if (!eof)
-        write_packet(of, pkt, ost, 0);
+        return mux_packet(of, pkt, ost);
 
 finish:
     if (ret < 0 && ret != AVERROR_EOF) {
         av_log(NULL, AV_LOG_ERROR, "Error applying bitstream filters to an output "
                "packet for stream #%d:%d.\n", ost->file_index, ost->index);
         if(exit_on_error)
-            exit_program(1);
+            return ret;
     }
+    return 0;
 }
 
 static int check_recording_time(OutputStream *ost)
@@ -918,8 +967,7 @@ static int check_recording_time(OutputStream *ost)
     return 1;
 }
 
-static void do_audio_out(OutputFile *of, OutputStream *ost,
-                         AVFrame *frame)
+static int encode_audio_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
 {
     AVCodecContext *enc = ost->enc_ctx;
     AVPacket pkt;
@@ -929,34 +977,16 @@ static void do_audio_out(OutputFile *of, OutputStream *ost,
     pkt.data = NULL;
     pkt.size = 0;
 
-    if (!check_recording_time(ost))
-        return;
-
-    if (frame->pts == AV_NOPTS_VALUE || audio_sync_method < 0)
-        frame->pts = ost->sync_opts;
-    ost->sync_opts = frame->pts + frame->nb_samples;
-    ost->samples_encoded += frame->nb_samples;
-    ost->frames_encoded++;
-
-    av_assert0(pkt.size || !pkt.data);
-    update_benchmark(NULL);
-    if (debug_ts) {
-        av_log(NULL, AV_LOG_INFO, "encoder <- type:audio "
-               "frame_pts:%s frame_pts_time:%s time_base:%d/%d\n",
-               av_ts2str(frame->pts), av_ts2timestr(frame->pts, &enc->time_base),
-               enc->time_base.num, enc->time_base.den);
-    }
-
     ret = avcodec_send_frame(enc, frame);
     if (ret < 0)
-        goto error;
+        return ret;
 
     while (1) {
         ret = avcodec_receive_packet(enc, &pkt);
         if (ret == AVERROR(EAGAIN))
-            break;
+            return 0;
         if (ret < 0)
-            goto error;
+            return ret;
 
         update_benchmark("encode_audio %d.%d", ost->file_index, ost->index);
 
@@ -969,13 +999,146 @@ static void do_audio_out(OutputFile *of, OutputStream *ost,
                    av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &enc->time_base));
         }
 
-        output_packet(of, &pkt, ost, 0);
+        if ((ret = output_packet(of, &pkt, ost, 0)) < 0)
+            return ret;
     }
+}
 
-    return;
-error:
-    av_log(NULL, AV_LOG_FATAL, "Audio encoding failed\n");
-    exit_program(1);
+static int encode_video_frame(OutputFile *of, OutputStream *ost, AVFrame *frame);
+
+#if HAVE_THREADS
+static void *encoder_thread(void *arg)
+{
+    OutputStream *ost = arg;
+    OutputFile    *of = output_files[ost->file_index];
+    AVFrame *frame;
+    int ret;
+
+    while ((ret = av_thread_message_queue_recv(ost->enc_queue, &frame, 0)) >= 0) {
+        if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+            ret = encode_video_frame(of, ost, frame);
+        else
+            ret = encode_audio_frame(of, ost, frame);
+        av_frame_free(&frame);
+        if (ret < 0)
+            break;
+    }
+
+    /* the main thread sees the error on its next frame or when finishing */
+    ost->enc_thread_ret = ret == AVERROR_EOF ? 0 : ret;
+    av_thread_message_queue_set_err_send(ost->enc_queue, ret < 0 ? ret : AVERROR_EOF);
+    return NULL;
+}
+
+static void encoder_thread_free_frame(void *msg)
+{
+    av_frame_free(msg);
+}
+
+static int init_encoder_thread(OutputStream *ost)
+{
+    int ret;
+
+    ret = av_thread_message_queue_alloc(&ost->enc_queue, FFMAX(encode_queue_size, 1),
+                                        sizeof(AVFrame *));
+    if (ret < 0)
+        return ret;
+    av_thread_message_queue_set_free_func(ost->enc_queue, encoder_thread_free_frame);
+
+    if ((ret = pthread_create(&ost->enc_thread, NULL, encoder_thread, ost))) {
+        av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+        av_thread_message_queue_free(&ost->enc_queue);
+        return AVERROR(ret);
+    }
+    return 0;
+}
+
+/* Wait for the encoder thread to encode the queued frames, or drop them if
+ * aborting, and hand the encoder back to the main thread. */
+static int free_encoder_thread(OutputStream *ost, int abort)
+{
+    if (!ost->enc_queue)
+        return 0;
+
+    av_thread_message_queue_set_err_recv(ost->enc_queue, abort ? AVERROR_EXIT : AVERROR_EOF);
+    if (abort)
+        av_thread_message_flush(ost->enc_queue);
+    pthread_join(ost->enc_thread, NULL);
+    av_thread_message_queue_free(&ost->enc_queue);
+    return ost->enc_thread_ret;
+}
+
+static void free_encoder_threads(void)
+{
+    int i;
+
+    for (i = 0; i < nb_output_streams; i++)
+        free_encoder_thread(output_streams[i], 1);
+}
+#endif
+
+/* Encode frame and write out the resulting packets, on the encoder thread of
+ * ost with -encode_thread. The thread takes a reference of its own, frame is
+ * left to the caller. */
+static int encode_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
+{
+    int ret;
+
+#if HAVE_THREADS
+    /* vstats and benchmark_all output is not thread-safe */
+    if (encode_thread && !ost->enc_queue && !vstats_filename && !do_benchmark_all &&
+        (ret = init_encoder_thread(ost)) < 0)
+        return ret;
+    if (ost->enc_queue) {
+        AVFrame *ref = av_frame_clone(frame);
+
+        if (!ref)
+            return AVERROR(ENOMEM);
+        /* fails once the thread stopped, with the error it stopped on */
+        ret = av_thread_message_queue_send(ost->enc_queue, &ref, 0);
+        if (ret < 0)
+            av_frame_free(&ref);
+    } else
+#endif
+    if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        ret = encode_video_frame(of, ost, frame);
+    else
+        ret = encode_audio_frame(of, ost, frame);
+
+    /* a failing muxer finishes the streams but is no encoding error */
+    if (ret < 0 && ost->muxer_failed) {
+        handle_output_error(ost, ret);
+        return 0;
+    }
+    return ret;
+}
+
+static void do_audio_out(OutputFile *of, OutputStream *ost,
+                         AVFrame *frame)
+{
+    AVCodecContext *enc = ost->enc_ctx;
+
+    if (!check_recording_time(ost))
+        return;
+
+    if (frame->pts == AV_NOPTS_VALUE || audio_sync_method < 0)
+        frame->pts = ost->sync_opts;
+    ost->sync_opts = frame->pts + frame->nb_samples;
+    ost->samples_encoded += frame->nb_samples;
+    ost->frames_encoded++;
+
+    update_benchmark(NULL);
+    if (debug_ts) {
+        av_log(NULL, AV_LOG_INFO, "encoder <- type:audio "
+               "frame_pts:%s frame_pts_time:%s time_base:%d/%d\n",
+               av_ts2str(frame->pts), av_ts2timestr(frame->pts, &enc->time_base),
+               enc->time_base.num, enc->time_base.den);
+    }
+
+    if (encode_frame(of, ost, frame) < 0) {
+        av_log(NULL, AV_LOG_FATAL, "Audio encoding failed\n");
+        exit_program(1);
+    }
 }
 
 static void do_subtitle_out(OutputFile *of,
@@ -987,6 +1150,7 @@ static void do_subtitle_out(OutputFile *of,
     AVCodecContext *enc;
     AVPacket pkt;
     int64_t pts;
+    int ret;
 
     if (sub->pts == AV_NOPTS_VALUE) {
         av_log(NULL, AV_LOG_ERROR, "Subtitle packets must have a pts\n");
@@ -1057,103 +1221,324 @@ static void do_subtitle_out(OutputFile *of,
                 pkt.pts += av_rescale_q(sub->end_display_time, (AVRational){ 1, 1000 }, ost->mux_timebase);
         }
         pkt.dts = pkt.pts;
-        output_packet(of, &pkt, ost, 0);
+        if ((ret = output_packet(of, &pkt, ost, 0)) < 0)
+            handle_output_error(ost, ret);
     }
 }
 
-#include <x264.h>
-
 int gop_num = 0;
 
-#define TOTAL_GOP_NUM 1000
-
-float global_target_score_array[TOTAL_GOP_NUM] = {0.0};
-float global_crf_array[TOTAL_GOP_NUM] = {0.0};
-extern float global_unsharp_array[TOTAL_GOP_NUM];
-float global_aq_strength_array[TOTAL_GOP_NUM] = {0.0};
-int   global_frames_of_gop_array[TOTAL_GOP_NUM] = {0};
 int   global_decode_gop_num = 0;
 int   global_stage1_gop_num = 0;
 int   global_stage2_gop_num = 0;
-extern int   global_gop;
 int   total_gop_num = 0;
 long long filtered_frame_num = 0;
 
-typedef struct Eagle_Param_Context {
-	float target_score_array[TOTAL_GOP_NUM];
-	float crf_array[TOTAL_GOP_NUM];
-	float aq_strength_array[TOTAL_GOP_NUM];
-	int   frames_of_gop_array[TOTAL_GOP_NUM];
-	int   decode_gop_num;
-	int   stage1_gop_num;
-	int   stage2_gop_num;
-	int   total_gop_num;
-	long long filtered_frame_num;
-}EagleParamContext;
-
-
-typedef struct X264Context {
-    AVClass        *class;
-    x264_param_t    params;
-    x264_t         *enc;
-    x264_picture_t  pic;
-    uint8_t        *sei;
-    int             sei_size;
-    char *preset;
-    char *tune;
-    char *profile;
-    char *level;
-    int fastfirstpass;
-    char *wpredp;
-    char *x264opts;
-    float crf;
-    float crf_max;
-    int cqp;
-    int aq_mode;
+/**
+ * Refcounted frames handed from one Eagle stage to the next. Pushing only
+ * takes a new reference, so a GOP decoded once is filtered, encoded and
+ * scored straight from the buffer pools that produced it.
+ */
+typedef struct EagleFrameQueue {
+	AVFrame **frames;
+	int       nb_frames;
+	int       nb_allocated;
+} EagleFrameQueue;
+
+static int eagle_frame_queue_push(EagleFrameQueue *q, const AVFrame *frame)
+{
+	if (q->nb_frames == q->nb_allocated) {
+		AVFrame **frames = av_realloc_array(q->frames, q->nb_allocated + 1, sizeof(*frames));
+		if (!frames)
+			return AVERROR(ENOMEM);
+		q->frames = frames;
+		if (!(q->frames[q->nb_allocated] = av_frame_alloc()))
+			return AVERROR(ENOMEM);
+		q->nb_allocated++;
+	}
+	return av_frame_ref(q->frames[q->nb_frames++], frame);
+}
+
+/* drop the references but keep the frame structs for the next GOP */
+static void eagle_frame_queue_clear(EagleFrameQueue *q)
+{
+	for (int i = 0; i < q->nb_frames; i++)
+		av_frame_unref(q->frames[i]);
+	q->nb_frames = 0;
+}
+
+static void eagle_frame_queue_free(EagleFrameQueue *q)
+{
+	for (int i = 0; i < q->nb_allocated; i++)
+		av_frame_free(&q->frames[i]);
+	av_freep(&q->frames);
+	q->nb_frames = q->nb_allocated = 0;
+}
+
+/* Analysis results of one GOP. */
+#define EAGLE_MAX_RUNGS 8
+
+typedef struct EagleGopInfo {
+    int   nb_frames;
     float aq_strength;
-    char *psy_rd;
-    int psy;
-    int rc_lookahead;
-    int weightp;
-    int weightb;
-    int ssim;
-    int intra_refresh;
-    int bluray_compat;
-    int b_bias;
-    int b_pyramid;
-    int mixed_refs;
-    int dct8x8;
-    int fast_pskip;
-    int aud;
-    int mbtree;
-    char *deblock;
-    float cplxblur;
-    char *partitions;
-    int direct_pred;
-    int slice_max_size;
-    char *stats;
-    int nal_hrd;
-    int avcintra_class;
-    int motion_est;
-    int forced_idr;
-    int coder;
-    int a53_cc;
-    int b_frame_strategy;
-    int chroma_offset;
-    int scenechange_threshold;
-    int noise_reduction;
-
-    char *x264_params;
-
-    int nb_reordered_opaque, next_reordered_opaque;
-    int64_t *reordered_opaque;
-
-    /**
-     * If the encoder does not support ROI then warn the first time we
-     * encounter a frame with ROI side data.
-     */
-    int roi_warned;
-} X264Context;
+    float unsharp;          ///< unsharp cap from the sharpness, lowered if VMAF drops
+    float target_score;     ///< VMAF score targeted by stage 2
+    float crf;              ///< CRF the GOP is encoded with
+    float rung_crf[EAGLE_MAX_RUNGS]; ///< CRF of each rung of -eagle_ladder
+    int64_t end_pts;        ///< pts of the first frame of the next GOP
+    int   shared;           ///< its decoded frames are kept for the transcode
+    int   share_failed;     ///< they did not fit in -eagle_share_decode or it
+                            ///< does not start and end on a keyframe
+} EagleGopInfo;
+
+/**
+ * Hand-off of per-GOP analysis results from the Eagle analysis to the
+ * encoder. A GOP is published once its crf/aq_strength/unsharp values are
+ * final; with -eagle_lookahead the analysis runs on its own thread and is
+ * held back once it is max_ahead GOPs in front of the encoder.
+ */
+typedef struct EagleGopQueue {
+#if HAVE_THREADS
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             thread_started;
+#endif
+    int nb_published;       ///< number of GOPs whose results are final
+    int nb_consumed;        ///< index of the GOP the encoder is working on
+    int max_ahead;          ///< 0 means unbounded (blocking pre-pass)
+    int finished;           ///< the analysis will not publish any more GOPs
+    int abort_request;
+
+    EagleGopInfo *gops;     ///< per-GOP results, grown by the analysis
+    int nb_gops;            ///< number of allocated entries
+
+    /* decoded frames handed to the transcode, see -eagle_share_decode */
+    EagleFrameQueue *shared;    ///< frames of each GOP, nb_gops entries
+    int64_t shared_bytes;       ///< memory held by them
+    int64_t shared_budget;      ///< 0 if the transcode decodes on its own
+} EagleGopQueue;
+
+static EagleGopQueue eagle_gop_queue;
+
+/* Ask the encoder to switch to the given rate control from frame on. */
+static int eagle_set_rate_control(AVFrame *frame, float crf, float aq_strength)
+{
+    AVFrameSideData *sd;
+    AVRateControlOverride *rc;
+
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_RATE_CONTROL_OVERRIDE);
+    sd = av_frame_new_side_data(frame, AV_FRAME_DATA_RATE_CONTROL_OVERRIDE, sizeof(*rc));
+    if (!sd)
+        return AVERROR(ENOMEM);
+    rc              = (AVRateControlOverride *)sd->data;
+    rc->self_size   = sizeof(*rc);
+    rc->crf         = crf;
+    rc->aq_strength = aq_strength;
+    return 0;
+}
+
+/* Entry of a GOP the analysis has not published yet, growing the table as
+ * needed. Only the analysis calls this; the table only moves under the lock
+ * the encoder reads published entries with. Returns NULL on ENOMEM. */
+static EagleGopInfo *eagle_gop_info(EagleGopQueue *q, int gop)
+{
+    if (gop >= q->nb_gops) {
+        int nb_gops = FFMAX(gop + 1, 2 * q->nb_gops);
+        EagleGopInfo *gops;
+        EagleFrameQueue *shared;
+
+#if HAVE_THREADS
+        if (q->thread_started)
+            pthread_mutex_lock(&q->lock);
+#endif
+        gops   = av_realloc_array(q->gops, nb_gops, sizeof(*gops));
+        if (gops)
+            q->gops = gops;
+        shared = gops ? av_realloc_array(q->shared, nb_gops, sizeof(*shared)) : NULL;
+        if (shared) {
+            q->shared = shared;
+            memset(gops   + q->nb_gops, 0, (nb_gops - q->nb_gops) * sizeof(*gops));
+            memset(shared + q->nb_gops, 0, (nb_gops - q->nb_gops) * sizeof(*shared));
+            q->nb_gops = nb_gops;
+        }
+#if HAVE_THREADS
+        if (q->thread_started)
+            pthread_mutex_unlock(&q->lock);
+#endif
+        if (!shared)
+            return NULL;
+    }
+    return &q->gops[gop];
+}
+
+/* Called by the analysis once GOP nb_published - 1 is complete. Returns
+ * AVERROR_EXIT if the transcode no longer needs any results. */
+static int eagle_gop_queue_publish(EagleGopQueue *q, int nb_published)
+{
+    int ret = 0;
+
+#if HAVE_THREADS
+    if (q->thread_started) {
+        pthread_mutex_lock(&q->lock);
+        q->nb_published = nb_published;
+        pthread_cond_broadcast(&q->cond);
+        while (!q->abort_request &&
+               q->nb_published - q->nb_consumed > q->max_ahead)
+            pthread_cond_wait(&q->cond, &q->lock);
+        if (q->abort_request)
+            ret = AVERROR_EXIT;
+        pthread_mutex_unlock(&q->lock);
+        return ret;
+    }
+#endif
+    q->nb_published = nb_published;
+    return ret;
+}
+
+static void eagle_gop_queue_finish(EagleGopQueue *q)
+{
+#if HAVE_THREADS
+    if (q->thread_started) {
+        pthread_mutex_lock(&q->lock);
+        q->finished = 1;
+        pthread_cond_broadcast(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+        return;
+    }
+#endif
+    q->finished = 1;
+}
+
+/* Block until the results of the given GOP are available and copy them to
+ * info. Returns 0 if the analysis ended without producing them. */
+static int eagle_gop_queue_wait(EagleGopQueue *q, int gop, EagleGopInfo *info)
+{
+    int available;
+
+#if HAVE_THREADS
+    if (q->thread_started) {
+        pthread_mutex_lock(&q->lock);
+        if (gop > q->nb_consumed) {
+            q->nb_consumed = gop;
+            pthread_cond_broadcast(&q->cond);
+        }
+        while (gop >= q->nb_published && !q->finished)
+            pthread_cond_wait(&q->cond, &q->lock);
+        available = gop < q->nb_published;
+        if (available)
+            *info = q->gops[gop];
+        pthread_mutex_unlock(&q->lock);
+        return available;
+    }
+#endif
+    q->nb_consumed = FFMAX(q->nb_consumed, gop);
+    available = gop < q->nb_published;
+    if (available)
+        *info = q->gops[gop];
+    return available;
+}
+
+static void eagle_gop_queue_lock(EagleGopQueue *q)
+{
+#if HAVE_THREADS
+    if (q->thread_started)
+        pthread_mutex_lock(&q->lock);
+#endif
+}
+
+static void eagle_gop_queue_unlock(EagleGopQueue *q)
+{
+#if HAVE_THREADS
+    if (q->thread_started)
+        pthread_mutex_unlock(&q->lock);
+#endif
+}
+
+static int64_t eagle_frame_size(const AVFrame *frame)
+{
+    int64_t size = 0;
+
+    for (int i = 0; i < FF_ARRAY_ELEMS(frame->buf) && frame->buf[i]; i++)
+        size += frame->buf[i]->size;
+    return size;
+}
+
+/* Free shared frames, with the lock held. */
+static void eagle_share_drop(EagleGopQueue *q, EagleFrameQueue *frames)
+{
+    for (int i = 0; i < frames->nb_frames; i++)
+        q->shared_bytes -= eagle_frame_size(frames->frames[i]);
+    eagle_frame_queue_free(frames);
+}
+
+/* Stop sharing frames, for GOPs not taken over by the transcode yet too. */
+static void eagle_share_disable(EagleGopQueue *q)
+{
+    eagle_gop_queue_lock(q);
+    q->shared_budget = 0;
+    for (int i = 0; i < q->nb_gops; i++) {
+        eagle_share_drop(q, &q->shared[i]);
+        q->gops[i].shared = 0;
+    }
+    eagle_gop_queue_unlock(q);
+}
+
+/* Called by the analysis for every frame it decodes. The frames of a GOP are
+ * kept for the transcode as long as they all fit in -eagle_share_decode;
+ * otherwise the transcode decodes that GOP itself. It also does if the GOP
+ * does not start on a keyframe, where its decoder could not resume. */
+static int eagle_share_frame(EagleGopQueue *q, int gop, const AVFrame *frame)
+{
+    EagleGopInfo *info = eagle_gop_info(q, gop);
+    int64_t size = eagle_frame_size(frame);
+    int ret = 0;
+
+    if (!info)
+        return AVERROR(ENOMEM);
+    if (info->share_failed)
+        return 0;
+
+    eagle_gop_queue_lock(q);
+    if (q->shared_bytes + size > q->shared_budget ||
+        (!q->shared[gop].nb_frames && !frame->key_frame)) {
+        eagle_share_drop(q, &q->shared[gop]);
+        info->shared       = 0;
+        info->share_failed = 1;
+    } else if ((ret = eagle_frame_queue_push(&q->shared[gop], frame)) >= 0) {
+        q->shared_bytes += size;
+        info->shared     = 1;
+    }
+    eagle_gop_queue_unlock(q);
+    return ret;
+}
+
+/* Called by the analysis once it reaches next, the frame starting the GOP
+ * after gop, or the end of the stream if next is NULL. The transcode finds
+ * the GOP boundaries by the pts of that frame, so without it nothing more can
+ * be shared. Unless it is a keyframe, the transcode decoder cannot stop at it
+ * and gop is decoded too. The analysis does not drain its decoder, which
+ * leaves the last GOP short of its final frames; the transcode decodes that
+ * one. */
+static int eagle_share_end_gop(EagleGopQueue *q, int gop, const AVFrame *next)
+{
+    EagleGopInfo *info = eagle_gop_info(q, gop);
+
+    if (!info)
+        return AVERROR(ENOMEM);
+    info->end_pts = next ? next->pts : AV_NOPTS_VALUE;
+    if (!next || !next->key_frame) {
+        eagle_gop_queue_lock(q);
+        eagle_share_drop(q, &q->shared[gop]);
+        info->shared       = 0;
+        info->share_failed = 1;
+        eagle_gop_queue_unlock(q);
+    }
+    if (next && next->pts == AV_NOPTS_VALUE)
+        eagle_share_disable(q);
+    return 0;
+}
+
 
 static void do_video_out(OutputFile *of,
                          OutputStream *ost,
@@ -1161,20 +1546,38 @@ static void do_video_out(OutputFile *of,
                          double sync_ipts)
 {
     int ret, format_video_sync;
-    AVPacket pkt;
     AVCodecContext *enc = ost->enc_ctx;
     AVCodecParameters *mux_par = ost->st->codecpar;
     AVRational frame_rate;
     int nb_frames, nb0_frames, i;
     double delta, delta0;
     double duration = 0;
-    int frame_size = 0;
     InputStream *ist = NULL;
     AVFilterContext *filter = ost->filter->filter;
 
     if (ost->source_index >= 0)
         ist = input_streams[ost->source_index];
 
+    /* an analysed GOP starts with this frame, keep its settings for the next
+     * frame encoded in case this one is dropped */
+    if (next_picture) {
+        AVFrameSideData *sd = av_frame_get_side_data(next_picture, AV_FRAME_DATA_RATE_CONTROL_OVERRIDE);
+
+        if (sd) {
+            EagleGopInfo gop;
+
+            ost->eagle_rc         = *(AVRateControlOverride *)sd->data;
+            ost->eagle_rc_pending = 1;
+            av_frame_remove_side_data(next_picture, AV_FRAME_DATA_RATE_CONTROL_OVERRIDE);
+
+            /* the rungs of -eagle_ladder get the same GOPs from the split of
+             * the input, each with its own CRF */
+            if (ost->eagle_rung && eagle_gop_queue_wait(&eagle_gop_queue, ost->eagle_gop, &gop))
+                ost->eagle_rc.crf = gop.rung_crf[ost->eagle_rung - 1];
+            ost->eagle_gop++;
+        }
+    }
+
     frame_rate = av_buffersink_get_frame_rate(filter);
     if (frame_rate.num > 0 && frame_rate.den > 0)
         duration = 1/(av_q2d(frame_rate) * av_q2d(enc->time_base));
@@ -1304,9 +1707,6 @@ static void do_video_out(OutputFile *of,
         AVFrame *in_picture;
         int forced_keyframe = 0;
         double pts_time;
-        av_init_packet(&pkt);
-        pkt.data = NULL;
-        pkt.size = 0;
 
         if (i < nb0_frames && ost->last_frame) {
             in_picture = ost->last_frame;
@@ -1374,6 +1774,19 @@ static void do_video_out(OutputFile *of,
             forced_keyframe = 1;
         }
 
+        /* the output GOPs are aligned with the analysed ones, which switch
+         * the rate control on their first frame */
+        if (ost->eagle_rc_pending && in_picture == next_picture) {
+            ret = eagle_set_rate_control(in_picture, ost->eagle_rc.crf, ost->eagle_rc.aq_strength);
+            if (ret < 0)
+                goto error;
+            av_log(NULL, AV_LOG_VERBOSE, "Eagle: output stream %d:%d new gop at frame %"PRIu64": "
+                   "crf %f aq_strength %f\n", ost->file_index, ost->index, ost->frames_encoded,
+                   ost->eagle_rc.crf, ost->eagle_rc.aq_strength);
+            ost->eagle_rc_pending = 0;
+            forced_keyframe = 1;
+        }
+
         if (forced_keyframe) {
             in_picture->pict_type = AV_PICTURE_TYPE_I;
             av_log(NULL, AV_LOG_DEBUG, "Forced keyframe at time %f\n", pts_time);
@@ -1389,73 +1802,13 @@ static void do_video_out(OutputFile *of,
 
         ost->frames_encoded++;
 
-        //TODO:eagle should add
-        //reconfig encoder params(aq_strength, crf), using the x264_encoder_reconfig
-        //example: X264Context *x4 = enc->priv_data;
-        //x4->params.rc_f_rf_constant = x4->crf = crx_value;
-        //x4->params.rc_f_aq_strength = x4->aq_strength = aq_strength_value;
-        {
-        	long long total_encoded_frame_num = 0;
-			X264Context *x4 = enc->priv_data;
-
-			global_frames_of_gop_array[global_gop];
-			for (int i = 0; i <= global_gop; i++) {
-				total_encoded_frame_num += global_frames_of_gop_array[i];
-			}
-
-			if (ost->frames_encoded > total_encoded_frame_num && global_gop < total_gop_num)
-				global_gop++;
-
-			x4->params.rc.f_rf_constant = x4->crf         = global_crf_array[global_gop];
-			x4->params.rc.f_aq_strength = x4->aq_strength = global_aq_strength_array[global_gop];
-
-			x264_encoder_reconfig(x4->enc, &x4->params);
-	        printf("ost->frames_encoded %d global_gop %d crf %f aq_strength_definite %f x4->aq_strength %f x4->params.rc.f_aq_strength %f\n",
-				ost->frames_encoded, global_gop, global_crf_array[global_gop], global_aq_strength_array[global_gop],
-				x4->aq_strength, x4->params.rc.f_aq_strength);	
-        }
-
-        ret = avcodec_send_frame(enc, in_picture);
+        ret = encode_frame(of, ost, in_picture);
         if (ret < 0)
             goto error;
         // Make sure Closed Captions will not be duplicated
         av_frame_remove_side_data(in_picture, AV_FRAME_DATA_A53_CC);
+        av_frame_remove_side_data(in_picture, AV_FRAME_DATA_RATE_CONTROL_OVERRIDE);
 
-        while (1) {
-            ret = avcodec_receive_packet(enc, &pkt);
-            update_benchmark("encode_video %d.%d", ost->file_index, ost->index);
-            if (ret == AVERROR(EAGAIN))
-                break;
-            if (ret < 0)
-                goto error;
-
-            if (debug_ts) {
-                av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
-                       "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                       av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &enc->time_base),
-                       av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &enc->time_base));
-            }
-
-            if (pkt.pts == AV_NOPTS_VALUE && !(enc->codec->capabilities & AV_CODEC_CAP_DELAY))
-                pkt.pts = ost->sync_opts;
-
-            av_packet_rescale_ts(&pkt, enc->time_base, ost->mux_timebase);
-
-            if (debug_ts) {
-                av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
-                    "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
-                    av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &ost->mux_timebase),
-                    av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &ost->mux_timebase));
-            }
-
-            frame_size = pkt.size;
-            output_packet(of, &pkt, ost, 0);
-
-            /* if two pass, output log */
-            if (ost->logfile && enc->stats_out) {
-                fprintf(ost->logfile, "%s", enc->stats_out);
-            }
-        }
         ost->sync_opts++;
         /*
          * For video, number of frames in == number of packets out.
@@ -1463,9 +1816,6 @@ static void do_video_out(OutputFile *of,
          * flush, we need to limit them here, before they go into encoder.
          */
         ost->frame_number++;
-
-        if (vstats_filename && frame_size)
-            do_video_stats(ost, frame_size);
     }
 
     if (!ost->last_frame)
@@ -1482,6 +1832,64 @@ error:
     exit_program(1);
 }
 
+static int encode_video_frame(OutputFile *of, OutputStream *ost, AVFrame *frame)
+{
+    AVCodecContext *enc = ost->enc_ctx;
+    int64_t pts = frame->pts;
+    int frame_size = 0;
+    AVPacket pkt;
+    int ret;
+
+    av_init_packet(&pkt);
+    pkt.data = NULL;
+    pkt.size = 0;
+
+    ret = avcodec_send_frame(enc, frame);
+    if (ret < 0)
+        return ret;
+
+    while (1) {
+        ret = avcodec_receive_packet(enc, &pkt);
+        update_benchmark("encode_video %d.%d", ost->file_index, ost->index);
+        if (ret == AVERROR(EAGAIN))
+            break;
+        if (ret < 0)
+            return ret;
+
+        if (debug_ts) {
+            av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
+                   "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
+                   av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &enc->time_base),
+                   av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &enc->time_base));
+        }
+
+        if (pkt.pts == AV_NOPTS_VALUE && !(enc->codec->capabilities & AV_CODEC_CAP_DELAY))
+            pkt.pts = pts;
+
+        av_packet_rescale_ts(&pkt, enc->time_base, ost->mux_timebase);
+
+        if (debug_ts) {
+            av_log(NULL, AV_LOG_INFO, "encoder -> type:video "
+                "pkt_pts:%s pkt_pts_time:%s pkt_dts:%s pkt_dts_time:%s\n",
+                av_ts2str(pkt.pts), av_ts2timestr(pkt.pts, &ost->mux_timebase),
+                av_ts2str(pkt.dts), av_ts2timestr(pkt.dts, &ost->mux_timebase));
+        }
+
+        frame_size = pkt.size;
+        if ((ret = output_packet(of, &pkt, ost, 0)) < 0)
+            return ret;
+
+        /* if two pass, output log */
+        if (ost->logfile && enc->stats_out) {
+            fprintf(ost->logfile, "%s", enc->stats_out);
+        }
+    }
+
+    if (vstats_filename && frame_size)
+        do_video_stats(ost, frame_size);
+    return 0;
+}
+
 static double psnr(double d)
 {
     return -10.0 * log10(d);
@@ -1808,6 +2216,8 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
 
     oc = output_files[0]->ctx;
 
+    /* the encoder threads update the output and the stream statistics */
+    ff_mutex_lock(&mux_lock);
     total_size = avio_size(oc->pb);
     if (total_size <= 0) // FIXME improve avio_size() so it works with non seekable output too
         total_size = avio_tell(oc->pb);
@@ -1887,6 +2297,7 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
         if (is_last_report)
             nb_frames_drop += ost->last_dropped;
     }
+    ff_mutex_unlock(&mux_lock);
 
     secs = FFABS(pts) / AV_TIME_BASE;
     us = FFABS(pts) % AV_TIME_BASE;
@@ -1942,6 +2353,36 @@ static void print_report(int is_last_report, int64_t timer_start, int64_t cur_ti
         av_bprintf(&buf_script, "speed=%4.3gx\n", speed);
     }
 
+#if HAVE_THREADS
+    /* packets queued by the demuxer threads and time spent waiting for them */
+    {
+        int nb_threads = 0, nb_packets = 0;
+        int64_t bytes = 0, stall = 0;
+
+        for (i = 0; i < nb_input_files; i++) {
+            InputFile *f = input_files[i];
+
+            if (f->in_thread_queue) {
+                nb_packets += av_thread_message_queue_nb_elems(f->in_thread_queue);
+                pthread_mutex_lock(&f->queue_lock);
+                bytes += f->queued_bytes;
+                pthread_mutex_unlock(&f->queue_lock);
+            } else if (!f->joined) {
+                continue;
+            }
+            stall += f->demux_stall;
+            nb_threads++;
+        }
+        if (nb_threads) {
+            av_bprintf(&buf, " demuxq=%d/%"PRId64"kB stall=%.2fs",
+                       nb_packets, bytes / 1024, stall / 1000000.0);
+            av_bprintf(&buf_script, "demux_queue_packets=%d\n", nb_packets);
+            av_bprintf(&buf_script, "demux_queue_bytes=%"PRId64"\n", bytes);
+            av_bprintf(&buf_script, "demux_stall_us=%"PRId64"\n", stall);
+        }
+    }
+#endif
+
     if (print_stats || is_last_report) {
         const char end = is_last_report ? '\n' : '\r';
         if (print_stats==1 && AV_LOG_INFO > av_log_get_level()) {
@@ -1996,6 +2437,19 @@ static void flush_encoders(void)
         if (!ost->encoding_needed)
             continue;
 
+#if HAVE_THREADS
+        /* the encoder is flushed on the main thread */
+        if ((ret = free_encoder_thread(ost, 0)) < 0) {
+            if (ost->muxer_failed) {
+                handle_output_error(ost, ret);
+                continue;
+            }
+            av_log(NULL, AV_LOG_FATAL, "%s encoding failed: %s\n",
+                   av_get_media_type_string(enc->codec_type), av_err2str(ret));
+            exit_program(1);
+        }
+#endif
+
         // Try to enable encoding with no input frames.
         // Maybe we should just let encoding fail instead.
         if (!ost->initialized) {
@@ -2083,7 +2537,8 @@ static void flush_encoders(void)
                 fprintf(ost->logfile, "%s", enc->stats_out);
             }
             if (ret == AVERROR_EOF) {
-                output_packet(of, &pkt, ost, 1);
+                if ((ret = output_packet(of, &pkt, ost, 1)) < 0)
+                    handle_output_error(ost, ret);
                 break;
             }
             if (ost->finished & MUXER_FINISHED) {
@@ -2092,7 +2547,8 @@ static void flush_encoders(void)
             }
             av_packet_rescale_ts(&pkt, enc->time_base, ost->mux_timebase);
             pkt_size = pkt.size;
-            output_packet(of, &pkt, ost, 0);
+            if ((ret = output_packet(of, &pkt, ost, 0)) < 0)
+                handle_output_error(ost, ret);
             if (ost->enc_ctx->codec_type == AVMEDIA_TYPE_VIDEO && vstats_filename) {
                 do_video_stats(ost, pkt_size);
             }
@@ -2127,13 +2583,15 @@ static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *p
     int64_t start_time = (of->start_time == AV_NOPTS_VALUE) ? 0 : of->start_time;
     int64_t ost_tb_start_time = av_rescale_q(start_time, AV_TIME_BASE_Q, ost->mux_timebase);
     AVPacket opkt;
+    int ret;
 
     // EOF: flush output bitstream filters.
     if (!pkt) {
         av_init_packet(&opkt);
         opkt.data = NULL;
         opkt.size = 0;
-        output_packet(of, &opkt, ost, 1);
+        if ((ret = output_packet(of, &opkt, ost, 1)) < 0)
+            handle_output_error(ost, ret);
         return;
     }
 
@@ -2194,7 +2652,8 @@ static void do_streamcopy(InputStream *ist, OutputStream *ost, const AVPacket *p
 
     opkt.duration = av_rescale_q(pkt->duration, ist->st->time_base, ost->mux_timebase);
 
-    output_packet(of, &opkt, ost, 0);
+    if ((ret = output_packet(of, &opkt, ost, 0)) < 0)
+        handle_output_error(ost, ret);
 }
 
 int guess_input_channel_layout(InputStream *ist)
@@ -2247,10 +2706,104 @@ static int ifilter_has_all_input_formats(FilterGraph *fg)
     return 1;
 }
 
+/* the transcode input stream the analysis runs on */
+static InputStream *eagle_analysed_ist;
+
+/* Find the analysed stream among the transcode inputs, the same one the
+ * analysis picks in the first input file opened from filename. */
+static void eagle_find_analysed_stream(const char *filename)
+{
+    for (int i = 0; i < nb_input_files; i++) {
+        InputFile *f = input_files[i];
+        int idx;
+
+        if (strcmp(f->ctx->url, filename))
+            continue;
+        idx = av_find_best_stream(f->ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+        if (idx >= 0)
+            eagle_analysed_ist = input_streams[f->ist_index + idx];
+        break;
+    }
+    if (!eagle_analysed_ist)
+        av_log(NULL, AV_LOG_WARNING, "Eagle: the analysed stream is not an input of the "
+               "transcode, its GOPs will not be tuned\n");
+}
+
+/* Find the analysed GOPs in the frames of a video input, by the pts the
+ * analysis recorded at their boundaries. The first frame of each GOP carries
+ * its rate control to the encoders, which start a GOP of their own there.
+ * Returns 1 if a GOP starts with frame. */
+static int eagle_track_gop(InputFilter *ifilter, AVFrame *frame)
+{
+    InputStream *ist = ifilter->ist;
+    int64_t pts = frame->pts;
+    EagleGopInfo gop;
+    int started = 0, ret;
+
+    /* the other inputs, such as an overlay, have GOPs of their own */
+    if (ist != eagle_analysed_ist)
+        return 0;
+
+    /* the analysis demuxes without the input timestamp offset */
+    if (pts != AV_NOPTS_VALUE)
+        pts -= av_rescale_q(input_files[ist->file_index]->ts_offset, AV_TIME_BASE_Q, ist->st->time_base);
+
+    while (!ifilter->eagle_gop ||
+           (pts != AV_NOPTS_VALUE && ifilter->eagle_gop_end != AV_NOPTS_VALUE &&
+            pts >= ifilter->eagle_gop_end)) {
+        if (!eagle_gop_queue_wait(&eagle_gop_queue, ifilter->eagle_gop, &gop)) {
+            ifilter->eagle_gop_end = AV_NOPTS_VALUE;
+            break;
+        }
+        ifilter->eagle_gop++;
+        ifilter->eagle_gop_end = gop.end_pts;
+        ifilter->eagle_unsharp = gop.unsharp;
+        started = 1;
+    }
+    if (!started)
+        return 0;
+
+    av_log(NULL, AV_LOG_DEBUG, "Eagle: input stream %d:%d gop %d from pts %s\n",
+           ist->file_index, ist->st->index, ifilter->eagle_gop - 1, av_ts2str(frame->pts));
+    if ((ret = eagle_set_rate_control(frame, gop.crf, gop.aq_strength)) < 0)
+        return ret;
+    return 1;
+}
+
+/* Queue the unsharp amount of each analysed GOP on the graph, timed at the
+ * pts of its first frame, so that it follows the frames through any
+ * buffering in the graph. A reconfigured graph gets the current amount
+ * again. */
+static int eagle_schedule_unsharp(InputFilter *ifilter, const AVFrame *frame, int reconfigured)
+{
+    char amount[32];
+    double time = -1;
+    int ret;
+
+    if (!reconfigured || !ifilter->eagle_gop)
+        return 0;
+
+    snprintf(amount, sizeof(amount), "%f", ifilter->eagle_unsharp);
+    if (frame->pts != AV_NOPTS_VALUE)
+        time = frame->pts * av_q2d(ifilter->filter->outputs[0]->time_base);
+    if (time >= 0)
+        ret = avfilter_graph_queue_command(ifilter->graph->graph, "unsharp", "luma_amount",
+                                           amount, 0, time);
+    else
+        ret = avfilter_graph_send_command(ifilter->graph->graph, "unsharp", "luma_amount",
+                                          amount, NULL, 0, 0);
+    return ret == AVERROR(ENOSYS) ? 0 : ret;
+}
+
 static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
 {
     FilterGraph *fg = ifilter->graph;
-    int need_reinit, ret, i;
+    int need_reinit, gop_started, ret, i;
+
+    /* done first, as the frame may be queued until the graph can be configured */
+    gop_started = eagle_track_gop(ifilter, frame);
+    if (gop_started < 0)
+        return gop_started;
 
     /* determine if the parameters for this input changed */
     need_reinit = ifilter->format != frame->format;
@@ -2316,6 +2869,10 @@ static int ifilter_send_frame(InputFilter *ifilter, AVFrame *frame)
         }
     }
 
+    ret = eagle_schedule_unsharp(ifilter, frame, need_reinit || gop_started);
+    if (ret < 0)
+        return ret;
+
     ret = av_buffersrc_add_frame_flags(ifilter->filter, frame, AV_BUFFERSRC_FLAG_PUSH);
     if (ret < 0) {
         if (ret != AVERROR_EOF)
@@ -2376,6 +2933,226 @@ static int decode(AVCodecContext *avctx, AVFrame *frame, int *got_frame, AVPacke
     return 0;
 }
 
+/**
+ * Transcode side of -eagle_share_decode. The packets of the analysed stream
+ * are split into GOPs by the pts the analysis recorded at each boundary; the
+ * frames of a GOP the analysis kept are output one per packet instead of
+ * being decoded a second time, the other GOPs go through the decoder.
+ */
+typedef struct EagleShare {
+    InputStream *ist;       ///< the analysed stream, NULL if not sharing
+    int gop;                ///< GOP of the packets being read, -1 before the first
+    EagleGopInfo info;      ///< its analysis results
+    EagleFrameQueue frames; ///< its shared frames, empty if it is decoded
+    int nb_output;          ///< shared frames output so far
+    int pending;            ///< packets read whose shared frame is not output yet
+    int eof;
+    int switching;          ///< finishing the GOP before entering the next one
+    int draining;           ///< the decoder was sent a flush packet
+    AVPacket *held;         ///< first packet of the next GOP while switching
+} EagleShare;
+
+static EagleShare eagle_share = { .gop = -1 };
+
+/* Find the stream the analysis decodes among the transcode inputs. */
+static int eagle_share_init(const char *filename)
+{
+    EagleShare *s = &eagle_share;
+
+    for (int i = 0; i < nb_input_files && !s->ist; i++) {
+        InputFile *f = input_files[i];
+        InputStream *ist;
+        int idx;
+
+        /* seeking and looping would break the matching by pts */
+        if (strcmp(f->ctx->url, filename) || f->start_time != AV_NOPTS_VALUE || f->loop)
+            continue;
+        idx = av_find_best_stream(f->ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0);
+        if (idx < 0)
+            continue;
+        ist = input_streams[f->ist_index + idx];
+        if (ist->decoding_needed && ist->hwaccel_id == HWACCEL_NONE &&
+            ist->dec == avcodec_find_decoder(ist->st->codecpar->codec_id))
+            s->ist = ist;
+    }
+    if (!s->ist) {
+        av_log(NULL, AV_LOG_WARNING, "Eagle: the analysed stream is not decoded in software "
+               "from its start, not sharing its frames\n");
+        eagle_share_disable(&eagle_gop_queue);
+        return 0;
+    }
+    if (!(s->held = av_packet_alloc()))
+        return AVERROR(ENOMEM);
+    av_log(NULL, AV_LOG_INFO, "Eagle: sharing decoded frames of stream #%d:%d with the analysis\n",
+           s->ist->file_index, s->ist->st->index);
+    return 0;
+}
+
+static void eagle_share_uninit(void)
+{
+    EagleShare *s = &eagle_share;
+    EagleGopQueue *q = &eagle_gop_queue;
+
+    eagle_share_drop(q, &s->frames);
+    av_packet_free(&s->held);
+    s->ist = NULL;
+}
+
+/* Start reading the packets of gop, taking over its shared frames. */
+static void eagle_share_enter_gop(EagleShare *s, int gop)
+{
+    EagleGopQueue *q = &eagle_gop_queue;
+
+    eagle_gop_queue_lock(q);
+    eagle_share_drop(q, &s->frames);
+    eagle_gop_queue_unlock(q);
+    s->nb_output = s->pending = 0;
+
+    s->gop = gop;
+    if (!eagle_gop_queue_wait(q, gop, &s->info)) {
+        /* the analysis stopped early, decode the rest */
+        memset(&s->info, 0, sizeof(s->info));
+        s->info.end_pts = AV_NOPTS_VALUE;
+        return;
+    }
+    if (s->info.shared) {
+        eagle_gop_queue_lock(q);
+        s->frames = q->shared[gop];
+        memset(&q->shared[gop], 0, sizeof(q->shared[gop]));
+        eagle_gop_queue_unlock(q);
+    }
+    av_log(NULL, AV_LOG_VERBOSE, "Eagle: gop %d %s\n", gop,
+           s->info.shared ? "taken from the analysis" : "decoded");
+}
+
+/* Output the next shared frame of the current GOP, if any is left. */
+static int eagle_share_output(EagleShare *s, AVFrame *frame, int *got_frame)
+{
+    EagleGopQueue *q = &eagle_gop_queue;
+    InputStream *ist = s->ist;
+    int64_t offset = av_rescale_q(input_files[ist->file_index]->ts_offset,
+                                  AV_TIME_BASE_Q, ist->st->time_base);
+    AVFrame *src;
+
+    if (s->nb_output >= s->frames.nb_frames)
+        return 0;
+    src = s->frames.frames[s->nb_output++];
+
+    eagle_gop_queue_lock(q);
+    q->shared_bytes -= eagle_frame_size(src);
+    eagle_gop_queue_unlock(q);
+
+    /* the analysis demuxes without the input timestamp offset */
+    av_frame_unref(frame);
+    av_frame_move_ref(frame, src);
+    if (frame->pts != AV_NOPTS_VALUE)
+        frame->pts += offset;
+    if (frame->best_effort_timestamp != AV_NOPTS_VALUE)
+        frame->best_effort_timestamp += offset;
+    if (frame->pkt_dts != AV_NOPTS_VALUE)
+        frame->pkt_dts += offset;
+    *got_frame = 1;
+    return 0;
+}
+
+/* Output the frames left in the decoder before it skips a shared GOP. */
+static int eagle_share_drain(EagleShare *s, AVCodecContext *avctx, AVFrame *frame, int *got_frame)
+{
+    int ret;
+
+    if (!s->draining) {
+        ret = avcodec_send_packet(avctx, NULL);
+        if (ret < 0 && ret != AVERROR_EOF)
+            return ret;
+        s->draining = 1;
+    }
+    ret = avcodec_receive_frame(avctx, frame);
+    if (ret >= 0) {
+        *got_frame = 1;
+        return 0;
+    }
+    if (ret != AVERROR_EOF)
+        return ret;
+    avcodec_flush_buffers(avctx);
+    s->draining = 0;
+    return 0;
+}
+
+/* decode() for the input streams, taking the frames of the analysed one
+ * from the analysis where it kept them. */
+static int eagle_share_decode_video(InputStream *ist, AVFrame *frame, int *got_frame, AVPacket *pkt)
+{
+    EagleShare *s = &eagle_share;
+    AVCodecContext *avctx = ist->dec_ctx;
+    int ret;
+
+    if (ist != s->ist)
+        return decode(avctx, frame, got_frame, pkt);
+
+    *got_frame = 0;
+    if (s->gop < 0)
+        eagle_share_enter_gop(s, 0);
+
+    if (pkt && !pkt->size) {
+        if (!s->info.shared)
+            return decode(avctx, frame, got_frame, pkt);
+        s->eof = 1;
+    } else if (pkt) {
+        int64_t offset = av_rescale_q(input_files[ist->file_index]->ts_offset,
+                                      AV_TIME_BASE_Q, ist->st->time_base);
+
+        if (pkt->pts != AV_NOPTS_VALUE && s->info.end_pts != AV_NOPTS_VALUE &&
+            pkt->pts - offset == s->info.end_pts) {
+            EagleGopInfo next;
+
+            if (!s->info.shared &&
+                !(eagle_gop_queue_wait(&eagle_gop_queue, s->gop + 1, &next) && next.shared)) {
+                eagle_share_enter_gop(s, s->gop + 1);
+                return decode(avctx, frame, got_frame, pkt);
+            }
+            if ((ret = av_packet_ref(s->held, pkt)) < 0)
+                return ret;
+            s->switching = 1;
+        } else if (s->info.shared) {
+            s->pending++;
+        } else {
+            return decode(avctx, frame, got_frame, pkt);
+        }
+    }
+
+    if (s->switching) {
+        /* everything of the current GOP goes out before the next one starts */
+        if (s->info.shared)
+            ret = eagle_share_output(s, frame, got_frame);
+        else
+            ret = eagle_share_drain(s, avctx, frame, got_frame);
+        if (ret < 0 || *got_frame)
+            return ret;
+
+        s->switching = 0;
+        eagle_share_enter_gop(s, s->gop + 1);
+        if (!s->info.shared) {
+            ret = decode(avctx, frame, got_frame, s->held);
+            av_packet_unref(s->held);
+            return ret;
+        }
+        av_packet_unref(s->held);
+        s->pending = 1;
+    }
+
+    if (!s->info.shared)
+        return decode(avctx, frame, got_frame, NULL);
+    if (!s->pending && !s->eof)
+        return 0;
+    if ((ret = eagle_share_output(s, frame, got_frame)) < 0)
+        return ret;
+    if (*got_frame) {
+        s->pending = FFMAX(s->pending - 1, 0);
+        return 0;
+    }
+    return s->eof ? AVERROR_EOF : 0;
+}
+
 static int send_frame_to_filters(InputStream *ist, AVFrame *decoded_frame)
 {
     int i, ret;
@@ -2502,7 +3279,7 @@ static int decode_video(InputStream *ist, AVPacket *pkt, int *got_output, int64_
     }
 
     update_benchmark(NULL);
-    ret = decode(ist->dec_ctx, decoded_frame, got_output, pkt ? &avpkt : NULL);
+    ret = eagle_share_decode_video(ist, decoded_frame, got_output, pkt ? &avpkt : NULL);
     update_benchmark("decode_video %d.%d", ist->file_index, ist->st->index);
     if (ret < 0)
         *decode_failed = 1;
@@ -3093,6 +3870,7 @@ static int compare_int64(const void *a, const void *b)
 /* open the muxer when all the streams are initialized */
 static int check_init_output_file(OutputFile *of, int file_index)
 {
+    OutputStream *err_ost = NULL;
     int ret, i;
 
     for (i = 0; i < of->ctx->nb_streams; i++) {
@@ -3103,8 +3881,11 @@ static int check_init_output_file(OutputFile *of, int file_index)
 
     of->ctx->interrupt_callback = int_cb;
 
+    /* the encoder threads of the other streams may be muxing already */
+    ff_mutex_lock(&mux_lock);
     ret = avformat_write_header(of->ctx, &of->opts);
     if (ret < 0) {
+        ff_mutex_unlock(&mux_lock);
         av_log(NULL, AV_LOG_ERROR,
                "Could not write header for output file #%d "
                "(incorrect codec parameters ?): %s\n",
@@ -3120,7 +3901,7 @@ static int check_init_output_file(OutputFile *of, int file_index)
         print_sdp();
 
     /* flush the muxing queues */
-    for (i = 0; i < of->ctx->nb_streams; i++) {
+    for (i = 0; i < of->ctx->nb_streams && !err_ost; i++) {
         OutputStream *ost = output_streams[of->ost_index + i];
 
         /* try to improve muxing time_base (only possible if nothing has been written yet) */
@@ -3130,9 +3911,17 @@ static int check_init_output_file(OutputFile *of, int file_index)
         while (av_fifo_size(ost->muxing_queue)) {
             AVPacket pkt;
             av_fifo_generic_read(ost->muxing_queue, &pkt, sizeof(pkt), NULL);
-            write_packet(of, &pkt, ost, 1);
+            if ((ret = write_packet(of, &pkt, ost, 1)) < 0) {
+                err_ost = ost;
+                break;
+            }
         }
     }
+    ff_mutex_unlock(&mux_lock);
+
+    /* not under mux_lock, exiting joins the encoder threads */
+    if (err_ost)
+        handle_output_error(err_ost, ret);
 
     return 0;
 }
@@ -3964,11 +4753,18 @@ static int need_output(void)
         OutputStream *ost    = output_streams[i];
         OutputFile *of       = output_files[ost->file_index];
         AVFormatContext *os  = output_files[ost->file_index]->ctx;
+        int limit_reached, max_frames_reached;
 
-        if (ost->finished ||
-            (os->pb && avio_tell(os->pb) >= of->limit_filesize))
+        if (ost->finished)
             continue;
-        if (ost->frame_number >= ost->max_frames) {
+        /* written by write_packet(), on the encoder threads with -encode_thread */
+        ff_mutex_lock(&mux_lock);
+        limit_reached      = os->pb && avio_tell(os->pb) >= of->limit_filesize;
+        max_frames_reached = ost->frame_number >= ost->max_frames;
+        ff_mutex_unlock(&mux_lock);
+        if (limit_reached)
+            continue;
+        if (max_frames_reached) {
             int j;
             for (j = 0; j < of->ctx->nb_streams; j++)
                 close_output_stream(output_streams[of->ost_index + j]);
@@ -4161,6 +4957,22 @@ static void *input_thread(void *arg)
             av_thread_message_queue_set_err_recv(f->in_thread_queue, ret);
             break;
         }
+
+        /* a packet larger than the limit still goes through an empty queue */
+        pthread_mutex_lock(&f->queue_lock);
+        while (f->thread_queue_bytes > 0 && f->queued_bytes > 0 &&
+               f->queued_bytes + pkt.size > f->thread_queue_bytes && !f->queue_abort)
+            pthread_cond_wait(&f->queue_cond, &f->queue_lock);
+        ret = f->queue_abort ? AVERROR_EOF : 0;
+        if (ret >= 0)
+            f->queued_bytes += pkt.size;
+        pthread_mutex_unlock(&f->queue_lock);
+        if (ret < 0) {
+            av_packet_unref(&pkt);
+            av_thread_message_queue_set_err_recv(f->in_thread_queue, ret);
+            break;
+        }
+
         ret = av_thread_message_queue_send(f->in_thread_queue, &pkt, flags);
         if (flags && ret == AVERROR(EAGAIN)) {
             flags = 0;
@@ -4171,6 +4983,10 @@ static void *input_thread(void *arg)
                    f->thread_queue_size);
         }
         if (ret < 0) {
+            /* the packet never reached the queue */
+            pthread_mutex_lock(&f->queue_lock);
+            f->queued_bytes -= pkt.size;
+            pthread_mutex_unlock(&f->queue_lock);
             if (ret != AVERROR_EOF)
                 av_log(f->ctx, AV_LOG_ERROR,
                        "Unable to send packet to main thread: %s\n",
@@ -4192,12 +5008,18 @@ static void free_input_thread(int i)
     if (!f || !f->in_thread_queue)
         return;
     av_thread_message_queue_set_err_send(f->in_thread_queue, AVERROR_EOF);
+    pthread_mutex_lock(&f->queue_lock);
+    f->queue_abort = 1;
+    pthread_cond_signal(&f->queue_cond);
+    pthread_mutex_unlock(&f->queue_lock);
     while (av_thread_message_queue_recv(f->in_thread_queue, &pkt, 0) >= 0)
         av_packet_unref(&pkt);
 
     pthread_join(f->thread, NULL);
     f->joined = 1;
     av_thread_message_queue_free(&f->in_thread_queue);
+    pthread_cond_destroy(&f->queue_cond);
+    pthread_mutex_destroy(&f->queue_lock);
 }
 
 static void free_input_threads(void)
@@ -4213,19 +5035,35 @@ static int init_input_thread(int i)
     int ret;
     InputFile *f = input_files[i];
 
-    if (nb_input_files == 1)
+    if (nb_input_files == 1 && !demux_thread)
         return 0;
 
-    if (f->ctx->pb ? !f->ctx->pb->seekable :
-        strcmp(f->ctx->iformat->name, "lavfi"))
+    /* a single input has nothing else to do while waiting for packets */
+    if (nb_input_files > 1 &&
+        (f->ctx->pb ? !f->ctx->pb->seekable :
+         strcmp(f->ctx->iformat->name, "lavfi")))
         f->non_blocking = 1;
     ret = av_thread_message_queue_alloc(&f->in_thread_queue,
                                         f->thread_queue_size, sizeof(AVPacket));
     if (ret < 0)
         return ret;
 
+    f->queued_bytes = 0;
+    f->queue_abort  = 0;
+    if ((ret = pthread_mutex_init(&f->queue_lock, NULL))) {
+        av_thread_message_queue_free(&f->in_thread_queue);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&f->queue_cond, NULL))) {
+        pthread_mutex_destroy(&f->queue_lock);
+        av_thread_message_queue_free(&f->in_thread_queue);
+        return AVERROR(ret);
+    }
+
     if ((ret = pthread_create(&f->thread, NULL, input_thread, f))) {
         av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+        pthread_cond_destroy(&f->queue_cond);
+        pthread_mutex_destroy(&f->queue_lock);
         av_thread_message_queue_free(&f->in_thread_queue);
         return AVERROR(ret);
     }
@@ -4247,9 +5085,25 @@ static int init_input_threads(void)
 
 static int get_input_packet_mt(InputFile *f, AVPacket *pkt)
 {
-    return av_thread_message_queue_recv(f->in_thread_queue, pkt,
-                                        f->non_blocking ?
-                                        AV_THREAD_MESSAGE_NONBLOCK : 0);
+    int64_t start = 0;
+    int ret;
+
+    /* a non-blocking receive returns at once, it never stalls */
+    if (!f->non_blocking)
+        start = av_gettime_relative();
+    ret = av_thread_message_queue_recv(f->in_thread_queue, pkt,
+                                       f->non_blocking ?
+                                       AV_THREAD_MESSAGE_NONBLOCK : 0);
+    if (!f->non_blocking)
+        f->demux_stall += av_gettime_relative() - start;
+    if (ret < 0)
+        return ret;
+
+    pthread_mutex_lock(&f->queue_lock);
+    f->queued_bytes -= pkt->size;
+    pthread_cond_signal(&f->queue_cond);
+    pthread_mutex_unlock(&f->queue_lock);
+    return ret;
 }
 #endif
 
@@ -4267,7 +5121,7 @@ static int get_input_packet(InputFile *f, AVPacket *pkt)
     }
 
 #if HAVE_THREADS
-    if (nb_input_files > 1)
+    if (f->in_thread_queue)
         return get_input_packet_mt(f, pkt);
 #endif
     return av_read_frame(f->ctx, pkt);
@@ -4965,99 +5819,15 @@ static void log_callback_null(void *ptr, int level, const char *fmt, va_list vl)
 
 //#include <x264.h>
 #include <malloc.h>
-#define MAX_MATRIX_SIZE 63
-#define FHD_BUFFER_SIZE 0x9867000 //1920*1088*51*3/2 //0x956A000 //1920*1088*50*3/2
 
-#define INBUF_SIZE 1024*1024*300
 #define DECODE_FRAME_NUM_PER_GOP 50
-#define MIN_NUM_OF_PER_GOP 300
 #define FILTERED_FRAME_NUM_PER_GOP 10
+/* frames of each probe window that are scored by VMAF */
+#define VMAF_FRAME_NUM_PER_GOP          (DECODE_FRAME_NUM_PER_GOP - 6)
+#define VMAF_FILTERED_FRAME_NUM_PER_GOP (FILTERED_FRAME_NUM_PER_GOP - 6)
 
 float pixel_sharpness_val = 0.0;
 
-static long long saved_data_size = 0;
-static long long saved_size = 0;
-int enc_pkt_size[DECODE_FRAME_NUM_PER_GOP];
-
-static long long saved_data_size_filtered = 0;
-int enc_pkt_size_filtered[DECODE_FRAME_NUM_PER_GOP];
-
-typedef struct MemInfo {
-	uint8_t *pVideoBuffer;
-	uint8_t *pVideoBufferCrf5;
-
-	uint8_t *pVideoBuffer1;
-	uint8_t *pEncodeVideoBuffer;
-	uint8_t *pDecodeVideoBuffer;
-
-	uint8_t *pVideoBuffer2;
-	uint8_t *pEncodeVideoBuffer2;
-	uint8_t *pDecodeVideoBuffer2;
-}MemInfo;
-#if 0
-typedef struct X264Context {
-    AVClass        *class;
-    x264_param_t    params;
-    x264_t         *enc;
-    x264_picture_t  pic;
-    uint8_t        *sei;
-    int             sei_size;
-    char *preset;
-    char *tune;
-    char *profile;
-    char *level;
-    int fastfirstpass;
-    char *wpredp;
-    char *x264opts;
-    float crf;
-    float crf_max;
-    int cqp;
-    int aq_mode;
-    float aq_strength;
-    char *psy_rd;
-    int psy;
-    int rc_lookahead;
-    int weightp;
-    int weightb;
-    int ssim;
-    int intra_refresh;
-    int bluray_compat;
-    int b_bias;
-    int b_pyramid;
-    int mixed_refs;
-    int dct8x8;
-    int fast_pskip;
-    int aud;
-    int mbtree;
-    char *deblock;
-    float cplxblur;
-    char *partitions;
-    int direct_pred;
-    int slice_max_size;
-    char *stats;
-    int nal_hrd;
-    int avcintra_class;
-    int motion_est;
-    int forced_idr;
-    int coder;
-    int a53_cc;
-    int b_frame_strategy;
-    int chroma_offset;
-    int scenechange_threshold;
-    int noise_reduction;
-
-    char *x264_params;
-
-    int nb_reordered_opaque, next_reordered_opaque;
-    int64_t *reordered_opaque;
-
-    /**
-     * If the encoder does not support ROI then warn the first time we
-     * encounter a frame with ROI side data.
-     */
-    int roi_warned;
-} X264Context;
-#endif
 typedef struct InputParams {
     char *src_filename;
     char *video_dst_filename;
@@ -5085,9 +5855,6 @@ typedef struct InputStreamInfo {
 
 typedef struct DecodeInfo {
     int width, height;
-    uint8_t *video_dst_data[4];
-    int video_dst_linesize[4];
-    int video_dst_bufsize;
     enum AVPixelFormat pix_fmt;
 	long long dec_frame_num;
 } DecodeInfo;
@@ -5115,12 +5882,88 @@ struct newData {
 	int width;
 	int height;
 	size_t offset;
-	uint8_t *ref;
-	uint8_t *dis;
+	AVFrame *const *ref;
+	AVFrame *const *dis;
 	int num_frames;
 	int stage;
+	int frame_idx;
 };
 
+/* Refcounted packets of one probe encode, in decoding order. */
+typedef struct EaglePacketQueue {
+	AVPacket **pkts;
+	int        nb_pkts;
+	int        nb_allocated;
+	size_t     size;             ///< total payload size in bytes
+} EaglePacketQueue;
+
+/* downscale the first nb_frames of src to width x height into dst */
+static int eagle_frame_queue_scale(struct SwsContext **sws, const EagleFrameQueue *src, int nb_frames,
+								   int width, int height, EagleFrameQueue *dst)
+{
+	AVFrame *frame = NULL;
+	int ret = 0;
+
+	eagle_frame_queue_clear(dst);
+	for (int i = 0; i < FFMIN(nb_frames, src->nb_frames); i++) {
+		const AVFrame *in = src->frames[i];
+
+		*sws = sws_getCachedContext(*sws, in->width, in->height, in->format,
+									width, height, in->format, SWS_BICUBIC, NULL, NULL, NULL);
+		if (!*sws)
+			return AVERROR(EINVAL);
+		if (!(frame = av_frame_alloc()))
+			return AVERROR(ENOMEM);
+		frame->format = in->format;
+		frame->width  = width;
+		frame->height = height;
+		if ((ret = av_frame_get_buffer(frame, 32)) < 0 ||
+			(ret = av_frame_copy_props(frame, in)) < 0)
+			break;
+		sws_scale(*sws, (const uint8_t * const *)in->data, in->linesize, 0, in->height,
+				  frame->data, frame->linesize);
+		if ((ret = eagle_frame_queue_push(dst, frame)) < 0)
+			break;
+		av_frame_free(&frame);
+	}
+	av_frame_free(&frame);
+	return ret;
+}
+
+/* takes ownership of the reference held by pkt */
+static int eagle_packet_queue_push(EaglePacketQueue *q, AVPacket *pkt)
+{
+	if (q->nb_pkts == q->nb_allocated) {
+		AVPacket **pkts = av_realloc_array(q->pkts, q->nb_allocated + 1, sizeof(*pkts));
+		if (!pkts)
+			return AVERROR(ENOMEM);
+		q->pkts = pkts;
+		if (!(q->pkts[q->nb_allocated] = av_packet_alloc()))
+			return AVERROR(ENOMEM);
+		q->nb_allocated++;
+	}
+	q->size += pkt->size;
+	av_packet_move_ref(q->pkts[q->nb_pkts++], pkt);
+	return 0;
+}
+
+static void eagle_packet_queue_clear(EaglePacketQueue *q)
+{
+	for (int i = 0; i < q->nb_pkts; i++)
+		av_packet_unref(q->pkts[i]);
+	q->nb_pkts = 0;
+	q->size    = 0;
+}
+
+static void eagle_packet_queue_free(EaglePacketQueue *q)
+{
+	for (int i = 0; i < q->nb_allocated; i++)
+		av_packet_free(&q->pkts[i]);
+	av_freep(&q->pkts);
+	q->nb_pkts = q->nb_allocated = 0;
+	q->size    = 0;
+}
+
 typedef struct DecEncH264FmtInfo {
 	AVCodec *codec;
 	AVCodecContext *codecCtx;
@@ -5137,10 +5980,7 @@ typedef struct UnsharpFilterInfo
 {
 	int width, height;
 	char filter_descr[100];
-	AVFrame *frame_in;
 	AVFrame *frame_out;
-	unsigned char *frame_buffer_in;
-	unsigned char *frame_buffer_out;
 	AVFilterContext *buffersink_ctx;
 	AVFilterContext *buffersrc_ctx;
 	AVFilterGraph *filter_graph;
@@ -5149,87 +5989,18 @@ typedef struct UnsharpFilterInfo
 	int filtered_frame_num;
 }UnsharpFilterInfo;
 
-typedef struct EncodeParams {
-	int target_vmaf_score[1000];
-	int crf_per_gop[1000];
-	int unsharp_per_gop[1000];
-	int aq_strength_per_gop[1000];
-}EncodeParams;
-
-static int read_image_new_b(uint8_t *data, float *buf, float off, int width, int height, int stride, int ref_flag, int stage)
+static void read_image_new_b(const uint8_t *data, int linesize, float *buf, float off, int width, int height, int stride)
 {
 	char *byte_ptr = (char *)buf;
-	unsigned char *tmp_buf = 0;
-	int i, j;
-	int ret = 1;
-	static int first_flag   = 1;
-	static int end_of_frame = 0;
-	static int reserved_ref = 0;
-	static int reserved_dis = 0;
-
-	if (end_of_frame == 1) {
-		first_flag   = 1;
-		end_of_frame = 0;
-		reserved_ref = 0;
-		reserved_dis = 0;
-		return 2;
-	}
-	if (first_flag) {
-		first_flag = 0;
-		if (stage == 1) {
-			reserved_ref = width * height * (DECODE_FRAME_NUM_PER_GOP - 5) * 3 / 2;
-			reserved_dis = width * height * (DECODE_FRAME_NUM_PER_GOP - 5) * 3 / 2;
-		} else if (stage == 2) {
-			reserved_ref = width * height * (FILTERED_FRAME_NUM_PER_GOP - 5) * 3 / 2;
-			reserved_dis = width * height * (FILTERED_FRAME_NUM_PER_GOP - 5) * 3 / 2;
-		}
-	}
 
-	if (width <= 0 || height <= 0)
-		goto fail_or_end;
-	
-	if (!(tmp_buf = malloc(width)))
-		goto fail_or_end;
-
-	for (i = 0; i < height; ++i) {
+	for (int i = 0; i < height; i++) {
 		float *row_ptr = (float *)byte_ptr;
 
-		if (ref_flag) {
-			if (stage == 1)
-				memcpy(tmp_buf, data + (DECODE_FRAME_NUM_PER_GOP - 5) * width * height * 3 / 2 - reserved_ref + i * width, width);
-			else if (stage == 2)
-				memcpy(tmp_buf, data + (FILTERED_FRAME_NUM_PER_GOP - 5) * width * height * 3 / 2 - reserved_ref + i * width, width);
-		} else {
-			if (stage == 1)
-				memcpy(tmp_buf, data + (DECODE_FRAME_NUM_PER_GOP - 5) * width * height * 3 / 2 - reserved_dis + i * width, width);
-			else if (stage == 2)
-				memcpy(tmp_buf, data + (FILTERED_FRAME_NUM_PER_GOP - 5)* width * height * 3 / 2 - reserved_dis + i * width, width);
-		}
-		for (j = 0; j < width; j++)
-			row_ptr[j] = tmp_buf[j] + off;
+		for (int j = 0; j < width; j++)
+			row_ptr[j] = data[i * linesize + j] + off;
 
 		byte_ptr += stride;
 	}
-
-	free(tmp_buf);
-
-	if (ref_flag)
-		reserved_ref -= width * height * 3 / 2;
-	else
-		reserved_dis -= width * height * 3 / 2;
-
-	if (reserved_ref == 0 || reserved_dis == 0)
-	{
-		first_flag   = 1;
-		end_of_frame = 1;
-		return 0;
-	}
-
-	ret = 0;
-
-fail_or_end:
-	//free(tmp_buf);
-	return 0;
 }
 
 /**
@@ -5274,27 +6045,23 @@ static int read_frame_new(float *ref_data, float *dis_data, float *temp_data, in
 	char *fmt = user_data->format;
 	int w = user_data->width;
 	int h = user_data->height;
-	int ret_ref,ret_dis;
-	uint8_t *frame_data = (uint8_t *)dis_data;
-
-	//read ref y
-	if (!strcmp(fmt, "yuv420p")) {
-		ret_ref = read_image_new_b(user_data->ref, ref_data, 0, w, h, stride_byte, 1, user_data->stage);
-	} else {
-		fprintf(stderr, "Eagle: unknown format %s.\n", fmt);
-		return 1;		
-	}
+	const AVFrame *ref, *dis;
 
-	//read dis y
-	if (!strcmp(fmt, "yuv420p")) {
-		ret_dis = read_image_new_b(user_data->dis, dis_data, 0, w, h, stride_byte, 0, user_data->stage);
-	} else {
+	if (strcmp(fmt, "yuv420p")) {
 		fprintf(stderr, "Eagle: unknown format %s.\n", fmt);
 		return 1;
 	}
-	if (ret_ref == 2 || ret_dis == 2)
+
+	if (user_data->frame_idx >= user_data->num_frames)
 		return 2;
 
+	//only the luma plane is scored, read it straight from the frames
+	ref = user_data->ref[user_data->frame_idx];
+	dis = user_data->dis[user_data->frame_idx];
+	read_image_new_b(ref->data[0], ref->linesize[0], ref_data, 0, w, h, stride_byte);
+	read_image_new_b(dis->data[0], dis->linesize[0], dis_data, 0, w, h, stride_byte);
+	user_data->frame_idx++;
+
 	//fprintf(stderr, "Frame: %d/%d\r", completed_frames++, user_data->num_frames);
 
 	return 0;
@@ -5360,229 +6127,44 @@ fail_or_end:
 	return ret;
 }
 
-static void fill_yuv_image_one(uint8_t *data[4], int linesize[4],
-								int width, int height, int frame_index, MemInfo *pmeminfo)
-{
-	int x, y;
-	int frame_size = width * height * 3 / 2;
-
-	for (int plane = 0; plane < 3; plane++) {
-		int frame_height = plane == 0 ? height : height >> 1;
-		int frame_width  = plane == 0 ? width  : width  >> 1;
-		int plane_size   = frame_height * frame_width;
-		int plane_stride = linesize[plane];
-
-		if (frame_width == plane_stride) {
-			if (plane == 0) {
-				memcpy(data[plane], pmeminfo->pVideoBuffer1+ frame_index * frame_size, plane_size);
-			} else if (plane == 1) {
-				memcpy(data[plane], pmeminfo->pVideoBuffer1 + frame_index * frame_size + width * height, plane_size);
-			} else if (plane == 2) {
-				memcpy(data[plane], pmeminfo->pVideoBuffer1 + frame_index * frame_size + width * height + (width >> 1) * (height >> 1), plane_size);
-			}
-		} else {
-			for (int row_idx = 0; row_idx < frame_height; row_idx++) {
-				memcpy(data[plane] + row_idx * plane_stride, 
-					pmeminfo->pVideoBuffer1 + frame_index * plane_size + row_idx * plane_stride, frame_width);
-			}
-		}
-	}
-}
-
-
-static void fill_yuv_image(uint8_t *data[4], int linesize[4],
-								int width, int height, int frame_index, MemInfo *pmeminfo)
-{
-	int x, y;
-	int frame_size = width * height * 3 / 2;
-
-	for (int plane = 0; plane < 3; plane++) {
-		int frame_height = plane == 0 ? height : height >> 1;
-		int frame_width  = plane == 0 ? width  : width  >> 1;
-		int plane_size   = frame_height * frame_width;
-		int plane_stride = linesize[plane];
-
-		if (frame_width == plane_stride) {
-			if (plane == 0) {
-				memcpy(data[plane], pmeminfo->pVideoBuffer + frame_index * frame_size, plane_size);
-			} else if (plane == 1) {
-				memcpy(data[plane], pmeminfo->pVideoBuffer + frame_index * frame_size + width * height, plane_size);
-			} else if (plane == 2) {
-				memcpy(data[plane], pmeminfo->pVideoBuffer + frame_index * frame_size + width * height + (width >> 1) * (height >> 1), plane_size);
-			}
-		} else {
-			for (int row_idx = 0; row_idx < frame_height; row_idx++) {
-				memcpy(data[plane] + row_idx * plane_stride, 
-					pmeminfo->pVideoBuffer + frame_index * plane_size + row_idx * plane_stride, frame_width);
-			}
-		}
-	}
-}
-
-static void fill_yuv_image_filtered(uint8_t *data[4], int linesize[4],
-								int width, int height, int frame_index, MemInfo *pmeminfo)
-{
-	int x, y;
-	int frame_size = width * height * 3 / 2;
-
-	for (int plane = 0; plane < 3; plane++) {
-		int frame_height = plane == 0 ? height : height >> 1;
-		int frame_width  = plane == 0 ? width  : width  >> 1;
-		int plane_size   = frame_height * frame_width;
-		int plane_stride = linesize[plane];
-
-		if (frame_width == plane_stride) {
-			if (plane == 0) {
-				memcpy(data[plane], pmeminfo->pVideoBuffer2 + frame_index * frame_size, plane_size);
-			} else if (plane == 1) {
-				memcpy(data[plane], pmeminfo->pVideoBuffer2 + frame_index * frame_size + width * height, plane_size);
-			} else if (plane == 2) {
-				memcpy(data[plane], pmeminfo->pVideoBuffer2 + frame_index * frame_size + width * height + (width >> 1) * (height >> 1), plane_size);
-			}
-		} else {
-			for (int row_idx = 0; row_idx < frame_height; row_idx++) {
-				memcpy(data[plane] + row_idx * plane_stride, 
-					pmeminfo->pVideoBuffer2 + frame_index * plane_size + row_idx * plane_stride, frame_width);
-			}
-		}
-	}
-}
+/**
+ * Encoders the Eagle analysis can tune, chosen with -c:v. The probes and the
+ * transcode open them with the same options; the CRF and AQ strength of each
+ * GOP reach both as AV_FRAME_DATA_RATE_CONTROL_OVERRIDE side data, which the
+ * encoder applies without being reopened.
+ */
+typedef struct EagleEncoder {
+    const char *name;
+    const char *options;    ///< "key=value" pairs separated by ':'
+    int reusable;           ///< it accepts frames again once drained and flushed
+} EagleEncoder;
+
+static const EagleEncoder eagle_encoders[] = {
+    /* x264 starts over after avcodec_flush_buffers(); the others are reopened */
+    { "libx264",    "profile=high:preset=medium:tune=ssim:forced-idr=1", 1 },
+    { "libx265",    "preset=medium:tune=ssim:forced-idr=1" },
+    /* constant quality mode, the CRF is the cq-level */
+    { "libvpx-vp9", "deadline=good:cpu-used=2:row-mt=1:tune=ssim:crf=32:b=0" },
+};
 
+static const EagleEncoder *eagle_encoder = &eagle_encoders[0];
 
-static int encode_frame(InputStreamInfo *p_input_stream_info, EncodeInfo *p_enc_info, float crf_val, int filtered_flag, MemInfo *pmeminfo, int first_loop)
+static const EagleEncoder *eagle_encoder_find(const char *name)
 {
-	int ret = 0;
-	static int enc_frame_num = 0;
-	int encode_total_num = 0;//filtered_flag ? 10 : DECODE_FRAME_NUM_PER_GOP;
-	int receive_frame_num = 0;
-	int receive_frame_total_num = 0;
-	if (first_loop)
-		receive_frame_total_num = 48;
-	else
-		receive_frame_total_num = 49;
-
-	if (filtered_flag)
-		encode_total_num = 10;
-	else if (first_loop)
-		encode_total_num = DECODE_FRAME_NUM_PER_GOP - 1;
-	else
-		encode_total_num = DECODE_FRAME_NUM_PER_GOP;
-
-	{
-		//reconfig encoder params(crf), using the x264_encoder_reconfig
-		X264Context *x4 = p_enc_info->codecCtx->priv_data;
-		x4->params.rc.f_rf_constant = x4->crf = crf_val;
-		x264_encoder_reconfig(x4->enc, &(x4->params));
-	}
-
-	for (int i = 0; i < encode_total_num; i++) {
-		if (!filtered_flag) {
-			if (first_loop) {
-				fill_yuv_image_one(p_enc_info->frame->data, p_enc_info->frame->linesize,
-							p_enc_info->codecCtx->width, p_enc_info->codecCtx->height, i, pmeminfo);
-
-			} else {
-				fill_yuv_image(p_enc_info->frame->data, p_enc_info->frame->linesize,
-							p_enc_info->codecCtx->width, p_enc_info->codecCtx->height, i, pmeminfo);
-			}
-		} else {
-			fill_yuv_image_filtered(p_enc_info->frame->data, p_enc_info->frame->linesize,
-						p_enc_info->codecCtx->width, p_enc_info->codecCtx->height, i, pmeminfo);
-		}
-
-		p_enc_info->frame->pts = i;
-
-		//encode the image
-		ret = avcodec_send_frame(p_enc_info->codecCtx, p_enc_info->frame);
-		if (ret == AVERROR_EOF) {
-			fprintf(stderr, "receive AVERROR_EOF in the encode_frame part p_enc_info->frame %p\n", p_enc_info->frame);
-			break;
-		} else if (ret < 0) {
-			fprintf(stderr, "Eagle: Error sending a frame for encoding in decode part\n");
-			fprintf(stderr, "ret %x AVERROR(EAGAIN) %x AVERROR_EOF %x AVERROR(EINVAL) %x AVERROR(ENOMEM) %x\n",
-							ret, AVERROR(EAGAIN), AVERROR_EOF, AVERROR(EINVAL), AVERROR(ENOMEM));
-			return ret;
-		}
-
-		while (ret >= 0) {
-			ret = avcodec_receive_packet(p_enc_info->codecCtx, p_enc_info->p_pkt);
-			if (ret == AVERROR(EAGAIN)) {
-				//fprintf(stderr, "Eagle: could not receive packet AVERROR_EOF %x AVERROR(EAGAIN) %x ret %x\n",
-				//				AVERROR_EOF, AVERROR(EAGAIN), ret);
-				continue;
-			} else if (ret < 0) {
-				fprintf(stderr, "Eagle: error during encoding\n");
-				return ret;
-			}
-
-			if (!filtered_flag)
-			{
-				//save the h264 format data into buffer to decode it
-				memcpy(pmeminfo->pEncodeVideoBuffer + saved_data_size, p_enc_info->p_pkt->data, p_enc_info->p_pkt->size);
-				if (receive_frame_num < receive_frame_total_num) {
-					//printf("receive_frame_num %d saved_size %d\n", receive_frame_num, saved_size);
-					receive_frame_num++;
-					saved_size += p_enc_info->p_pkt->size;
-				}
-				saved_data_size += p_enc_info->p_pkt->size;
-				enc_pkt_size[enc_frame_num++] = p_enc_info->p_pkt->size;
-			} else {
-				memcpy(pmeminfo->pEncodeVideoBuffer2 + saved_data_size_filtered, p_enc_info->p_pkt->data, p_enc_info->p_pkt->size);
-				saved_data_size_filtered += p_enc_info->p_pkt->size;
-				enc_pkt_size_filtered[enc_frame_num++] = p_enc_info->p_pkt->size;
-			}
-			av_packet_unref(p_enc_info->p_pkt);
-		}
-	}
-
-	//flush
-	ret = avcodec_send_frame(p_enc_info->codecCtx, NULL);
-	if (ret < 0) {
-		fprintf(stderr, "Eagle: error sending a frame for encoding in flush part ret %x\n", ret);
-		exit(1);
-	}
-
-	while (ret >= 0) {
-		ret = avcodec_receive_packet(p_enc_info->codecCtx, p_enc_info->p_pkt);
-		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-			break;
-		} else if (ret < 0) {
-			fprintf(stderr, "Eagle: error during encoding\n");
-			exit(1);
-		}
-
-		if (!filtered_flag)
-		{
-			//save the h264 format data into buffer to decode it
-			memcpy(pmeminfo->pEncodeVideoBuffer + saved_data_size, p_enc_info->p_pkt->data, p_enc_info->p_pkt->size);
-			if (receive_frame_num < receive_frame_total_num) {
-				//printf("receive_frame_num %d saved_size %d\n", receive_frame_num, saved_size);
-				receive_frame_num++;
-				saved_size += p_enc_info->p_pkt->size;
-			}
-			saved_data_size += p_enc_info->p_pkt->size;
-			enc_pkt_size[enc_frame_num++] = p_enc_info->p_pkt->size;
-		} else {
-			memcpy(pmeminfo->pEncodeVideoBuffer2 + saved_data_size_filtered, p_enc_info->p_pkt->data, p_enc_info->p_pkt->size);
-			saved_data_size_filtered += p_enc_info->p_pkt->size;
-			enc_pkt_size_filtered[enc_frame_num++] = p_enc_info->p_pkt->size;
-		}
-		av_packet_unref(p_enc_info->p_pkt);
-	}
-
-	enc_frame_num = 0;
-
-	return 0;
+    for (int i = 0; i < FF_ARRAY_ELEMS(eagle_encoders); i++)
+        if (!strcmp(eagle_encoders[i].name, name))
+            return &eagle_encoders[i];
+    return NULL;
 }
 
-static int encode_prepare(InputStreamInfo *p_input_stream_info, EncodeInfo *p_enc_info, DecodeInfo *p_dec_info, int tune_flag, int fps)
+static int encode_prepare(EncodeInfo *p_enc_info, int width, int height, int tune_flag, int fps)
 {
+    AVDictionary *opts = NULL;
     int ret = 0;
-    enum AVCodecID codec_id = AV_CODEC_ID_H264;
 
-	p_enc_info->codec = avcodec_find_encoder(codec_id);
+	p_enc_info->codec = avcodec_find_encoder_by_name(eagle_encoder->name);
     if (!p_enc_info->codec) {
-        fprintf(stderr, "Eagle: could not find the encoder\n");
+        fprintf(stderr, "Eagle: could not find the encoder %s\n", eagle_encoder->name);
         return -1;
     }
 
@@ -5592,46 +6174,38 @@ static int encode_prepare(InputStreamInfo *p_input_stream_info, EncodeInfo *p_en
         return -1;
     }
 
-    p_enc_info->codecCtx->width     = p_dec_info->width;
-    p_enc_info->codecCtx->height    = p_dec_info->height;
+    p_enc_info->codecCtx->width     = width;
+    p_enc_info->codecCtx->height    = height;
     p_enc_info->codecCtx->pix_fmt   = AV_PIX_FMT_YUV420P;
 	p_enc_info->codecCtx->time_base = (AVRational){1, fps};
 	p_enc_info->codecCtx->framerate = (AVRational){fps, 1};
 
 	printf("fps %d\n", fps);
 
-    av_opt_set(p_enc_info->codecCtx->priv_data, "profile", "high",   0);
-    av_opt_set(p_enc_info->codecCtx->priv_data, "preset",  "medium", 0);
-	if (tune_flag) {
-    	av_opt_set(p_enc_info->codecCtx->priv_data, "tune",    "ssim",   0);
+    //the options of the transcode; each probe starts with a forced IDR so that the encoder can be reused
+    if (av_dict_parse_string(&opts, eagle_encoder->options, "=", ":", 0) < 0) {
+        av_dict_free(&opts);
+        return -1;
+    }
+	if (!tune_flag) {
+		av_dict_set(&opts, "tune", NULL, 0);
 	}
 
     // open the encoder
-    if (avcodec_open2(p_enc_info->codecCtx, p_enc_info->codec, NULL) < 0) {
+    ret = avcodec_open2(p_enc_info->codecCtx, p_enc_info->codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
         fprintf(stderr, "Eagle: Open encoder fail\n");
         return -1;
     }
 
-    //allocate AVFrame structure
+    //allocate AVFrame structure, it only ever references the frames to encode
     p_enc_info->frame = av_frame_alloc();
     if (!p_enc_info->frame) {
         fprintf(stderr, "Eagle: could not allocate video frame\n");
         return -1;
     }
 
-    p_enc_info->frame->width       = p_enc_info->codecCtx->width;
-    p_enc_info->frame->height      = p_enc_info->codecCtx->height;
-    p_enc_info->frame->format      = p_enc_info->codecCtx->pix_fmt;
-	p_enc_info->frame->linesize[0] = p_input_stream_info->p_frame->linesize[0];
-	p_enc_info->frame->linesize[1] = p_input_stream_info->p_frame->linesize[1];
-	p_enc_info->frame->linesize[2] = p_input_stream_info->p_frame->linesize[2];
-
-	//allocate AVFrame data
-	ret = av_frame_get_buffer(p_enc_info->frame, 32);
-	if (ret < 0) {
-		fprintf(stderr, "Eagle: could not allocate the video frame data\n");
-		return ret;
-	}
 
     //init AVPacket
     av_init_packet(&p_enc_info->pkt);
@@ -5647,55 +6221,80 @@ static int encode_prepare(InputStreamInfo *p_input_stream_info, EncodeInfo *p_en
     return ret;
 }
 
-static long long get_unsharp_val(uint8_t *data, int width, int height, double amounts, int msize_x, int msize_y)
+static void encode_release(EncodeInfo *p_enc_info)
 {
-    int tmp1, tmp2;
-    int res;
-    long long sharpness = 0;
-    const int amount = amounts * 65536;
-    const int steps_x = msize_x >> 1;
-    const int steps_y = msize_y >> 1;
-    const int32_t scalebits = (steps_x + steps_y) * 2;
-    const int32_t halfscale = 1 << (scalebits - 1);
-
-    uint32_t *sc[MAX_MATRIX_SIZE - 1] = {NULL};
+    avcodec_free_context(&p_enc_info->codecCtx);
+    av_frame_free(&p_enc_info->frame);
+    av_packet_free(&p_enc_info->p_pkt);
+}
 
-    for (int z = 0; z < 2 * steps_y; z++) {
-        sc[z] = (uint32_t *)malloc((width + 2 * steps_x) * sizeof(uint32_t));
-        memset(sc[z], 0, sizeof(sc[z][0]) * (width + 2 * steps_x));
-    }
+/**
+ * Per-frame measurements of the analysis, made by filters in a graph kept
+ * open for the whole analysis:
+ * - the luma sharpness: the sum of the differences between each pixel and
+ *   its 5x5 unsharp blur, from the slice-threaded sharpdetect filter
+ * - the scene change score against the previous frame, from the select
+ *   filter, which the GOPs are split on
+ */
+typedef struct EagleMeter {
+    AVFilterGraph   *graph;
+    AVFilterContext *src;
+    AVFilterContext *sink;
+    AVFrame         *frame;
+} EagleMeter;
+
+static void eagle_meter_uninit(EagleMeter *m)
+{
+    avfilter_graph_free(&m->graph);
+    av_frame_free(&m->frame);
+}
 
-    //y from 1 not -steps_y
-    //x from 1 not -steps_x
-    for (int y = steps_y; y < height - 1; y++) {
-        uint32_t sr[MAX_MATRIX_SIZE - 1] = {0};
-        for (int x = steps_x; x < width - 1; x++) {
-            tmp1 = data[y * width + x];
-            for (int z = 0; z < steps_x * 2; z += 2) {
-                tmp2 = sr[z + 0] + tmp1;
-                sr[z + 0] = tmp1;
-                tmp1 = sr[z + 1] + tmp2;
-                sr[z + 1] = tmp2;
-            }
+static int eagle_meter_init(EagleMeter *m, const AVFrame *frame)
+{
+    AVFilterContext *scene, *detect;
+    char args[256];
+    int ret;
 
-            for (int z = 0; z < steps_y * 2; z += 2) {
-                tmp2 = sc[z + 0][x + steps_x] + tmp1;
-                sc[z + 0][x + steps_x] = tmp1;
-                tmp1 = sc[z + 1][x + steps_x] + tmp2;
-                sc[z + 1][x + steps_x] = tmp2;
-            }
+    if (!(m->graph = avfilter_graph_alloc()) || !(m->frame = av_frame_alloc()))
+        return AVERROR(ENOMEM);
 
-            /*res = data[y * width + x] + (((data[y * height + x] - (int32_t)((tmp1 + halfscale) >> scalebits)) * amount) >> 16);*/
-            res = ((data[y * width + x] - (int32_t)((tmp1 + halfscale) >> scalebits)) * amount) >> 16;
-            sharpness += res;
-        }
+    snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=1/25:pixel_aspect=1/1",
+             frame->width, frame->height, frame->format);
+    if ((ret = avfilter_graph_create_filter(&m->src, avfilter_get_by_name("buffer"),
+                                            "in", args, NULL, m->graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(&scene, avfilter_get_by_name("select"),
+                                            "scene", "expr=gte(scene,0)", NULL, m->graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(&detect, avfilter_get_by_name("sharpdetect"),
+                                            "sharpdetect", "msize_x=5:msize_y=5", NULL, m->graph)) < 0 ||
+        (ret = avfilter_graph_create_filter(&m->sink, avfilter_get_by_name("buffersink"),
+                                            "out", NULL, NULL, m->graph)) < 0 ||
+        (ret = avfilter_link(m->src, 0, scene, 0)) < 0 ||
+        (ret = avfilter_link(scene, 0, detect, 0)) < 0 ||
+        (ret = avfilter_link(detect, 0, m->sink, 0)) < 0 ||
+        (ret = avfilter_graph_config(m->graph, NULL)) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "Eagle: cannot set up the analysis filters: %s\n", av_err2str(ret));
+        return ret;
     }
+    return 0;
+}
 
-	for (int z = 0; z < 2 * steps_y; z++) {
-		free(sc[z]);
-	}
+static int eagle_meter_measure(EagleMeter *m, const AVFrame *frame, long long *sharpness, double *scene)
+{
+    AVDictionaryEntry *e;
+    int ret;
 
-    return sharpness;
+    if (!m->graph && (ret = eagle_meter_init(m, frame)) < 0)
+        return ret;
+
+    if ((ret = av_buffersrc_add_frame_flags(m->src, (AVFrame *)frame, AV_BUFFERSRC_FLAG_KEEP_REF)) < 0 ||
+        (ret = av_buffersink_get_frame(m->sink, m->frame)) < 0)
+        return ret;
+    e = av_dict_get(m->frame->metadata, "lavfi.sharpdetect.sum", NULL, 0);
+    *sharpness = e ? strtoll(e->value, NULL, 10) : 0;
+    e = av_dict_get(m->frame->metadata, "lavfi.scene_score", NULL, 0);
+    *scene = e ? av_strtod(e->value, NULL) : 0;
+    av_frame_unref(m->frame);
+    return 0;
 }
 
 static int decode_prepare(InputStreamInfo **p_input_stream_info, DecodeInfo *p_dec_info)
@@ -5705,13 +6304,6 @@ static int decode_prepare(InputStreamInfo **p_input_stream_info, DecodeInfo *p_d
     p_dec_info->width  = ps->p_video_codec_par->width;
     p_dec_info->height = ps->p_video_codec_par->height;
     p_dec_info->pix_fmt = ps->p_video_codec_par->format;
-    p_dec_info->video_dst_bufsize = av_image_alloc(p_dec_info->video_dst_data, p_dec_info->video_dst_linesize,
-                                                    p_dec_info->width, p_dec_info->height, p_dec_info->pix_fmt, 1);
-
-    if (p_dec_info->video_dst_bufsize < 0) {
-        fprintf(stderr, "Eagle could not allocate raw video buffer\n");
-        return -1;
-    }
 
     //allocate frame to store the decoded output data
     ps->p_frame = av_frame_alloc();
@@ -5829,230 +6421,6 @@ static int get_input_fmt(InputStreamInfo **pp_input_stream_info, char *filename)
     return ret;
 }
 
-static int decode_write_frame(FILE *pOutput_File, AVCodecContext *avctx,
-                              AVFrame *frame, int *frame_count, AVPacket *pkt, int last, 
-                              MemInfo *pmeminfo, int filtered_flag, DecodeInfo *pdecinfo)
-{
-    int i;
-    int idx;
-    int color_idx;
-    int len, got_frame;
-    char buf[1024];
-
-    len = avcodec_decode_video2(avctx, frame, &got_frame, pkt);
-    if (len < 0) {
-        fprintf(stderr, "Error while decoding frame %d\n", *frame_count);
-        return len;
-    }
-
-    if (got_frame) {
-
-        fflush(stdout);
-
-		if (!filtered_flag) {
-			
-			av_image_copy(pdecinfo->video_dst_data, pdecinfo->video_dst_linesize,
-						  (const uint8_t *)(frame->data), frame->linesize,
-						  AV_PIX_FMT_YUV420P, frame->width, frame->height);
-			
-		    //memcpy(pmeminfo->pDecodeVideoBuffer + (*frame_count) * frame->width * frame->height * 3 / 2,
-			//    frame->data[0],	frame->width * frame->height * 3 / 2);
-			memcpy(pmeminfo->pDecodeVideoBuffer + (*frame_count) * frame->width * frame->height * 3 / 2,
-			    pdecinfo->video_dst_data[0],	frame->width * frame->height * 3 / 2);
-		} else {
-			av_image_copy(pdecinfo->video_dst_data, pdecinfo->video_dst_linesize,
-						  (const uint8_t *)(frame->data), frame->linesize,
-						  AV_PIX_FMT_YUV420P, frame->width, frame->height);
-			memcpy(pmeminfo->pDecodeVideoBuffer2 + (*frame_count) * frame->width * frame->height * 3 / 2,
-			    pdecinfo->video_dst_data[0],	frame->width * frame->height * 3 / 2);
-		}
-
-        //the picture is allocated by the decoder, no need to free it
-        (*frame_count)++;
-
-        //fwrite(frame->data[0], 1, frame->width*frame->height, pOutput_File);
-        //fwrite(frame->data[1], 1, (frame->width/2)*(frame->height/2), pOutput_File);
-        //fwrite(frame->data[2], 1, (frame->width/2)*(frame->height/2), pOutput_File);
-
-        if (pkt->data) {
-            pkt->size -= len;
-            pkt->data += len;
-        }
-    }
-
-    return got_frame;
-}
-
-static int decode_write_frame_new(FILE *pOutput_File, AVCodecContext *avctx,
-                              AVFrame *frame, int *frame_count, AVPacket *pkt, int last,
-                              MemInfo *pmeminfo, int filtered_flag, DecodeInfo *pdecinfo)
-{
-	char buf[1024];
-	int ret;
-
-	ret = avcodec_send_packet(avctx, pkt);
-	if (ret < 0) {
-		fprintf(stderr, "Eagle: Error sending a packet for decoding in decode_write_frame_new\n");
-		exit(1);
-	}
-
-	while (ret >= 0) {
-		ret = avcodec_receive_frame(avctx, frame);
-		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-			return;
-		else if (ret < 0) {
-			fprintf(stderr, "Error during decoding\n");
-			exit(1);
-		}
-
-		fflush(stdout);
-
-		if (!filtered_flag) {
-			#if 1
-			av_image_copy(pdecinfo->video_dst_data, pdecinfo->video_dst_linesize,
-						  (const uint8_t *)(frame->data), frame->linesize,
-						  AV_PIX_FMT_YUV420P, frame->width, frame->height);
-
-			memcpy(pmeminfo->pDecodeVideoBuffer + (*frame_count) * frame->width * frame->height * 3 / 2,
-			    pdecinfo->video_dst_data[0],	frame->width * frame->height * 3 / 2);
-			//memcpy(pmeminfo->pDecodeVideoBuffer + (*frame_count) * frame->width * frame->height * 3 / 2,
-			//	(const uint8_t *)(frame->data[0]), frame->width * frame->height);
-			//memcpy(pmeminfo->pDecodeVideoBuffer + (*frame_count) * frame->width * frame->height * 3 / 2 + frame->width * frame->height,
-			//	(const uint8_t *)(frame->data[1]), (frame->width / 2) * (frame->height / 2));
-			//memcpy(pmeminfo->pDecodeVideoBuffer + (*frame_count) * frame->width * frame->height * 3 / 2 + frame->width * frame->height + (frame->width / 2) * (frame->height / 2),
-			//	(const uint8_t *)(frame->data[2]), (frame->width / 2) * (frame->height / 2));
-			#else
-			memcpy(pmeminfo->pDecodeVideoBuffer + (*frame_count) * frame->width * frame->height * 3 / 2,
-				(const uint8_t *)(frame->data[0]), frame->width * frame->height);
-			memcpy(pmeminfo->pDecodeVideoBuffer + (*frame_count) * frame->width * frame->height * 3 / 2 + frame->width * frame->height,
-				(const uint8_t *)(frame->data[1]), (frame->width / 2) * (frame->height / 2));
-			memcpy(pmeminfo->pDecodeVideoBuffer + (*frame_count) * frame->width * frame->height * 3 / 2 + frame->width * frame->height + (frame->width / 2) * (frame->height / 2),
-				(const uint8_t *)(frame->data[2]), (frame->width / 2) * (frame->height / 2));
-			#endif
-		} else {
-			av_image_copy(pdecinfo->video_dst_data, pdecinfo->video_dst_linesize,
-						  (const uint8_t *)(frame->data), frame->linesize,
-						  AV_PIX_FMT_YUV420P, frame->width, frame->height);
-			memcpy(pmeminfo->pDecodeVideoBuffer2 + (*frame_count) * frame->width * frame->height * 3 / 2,
-			    pdecinfo->video_dst_data[0],	frame->width * frame->height * 3 / 2);
-			
-			//memcpy(pmeminfo->pDecodeVideoBuffer2 + (*frame_count) * frame->width * frame->height * 3 / 2,
-			//    pdecinfo->video_dst_data[0],	frame->width * frame->height);
-			//memcpy(pmeminfo->pDecodeVideoBuffer2 + (*frame_count) * frame->width * frame->height * 3 / 2 + frame->width * frame->height,
-			//	(const uint8_t *)(frame->data[1]), (frame->width / 2) * (frame->height / 2));
-			//memcpy(pmeminfo->pDecodeVideoBuffer2 + (*frame_count) * frame->width * frame->height * 3 / 2 + frame->width * frame->height + (frame->width / 2) * (frame->height / 2),
-			//	(const uint8_t *)(frame->data[2]), (frame->width / 2) * (frame->height / 2));
-		}
-
-        //the picture is allocated by the decoder, no need to free it
-        (*frame_count)++;
-
-        //fwrite(frame->data[0], 1, frame->width*frame->height, pOutput_File);
-        //fwrite(frame->data[1], 1, (frame->width/2)*(frame->height/2), pOutput_File);
-        //fwrite(frame->data[2], 1, (frame->width/2)*(frame->height/2), pOutput_File);
-
-	}
-}
-
-
-static int decode_encoded_h264_rawdata(DecEncH264FmtInfo *pinfo, MemInfo *pmeminfo, DecodeInfo *pdecinfo)
-{
-	int ret = 0;
-	int len = 0, frame_count = 0;
-
-	pinfo->inbuf = (uint8_t *)malloc(INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
-	memset(pinfo->inbuf , 0, INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
-	av_init_packet(&(pinfo->pkt));
-	pinfo->codec = avcodec_find_decoder(AV_CODEC_ID_H264);
-	if (!pinfo->codec) {
-		fprintf(stderr, "cannot find the decoder\n");
-		exit(1);
-	}
-	
-	pinfo->codecCtx = avcodec_alloc_context3(pinfo->codec);
-	if (!pinfo->codecCtx) {
-		fprintf(stderr, "could not allocate video codec context\n");
-		exit(1);
-	}
-	
-	if (pinfo->codec->capabilities & AV_CODEC_CAP_TRUNCATED) {
-		pinfo->codecCtx->flags |= AV_CODEC_FLAG_TRUNCATED;
-	}
-	
-	pinfo->pCodecParserCtx = av_parser_init(AV_CODEC_ID_H264);
-	if (!pinfo->pCodecParserCtx) {
-		fprintf(stderr, "Error: alloc parser fail\n");
-		exit(1);
-	}
-	
-	//open the decoder
-	if (avcodec_open2(pinfo->codecCtx, pinfo->codec, NULL) < 0) {
-		fprintf(stderr, "could not open the decoder\n");
-		exit(1);
-	}
-	
-	//open frame structure
-	pinfo->frame = av_frame_alloc();
-	if (!pinfo->frame) {
-		fprintf(stderr, "could not allocate video frame\n");
-		exit(1);
-	}
-	
-	frame_count = 0;
-
-	memcpy(pinfo->inbuf, pmeminfo->pEncodeVideoBuffer, saved_data_size);
-	pinfo->pDataPtr  = pinfo->inbuf;
-	pinfo->uDataSize = saved_data_size;
-	//printf("saved_data_size %d\n", saved_data_size);
-	while (pinfo->uDataSize > 0) {
-		len = av_parser_parse2(pinfo->pCodecParserCtx, pinfo->codecCtx, &(pinfo->pkt.data), &(pinfo->pkt.size),
-							pinfo->pDataPtr, pinfo->uDataSize,
-							AV_NOPTS_VALUE, AV_NOPTS_VALUE, AV_NOPTS_VALUE);
-		pinfo->uDataSize -= len;
-		pinfo->pDataPtr  += len;
-
-		if (pinfo->pkt.size)
-			decode_write_frame_new(pinfo->outputfp, pinfo->codecCtx, pinfo->frame, &frame_count, &(pinfo->pkt), 0, pmeminfo, 0, pdecinfo) ;
-	} 
-
-	//decode the data in the decoder itself
-	pinfo->pkt.size = 0;
-	pinfo->pkt.data = NULL;
-
-	decode_write_frame_new(pinfo->outputfp, pinfo->codecCtx, pinfo->frame, &frame_count, NULL, 0, pmeminfo, 0, pdecinfo);
-
-	return 0;
-}
-
-static int compute_vmaf_prepare(struct newData **s, int *vmaf_width, int *vmaf_height, 
-										const int width, const int height,
-										const uint8_t *ref, const uint8_t *dis)
-							//DecEncH264FmtInfo *Dec264FmtInfo, const MemInfo *pmeminfo)
-{
-	int ret = 0;
-	struct newData *ps = (struct newData *)malloc(sizeof(struct newData));
-	memset(ps, 0, sizeof(struct newData));
-	ps->format   = "yuv420p";
-	*vmaf_width  = width;
-	*vmaf_height = height;
-	ps->width =  *vmaf_width;
-	ps->height = *vmaf_height;
-	if (!strcmp(ps->format, "yuv420p")) {
-		if (((*vmaf_width) * (*vmaf_height)) % 2 != 0) {
-			fprintf(stderr, "(width * height) %% 2 != 0, width = %d, height %d.\n", (*vmaf_width), (*vmaf_height));
-			ret = 1;
-			exit(0);
-		}
-		ps->offset = (*vmaf_width) * (*vmaf_height) >> 1;
-	}
-	ps->ref = ref;
-	ps->dis = dis;
-	ps->num_frames = 50;
-	*s = ps;
-
-	return 0;	
-}
-
 static int init_video_filter(const char *filter_descr, int width, int height, UnsharpFilterInfo *pfilterinfo)
 {
 	char args[512];
@@ -6112,7 +6480,7 @@ static int init_video_filter(const char *filter_descr, int width, int height, Un
 
 static int add_frame_to_filter(AVFrame *frameIn, UnsharpFilterInfo *pfilterinfo)
 {
-	if (av_buffersrc_add_frame(pfilterinfo->buffersrc_ctx, frameIn) < 0) {
+	if (av_buffersrc_add_frame_flags(pfilterinfo->buffersrc_ctx, frameIn, AV_BUFFERSRC_FLAG_KEEP_REF) < 0) {
 		return 0;
 	}
 	return 1;
@@ -6126,60 +6494,6 @@ static int get_frame_from_filter(AVFrame **frameOut, UnsharpFilterInfo *pfilteri
 	return 1;
 }
 
-static void init_video_frame_in_out(AVFrame **frameIn, AVFrame **frameOut, unsigned char **frame_buffer_in, unsigned char **frame_buffer_out, int frameWidth, int frameHeight)
-{
-    *frameIn = av_frame_alloc();
-    *frame_buffer_in = (unsigned char *)av_malloc(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, frameWidth, frameHeight, 1));
-    av_image_fill_arrays((*frameIn)->data, (*frameIn)->linesize, *frame_buffer_in, AV_PIX_FMT_YUV420P, frameWidth, frameHeight, 1);
-
-    *frameOut = av_frame_alloc();
-    *frame_buffer_out = (unsigned char *)av_malloc(av_image_get_buffer_size(AV_PIX_FMT_YUV420P, frameWidth, frameHeight, 1));
-    av_image_fill_arrays((*frameOut)->data, (*frameOut)->linesize, *frame_buffer_out, AV_PIX_FMT_YUV420P, frameWidth, frameHeight, 1);
-
-    (*frameIn)->width  = frameWidth;
-    (*frameIn)->height = frameHeight;
-    (*frameIn)->format = AV_PIX_FMT_YUV420P;
-}
-
-static int read_yuv_data_to_buf(unsigned char *frame_buffer_in, const uint8_t *data, AVFrame **frameIn, int width, int height, int first_part)
-{
-	static int filter_frame_num = 0;
-	static int filter_frame_num_two = 0;
-	AVFrame *pFrameIn = *frameIn;
-	int frameSize = width * height * 3 / 2;
-
-
-	if (first_part) {
-		if(filter_frame_num < DECODE_FRAME_NUM_PER_GOP) {
-			memcpy(frame_buffer_in, data + filter_frame_num * width * height * 3 / 2, frameSize);
-		} else {
-			filter_frame_num = 0;
-			return 0;
-		}
-	} else {
-		if(filter_frame_num_two < DECODE_FRAME_NUM_PER_GOP) {
-			memcpy(frame_buffer_in, data + filter_frame_num_two * width * height * 3 / 2, frameSize);
-		} else {
-			filter_frame_num_two = 0;
-			return 0;
-		}
-	}
-
-	pFrameIn->data[0] = frame_buffer_in;
-	pFrameIn->data[1] = pFrameIn->data[0] + width * height;
-	pFrameIn->data[2] = pFrameIn->data[1] + width * height / 4;
-
-	if (first_part) {
-		filter_frame_num++;
-		filter_frame_num = (filter_frame_num == DECODE_FRAME_NUM_PER_GOP) ? 0 : filter_frame_num;
-	} else {
-		filter_frame_num_two++;
-		filter_frame_num_two = (filter_frame_num_two == FILTERED_FRAME_NUM_PER_GOP) ? 0 : filter_frame_num_two;
-	}
-	
-	return 1;
-}
-
 static int read_yuv_data_to_buf_two(unsigned char *frame_buffer_in, const uint8_t *data, AVFrame **frameIn, int width, int height)
 {
 	static int filter_frame_num_two = 0;
@@ -6210,378 +6524,1111 @@ static int read_yuv_data_to_buf_two(unsigned char *frame_buffer_in, const uint8_
 	return 1;
 }
 
-
-static void write_yuv_to_outfile(const AVFrame *frame_out, FILE *fp)
-{
-	if (frame_out->format == AV_PIX_FMT_YUV420P) {
-		for (int i = 0; i < frame_out->height; i++) {
-			fwrite(frame_out->data[0] + frame_out->linesize[0] * i, 1, frame_out->width, fp);;
-		}
-        for (int i = 0; i < frame_out->height >> 1; i++) {
-            fwrite(frame_out->data[1] + frame_out->linesize[1] * i, 1, frame_out->width >> 1, fp);
-        }
-        for (int i = 0; i < frame_out->height >> 1; i++) {
-            fwrite(frame_out->data[2] + frame_out->linesize[2] * i, 1, frame_out->width >> 1, fp);
-        }
-	}
-}
-
-static int unsharp_decoded_yuv(UnsharpFilterInfo *pfilterinfo, const MemInfo *pmeminfo, const InputStreamInfo *p_input_stream_info, FILE *fp_filter, int first_part)
+/* run the first nb_frames frames of src through the unsharp filter described
+ * by pfilterinfo->filter_descr, queueing the filtered frames in dst */
+static int unsharp_decoded_yuv(UnsharpFilterInfo *pfilterinfo, const EagleFrameQueue *src,
+							   int nb_frames, EagleFrameQueue *dst)
 {
 	int ret = 0;
-	int frameWidth  = p_input_stream_info->p_frame->width;
-	int frameHeight = p_input_stream_info->p_frame->height;
-	uint8_t *data = NULL;
+	int frameWidth, frameHeight;
+
+	eagle_frame_queue_clear(dst);
+	nb_frames = FFMIN(nb_frames, src->nb_frames);
+	if (!nb_frames)
+		return 0;
+	frameWidth  = src->frames[0]->width;
+	frameHeight = src->frames[0]->height;
 
 	printf("filter_descr %s frameWidth %d frameHeight %d\n", pfilterinfo->filter_descr, frameWidth, frameHeight);
 	if (ret = init_video_filter(pfilterinfo->filter_descr, frameWidth, frameHeight, pfilterinfo)) {
-		return ret;
+		goto end;
 	};
 
-	init_video_frame_in_out(&(pfilterinfo->frame_in), &(pfilterinfo->frame_out), &(pfilterinfo->frame_buffer_in), &(pfilterinfo->frame_buffer_out), frameWidth, frameHeight);
-
-	if (first_part) {
-		data = pmeminfo->pVideoBufferCrf5;
-	} else {
-		data = pmeminfo->pVideoBuffer;
+	pfilterinfo->frame_out = av_frame_alloc();
+	if (!pfilterinfo->frame_out) {
+		ret = AVERROR(ENOMEM);
+		goto end;
 	}
 
-	while (read_yuv_data_to_buf(pfilterinfo->frame_buffer_in, data, &(pfilterinfo->frame_in), frameWidth, frameHeight, first_part)) {
-		//add frame to filter graph
-		if (!add_frame_to_filter((pfilterinfo->frame_in), pfilterinfo)) {
+	for (pfilterinfo->filtered_frame_num = 0; pfilterinfo->filtered_frame_num < nb_frames; pfilterinfo->filtered_frame_num++) {
+		//add frame to filter graph, the graph only takes a new reference
+		if (!add_frame_to_filter(src->frames[pfilterinfo->filtered_frame_num], pfilterinfo)) {
 			printf("error: while adding frame\n");
+			ret = AVERROR(EINVAL);
 			goto end;
 		}
 
 		//get frame from filter graph
 		if (!get_frame_from_filter(&(pfilterinfo->frame_out), pfilterinfo)) {
 			printf("error: while getting frame\n");
+			ret = AVERROR(EINVAL);
 			goto end;
 		}
 
-		//write the frame to output file
-		//if (first_part)
-		//	write_yuv_to_outfile(pfilterinfo->frame_out, fp_filter);
-
-		if (first_part)
-		{
-			memcpy(pmeminfo->pVideoBuffer1 + pfilterinfo->filtered_frame_num * pfilterinfo->frame_out->width * pfilterinfo->frame_out->height * 3 / 2, 
-					pfilterinfo->frame_out->data[0], 
-					pfilterinfo->frame_out->width * pfilterinfo->frame_out->height);
-			memcpy(pmeminfo->pVideoBuffer1 + pfilterinfo->filtered_frame_num * pfilterinfo->frame_out->width * pfilterinfo->frame_out->height * 3 / 2 + pfilterinfo->frame_out->width * pfilterinfo->frame_out->height,
-					pfilterinfo->frame_out->data[1], 
-					(pfilterinfo->frame_out->width >> 1) * (pfilterinfo->frame_out->height >> 1));
-			memcpy(pmeminfo->pVideoBuffer1 + pfilterinfo->filtered_frame_num * pfilterinfo->frame_out->width * pfilterinfo->frame_out->height * 3 / 2 + pfilterinfo->frame_out->width * pfilterinfo->frame_out->height + (pfilterinfo->frame_out->width >> 1) * (pfilterinfo->frame_out->height >> 1),
-					pfilterinfo->frame_out->data[2], 
-					(pfilterinfo->frame_out->width >> 1) * (pfilterinfo->frame_out->height >> 1));
-
-		} else {
-			memcpy(pmeminfo->pVideoBuffer2 + pfilterinfo->filtered_frame_num * pfilterinfo->frame_out->width * pfilterinfo->frame_out->height * 3 / 2, 
-					pfilterinfo->frame_out->data[0], 
-					pfilterinfo->frame_out->width * pfilterinfo->frame_out->height);
-			memcpy(pmeminfo->pVideoBuffer2 + pfilterinfo->filtered_frame_num * pfilterinfo->frame_out->width * pfilterinfo->frame_out->height * 3 / 2 + pfilterinfo->frame_out->width * pfilterinfo->frame_out->height,
-					pfilterinfo->frame_out->data[1], 
-					(pfilterinfo->frame_out->width >> 1) * (pfilterinfo->frame_out->height >> 1));
-			memcpy(pmeminfo->pVideoBuffer2 + pfilterinfo->filtered_frame_num * pfilterinfo->frame_out->width * pfilterinfo->frame_out->height * 3 / 2 + pfilterinfo->frame_out->width * pfilterinfo->frame_out->height + (pfilterinfo->frame_out->width >> 1) * (pfilterinfo->frame_out->height >> 1),
-					pfilterinfo->frame_out->data[2], 
-					(pfilterinfo->frame_out->width >> 1) * (pfilterinfo->frame_out->height >> 1));
-		}
+		ret = eagle_frame_queue_push(dst, pfilterinfo->frame_out);
 		av_frame_unref(pfilterinfo->frame_out);
-		pfilterinfo->filtered_frame_num++;
-		if (first_part) {
-			if (pfilterinfo->filtered_frame_num == DECODE_FRAME_NUM_PER_GOP) {
-				pfilterinfo->filtered_frame_num = 0;
-				break;
-			}
-		} else if (pfilterinfo->filtered_frame_num == FILTERED_FRAME_NUM_PER_GOP) {
-			pfilterinfo->filtered_frame_num = 0;
-			break;
-		}
+		if (ret < 0)
+			goto end;
 	}
+	pfilterinfo->filtered_frame_num = 0;
 
+end:
 	avfilter_graph_free(&(pfilterinfo->filter_graph));
 	avfilter_inout_free(&(pfilterinfo->outputs));
 	avfilter_inout_free(&(pfilterinfo->inputs));
-	av_frame_free(&(pfilterinfo->frame_in));
 	av_frame_free(&(pfilterinfo->frame_out));
-	av_free(pfilterinfo->frame_buffer_in);
-	av_free(pfilterinfo->frame_buffer_out);
 
-	return 0;
-end:
-	av_frame_free(&(pfilterinfo->frame_in));
-	av_frame_free(&(pfilterinfo->frame_out));
-	return 0;
+	return ret;
 }
 
-static int enc_filtered_yuv_to_264(MemInfo *pmeminfo, float crf_val, const InputStreamInfo *p_input_stream_info, int fps)
+static float get_unsharp(float pixel_unsharpness)
 {
-	int ret = 0;
-	static int enc_frame_num = 0;
-
-	AVFrame *pframe;
-	AVPacket *ppkt;
-	AVPacket pkt;
-	X264Context *x4 = NULL;
-	
-	enum AVCodecID codec_id = AV_CODEC_ID_H264;
-	AVCodec *pcodec = avcodec_find_encoder(codec_id);
-	if (!pcodec) {
-		fprintf(stderr, "enc_filtered_yuv_to_264\n");
-		return -1;
-	}
+	float unsharp_factor;
+	if (pixel_unsharpness <= 0.1)
+		pixel_unsharpness = 0.1;
+	else if (pixel_unsharpness >= 0.8)
+		pixel_unsharpness = 0.8;
 
-	AVCodecContext *pcodecCtx = avcodec_alloc_context3(pcodec);
-	if (!pcodecCtx) {
-		fprintf(stderr, "Eagle: could not allocate video codec context\n");
-		return -1;
-	}
+	unsharp_factor = (((0.8 - pixel_unsharpness) / 0.7) * ((0.8 - pixel_unsharpness) / 0.7)) * 6;
 
-	pcodecCtx->width     = p_input_stream_info->p_frame->width;
-	pcodecCtx->height    = p_input_stream_info->p_frame->height;
-	pcodecCtx->pix_fmt   = AV_PIX_FMT_YUV420P;
-	pcodecCtx->time_base = (AVRational){1, fps};
-	pcodecCtx->framerate = (AVRational){fps, 1};
+	if (unsharp_factor <= 1.0)
+		unsharp_factor = 1.0;
 
-	av_opt_set(pcodecCtx->priv_data, "profile", "high",   0);
-	av_opt_set(pcodecCtx->priv_data, "preset",  "medium", 0);
-	av_opt_set(pcodecCtx->priv_data, "tune",    "ssim",   0);
+	return unsharp_factor * pixel_unsharpness;
+}
 
-	//open the encoder
-	if (avcodec_open2(pcodecCtx, pcodec, NULL) < 0) {
-		fprintf(stderr, "Eagle: Open encoder fail\n");
-		return -1;
-	}
+static float get_aq_strength(float pixel_unsharpness)
+{
+	float aq_float = 0.0;
+	if (pixel_unsharpness <= 0.1)
+		pixel_unsharpness = 0.1;
+	else if (pixel_unsharpness >= 0.8)
+		pixel_unsharpness = 0.8;
 
-	//allocate AVFrame structure
-	pframe = av_frame_alloc();
-	if (!pframe) {
-		fprintf(stderr, "Eagle: could not allocate video frame\n");
-		return -1;
-	}
+	aq_float = (float)(0.5 + (0.8 - pixel_unsharpness) / 0.7);
+	if (aq_float < 1.0)
+		aq_float = 1.0;
 
-	pframe->width  = pcodecCtx->width;
-	pframe->height = pcodecCtx->height;
-	pframe->format = pcodecCtx->pix_fmt;
-	pframe->linesize[0] = p_input_stream_info->p_frame->linesize[0];
-	pframe->linesize[1] = p_input_stream_info->p_frame->linesize[1];
-	pframe->linesize[2] = p_input_stream_info->p_frame->linesize[2];
+	return aq_float;
+}
 
-	//allocate AVFrame data
-	ret = av_frame_get_buffer(pframe, 32);
-	if (ret < 0) {
-		fprintf(stderr, "Eagle: could not allocate the video frame data\n");
-		return ret;
-	}
+/* a probe encoder, kept open for the geometry it was opened with */
+typedef struct EagleProbeEncoder {
+    EncodeInfo         enc;
+    int64_t            next_pts;        ///< keeps the encoder input monotonic
+} EagleProbeEncoder;
 
-	//init AVPacket
-	av_init_packet(&pkt);
-	pkt.data = NULL;
-	pkt.size = 0;
+/**
+ * Resources owned by one probe worker. A probe encodes a window of frames at
+ * one CRF, decodes the result back and scores it with VMAF; everything it
+ * writes lives here so that several probes can run at once.
+ */
+typedef struct EagleProbe {
+    struct EagleProbePool *pool;
+    int                job;             ///< index of the job being run
+
+    UnsharpFilterInfo  filter;
+
+    /* kept open across probes, only drained and flushed in between; the
+     * output and each rung of the ladder have an encoder of their own */
+    EagleProbeEncoder  encs[EAGLE_MAX_RUNGS + 1];
+    EagleProbeEncoder *enc;             ///< encoder of the running scan
+    AVCodecContext    *dec;
+    AVFrame           *dec_frame;
+
+    EagleFrameQueue    filtered;        ///< per-probe unsharp output
+    struct SwsContext *sws;
+    EagleFrameQueue    scaled;          ///< unsharp output at the probe resolution
+    EaglePacketQueue   packets;         ///< encoded probe
+    EagleFrameQueue    decoded;         ///< probe decoded back
+} EagleProbe;
+
+typedef struct EagleProbeResult {
+    float vmaf_score;
+    float bitrate;
+    int   ret;
+    int   done;
+} EagleProbeResult;
+
+#define EAGLE_MAX_SCAN_JOBS 64
 
-	ppkt = av_packet_alloc();
-	if (!ppkt) {
-		fprintf(stderr, "Eagle: could not allocate pkt\n");
-		return -1;
-	}
+/**
+ * A search over nb_jobs candidates (CRFs or unsharp amounts) that would be
+ * evaluated one after another, stopping at the first candidate accepted by
+ * check(). Candidates are probed concurrently but check() still sees the
+ * results strictly in order, so the outcome does not depend on the number
+ * of workers.
+ */
+typedef struct EagleScan {
+    int  nb_jobs;
+    int  (*run)(struct EagleScan *scan, EagleProbe *p, int idx);
+    int  (*check)(struct EagleScan *scan, int idx);
+
+    EagleProbeResult results[EAGLE_MAX_SCAN_JOBS];
+    int   stop_idx;                 ///< accepted candidate, nb_jobs if none
+    int   err;
+
+    /* read-only while the scan runs */
+    const EagleFrameQueue *orig;    ///< source frames the unsharp probes sharpen
+    const EagleFrameQueue *ref;     ///< frames VMAF is computed against
+    const EagleFrameQueue *src;     ///< frames to encode
+    int   width, height, fps;       ///< probe resolution, possibly below the source's
+    int   nb_frames;                ///< frames encoded per probe
+    int   nb_vmaf_frames;           ///< frames scored per probe
+    int   n_subsample;
+    int   vmaf_threads;
+    char *model_path;
+    float crf;                      ///< CRF of the first candidate
+    const char *const *unsharp_val; ///< unsharp amount of each candidate
+    float target_per_score;
+    int   gop;
+    int   vmaf_dropped;             ///< unsharp scan stopped on a VMAF drop
+    struct EagleRung *rungs;        ///< rungs scaled by eagle_rung_scale_run()
+} EagleScan;
+
+typedef struct EagleProbePool {
+    AVSliceThread *thread;
+    EagleProbe    *probes;
+    int            nb_probes;
+    EagleScan     *scan;
+#if HAVE_THREADS
+    pthread_mutex_t lock;
+#endif
+    atomic_int     stop_idx;
+    int            next_check;
+} EagleProbePool;
 
-	{
-		//reconfig encoder params(aq_strength, crf), using the x264_encoder_reconfig
-		X264Context *x4 = pcodecCtx->priv_data;
-		x4->crf = crf_val;
-		x4->params.rc.f_rf_constant = crf_val;
-		//x4->aq_strength = global_aq_strength_array[global_stage2_gop_num];
-		//x4->params.rc.f_aq_strength = global_aq_strength_array[global_stage2_gop_num];
-		x264_encoder_reconfig(x4->enc, &(x4->params));
-	}
+static int eagle_probe_cancelled(const EagleProbe *p)
+{
+    return p->job > atomic_load_explicit(&p->pool->stop_idx, memory_order_relaxed);
+}
 
-	//encode frame
-	for (int i = 0; i < 6/*FILTERED_FRAME_NUM_PER_GOP/*6*/; i++) {
-		fill_yuv_image_filtered(pframe->data, pframe->linesize, 
-								pcodecCtx->width, pcodecCtx->height, i, pmeminfo);
-		pframe->pts = i;
+static int eagle_probe_encode(EagleProbe *p, const EagleFrameQueue *src, int nb_frames, float crf)
+{
+    EncodeInfo *e = &p->enc->enc;
+    int ret;
 
-		//encode the image
-		ret = avcodec_send_frame(pcodecCtx, pframe);
-		if (ret == AVERROR_EOF) {
-			break;
-		} else if (ret < 0) {
-			fprintf(stderr, "Eagle: Error sending a frame for encoding\n");
-			return ret;
-		}
+    eagle_packet_queue_clear(&p->packets);
+    for (int i = 0; i <= nb_frames; i++) {
+        if (i < nb_frames) {
+            if (eagle_probe_cancelled(p))
+                return AVERROR_EXIT;
+            if ((ret = av_frame_ref(e->frame, src->frames[i])) < 0)
+                return ret;
+            /* the decoder's picture types would otherwise be forced on x264;
+             * the first frame is an IDR to cut the probe from the previous one */
+            e->frame->pict_type = i ? AV_PICTURE_TYPE_NONE : AV_PICTURE_TYPE_I;
+            e->frame->pts       = p->enc->next_pts++;
+            if (!i && (ret = eagle_set_rate_control(e->frame, crf, -1)) < 0)
+                return ret;
+        }
 
-		while (ret >= 0) {
-			ret = avcodec_receive_packet(pcodecCtx, ppkt);
-			if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-				//fprintf(stderr, "Eagle: could not a receive packet AVERROR_EOF %x ret %x\n",
-				//				AVERROR_EOF, AVERROR(EAGAIN), ret);
-				continue;
-			} else if (ret < 0) {
-				fprintf(stderr, "Eagle: error during encoding\n");
-				return ret;
-			}
-			//printf("encoding success\n");
+        ret = avcodec_send_frame(e->codecCtx, i < nb_frames ? e->frame : NULL);
+        av_frame_unref(e->frame);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_ERROR, "Eagle: error sending a frame for encoding: %s\n", av_err2str(ret));
+            return ret;
+        }
+
+        while ((ret = avcodec_receive_packet(e->codecCtx, e->p_pkt)) >= 0) {
+            if ((ret = eagle_packet_queue_push(&p->packets, e->p_pkt)) < 0)
+                return ret;
+        }
+        if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+            av_log(NULL, AV_LOG_ERROR, "Eagle: error during encoding: %s\n", av_err2str(ret));
+            return ret;
+        }
+    }
 
-			memcpy(pmeminfo->pEncodeVideoBuffer2 + saved_data_size_filtered, ppkt->data, ppkt->size);
-			saved_data_size_filtered += ppkt->size;
-			enc_pkt_size_filtered[enc_frame_num++] = ppkt->size;
+    //the encoder is drained; make it accept the next probe
+    if (!eagle_encoder->reusable) {
+        int width = e->codecCtx->width, height = e->codecCtx->height, fps = e->codecCtx->time_base.den;
 
-			av_packet_unref(ppkt);
-		}
-	}
+        encode_release(e);
+        return encode_prepare(e, width, height, 1, fps) < 0 ? AVERROR_EXTERNAL : 0;
+    }
+    avcodec_flush_buffers(e->codecCtx);
+    return 0;
+}
 
-	//flush
-	ret = avcodec_send_frame(pcodecCtx, NULL);
-	if (ret < 0) {
-		fprintf(stderr, "Eagle: error sending a frame for encoding\n");
-		exit(1);
-	}
+static int eagle_probe_decode_packet(EagleProbe *p, AVCodecContext *dec, AVFrame *frame,
+                                     const AVPacket *pkt)
+{
+    int ret = avcodec_send_packet(dec, pkt);
+    if (ret < 0)
+        return ret;
+
+    while ((ret = avcodec_receive_frame(dec, frame)) >= 0) {
+        ret = eagle_frame_queue_push(&p->decoded, frame);
+        av_frame_unref(frame);
+        if (ret < 0)
+            return ret;
+    }
+
+    return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/* decode the probe packets back into p->decoded; they are whole access
+ * units, so they go to the decoder as they are, without a parser */
+static int eagle_probe_decode(EagleProbe *p)
+{
+    int ret = 0;
+
+    eagle_frame_queue_clear(&p->decoded);
+
+    for (int i = 0; i < p->packets.nb_pkts && ret >= 0; i++)
+        ret = eagle_probe_decode_packet(p, p->dec, p->dec_frame, p->packets.pkts[i]);
+    if (ret >= 0)
+        ret = eagle_probe_decode_packet(p, p->dec, p->dec_frame, NULL);
+    avcodec_flush_buffers(p->dec);
+
+    if (ret < 0)
+        av_log(NULL, AV_LOG_ERROR, "Eagle: error decoding probe: %s\n", av_err2str(ret));
+    return ret;
+}
+
+static void eagle_probe_close(EagleProbe *p)
+{
+    for (int i = 0; i < FF_ARRAY_ELEMS(p->encs); i++)
+        encode_release(&p->encs[i].enc);
+    p->enc = NULL;
+    avcodec_free_context(&p->dec);
+    av_frame_free(&p->dec_frame);
+}
+
+/* Pick the encoder of a probe opened with the geometry of the scan, opening
+ * it on first use, and open the decoder, which handles any geometry. */
+static int eagle_probe_open(EagleProbe *p, const EagleScan *scan)
+{
+    EagleProbeEncoder *unused = NULL;
+    AVCodec *codec;
+    int ret;
+
+    p->enc = NULL;
+    for (int i = 0; i < FF_ARRAY_ELEMS(p->encs) && !p->enc; i++) {
+        AVCodecContext *enc = p->encs[i].enc.codecCtx;
+
+        if (!enc) {
+            if (!unused)
+                unused = &p->encs[i];
+        } else if (enc->width == scan->width && enc->height == scan->height &&
+                   enc->time_base.den == scan->fps) {
+            p->enc = &p->encs[i];
+        }
+    }
+    if (!p->enc) {
+        //all in use by other geometries; recycle the first one
+        if (!unused) {
+            unused = &p->encs[0];
+            encode_release(&unused->enc);
+        }
+        if ((ret = encode_prepare(&unused->enc, scan->width, scan->height, 1, scan->fps)) < 0)
+            goto fail;
+        unused->next_pts = 0;
+        p->enc = unused;
+    }
+    if (p->dec)
+        return 0;
+
+    if (!(codec = avcodec_find_decoder(p->enc->enc.codec->id))) {
+        ret = AVERROR_DECODER_NOT_FOUND;
+        goto fail;
+    }
+    p->dec       = avcodec_alloc_context3(codec);
+    p->dec_frame = av_frame_alloc();
+    if (!p->dec || !p->dec_frame) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    if ((ret = avcodec_open2(p->dec, codec, NULL)) < 0)
+        goto fail;
+    return 0;
+
+fail:
+    eagle_probe_close(p);
+    return ret;
+}
+
+/* encode, decode and score one window of frames at one CRF */
+static int eagle_probe_run(EagleScan *scan, EagleProbe *p, int idx, const EagleFrameQueue *src, float crf)
+{
+    EagleProbeResult *r = &scan->results[idx];
+    char fmt[] = "yuv420p";
+    struct newData s = { 0 };
+    double vmaf_score = 0.0;
+    int nb_frames = FFMIN(scan->nb_frames, src->nb_frames);
+    int ret;
+
+    if ((ret = eagle_probe_open(p, scan)) < 0)
+        return ret;
+    if ((ret = eagle_probe_encode(p, src, nb_frames, crf)) < 0) {
+        //a cancelled or failed probe leaves the encoder mid-stream
+        encode_release(&p->enc->enc);
+        return ret;
+    }
+
+    if ((ret = eagle_probe_decode(p)) < 0)
+        return ret;
+
+    s.format     = fmt;
+    s.width      = scan->width;
+    s.height     = scan->height;
+    s.ref        = scan->ref->frames;
+    s.dis        = p->decoded.frames;
+    s.num_frames = FFMIN(scan->nb_vmaf_frames, FFMIN(p->decoded.nb_frames, scan->ref->nb_frames));
+    s.stage      = 1;
+    ret = compute_vmaf(&vmaf_score, fmt, scan->width, scan->height, read_frame_new, &s,
+                       scan->model_path, NULL, NULL, 0, 0, 0, 0, 0, 0, 0, NULL,
+                       FFMAX(scan->vmaf_threads, 1), scan->n_subsample, 0);
+    if (ret) {
+        av_log(NULL, AV_LOG_ERROR, "Eagle: VMAF computation failed\n");
+        return AVERROR_EXTERNAL;
+    }
+
+    r->vmaf_score = vmaf_score;
+    r->bitrate    = (float)p->packets.size / 1024 * 8 / ((float)nb_frames / scan->fps);
+    return 0;
+}
+
+static void eagle_probe_worker(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
+{
+    EagleProbePool *pool = priv;
+    EagleScan *scan = pool->scan;
+    EagleProbe *p = &pool->probes[threadnr];
+    EagleProbeResult *r = &scan->results[jobnr];
+
+    p->job = jobnr;
+    r->ret = eagle_probe_cancelled(p) ? AVERROR_EXIT : scan->run(scan, p, jobnr);
+
+#if HAVE_THREADS
+    if (pool->thread)
+        pthread_mutex_lock(&pool->lock);
+#endif
+    r->done = 1;
+    while (pool->next_check < atomic_load(&pool->stop_idx) &&
+           scan->results[pool->next_check].done) {
+        int idx = pool->next_check;
+
+        if (scan->results[idx].ret < 0) {
+            scan->err = scan->results[idx].ret;
+            atomic_store(&pool->stop_idx, idx);
+        } else if (scan->check && scan->check(scan, idx)) {
+            atomic_store(&pool->stop_idx, idx);
+        } else {
+            pool->next_check++;
+        }
+    }
+#if HAVE_THREADS
+    if (pool->thread)
+        pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+static int eagle_probe_pool_init(EagleProbePool *pool, int nb_threads)
+{
+    int ret;
+
+    memset(pool, 0, sizeof(*pool));
+    if (!nb_threads)
+        nb_threads = av_cpu_count();
+
+#if HAVE_THREADS
+    if (nb_threads > 1) {
+        ret = avpriv_slicethread_create(&pool->thread, pool, eagle_probe_worker, NULL, nb_threads);
+        if (ret < 0) {
+            av_log(NULL, AV_LOG_WARNING, "Eagle: could not start %d probe threads, probing serially\n",
+                   nb_threads);
+            pool->thread = NULL;
+        } else {
+            nb_threads = ret;
+            if ((ret = pthread_mutex_init(&pool->lock, NULL))) {
+                avpriv_slicethread_free(&pool->thread);
+                return AVERROR(ret);
+            }
+        }
+    }
+#endif
+    if (!pool->thread)
+        nb_threads = 1;
+
+    pool->probes = av_mallocz_array(nb_threads, sizeof(*pool->probes));
+    if (!pool->probes)
+        return AVERROR(ENOMEM);
+    pool->nb_probes = nb_threads;
+    for (int i = 0; i < nb_threads; i++)
+        pool->probes[i].pool = pool;
+
+    return 0;
+}
+
+static void eagle_probe_pool_uninit(EagleProbePool *pool)
+{
+#if HAVE_THREADS
+    if (pool->thread) {
+        avpriv_slicethread_free(&pool->thread);
+        pthread_mutex_destroy(&pool->lock);
+    }
+#endif
+    for (int i = 0; i < pool->nb_probes; i++) {
+        EagleProbe *p = &pool->probes[i];
+        eagle_probe_close(p);
+        sws_freeContext(p->sws);
+        eagle_frame_queue_free(&p->filtered);
+        eagle_frame_queue_free(&p->scaled);
+        eagle_packet_queue_free(&p->packets);
+        eagle_frame_queue_free(&p->decoded);
+    }
+    av_freep(&pool->probes);
+}
+
+/* Run a scan to its stopping point; candidates after it are cancelled.
+ * Without a check() callback all candidates are probed. */
+static int eagle_probe_pool_scan(EagleProbePool *pool, EagleScan *scan)
+{
+    av_assert0(scan->nb_jobs > 0 && scan->nb_jobs <= FF_ARRAY_ELEMS(scan->results));
+
+    memset(scan->results, 0, sizeof(scan->results));
+    scan->err        = 0;
+    pool->scan       = scan;
+    pool->next_check = 0;
+    atomic_store(&pool->stop_idx, scan->nb_jobs);
+
+    if (pool->thread) {
+        avpriv_slicethread_execute(pool->thread, scan->nb_jobs, 0);
+    } else {
+        for (int i = 0; i < scan->nb_jobs && i <= atomic_load(&pool->stop_idx); i++)
+            eagle_probe_worker(pool, i, 0, scan->nb_jobs, 1);
+    }
+
+    scan->stop_idx = atomic_load(&pool->stop_idx);
+    return scan->err;
+}
+
+static int eagle_unsharp_run(EagleScan *scan, EagleProbe *p, int idx)
+{
+    int ret;
+
+    snprintf(p->filter.filter_descr, sizeof(p->filter.filter_descr),
+             "unsharp=luma_msize_x=5:luma_msize_y=5:luma_amount=%s", scan->unsharp_val[idx]);
+    ret = unsharp_decoded_yuv(&p->filter, scan->orig, scan->nb_frames, &p->filtered);
+    if (ret < 0)
+        return ret;
+    if (scan->ref == scan->orig)
+        return eagle_probe_run(scan, p, idx, &p->filtered, scan->crf);
+
+    ret = eagle_frame_queue_scale(&p->sws, &p->filtered, scan->nb_frames,
+                                  scan->width, scan->height, &p->scaled);
+    if (ret < 0)
+        return ret;
+    return eagle_probe_run(scan, p, idx, &p->scaled, scan->crf);
+}
+
+/* stop once sharpening starts to hurt the VMAF score */
+static int eagle_unsharp_check(EagleScan *scan, int idx)
+{
+    if (idx > 0 && scan->results[idx].vmaf_score < scan->results[idx - 1].vmaf_score) {
+        scan->vmaf_dropped = 1;
+        return 1;
+    }
+    return 0;
+}
+
+static int eagle_crf_run(EagleScan *scan, EagleProbe *p, int idx)
+{
+    return eagle_probe_run(scan, p, idx, scan->src, scan->crf + idx);
+}
+
+#define EAGLE_MAX_CRF 51
+
+typedef struct EagleSearch EagleSearch;
+
+/**
+ * A way of picking the next CRF to probe. next() is only called while the
+ * bracket still contains unprobed CRFs and must return one strictly inside it.
+ */
+typedef struct EagleSearchStrategy {
+    const char *name;
+    int (*next)(EagleSearch *s);
+    int prefetch;                   ///< probe ahead on idle workers
+} EagleSearchStrategy;
+
+/**
+ * Search [lo, hi] for the smallest CRF at which g() becomes non-negative,
+ * g() being assumed to increase with the CRF. A probe with tol_lo < g <
+ * tol_hi is accepted right away.
+ */
+struct EagleSearch {
+    const EagleSearchStrategy *strategy;
+    const char     *name;
+    EagleProbePool *pool;
+    EagleScan      *scan;
+    float (*g)(EagleSearch *s, int crf);
+    int   span;                     ///< g(crf) needs the probes of crf - span + 1 .. crf
+    float target;
+    int   lo, hi;
+    float tol_lo, tol_hi;
+
+    EagleProbeResult probes[EAGLE_MAX_CRF + 1];
+    int   below, above;             ///< g(below) < 0 <= g(above), lo - 1 and hi + 1 if unprobed
+    float g_below, g_above;
+    int   nb_evals;
+    int   last_crf, prev_crf;
+    float last_g, prev_g;
+    int   same_side;                ///< evaluations in a row that moved the same bracket end
+    int   last_side;                ///< -1 if the last evaluation moved below, 1 if above
+    int   nb_probes;
+
+    /* rate-quality model carried over from the previous GOP */
+    int   seed_crf;                 ///< -1 if none
+    float seed_slope;
+
+    int   total_probes, nb_searches;
+};
+
+static int eagle_search_bisect(EagleSearch *s)
+{
+    return (s->below + s->above) / 2;
+}
+
+/* slope of g between the last two evaluations, 0 if unknown */
+static float eagle_search_slope(const EagleSearch *s)
+{
+    if (s->nb_evals < 2 || s->last_crf == s->prev_crf)
+        return 0;
+    return (s->last_g - s->prev_g) / (s->last_crf - s->prev_crf);
+}
+
+/* Interpolate the zero of g inside a closed bracket or extrapolate from the
+ * last evaluation along slope; fall back to bisection when neither works or
+ * when one end of the bracket has stopped moving. */
+static int eagle_search_interpolate(EagleSearch *s, float slope)
+{
+    double crf;
+
+    if (s->same_side >= 2)
+        return eagle_search_bisect(s);
+    if (s->below >= s->lo && s->above <= s->hi)
+        crf = s->below - s->g_below * (s->above - s->below) / (s->g_above - s->g_below);
+    else if (s->nb_evals && slope > 0)
+        crf = s->last_crf - s->last_g / slope;
+    else
+        return eagle_search_bisect(s);
+
+    return av_clip(lrint(crf), s->below + 1, s->above - 1);
+}
+
+static int eagle_search_linear_next(EagleSearch *s)
+{
+    return s->below + 1;
+}
+
+static int eagle_search_secant_next(EagleSearch *s)
+{
+    return eagle_search_interpolate(s, eagle_search_slope(s));
+}
+
+static int eagle_search_model_next(EagleSearch *s)
+{
+    float slope = eagle_search_slope(s);
+
+    if (!s->nb_evals && s->seed_crf > s->below && s->seed_crf < s->above)
+        return s->seed_crf;
+    return eagle_search_interpolate(s, slope > 0 ? slope : s->seed_slope);
+}
+
+static const EagleSearchStrategy eagle_search_strategies[] = {
+    { "linear", eagle_search_linear_next, 1 },
+    { "bisect", eagle_search_bisect },
+    { "secant", eagle_search_secant_next },
+    { "model",  eagle_search_model_next },
+};
+
+static const EagleSearchStrategy *eagle_search_find(const char *name)
+{
+    for (int i = 0; i < FF_ARRAY_ELEMS(eagle_search_strategies); i++)
+        if (!strcmp(eagle_search_strategies[i].name, name))
+            return &eagle_search_strategies[i];
+    return NULL;
+}
+
+/* make sure the probes g(crf) depends on are available */
+static int eagle_search_probe(EagleSearch *s, int crf)
+{
+    EagleScan *scan = s->scan;
+    int first = crf - s->span + 1, last = crf;
+    int ret;
+
+    while (first <= last && s->probes[first].done)
+        first++;
+    if (first > last)
+        return 0;
+    if (s->strategy->prefetch)
+        while (last < s->hi && last - first + 1 < s->pool->nb_probes && !s->probes[last + 1].done)
+            last++;
+
+    scan->nb_jobs      = last - first + 1;
+    scan->run          = eagle_crf_run;
+    scan->check        = NULL;
+    scan->crf          = first;
+    scan->vmaf_threads = s->pool->nb_probes / scan->nb_jobs;
+    if ((ret = eagle_probe_pool_scan(s->pool, scan)) < 0)
+        return ret;
+
+    for (int i = 0; i < scan->nb_jobs; i++) {
+        s->probes[first + i]      = scan->results[i];
+        s->probes[first + i].done = 1;
+    }
+    s->nb_probes += scan->nb_jobs;
+    return 0;
+}
+
+static int eagle_search_run(EagleSearch *s, int *crf_out)
+{
+    int ret;
+
+    av_assert0(s->lo - s->span + 1 >= 0 && s->hi <= EAGLE_MAX_CRF);
+
+    memset(s->probes, 0, sizeof(s->probes));
+    s->below     = s->lo - 1;
+    s->above     = s->hi + 1;
+    s->nb_evals  = 0;
+    s->same_side = 0;
+    s->last_side = 0;
+    s->nb_probes = 0;
+    *crf_out     = -1;
+
+    while (s->above - s->below > 1) {
+        int crf = s->strategy->next(s);
+        float g;
+
+        av_assert0(crf > s->below && crf < s->above);
+        if ((ret = eagle_search_probe(s, crf)) < 0)
+            return ret;
+        g = s->g(s, crf);
+
+        s->prev_crf = s->last_crf;
+        s->prev_g   = s->last_g;
+        s->last_crf = crf;
+        s->last_g   = g;
+        s->nb_evals++;
+
+        if (g > s->tol_lo && g < s->tol_hi) {
+            *crf_out = crf;
+            break;
+        }
+        s->same_side = (g < 0) == (s->last_side < 0) ? s->same_side + 1 : 1;
+        s->last_side = g < 0 ? -1 : 1;
+        if (g < 0) {
+            s->below   = crf;
+            s->g_below = g;
+        } else {
+            s->above   = crf;
+            s->g_above = g;
+        }
+    }
+    if (*crf_out < 0)
+        *crf_out = s->above;
+
+    /* seed the next GOP with where this one ended and how steep g was */
+    if (*crf_out <= s->hi) {
+        s->seed_crf = *crf_out;
+        if (s->below >= s->lo && s->above <= s->hi && s->above > s->below)
+            s->seed_slope = (s->g_above - s->g_below) / (s->above - s->below);
+        else if (eagle_search_slope(s) > 0)
+            s->seed_slope = eagle_search_slope(s);
+    }
+
+    s->total_probes += s->nb_probes;
+    s->nb_searches++;
+    av_log(NULL, AV_LOG_INFO, "Eagle: gop %d %s search (%s): crf %d after %d evaluations, %d probes\n",
+           s->scan->gop, s->name, s->strategy->name, *crf_out, s->nb_evals, s->nb_probes);
+    return 0;
+}
+
+static void eagle_search_report(const EagleSearch *s)
+{
+    if (s->nb_searches)
+        av_log(NULL, AV_LOG_INFO, "Eagle: %s search (%s): %d probes over %d GOPs, %.1f per GOP\n",
+               s->name, s->strategy->name, s->total_probes, s->nb_searches,
+               (double)s->total_probes / s->nb_searches);
+}
+
+/* stage 1: the bitrate saved per VMAF point lost must fall under the target */
+static float eagle_stage1_g(EagleSearch *s, int crf)
+{
+    const EagleProbeResult *r = &s->probes[crf], *prev = r - 1;
+    float per_score = 600;
+
+    if (fabs(r->vmaf_score - prev->vmaf_score) > 1e-6)
+        per_score = (r->bitrate - prev->bitrate) / (r->vmaf_score - prev->vmaf_score);
+
+    av_log(NULL, AV_LOG_DEBUG, "Eagle: stage1_gop %d bitrate %f prev_bitrate %f vmaf_score %f prev_vmaf_score %f crf %d per_score %f\n",
+           s->scan->gop, r->bitrate, prev->bitrate, r->vmaf_score, prev->vmaf_score, crf, per_score);
+
+    return s->target - per_score;
+}
+
+/* stage 2: the VMAF score of the sharpened GOP must reach the target score */
+static float eagle_stage2_g(EagleSearch *s, int crf)
+{
+    av_log(NULL, AV_LOG_DEBUG, "Eagle: stage 2 vmaf_score %f crf %d target_score %f\n", s->probes[crf].vmaf_score, crf, s->target);
+    return s->target - s->probes[crf].vmaf_score;
+}
+
+/* A rendition of -eagle_ladder, whose CRF is searched like the one of stage 2
+ * on the GOP scaled to its size. */
+typedef struct EagleRung {
+    int   width, height;
+    float vmaf;                     ///< VMAF target, 0 for the one of stage 2
+    char  name[32];
+    EagleFrameQueue ref, src;       ///< source and sharpened GOP at the rung size
+    struct SwsContext *sws;
+    EagleSearch search;
+} EagleRung;
+
+static EagleRung eagle_rungs[EAGLE_MAX_RUNGS];
+static int eagle_nb_rungs;
+
+/* parse "WxH[:vmaf]|WxH[:vmaf]|..." into eagle_rungs */
+static int eagle_ladder_parse(const char *ladder)
+{
+    char *dup = av_strdup(ladder), *saveptr = NULL, *rung, *end;
+    int ret = 0;
+
+    if (!dup)
+        return AVERROR(ENOMEM);
+    eagle_nb_rungs = 0;
+    for (rung = av_strtok(dup, "|", &saveptr); rung; rung = av_strtok(NULL, "|", &saveptr)) {
+        EagleRung *r = &eagle_rungs[eagle_nb_rungs];
+        char *vmaf = strchr(rung, ':');
+
+        if (eagle_nb_rungs == EAGLE_MAX_RUNGS) {
+            av_log(NULL, AV_LOG_ERROR, "Eagle: more than %d rungs in the ladder\n", EAGLE_MAX_RUNGS);
+            ret = AVERROR(EINVAL);
+            break;
+        }
+        if (vmaf)
+            *vmaf++ = 0;
+        if (av_parse_video_size(&r->width, &r->height, rung) < 0 || (r->width | r->height) & 1) {
+            av_log(NULL, AV_LOG_ERROR, "Eagle: invalid rung size '%s'\n", rung);
+            ret = AVERROR(EINVAL);
+            break;
+        }
+        r->vmaf = vmaf ? strtod(vmaf, &end) : 0;
+        if (vmaf && (*end || r->vmaf < 0 || r->vmaf > 100)) {
+            av_log(NULL, AV_LOG_ERROR, "Eagle: invalid rung VMAF target '%s'\n", vmaf);
+            ret = AVERROR(EINVAL);
+            break;
+        }
+        snprintf(r->name, sizeof(r->name), "rung %dx%d", r->width, r->height);
+        eagle_nb_rungs++;
+    }
+    av_free(dup);
+    return ret;
+}
+
+static void eagle_ladder_init(const EagleSearch *stage2)
+{
+    for (int i = 0; i < eagle_nb_rungs; i++) {
+        eagle_rungs[i].search      = *stage2;
+        eagle_rungs[i].search.name = eagle_rungs[i].name;
+    }
+}
+
+static void eagle_ladder_uninit(void)
+{
+    for (int i = 0; i < eagle_nb_rungs; i++) {
+        EagleRung *r = &eagle_rungs[i];
+
+        eagle_search_report(&r->search);
+        eagle_frame_queue_free(&r->ref);
+        eagle_frame_queue_free(&r->src);
+        sws_freeContext(r->sws);
+        r->sws = NULL;
+    }
+}
+
+static int eagle_rung_scale_run(EagleScan *scan, EagleProbe *p, int idx)
+{
+    EagleRung *r = &scan->rungs[idx];
+    int ret;
+
+    ret = eagle_frame_queue_scale(&r->sws, scan->orig, DECODE_FRAME_NUM_PER_GOP,
+                                  r->width, r->height, &r->ref);
+    if (ret < 0)
+        return ret;
+    return eagle_frame_queue_scale(&r->sws, scan->src, DECODE_FRAME_NUM_PER_GOP,
+                                   r->width, r->height, &r->src);
+}
+
+/* Search the CRF of every rung for the GOP in orig, sharpened into
+ * sharpened. The rungs are scaled in parallel, then searched one after the
+ * other, each search spreading its probes over the pool. scan holds the
+ * stage 2 settings and is restored afterwards. */
+static int eagle_ladder_search(EagleProbePool *pool, EagleScan *scan, const EagleFrameQueue *orig,
+                               const EagleFrameQueue *sharpened, EagleGopInfo *info)
+{
+    const EagleFrameQueue *ref = scan->ref, *src = scan->src;
+    int width = scan->width, height = scan->height;
+    EagleScan *scale;
+    int ret;
+
+    if (!(scale = av_mallocz(sizeof(*scale))))
+        return AVERROR(ENOMEM);
+    scale->nb_jobs = eagle_nb_rungs;
+    scale->run     = eagle_rung_scale_run;
+    scale->orig    = orig;
+    scale->src     = sharpened;
+    scale->rungs   = eagle_rungs;
+    ret = eagle_probe_pool_scan(pool, scale);
+    av_free(scale);
+    if (ret < 0)
+        return ret;
 
-	while (ret >= 0) {
-		ret = avcodec_receive_packet(pcodecCtx, ppkt);
-		if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-			break;
-		} else if (ret < 0) {
-			fprintf(stderr, "Eagle: error during encoding\n");
-			exit(1);
-		}
+    for (int i = 0; i < eagle_nb_rungs && ret >= 0; i++) {
+        EagleRung *r = &eagle_rungs[i];
+        int crf;
 
-		//FILE *fp = fopen("./encode264_filtered.264", "ab");
-		//fwrite(ppkt->data, 1, ppkt->size, fp);
-		//fclose(fp);
+        scan->ref         = &r->ref;
+        scan->src         = &r->src;
+        scan->width       = r->width;
+        scan->height      = r->height;
+        r->search.target  = r->vmaf > 0 ? r->vmaf : info->target_score;
+        if ((ret = eagle_search_run(&r->search, &crf)) >= 0)
+            info->rung_crf[i] = FFMIN(crf, r->search.hi) + 1;
+    }
 
-		memcpy(pmeminfo->pEncodeVideoBuffer2 + saved_data_size_filtered, ppkt->data, ppkt->size);
-		saved_data_size_filtered += ppkt->size;
-		enc_pkt_size_filtered[enc_frame_num++] = ppkt->size;
+    scan->ref    = ref;
+    scan->src    = src;
+    scan->width  = width;
+    scan->height = height;
+    return ret;
+}
 
-		av_packet_unref(ppkt);
-	}
-	//fprintf(stderr, "flush success filtered yuv to 264\n");
+/* Full-fidelity rerun of the CRF searches, to see what the downscaled or
+ * subsampled probes cost in accuracy. */
+typedef struct EagleCalibration {
+    EagleSearch stage1, stage2;
+    EagleScan   scan;
+    int         nb_gops;
+    int         nb_exact;           ///< GOPs where both picked the same CRF
+    int         sum_diff, max_diff; ///< absolute CRF differences
+    int64_t     fast_time, full_time;
+} EagleCalibration;
+
+static void eagle_calibration_init(EagleCalibration *c, const EagleSearch *stage1,
+                                   const EagleSearch *stage2)
+{
+    memset(c, 0, sizeof(*c));
+    c->stage1        = *stage1;
+    c->stage1.name   = "stage1 full-fidelity";
+    c->stage1.scan   = &c->scan;
+    c->stage2        = *stage2;
+    c->stage2.name   = "stage2 full-fidelity";
+    c->stage2.scan   = &c->scan;
+}
 
-	//uninit the encoder
-	enc_frame_num = 0;
-	av_packet_free(&ppkt);
-	av_frame_free(&pframe);
-	avcodec_close(pcodecCtx);
-	avcodec_free_context(&pcodecCtx);
+/* Search the CRF of a GOP again on the full resolution frames, scoring every
+ * frame, and compare it with fast_crf found in fast_time. */
+static int eagle_calibrate_gop(EagleCalibration *c, const EagleScan *fast,
+                               const EagleFrameQueue *ref, const EagleFrameQueue *src,
+                               int fast_crf, int64_t fast_time)
+{
+    EagleScan *scan = &c->scan;
+    int64_t start = av_gettime_relative();
+    int stage1_crf, stage2_crf, crf, diff, ret;
+
+    *scan = *fast;
+    scan->orig           = ref;
+    scan->ref            = ref;
+    scan->src            = src;
+    scan->width          = ref->frames[0]->width;
+    scan->height         = ref->frames[0]->height;
+    scan->n_subsample    = 1;
+    scan->nb_frames      = DECODE_FRAME_NUM_PER_GOP - 1;
+    scan->nb_vmaf_frames = VMAF_FRAME_NUM_PER_GOP;
+    if ((ret = eagle_search_run(&c->stage1, &stage1_crf)) < 0)
+        return ret;
 
-	return 0;
+    c->stage2.target = 0;
+    if (stage1_crf <= c->stage1.hi)
+        c->stage2.target = av_clipf(c->stage1.probes[stage1_crf].vmaf_score, 90.0, 96.0);
+    scan->nb_frames      = FILTERED_FRAME_NUM_PER_GOP - 4;
+    scan->nb_vmaf_frames = VMAF_FILTERED_FRAME_NUM_PER_GOP;
+    if ((ret = eagle_search_run(&c->stage2, &stage2_crf)) < 0)
+        return ret;
+    crf = FFMIN(stage2_crf, c->stage2.hi) + 1;
+
+    diff = abs(crf - fast_crf);
+    c->nb_gops++;
+    c->nb_exact  += !diff;
+    c->sum_diff  += diff;
+    c->max_diff   = FFMAX(c->max_diff, diff);
+    c->fast_time += fast_time;
+    c->full_time += av_gettime_relative() - start;
+
+    av_log(NULL, AV_LOG_INFO, "Eagle: gop %d calibration: crf %d at %dx%d, %d at full fidelity "
+           "(target %.2f)\n", fast->gop, fast_crf, fast->width, fast->height, crf, c->stage2.target);
+    return 0;
 }
 
-static int decode_filtered_encoded_h264_rawdata(MemInfo *pmeminfo, DecodeInfo *pdecinfo)
+static void eagle_calibration_report(const EagleCalibration *c)
 {
-	int len = 0, frame_count = 0;
-	uint8_t *pDataPtr = NULL;
-	size_t uDataSize;
-	FILE *fp = NULL;//fopen("dec_filtered_enc.yuv", "wb");
-	AVCodecParserContext * pcodecparsctx = NULL;
-	AVFrame *pframe = NULL;
-	AVPacket pkt;
-	uint8_t *inbuf = (uint8_t *)malloc(INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
-	memset(inbuf, 0, INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE);
-	av_init_packet(&pkt);
-	AVCodec *pcodec = avcodec_find_decoder(AV_CODEC_ID_H264);
-	if (!pcodec) {
-		fprintf(stderr, "cannot find the decoder in the filtered encode part\n");
-		exit(1);
-	}
+    if (!c->nb_gops)
+        return;
+    av_log(NULL, AV_LOG_INFO, "Eagle: calibration over %d GOPs: same crf in %d, mean difference "
+           "%.2f, max %d; the fast probes took %.1f%% of the full-fidelity time\n",
+           c->nb_gops, c->nb_exact, (double)c->sum_diff / c->nb_gops, c->max_diff,
+           c->full_time ? 100.0 * c->fast_time / c->full_time : 0.0);
+}
 
-	AVCodecContext *pcodecctx = avcodec_alloc_context3(pcodec);
-	if (!pcodecctx) {
-		fprintf(stderr, "could not allocate video codec context in the filtered encode part\n");
-		exit(1);
-	}
+#define EAGLE_CACHE_MAGIC "eagle-cache 1"
 
-	if (pcodec->capabilities & AV_CODEC_CAP_TRUNCATED) {
-		pcodecctx->flags |= AV_CODEC_FLAG_TRUNCATED;
-	}
-	
-	pcodecparsctx = av_parser_init(AV_CODEC_ID_H264);
-	if (!pcodecparsctx) {
-		fprintf(stderr, "Error: alloc parser fail\n");
-		exit(1);
-	}
-	
-	//open the decoder
-	if (avcodec_open2(pcodecctx, pcodec, NULL) < 0) {
-		fprintf(stderr, "could not open the decoder\n");
-		exit(1);
-	}
-	
-	//open frame structure
-	pframe = av_frame_alloc();
-	if (!pframe) {
-		fprintf(stderr, "could not allocate video frame\n");
-		exit(1);
-	}
+/**
+ * On-disk cache of the per-GOP analysis results. A GOP is keyed by a hash of
+ * the analysis settings and of the video packets it was decoded from, so
+ * unchanged GOPs of a re-encoded input are reused even if others changed.
+ * The file is a header line followed by one line per GOP:
+ * "key nb_frames target_score crf aq_strength unsharp".
+ */
+typedef struct EagleCache {
+    AVDictionary      *entries;     ///< key -> results, loaded from the file
+    FILE              *file;        ///< new entries are appended here
+    struct AVMurMur3  *hash;        ///< hash of the GOP being read, NULL without a cache
+    const char        *settings;
+    int                nb_hits, nb_misses;
+} EagleCache;
+
+static int eagle_cache_load(EagleCache *c, const char *path)
+{
+    char line[256], key[33];
+    EagleGopInfo gop;
+    int nb_invalid = 0, ret;
+    FILE *f = fopen(path, "r");
 
-	frame_count = 0;
+    if (!f)
+        return 0;
+    if (!fgets(line, sizeof(line), f) || strcmp(line, EAGLE_CACHE_MAGIC "\n")) {
+        av_log(NULL, AV_LOG_WARNING, "Eagle: %s is not an analysis cache, overwriting it\n", path);
+        fclose(f);
+        return AVERROR_INVALIDDATA;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%32[0-9a-f] %d %f %f %f %f", key, &gop.nb_frames, &gop.target_score,
+                   &gop.crf, &gop.aq_strength, &gop.unsharp) != 6 || strlen(key) != 32 ||
+            gop.nb_frames <= 0 || gop.crf < 0 || gop.crf > EAGLE_MAX_CRF + 1) {
+            nb_invalid++;
+            continue;
+        }
+        if ((ret = av_dict_set(&c->entries, key, line + 33, 0)) < 0) {
+            fclose(f);
+            return ret;
+        }
+    }
+    fclose(f);
 
-	memcpy(inbuf, pmeminfo->pEncodeVideoBuffer2, saved_data_size_filtered);
-	pDataPtr  = inbuf;
-	uDataSize = saved_data_size_filtered;
-	while (uDataSize > 0) {
-		len = av_parser_parse2(pcodecparsctx, pcodecctx, &(pkt.data), &(pkt.size),
-							pDataPtr, uDataSize, AV_NOPTS_VALUE, AV_NOPTS_VALUE, AV_NOPTS_VALUE);
-		uDataSize -= len;
-		pDataPtr  += len;
+    if (nb_invalid)
+        av_log(NULL, AV_LOG_WARNING, "Eagle: skipped %d invalid entries of %s\n", nb_invalid, path);
+    av_log(NULL, AV_LOG_INFO, "Eagle: loaded %d GOPs from %s\n", av_dict_count(c->entries), path);
+    return 0;
+}
 
-		if (pkt.size == 0) {
-			continue;
-		}
+static int eagle_cache_open(EagleCache *c, const char *path, const char *settings)
+{
+    int ret = eagle_cache_load(c, path);
 
-		if (decode_write_frame(fp, pcodecctx, pframe, &frame_count, &pkt, 0, pmeminfo, 1, pdecinfo) < 0) {
-			exit(1);
-		}
-	}
+    if (ret < 0 && ret != AVERROR_INVALIDDATA)
+        return ret;
+    c->file = fopen(path, ret < 0 ? "w" : "a");
+    if (!c->file) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "Eagle: could not open %s: %s\n", path, av_err2str(ret));
+        return ret;
+    }
+    fseek(c->file, 0, SEEK_END);
+    if (!ftell(c->file))
+        fprintf(c->file, EAGLE_CACHE_MAGIC "\n");
 
-	//decode the data in the decoder itself
-	pkt.size = 0;
-	pkt.data = NULL;
-	decode_write_frame(fp, pcodecctx, pframe, &frame_count, &pkt, 0, pmeminfo, 1, pdecinfo);
-
-	//uninit the decoder
-	if (fp)
-		fclose(fp);
-	av_frame_free(&pframe);
-	avcodec_close(pcodecctx);
-	av_parser_close(pcodecparsctx);
-	avcodec_free_context(&pcodecctx);
-	free(inbuf);
-	inbuf = NULL;	
-	
-	return 0;
+    if (!(c->hash = av_murmur3_alloc()))
+        return AVERROR(ENOMEM);
+    c->settings = settings;
+    return 0;
 }
 
-static float get_unsharp(float pixel_unsharpness)
+static void eagle_cache_close(EagleCache *c)
 {
-	float unsharp_factor;
-	if (pixel_unsharpness <= 0.1)
-		pixel_unsharpness = 0.1;
-	else if (pixel_unsharpness >= 0.8)
-		pixel_unsharpness = 0.8;
-
-	unsharp_factor = (((0.8 - pixel_unsharpness) / 0.7) * ((0.8 - pixel_unsharpness) / 0.7)) * 6;
+    if (c->hash)
+        av_log(NULL, AV_LOG_INFO, "Eagle: analysis cache: reused %d of %d GOPs\n",
+               c->nb_hits, c->nb_hits + c->nb_misses);
+    if (c->file)
+        fclose(c->file);
+    av_dict_free(&c->entries);
+    av_freep(&c->hash);
+}
 
-	if (unsharp_factor <= 1.0)
-		unsharp_factor = 1.0;
+static void eagle_cache_start_gop(EagleCache *c)
+{
+    if (!c->hash)
+        return;
+    av_murmur3_init(c->hash);
+    av_murmur3_update(c->hash, (const uint8_t *)c->settings, strlen(c->settings));
+}
 
-	return unsharp_factor * pixel_unsharpness;
+static void eagle_cache_add_packet(EagleCache *c, const AVPacket *pkt)
+{
+    if (c->hash)
+        av_murmur3_update(c->hash, pkt->data, pkt->size);
 }
 
-static float get_aq_strength(float pixel_unsharpness)
+/* Finish the key of the GOP just read and fill info from the cache. Returns
+ * 1 if the GOP was found with the same number of frames. */
+static int eagle_cache_lookup(EagleCache *c, char key[33], EagleGopInfo *info)
 {
-	float aq_float = 0.0;
-	if (pixel_unsharpness <= 0.1)
-		pixel_unsharpness = 0.1;
-	else if (pixel_unsharpness >= 0.8)
-		pixel_unsharpness = 0.8;
+    uint8_t hash[16];
+    AVDictionaryEntry *e;
+    EagleGopInfo gop = { 0 };
+    int pos, n;
 
-	aq_float = (float)(0.5 + (0.8 - pixel_unsharpness) / 0.7);
-	if (aq_float < 1.0)
-		aq_float = 1.0;
+    if (!c->hash)
+        return 0;
+    av_murmur3_final(c->hash, hash);
+    for (int i = 0; i < sizeof(hash); i++)
+        snprintf(key + 2 * i, 3, "%02x", hash[i]);
+
+    e = av_dict_get(c->entries, key, NULL, 0);
+    if (e && sscanf(e->value, "%d %f %f %f %f%n", &gop.nb_frames, &gop.target_score,
+                    &gop.crf, &gop.aq_strength, &gop.unsharp, &pos) == 5 &&
+        gop.nb_frames == info->nb_frames) {
+        /* the ladder is part of the settings, so every rung is there */
+        for (int i = 0; i < eagle_nb_rungs; i++) {
+            if (sscanf(e->value + pos, "%f%n", &gop.rung_crf[i], &n) != 1)
+                goto miss;
+            pos += n;
+        }
+        /* the boundary and shared frames of the GOP are the ones just decoded */
+        info->target_score = gop.target_score;
+        info->crf          = gop.crf;
+        info->aq_strength  = gop.aq_strength;
+        info->unsharp      = gop.unsharp;
+        memcpy(info->rung_crf, gop.rung_crf, sizeof(info->rung_crf));
+        c->nb_hits++;
+        return 1;
+    }
+miss:
+    c->nb_misses++;
+    return 0;
+}
 
-	return aq_float;
+static void eagle_cache_store(EagleCache *c, const char *key, const EagleGopInfo *info)
+{
+    if (!c->file)
+        return;
+    fprintf(c->file, "%s %d %.9g %.9g %.9g %.9g", key, info->nb_frames, info->target_score,
+            info->crf, info->aq_strength, info->unsharp);
+    for (int i = 0; i < eagle_nb_rungs; i++)
+        fprintf(c->file, " %.9g", info->rung_crf[i]);
+    fprintf(c->file, "\n");
+    fflush(c->file);
 }
 
 //decode the mp4 format h264 codec to yuv,
@@ -6590,61 +7637,43 @@ static int EaglePreProcess(char *filename)
 	int fps = 0;
 	int org_bitrate = 0;
 	int end_of_file = 0;
-	const char *fmt = "yuv420p";
-	char *log_file = "./log_test.txt";
-	char *log_file_2 = "./log_test_2.txt";
-	int vmaf_width, vmaf_height;
 	char *model_path = "/usr/local/share/model/vmaf_v0.6.1.pkl";
-	const char *pool_method = NULL;
-	int frame_num = 0;
     int ret = -1;
-	double vmaf_score = 0.0;
-	float stage2_score_in = 0.0;
-	float stage2_score_diff = 0.0;
-	float stage2_crf_step = 1.0;
-	float stage2_bitrate_in = 0.0;
-	float stage2_step_vmaf = 0.0;
-	float stage2_vmaf_diff = 0.0;
-	float stage2_step_vmaf_res = 0.0;
-	float stage2_best_bitrate = 1000000;
-	float stage2_best_vmaf_diff = 100;
-	float stage2_best_vmaf = 0;
 	float stage2_target_vmaf_score = 0.0;
-	int   stage2_best_crf  = 0;
-	int   stage2_early_stop = 0;
-	int   stage2_loop_count = 0;
-	int   stage2_resolution_num = 1;
-	int   stage2_first_flag = 1;
-	int   stage2_last_crf = 18;
-	int   stage2_start_crf = 18;
-	struct newData *s = NULL;
-	int disable_clip = 0, disable_avx = 0, enable_transform = 0, phone_model = 0;
-	int do_psnr = 0, do_ssim = 0, do_ms_ssim = 0, n_thread = 1, n_subsample = 1, enable_conf_interval = 0; 
-    int video_stream_idx = -1, audio_stream_idx = -1;
-
-	struct timeval before_crf5_part,  after_crf5_part  = {0};
-	long long crf5_time_val = 0;
+	EagleGopInfo *gop_info;
+
 	struct timeval before_loop1_part, after_loop1_part = {0};
 	long long loop1_time_val = 0;
 	struct timeval before_loop2_part, after_loop2_part = {0};
 	long long loop2_time_val;
 
 	//crf & bitrate & target_score
-	float stage1_prev_bitrate = 0.0, stage1_bitrate = 0.0;
-	float stage2_prev_bitrate = 0.0, stage2_bitrate = 0.0;
-	float stage1_vmaf_score = 0.0, stage1_prev_vmaf_score = 0.0;
-	float stage2_vmaf_score = 0.0, stage2_prev_vmaf_score = 0.0;
-	float stage1_per_score = 0.0, stage2_per_score = 0.0;
+	float stage1_vmaf_score = 0.0;
 	int stage1_crf = 0, stage2_crf = 0;
 	float target_per_score = 400;
-	static int stage1_first_flag = 1;
 
-	//to determin the unsharp value
-	float pre_vmaf_score = 0.0;
-	int has_checked = 0;
-	
-	char *unsharp_val[10] = {"0.0", "0.1", "0.2", "0.3", "0.4", "0.5", "0.6", "0.7", "0.8", "0.9"};
+	const char *unsharp_val[10] = {"0.0", "0.1", "0.2", "0.3", "0.4", "0.5", "0.6", "0.7", "0.8", "0.9"};
 	float unsharp[10]     = {0.0, 0.1, 0.2, 0.3, 0.4, 0.5, 0.6, 0.7, 0.8, 0.9};
+	float unsharp_cap;
+	EagleProbePool probe_pool;
+	EagleScan scan = { 0 };
+	EagleSearch stage1_search = { 0 }, stage2_search = { 0 };
+	//the decoded source gop and its sharpened version
+	EagleFrameQueue gop_frames = { 0 };
+	EagleFrameQueue sharpened  = { 0 };
+	//the same frames at the probe resolution, if it is lower
+	EagleFrameQueue gop_frames_probe = { 0 };
+	EagleFrameQueue sharpened_probe  = { 0 };
+	struct SwsContext *probe_sws = NULL;
+	EagleCalibration calibration;
+	int64_t stages_start;
+	EagleCache cache = { 0 };
+	char cache_settings[1024], cache_key[33] = "";
+
+	long long sharpness = 0;
+	long long total_sharpness = 0;
+	double scene_score = 0;
+	EagleMeter meter = { 0 };
 
     DecodeInfo *pdecinfo = (DecodeInfo *)malloc(sizeof(DecodeInfo));
 	if (pdecinfo != NULL) {
@@ -6660,27 +7689,11 @@ static int EaglePreProcess(char *filename)
 		memset(pdec264fmtinfo, 0, sizeof(DecEncH264FmtInfo));
 	}
 
-	UnsharpFilterInfo *pfilterinfo = (UnsharpFilterInfo *)malloc(sizeof(UnsharpFilterInfo));
-	if (pfilterinfo != NULL) {
-		memset(pfilterinfo, 0, sizeof(UnsharpFilterInfo));
-	}
-
 	UnsharpFilterInfo *pfilterinfoOne = (UnsharpFilterInfo *)malloc(sizeof(UnsharpFilterInfo));
 	if (pfilterinfoOne!= NULL) {
 		memset(pfilterinfoOne, 0, sizeof(UnsharpFilterInfo));
 	}
 
-	MemInfo *pmeminfo = (MemInfo *)malloc(sizeof(MemInfo));
-	memset(pmeminfo, 0, sizeof(MemInfo));
-
-	//filter part
-	unsigned char *frame_buffer_in  = NULL;
-	unsigned char *frame_buffer_out = NULL;
-	int frameWidth, frameHeight = 0;
-	int filtered_frame_num = 0;
-	long long sharpness = 0;
-	long long total_sharpness = 0;
-
 	pdec264fmtinfo->outputfp = NULL;//(FILE *)fopen("./end.yuv", "wb");
 	if (pdec264fmtinfo->outputfp == NULL) {
 		//printf("open end yuv fail\n");
@@ -6695,30 +7708,6 @@ static int EaglePreProcess(char *filename)
 	//strcpy(pfilterinfo->filter_descr, "unsharp=luma_msize_x=5:luma_msize_y=5:luma_amount=0.9");
 	strcat(pfilterinfoOne->filter_descr, "unsharp=luma_msize_x=5:luma_msize_y=5:luma_amount=");
 
-	//allocate meminfo
-	pmeminfo->pVideoBuffer 			= (uint8_t *)malloc(FHD_BUFFER_SIZE);
-	pmeminfo->pVideoBufferCrf5      = (uint8_t *)malloc(FHD_BUFFER_SIZE);
-	
-	pmeminfo->pVideoBuffer1         = (uint8_t *)malloc(FHD_BUFFER_SIZE);
-	pmeminfo->pEncodeVideoBuffer 	= (uint8_t *)malloc(1024*1024*10);
-	pmeminfo->pDecodeVideoBuffer 	= (uint8_t *)malloc(FHD_BUFFER_SIZE);
-	
-	pmeminfo->pVideoBuffer2			= (uint8_t *)malloc(FHD_BUFFER_SIZE / 5);
-	pmeminfo->pEncodeVideoBuffer2 	= (uint8_t *)malloc(1024*1024*10);
-	pmeminfo->pDecodeVideoBuffer2 	= (uint8_t *)malloc(FHD_BUFFER_SIZE / 5);
-
-	printf("pVideoBuffer2 %p pEncodeVideoBuffer2 %p pDecodeVideoBuffer2 %p\n",
-		pmeminfo->pVideoBuffer2, pmeminfo->pEncodeVideoBuffer2, pmeminfo->pDecodeVideoBuffer2);
-
-	memset(pmeminfo->pVideoBuffer, 		 	0, FHD_BUFFER_SIZE);
-	memset(pmeminfo->pVideoBufferCrf5,      0, FHD_BUFFER_SIZE);
-	memset(pmeminfo->pVideoBuffer1,         0, FHD_BUFFER_SIZE);
-	memset(pmeminfo->pEncodeVideoBuffer, 	0, 1024*1024*10);
-	memset(pmeminfo->pDecodeVideoBuffer, 	0, FHD_BUFFER_SIZE);
-	memset(pmeminfo->pVideoBuffer2, 		0, FHD_BUFFER_SIZE / 5);
-	memset(pmeminfo->pEncodeVideoBuffer2, 	0, 1024*1024*10);
-	memset(pmeminfo->pDecodeVideoBuffer2, 	0, FHD_BUFFER_SIZE / 5);
-
     InputStreamInfo *p_input_stream_info = (InputStreamInfo *)malloc(sizeof(InputStreamInfo));
 	InputStreamInfo *p_temp_input_stream_info = (InputStreamInfo *)malloc(sizeof(InputStreamInfo));
     if (!p_input_stream_info) {
@@ -6758,9 +7747,55 @@ static int EaglePreProcess(char *filename)
         return ret;
     }
 
+    if ((ret = eagle_probe_pool_init(&probe_pool, eagle_threads)) < 0) {
+        fprintf(stderr, "Eagle: probe pool init fail\n");
+        return ret;
+    }
+    av_log(NULL, AV_LOG_INFO, "Eagle: running %d probes in parallel\n", probe_pool.nb_probes);
+
+	stage1_search.strategy = eagle_search_find(eagle_search ? eagle_search : "model");
+	if (!stage1_search.strategy) {
+		av_log(NULL, AV_LOG_ERROR, "Eagle: unknown search strategy '%s'\n", eagle_search);
+		return AVERROR(EINVAL);
+	}
+	//stage 1 looks for the knee of the rate-quality curve, crf 18 only serves as its left neighbour
+	stage1_search.name     = "stage1";
+	stage1_search.pool     = &probe_pool;
+	stage1_search.scan     = &scan;
+	stage1_search.g        = eagle_stage1_g;
+	stage1_search.span     = 2;
+	stage1_search.target   = target_per_score;
+	stage1_search.lo       = 19;
+	stage1_search.hi       = 50;
+	stage1_search.seed_crf = -1;
+	//stage 2 looks for the crf whose vmaf score is within (-1, 0.2) of the stage 1 target
+	stage2_search          = stage1_search;
+	stage2_search.name     = "stage2";
+	stage2_search.g        = eagle_stage2_g;
+	stage2_search.span     = 1;
+	stage2_search.lo       = 18;
+	stage2_search.hi       = 39;
+	stage2_search.tol_lo   = -0.2;
+	stage2_search.tol_hi   = 1.0;
+	eagle_calibration_init(&calibration, &stage1_search, &stage2_search);
+	//every rung of the ladder searches like stage 2, with its own seed
+	eagle_ladder_init(&stage2_search);
+
+	//everything that changes the results of a gop besides its packets
+	if (eagle_cache) {
+		snprintf(cache_settings, sizeof(cache_settings),
+				 "%s %s search=%s probe_height=%d vmaf_subsample=%d model=%s ladder=%s",
+				 eagle_encoder->name, eagle_encoder->options, stage1_search.strategy->name, eagle_probe_height, eagle_vmaf_subsample, model_path,
+				 eagle_ladder ? eagle_ladder : "");
+		if ((ret = eagle_cache_open(&cache, eagle_cache, cache_settings)) < 0)
+			return ret;
+	}
+	eagle_cache_start_gop(&cache);
+
 	while (av_read_frame(p_input_stream_info->p_fmt_ctx, p_input_stream_info->p_pkt) >= 0) {
 		do {
 			if (p_input_stream_info->p_pkt->stream_index == p_input_stream_info->video_stream_idx) {
+				eagle_cache_add_packet(&cache, p_input_stream_info->p_pkt);
 				ret = avcodec_send_packet(p_input_stream_info->p_video_codecctx, p_input_stream_info->p_pkt);
 				if (ret != 0) {
 					fprintf(stderr, "ret %x AVERROR(EAGAIN) %x AVERROR_EOF %x AVERROR(EINVAL) %x AVERROR(ENOMEM) %x\n", 
@@ -6782,17 +7817,29 @@ static int EaglePreProcess(char *filename)
 						break;
 					}
 
-					if (p_input_stream_info->p_frame->pict_type == AV_PICTURE_TYPE_I &&
-						pdecinfo->dec_frame_num >= MIN_NUM_OF_PER_GOP) {
+					if (p_input_stream_info->p_frame->format != AV_PIX_FMT_YUV420P) {
+						fprintf(stderr, "Eagle: only yuv420p input is supported\n");
+						return AVERROR_PATCHWELCOME;
+					}
+					if ((ret = eagle_meter_measure(&meter, p_input_stream_info->p_frame, &sharpness, &scene_score)) < 0)
+						return ret;
+
+					//a gop ends at the first scene cut once it is long enough, or when it gets too long
+					if ((pdecinfo->dec_frame_num >= eagle_min_gop && scene_score >= eagle_scene_threshold) ||
+						pdecinfo->dec_frame_num >= eagle_max_gop) {
 						pixel_sharpness_val = (float)((float)total_sharpness / pdecinfo->dec_frame_num)/(float)(p_input_stream_info->p_frame->width)/(float)(p_input_stream_info->p_frame->height);
-						global_frames_of_gop_array[global_decode_gop_num] = pdecinfo->dec_frame_num;
-						global_aq_strength_array[global_decode_gop_num]   = get_aq_strength(pixel_sharpness_val);
-						global_unsharp_array[global_decode_gop_num]     = get_unsharp(pixel_sharpness_val);
-						printf("gop %d dec_frame_num %lld total_sharpness %lld avg_unsharp %lld pixel_sharpness_val %f unsharp_value %f aq_strength %f\n", 
+						if (!(gop_info = eagle_gop_info(&eagle_gop_queue, global_decode_gop_num)))
+							return AVERROR(ENOMEM);
+						gop_info->nb_frames   = pdecinfo->dec_frame_num;
+						gop_info->aq_strength = get_aq_strength(pixel_sharpness_val);
+						gop_info->unsharp     = get_unsharp(pixel_sharpness_val);
+						av_log(NULL, AV_LOG_VERBOSE, "Eagle: gop %d dec_frame_num %lld total_sharpness %lld avg_unsharp %lld pixel_sharpness_val %f unsharp_value %f aq_strength %f next scene_score %f\n", 
 							global_decode_gop_num,
 							pdecinfo->dec_frame_num, total_sharpness, total_sharpness / pdecinfo->dec_frame_num,  
-							pixel_sharpness_val, global_unsharp_array[global_decode_gop_num],
-							global_aq_strength_array[global_decode_gop_num]);
+							pixel_sharpness_val, gop_info->unsharp, gop_info->aq_strength, scene_score);
+						if ((ret = eagle_share_end_gop(&eagle_gop_queue, global_decode_gop_num,
+													   p_input_stream_info->p_frame)) < 0)
+							return ret;
 						total_sharpness         = 0;
 						pdecinfo->dec_frame_num = 0;
 						p_input_stream_info->p_pkt->data += p_input_stream_info->p_pkt->size;
@@ -6803,20 +7850,17 @@ static int EaglePreProcess(char *filename)
 					}
 
 DECODE_ORG_BITS:
-					av_image_copy(pdecinfo->video_dst_data, pdecinfo->video_dst_linesize,
-								  (const uint8_t *)(p_input_stream_info->p_frame->data),
-								  p_input_stream_info->p_frame->linesize,
-								  pdecinfo->pix_fmt, pdecinfo->width, pdecinfo->height);
-					sharpness = get_unsharp_val(pdecinfo->video_dst_data[0],
-									pdecinfo->width, pdecinfo->height, 1.0, 5, 5);
 					//printf("frame_num %d sharpness %d\n", pdecinfo->dec_frame_num, sharpness);
 					total_sharpness += sharpness;
 
-					if (pdecinfo->dec_frame_num <= DECODE_FRAME_NUM_PER_GOP) {
-						memcpy(pmeminfo->pVideoBuffer + pdecinfo->dec_frame_num * pdecinfo->width * pdecinfo->height * 3 / 2,
-								pdecinfo->video_dst_data[0], pdecinfo->width * pdecinfo->height * 3 / 2);
-						//fwrite(pdecinfo->video_dst_data[0], 1, pdecinfo->video_dst_bufsize, inputpar.video_dst_file);
-					}
+					//keep a reference to the first frames of the gop for the analysis
+					if (gop_frames.nb_frames < DECODE_FRAME_NUM_PER_GOP &&
+						(ret = eagle_frame_queue_push(&gop_frames, p_input_stream_info->p_frame)) < 0)
+						return ret;
+					//and to all of them if the transcode takes its frames from here
+					if (eagle_share_decode &&
+						(ret = eagle_share_frame(&eagle_gop_queue, global_decode_gop_num, p_input_stream_info->p_frame)) < 0)
+						return ret;
 
 					pdecinfo->dec_frame_num++;
 					break;
@@ -6858,12 +7902,8 @@ DECODE_ORG_BITS:
 				break;
 			}
 
-			av_image_copy(pdecinfo->video_dst_data, pdecinfo->video_dst_linesize,
-						  (const uint8_t *)(p_input_stream_info->p_frame->data),
-						  p_input_stream_info->p_frame->linesize,
-						  pdecinfo->pix_fmt, pdecinfo->width, pdecinfo->height);
-			sharpness = get_unsharp_val(pdecinfo->video_dst_data[0],
-							pdecinfo->width, pdecinfo->height, 1.0, 5, 5);
+			if ((ret = eagle_meter_measure(&meter, p_input_stream_info->p_frame, &sharpness, &scene_score)) < 0)
+				return ret;
 			printf("frame_num %d sharpness %d\n", pdecinfo->dec_frame_num, sharpness);
 			total_sharpness += sharpness;
 
@@ -6875,9 +7915,13 @@ DECODE_ORG_BITS:
 		pixel_sharpness_val = (float)((float)total_sharpness / pdecinfo->dec_frame_num)/(float)(p_input_stream_info->p_frame->width)/(float)(p_input_stream_info->p_frame->height);
 		//printf("total_sharpness %ld pixel_sharpness_val %f dec_frame_num %d\n", 
 		//	total_sharpness, pixel_sharpness_val, pdecinfo->dec_frame_num);
-		global_frames_of_gop_array[global_decode_gop_num] = pdecinfo->dec_frame_num;
-		global_aq_strength_array[global_decode_gop_num]   = get_aq_strength(pixel_sharpness_val);
-		global_unsharp_array[global_decode_gop_num++]     = get_unsharp(pixel_sharpness_val);
+		if (!(gop_info = eagle_gop_info(&eagle_gop_queue, global_decode_gop_num)))
+			return AVERROR(ENOMEM);
+		gop_info->nb_frames   = pdecinfo->dec_frame_num;
+		gop_info->aq_strength = get_aq_strength(pixel_sharpness_val);
+		gop_info->unsharp     = get_unsharp(pixel_sharpness_val);
+		if ((ret = eagle_share_end_gop(&eagle_gop_queue, global_decode_gop_num, NULL)) < 0)
+			return ret;
 		pdecinfo->dec_frame_num = 0;
 		p_input_stream_info->p_pkt->data += p_input_stream_info->p_pkt->size;
 		p_input_stream_info->p_pkt->size = 0;
@@ -6887,395 +7931,169 @@ DECODE_ORG_BITS:
 	}
 
 NEXT:
-	gettimeofday(&before_crf5_part, NULL);
+	gettimeofday(&before_loop1_part, NULL);
 
-	// convert the yuv to crf5segment
-	#if 0
-	ret = encode_prepare(p_input_stream_info, pencinfo, pdecinfo, 1, fps);
-	if (ret < 0) {
-		fprintf(stderr, "Eagle: encode crf 5 prepare fail done\n");
-		return ret;
+	//a gop analysed by a previous run needs no probes
+	gop_info = &eagle_gop_queue.gops[global_decode_gop_num];
+	if (eagle_cache_lookup(&cache, cache_key, gop_info)) {
+		av_log(NULL, AV_LOG_VERBOSE, "Eagle: gop %d cached crf %f unsharp %f\n", global_decode_gop_num, gop_info->crf, gop_info->unsharp);
+		eagle_cache_start_gop(&cache);
+		global_decode_gop_num++;
+		gettimeofday(&before_loop2_part, NULL);
+		goto GOP_DONE;
 	}
-
-	ret = encode_frame(p_input_stream_info, pencinfo, 5.0, 0, pmeminfo, 0);
-	if (ret < 0) {
-		fprintf(stderr, "Eagle: encode crf 5 frame fail");
+	eagle_cache_start_gop(&cache);
+
+	//the reference segment is the decoded source itself, downscaled if asked to
+	scan.orig             = &gop_frames;
+	scan.ref              = &gop_frames;
+	scan.width            = p_input_stream_info->p_frame->width;
+	scan.height           = p_input_stream_info->p_frame->height;
+	if (eagle_probe_height > 0 && eagle_probe_height < scan.height) {
+		scan.width  = av_rescale(scan.width, eagle_probe_height, scan.height) & ~1;
+		scan.height = eagle_probe_height & ~1;
+		ret = eagle_frame_queue_scale(&probe_sws, &gop_frames, DECODE_FRAME_NUM_PER_GOP,
+									  scan.width, scan.height, &gop_frames_probe);
+		if (ret < 0)
+			return ret;
+		scan.ref = &gop_frames_probe;
 	}
-	avcodec_close(pencinfo->codecCtx);
-	avcodec_free_context(&(pencinfo->codecCtx));
-	av_frame_free(&(pencinfo->frame));
-	av_packet_free(&(pencinfo->p_pkt));
-
-	ret = decode_encoded_h264_rawdata(pdec264fmtinfo, pmeminfo, pdecinfo);
-	if (ret != 0) {
-		fprintf(stderr, "decode crf 5 error fail\n");
+	scan.fps              = fps;
+	scan.nb_frames        = DECODE_FRAME_NUM_PER_GOP - 1;
+	scan.nb_vmaf_frames   = VMAF_FRAME_NUM_PER_GOP;
+	scan.vmaf_threads     = 1;
+	scan.model_path       = model_path;
+	scan.unsharp_val      = unsharp_val;
+	scan.target_per_score = target_per_score;
+
+	//check need to use the unsharp or not: probe increasing amounts at crf 23
+	//until the VMAF drops or the amount exceeds the cap
+	unsharp_cap = gop_info->unsharp;
+	scan.nb_jobs      = 1;
+	while (scan.nb_jobs < FF_ARRAY_ELEMS(unsharp) && unsharp[scan.nb_jobs - 1] <= unsharp_cap)
+		scan.nb_jobs++;
+	scan.run          = eagle_unsharp_run;
+	scan.check        = eagle_unsharp_check;
+	scan.crf          = 23.0;
+	scan.n_subsample  = 5;
+	scan.vmaf_dropped = 0;
+	if ((ret = eagle_probe_pool_scan(&probe_pool, &scan)) < 0) {
+		fprintf(stderr, "Eagle: unsharp probe fail\n");
 		return ret;
 	}
-	memcpy(pmeminfo->pVideoBufferCrf5, pmeminfo->pDecodeVideoBuffer, FHD_BUFFER_SIZE);
-	#else
-	memcpy(pmeminfo->pVideoBufferCrf5, pmeminfo->pVideoBuffer, FHD_BUFFER_SIZE);
-	#endif
-
-	saved_data_size = 0;
-	saved_size = 0;
-
-	gettimeofday(&after_crf5_part, NULL);
-	crf5_time_val += 1000000 * (after_crf5_part.tv_sec - before_crf5_part.tv_sec) + (after_crf5_part.tv_usec - before_crf5_part.tv_usec);
-
-	gettimeofday(&before_loop1_part, NULL);
-
-	//check need to use the unsharp or not
-	for (int i = 0; i < 10; i++)
-	{
-		strncpy(pfilterinfoOne->filter_descr + strlen("unsharp=luma_msize_x=5:luma_msize_y=5:luma_amount="), unsharp_val[i], 3);
-
-		ret = unsharp_decoded_yuv(pfilterinfoOne, pmeminfo, p_input_stream_info, fp_filter, 1);
-		ret = encode_prepare(p_input_stream_info, pencinfo, pdecinfo, 1, fps);
-		if (ret < 0) {
-			fprintf(stderr, "Eagle: encode prepare fail in check if use unsharp or not part\n");
-			return ret;
-		}
-		ret = encode_frame(p_input_stream_info, pencinfo, 23.0, 0, pmeminfo, 1);
-		if (ret < 0) {
-			fprintf(stderr, "Eagle: encode frame fail in check if use unsharp or not part\n");
-			return ret;
-		}
-		avcodec_close(pencinfo->codecCtx);
-		avcodec_free_context(&(pencinfo->codecCtx));
-		av_frame_free(&(pencinfo->frame));
-		av_packet_free(&(pencinfo->p_pkt));
-		
-		//4. decode the encoded pkt to yuv
-		if ((ret = decode_encoded_h264_rawdata(pdec264fmtinfo, pmeminfo, pdecinfo)) != 0){
-			fprintf(stderr, "decode error fail\n");
-			return ret;
-		}
-		
-		//5. compare the yuv decoded from 4 and 2, to get the target score
-		compute_vmaf_prepare(&s, &vmaf_width, &vmaf_height, 
-							p_input_stream_info->p_frame->width, p_input_stream_info->p_frame->height, /*1920, 1036,*/ 
-							pmeminfo->pVideoBufferCrf5, /*pmeminfo->pVideoBuffer*/pmeminfo->pDecodeVideoBuffer);
-		s->stage = 1;
-		compute_vmaf(&vmaf_score, fmt, vmaf_width, vmaf_height, read_frame_new, s, model_path, log_file, NULL,
-						disable_clip, disable_avx, enable_transform, phone_model, do_psnr, do_ssim, 
-						do_ms_ssim, pool_method, n_thread, 5/*n_subsample*/, enable_conf_interval);
-		if (vmaf_score < pre_vmaf_score) {
-			global_unsharp_array[global_decode_gop_num] = unsharp[i - 1];//(i - 1) / 10.0;
-			printf("i %d unsharp %f %f\n", i - 1, global_unsharp_array[global_decode_gop_num], unsharp[i - 1]);
-			free(s);
-			s = NULL;
-			saved_size      = 0;
-			saved_data_size = 0;
-			break;
-		} else if (unsharp[i] > global_unsharp_array[global_decode_gop_num - 1]){
-			free(s);
-			s = NULL;
-			saved_size 		= 0;
-			saved_data_size = 0;
-			break;
-		} else {
-			pre_vmaf_score = vmaf_score;
-		}
-		free(s);
-		s = NULL;
-		saved_size = 0;
-		saved_data_size = 0;
+	if (scan.vmaf_dropped) {
+		gop_info->unsharp = unsharp[scan.stop_idx - 1];
+		av_log(NULL, AV_LOG_DEBUG, "Eagle: i %d unsharp %f %f\n", scan.stop_idx - 1, gop_info->unsharp, unsharp[scan.stop_idx - 1]);
 	}
+	snprintf(pfilterinfoOne->filter_descr, sizeof(pfilterinfoOne->filter_descr),
+			 "unsharp=luma_msize_x=5:luma_msize_y=5:luma_amount=%s",
+			 unsharp_val[FFMIN(scan.stop_idx, scan.nb_jobs - 1)]);
+	av_log(NULL, AV_LOG_VERBOSE, "Eagle: gop %d unsharp %f\n", global_decode_gop_num, gop_info->unsharp);
 	global_decode_gop_num++;
 
-	printf("global_unsharp_array %f\n", global_unsharp_array[global_decode_gop_num]);
-
-	//strncpy(pfilterinfoOne->filter_descr + strlen("unsharp=luma_msize_x=5:luma_msize_y=5:luma_amount="), global_unsharp_array[global_decode_gop_num], 3);
-	printf("filter_descr %s\n", pfilterinfoOne->filter_descr);
-	ret = unsharp_decoded_yuv(pfilterinfoOne, pmeminfo, p_input_stream_info, fp_filter, 1);
-	//memcpy(pmeminfo->pVideoBuffer1, pmeminfo->pVideoBufferCrf5, FHD_BUFFER_SIZE);
-
-	for (int crf = 18; crf <= 50; crf++) {		
-		//3. encode the yuv data decoded in part 2 to h264 file, using crf 18..(FHD start crf = 25)
-        if ((ret = encode_prepare(p_input_stream_info, pencinfo, pdecinfo, 1, fps)) < 0) {
-            fprintf(stderr, "Eagle: encode prepare fail\n");
-            return ret;
-        }
-
-		if ((ret = encode_frame(p_input_stream_info, pencinfo, (float)crf, 0, pmeminfo, 1)) < 0) {
-    		fprintf(stderr, "Eagle: encode frame fail\n");
-    		return ret;
-    	}
-
-		avcodec_close(pencinfo->codecCtx);
-		avcodec_free_context(&(pencinfo->codecCtx));
-		av_frame_free(&(pencinfo->frame));
-		av_packet_free(&(pencinfo->p_pkt));
-	
-    	//4. decode the encoded pkt to yuv
-    	if ((ret = decode_encoded_h264_rawdata(pdec264fmtinfo, pmeminfo, pdecinfo)) != 0){
-    		fprintf(stderr, "decode error fail\n");
-    		return ret;
-    	}
-
-    	//5. compare the yuv decoded from 4 and 2, to get the target score
-    	compute_vmaf_prepare(&s, &vmaf_width, &vmaf_height, 
-    						p_input_stream_info->p_frame->width, p_input_stream_info->p_frame->height, /*1920, 1036,*/ 
-    						pmeminfo->pVideoBufferCrf5, /*pmeminfo->pVideoBuffer*/pmeminfo->pDecodeVideoBuffer);
-		s->stage = 1;
-
-		compute_vmaf(&vmaf_score, fmt, vmaf_width, vmaf_height, read_frame_new, s, model_path, log_file, NULL,
-        				disable_clip, disable_avx, enable_transform, phone_model, do_psnr, do_ssim, 
-        				do_ms_ssim, pool_method, n_thread, 1/*n_subsample*/, enable_conf_interval);
-		printf("stage 1 vmaf_score %f\n", vmaf_score);
-		free(s);
-		s = NULL;
-		//exit(0);
-
-		av_frame_free(&(pdec264fmtinfo->frame));
-		avcodec_close(pdec264fmtinfo->codecCtx);
-		av_parser_close(pdec264fmtinfo->pCodecParserCtx);
-		avcodec_free_context(&(pdec264fmtinfo->codecCtx));
-		free(pdec264fmtinfo->inbuf);
-		pdec264fmtinfo->inbuf = NULL;
-
-		stage1_vmaf_score = vmaf_score;
-		stage1_bitrate = (float)((float)saved_data_size / 1024) / (float)((float)(DECODE_FRAME_NUM_PER_GOP - 2) / fps) * 8;
-
-		if ((fabs(stage1_vmaf_score - stage1_prev_vmaf_score) <= 1e-6) || stage1_first_flag){
-			stage1_first_flag = 0;
-			stage1_per_score = 600;
-		} else {
-			stage1_per_score = (stage1_bitrate - stage1_prev_bitrate) / (stage1_vmaf_score - stage1_prev_vmaf_score);
-		}
+	av_log(NULL, AV_LOG_DEBUG, "Eagle: filter_descr %s\n", pfilterinfoOne->filter_descr);
+	//6. unsharp the decoded yuv data, stage 2 reuses the first frames
+	ret = unsharp_decoded_yuv(pfilterinfoOne, &gop_frames, DECODE_FRAME_NUM_PER_GOP, &sharpened);
+	if (ret < 0)
+		return ret;
+	stages_start = av_gettime_relative();
+	scan.src = &sharpened;
+	if (scan.ref != &gop_frames) {
+		ret = eagle_frame_queue_scale(&probe_sws, &sharpened, DECODE_FRAME_NUM_PER_GOP,
+									  scan.width, scan.height, &sharpened_probe);
+		if (ret < 0)
+			return ret;
+		scan.src = &sharpened_probe;
+	}
 
-		printf("stage1_gop %d bitrate %f prev_bitrate %f vmaf_score %f prev_vmaf_score %f crf %d per_score %f saved_data_size %d saved_size %d \n",
-				global_stage1_gop_num, stage1_bitrate, stage1_prev_bitrate, stage1_vmaf_score, stage1_prev_vmaf_score, crf, stage1_per_score, saved_data_size, saved_size);
-		//exit(1);
-		if (stage1_per_score <= target_per_score) {
-			printf("stage1_gop %d global_stage1_gop_num stage1_vmaf_score final result %f crf %d stage1_per_score %f stage1_bitrate %f\n", 
-					global_stage1_gop_num, stage1_vmaf_score, crf, stage1_per_score, stage1_bitrate);
-
-			stage1_vmaf_score = (stage1_vmaf_score > 96.0) ? 96.0 : ((stage1_vmaf_score < 90.0) ? 90.0 : stage1_vmaf_score);
-			printf("vmaf_score %f\n", stage1_vmaf_score);
-
-			global_target_score_array[global_stage1_gop_num] = stage1_vmaf_score;
-			stage1_prev_bitrate =
-				 stage1_bitrate =
-				 stage1_vmaf_score 		=
-				 stage1_prev_vmaf_score =
-				 stage1_per_score = 0.0;
-			//exit(1);
-			saved_data_size = 0;
-			saved_size = 0;
-			break;
-		}
+	//3. encode the yuv data decoded in part 2 to h264 file at the crfs picked by the search,
+	//4. decode it back and 5. compare it with the source to get the target score
+	scan.n_subsample = FFMAX(eagle_vmaf_subsample, 1);
+	scan.gop         = global_stage1_gop_num;
+	if ((ret = eagle_search_run(&stage1_search, &stage1_crf)) < 0) {
+		fprintf(stderr, "Eagle: encode frame fail\n");
+		return ret;
+	}
+	if (stage1_crf <= stage1_search.hi) {
+		stage1_vmaf_score = stage1_search.probes[stage1_crf].vmaf_score;
+		av_log(NULL, AV_LOG_VERBOSE, "Eagle: stage1_gop %d global_stage1_gop_num stage1_vmaf_score final result %f crf %d stage1_bitrate %f\n",
+				global_stage1_gop_num, stage1_vmaf_score, stage1_crf, stage1_search.probes[stage1_crf].bitrate);
 
-		stage1_prev_bitrate = stage1_bitrate;
-		stage1_prev_vmaf_score = stage1_vmaf_score;
+		stage1_vmaf_score = (stage1_vmaf_score > 96.0) ? 96.0 : ((stage1_vmaf_score < 90.0) ? 90.0 : stage1_vmaf_score);
+		av_log(NULL, AV_LOG_DEBUG, "Eagle: vmaf_score %f\n", stage1_vmaf_score);
 
-		saved_data_size = 0;
-		saved_size      = 0;
+		gop_info->target_score = stage1_vmaf_score;
 	}
-	stage1_first_flag = 1;
 
 	gettimeofday(&after_loop1_part, NULL);
 	loop1_time_val += 1000000 * (after_loop1_part.tv_sec - before_loop1_part.tv_sec) + (after_loop1_part.tv_usec - before_loop1_part.tv_usec);
 
 	gop_num++;
 
-    //6. unsharp the decoded yuv data
-
 	gettimeofday(&before_loop2_part, NULL);
-	memcpy(pfilterinfo->filter_descr, pfilterinfoOne->filter_descr, 100);
-    ret = unsharp_decoded_yuv(pfilterinfo, pmeminfo, p_input_stream_info, fp_filter, 0);
-    //memcpy(pmeminfo->pVideoBuffer2, pmeminfo->pVideoBuffer, (FHD_BUFFER_SIZE / 5));
-	printf("unsharp_decoded_yuv done\n");
-	stage2_last_crf = 18;
-
-	stage2_best_bitrate = 1000000;
-	stage2_best_vmaf_diff = 100;
-	stage2_best_vmaf  = 0;
-	stage2_early_stop = 0;
-	stage2_loop_count = 0;
-	stage2_first_flag = 1;
-	stage2_crf_step   = 1.0;
-	stage2_start_crf  = 18;
-
-	//if (global_target_score_array[global_stage2_gop_num] - 2 >= 91) {
-	//	stage2_target_vmaf_score = global_target_score_array[global_stage2_gop_num] - 2;
-	//} else {
-	//	stage2_target_vmaf_score = global_target_score_array[global_stage2_gop_num];
-	//}
-
-	for (int crf = 18; crf < 40; /*crf++*/) {
-		stage2_crf_step = 1;
-
-    	//7. encode the filtered frame to get the crf
-		ret = enc_filtered_yuv_to_264(pmeminfo, (float)(crf), p_input_stream_info, fps);
-
-    	//8. decode the encoded 264 raw data to yuv
-    	ret = decode_filtered_encoded_h264_rawdata(pmeminfo, pdecinfo);
 
-		if (0)
-		{
-			FILE *fp = fopen("./pVideoBuffer.yuv", "wb");
-			fwrite(pmeminfo->pVideoBuffer, 1, FHD_BUFFER_SIZE / 5, fp);
-			fclose(fp);
-			fp = fopen("./pDecodeVideoBuffer2.yuv", "wb");
-			fwrite(pmeminfo->pDecodeVideoBuffer2, 1, FHD_BUFFER_SIZE / 5, fp);
-			fclose(fp);
-		}
-
-		//9. compute the vmaf and determine the finally crf value
-		printf("width %d height %d linesize %d %d\n", 
-				p_input_stream_info->p_frame->width, p_input_stream_info->p_frame->height,
-				p_input_stream_info->p_frame->linesize[0], p_input_stream_info->p_frame->linesize[1]);
-    	compute_vmaf_prepare(&s, &vmaf_width, &vmaf_height, 
-    						p_input_stream_info->p_frame->width, p_input_stream_info->p_frame->height, 
-    						pmeminfo->pVideoBuffer, pmeminfo->pDecodeVideoBuffer2);
-
-		s->stage      = 2;
-		s->num_frames = 5;
-
-		compute_vmaf(&vmaf_score, fmt, vmaf_width, vmaf_height, read_frame_new, s, model_path, log_file_2, NULL,
-        				disable_clip, disable_avx, enable_transform, phone_model, do_psnr, do_ssim, 
-        				do_ms_ssim, pool_method, n_thread, n_subsample, enable_conf_interval);
-		printf("stage 2 vmaf_score %f\n", vmaf_score);
-
-		stage2_score_in   = vmaf_score;
-		stage2_bitrate_in = (float)((float)(saved_data_size_filtered/* -  enc_pkt_size_filtered[5]*/)/ 1024) / (float)((float)(FILTERED_FRAME_NUM_PER_GOP - 4) / fps) * 8;
-		stage2_vmaf_diff  = stage2_score_in - stage2_target_vmaf_score;
-
-		if (stage2_bitrate_in > stage2_best_bitrate && abs(stage2_vmaf_diff) < 5 && 0){
-			//early_stop never happen
-		}
-
-		//best descition
-		if ((stage2_vmaf_diff > -1 && stage2_bitrate_in < stage2_best_bitrate) || stage2_first_flag) {
-			stage2_best_bitrate   = stage2_bitrate_in;
-			stage2_best_vmaf_diff = stage2_vmaf_diff;
-			stage2_best_vmaf      = stage2_score_in;
-			stage2_best_crf       = crf;
-			stage2_first_flag     = 0;
-		}
-
-		if (abs(stage2_vmaf_diff) < 1 && stage2_vmaf_diff < 0.2) {
-			printf("stage2_vmaf_diff %f crf %d line %d\n", stage2_vmaf_diff, crf, __LINE__);
-			saved_data_size_filtered = 0;
-			global_crf_array[global_stage2_gop_num] = (int)crf + 1;
-			stage2_last_crf = crf;
-			free(s);
-			//exit(0);
-			s = NULL;
-			break;
-		}
-
-		//crf descition
-		stage2_step_vmaf_res = (float)((crf - 18) / 10.0);
-		stage2_step_vmaf_res = (stage2_step_vmaf_res < 0.2) ? 0.2 : stage2_step_vmaf_res;
-
-		
-		if (stage2_vmaf_diff > 20.0)
-			stage2_step_vmaf = 1.5 * stage2_step_vmaf_res;
-		else if (stage2_vmaf_diff > 15)
-			stage2_step_vmaf = 2 * stage2_step_vmaf_res;
-		else if (stage2_vmaf_diff > 10)
-			stage2_step_vmaf = 2.5 * stage2_step_vmaf_res;
-		else
-			stage2_step_vmaf = 4 * stage2_step_vmaf_res;
-
-		stage2_step_vmaf = (stage2_step_vmaf < 1) ? 1 : stage2_step_vmaf;
-
-		stage2_score_diff = stage2_score_in - stage2_target_vmaf_score;
-		printf("stage2_step_vmaf stage2_score_diff target_score stage2_score_in %f %f %f %f\n",
-				stage2_step_vmaf, stage2_score_diff, stage2_target_vmaf_score, stage2_score_in);
-
-		if (stage2_score_diff > 0) {
-			stage2_crf_step = stage2_score_diff / stage2_step_vmaf;
-			stage2_crf_step = (stage2_crf_step < 1) ? 1 : stage2_crf_step;
-			if (crf < (int)stage2_last_crf){
-				//getchar();
-				saved_data_size_filtered = 0;
-				global_crf_array[global_stage2_gop_num] = (int)crf + 1;
-				stage2_last_crf = crf;
-				printf("global_stage2_gop_num %d global_crf_array[%d] %f\n", global_stage2_gop_num, global_stage2_gop_num, global_crf_array[global_stage2_gop_num]);
-				free(s);
-				s = NULL;
-				break;
-			}
-		} else {
-			if ((crf == (int)(stage2_last_crf + 1)) || (crf == (int)(stage2_start_crf)) || (crf == 18) || (crf == (int)(stage2_last_crf - 1))) {
-				saved_data_size_filtered = 0;
-				global_crf_array[global_stage2_gop_num] = (int)crf + 1;
-				printf("stage2_last_crf %d \n", stage2_last_crf);
-				stage2_last_crf = crf;
-				printf("global_stage2_gop_num %d global_crf_array[%d] %f\n", global_stage2_gop_num, global_stage2_gop_num, global_crf_array[global_stage2_gop_num]);
-				free(s);
-				//exit(0);
-				s = NULL;
-				break;
-			} else {
-				stage2_crf_step = stage2_score_diff / stage2_step_vmaf;
-				stage2_crf_step = (stage2_crf_step > -1) ? -1 : stage2_crf_step;
-			}
-		}
-
-		if (stage2_crf_step > 5)
-			stage2_crf_step = 5;
-		if (stage2_crf_step < -2)
-			stage2_crf_step = -2;
-		stage2_crf_step = (stage2_crf_step < 0) ? (int)(stage2_crf_step) : stage2_crf_step;
-
-		stage2_last_crf = crf;
-
-		printf("stage2_crf_step %f\n", stage2_crf_step);
-		if (crf + stage2_crf_step > 40) {
-			saved_data_size_filtered = 0;
-			global_crf_array[global_stage2_gop_num] = (int)(crf) + 1;
-			free(s);
-			s = NULL;
-			break;
-		} else {
-			crf = (int)(crf + stage2_crf_step);
-		}
-
-		if (vmaf_score < stage2_target_vmaf_score) {
-			printf("global_stage2_gop_num %d crf %d vmaf_score %f global_crf_array[%d] %f\n",
-				global_stage2_gop_num, crf, vmaf_score, global_stage2_gop_num, global_crf_array[global_stage2_gop_num]);
-			free(s);
-			s = NULL;
-			saved_data_size_filtered = 0;
-			global_crf_array[global_stage2_gop_num] = (int)crf + 1;
-			break;
-		}
-
-		free(s);
-		s = NULL;
-		saved_data_size_filtered = 0;
+	//7. encode the filtered frames, 8. decode them back and 9. compute the vmaf until the
+	//search settles on the final crf
+	scan.nb_frames      = FILTERED_FRAME_NUM_PER_GOP - 4;
+	scan.nb_vmaf_frames = VMAF_FILTERED_FRAME_NUM_PER_GOP;
+	scan.gop            = global_stage2_gop_num;
+	stage2_search.target = stage2_target_vmaf_score = gop_info->target_score;
+	if ((ret = eagle_search_run(&stage2_search, &stage2_crf)) < 0) {
+		fprintf(stderr, "Eagle: encode filtered frame fail\n");
+		return ret;
+	}
+	gop_info->crf = FFMIN(stage2_crf, stage2_search.hi) + 1;
+	if (eagle_nb_rungs &&
+		(ret = eagle_ladder_search(&probe_pool, &scan, &gop_frames, &sharpened, gop_info)) < 0) {
+		fprintf(stderr, "Eagle: ladder search fail\n");
+		return ret;
 	}
-	printf("after one gop target_score %f global_crf_array[%d] %f\n", 
-		stage2_target_vmaf_score, global_stage2_gop_num, global_crf_array[global_stage2_gop_num]);
+	if (eagle_calibrate && (scan.ref != &gop_frames || scan.n_subsample > 1)) {
+		ret = eagle_calibrate_gop(&calibration, &scan, &gop_frames, &sharpened, gop_info->crf,
+								  av_gettime_relative() - stages_start);
+		if (ret < 0)
+			return ret;
+	}
+	eagle_cache_store(&cache, cache_key, gop_info);
+
+	av_log(NULL, AV_LOG_VERBOSE, "Eagle: after one gop target_score %f crf[%d] %f\n",
+		stage2_target_vmaf_score, global_stage2_gop_num, gop_info->crf);
+GOP_DONE:
 	global_stage1_gop_num++;
 	global_stage2_gop_num++;
+	if (eagle_gop_queue_publish(&eagle_gop_queue, global_stage2_gop_num) < 0)
+		end_of_file = 1;
 	//exit(0);
 	gettimeofday(&after_loop2_part, NULL);
 	loop2_time_val += 1000000 * (after_loop2_part.tv_sec - before_loop2_part.tv_sec) + (after_loop2_part.tv_usec - before_loop2_part.tv_usec);
 	printf("loop2_time_val %lld\n", loop2_time_val);
 
-	printf("Statistics Time crf5_time_val %lld loop1_time_val %lld loop2_time_val %lld\n", 
-			crf5_time_val, loop1_time_val, loop2_time_val);
+	printf("Statistics Time loop1_time_val %lld loop2_time_val %lld\n",
+			loop1_time_val, loop2_time_val);
 
 	if (end_of_file) {
-		free(pmeminfo->pVideoBuffer); 		pmeminfo->pVideoBuffer 		  = NULL;
-		free(pmeminfo->pVideoBuffer2); 		pmeminfo->pVideoBuffer2 	  = NULL;
-		free(pmeminfo->pEncodeVideoBuffer); pmeminfo->pEncodeVideoBuffer  = NULL;
-		free(pmeminfo->pEncodeVideoBuffer2);pmeminfo->pEncodeVideoBuffer2 = NULL;
-		free(pmeminfo->pDecodeVideoBuffer);	pmeminfo->pDecodeVideoBuffer  = NULL;
-		free(pmeminfo->pDecodeVideoBuffer2);pmeminfo->pDecodeVideoBuffer2 = NULL;
-		free(pmeminfo);				pmeminfo 	= NULL;
-		av_freep(&(pdecinfo->video_dst_data[0]));
+		eagle_frame_queue_free(&gop_frames);
+		eagle_frame_queue_free(&sharpened);
+		eagle_frame_queue_free(&gop_frames_probe);
+		eagle_frame_queue_free(&sharpened_probe);
+		sws_freeContext(probe_sws);
+		eagle_meter_uninit(&meter);
+		eagle_search_report(&stage1_search);
+		eagle_search_report(&stage2_search);
+		eagle_ladder_uninit();
+		eagle_search_report(&calibration.stage1);
+		eagle_search_report(&calibration.stage2);
+		eagle_calibration_report(&calibration);
+		eagle_cache_close(&cache);
+		eagle_probe_pool_uninit(&probe_pool);
+		av_log(NULL, AV_LOG_INFO, "Eagle: analysed %d gops of %dx%d, peak memory %"PRId64"KiB\n",
+		       global_stage2_gop_num, scan.width, scan.height, getmaxrss() / 1024);
 		free(pdecinfo);				pdecinfo	= NULL;
 		free(pencinfo);				pencinfo	= NULL;
 		if (pdec264fmtinfo->outputfp)
 			fclose(pdec264fmtinfo->outputfp);
 		free(pdec264fmtinfo);		pdec264fmtinfo	= NULL;
-		free(pfilterinfo);			pfilterinfo		= NULL;
+		free(pfilterinfoOne);		pfilterinfoOne	= NULL;
 		av_packet_free(&(p_input_stream_info->p_pkt));  p_input_stream_info->p_pkt   = NULL;
 		av_frame_free(&(p_input_stream_info->p_frame)); p_input_stream_info->p_frame = NULL;
 		avformat_close_input(&(p_input_stream_info->p_fmt_ctx));
@@ -7287,22 +8105,186 @@ NEXT:
 			fclose(fp_filter);
 		return ret;
 	}
-	else
+	else {
+		eagle_frame_queue_clear(&gop_frames);
 		goto DECODE_ORG_BITS;
+	}
 
 	return ret;
 }
 
+#if HAVE_THREADS
+static void *eagle_analysis_thread(void *arg)
+{
+    EaglePreProcess(arg);
+    eagle_gop_queue_finish(&eagle_gop_queue);
+    return NULL;
+}
+#endif
+
+/* Run the analysis of filename either to completion or, with
+ * -eagle_lookahead, on a thread racing ahead of the transcode. */
+static int eagle_start_analysis(char *filename)
+{
+    EagleGopQueue *q = &eagle_gop_queue;
+
+    q->shared_budget = (int64_t)eagle_share_decode << 20;
+#if HAVE_THREADS
+    if (eagle_lookahead > 0) {
+        int ret;
+
+        q->max_ahead = eagle_lookahead;
+        if ((ret = pthread_mutex_init(&q->lock, NULL)))
+            return AVERROR(ret);
+        if ((ret = pthread_cond_init(&q->cond, NULL))) {
+            pthread_mutex_destroy(&q->lock);
+            return AVERROR(ret);
+        }
+        q->thread_started = 1;
+        if ((ret = pthread_create(&q->thread, NULL, eagle_analysis_thread, filename))) {
+            av_log(NULL, AV_LOG_ERROR, "pthread_create failed: %s. Try to increase `ulimit -v` or decrease `ulimit -s`.\n", strerror(ret));
+            q->thread_started = 0;
+            pthread_cond_destroy(&q->cond);
+            pthread_mutex_destroy(&q->lock);
+            return AVERROR(ret);
+        }
+        av_log(NULL, AV_LOG_INFO, "Eagle: analysis running up to %d GOPs ahead of the encoder\n",
+               q->max_ahead);
+        return 0;
+    }
+#endif
+
+    EaglePreProcess(filename);
+    eagle_gop_queue_finish(q);
+    return 0;
+}
+
+static void eagle_stop_analysis(void)
+{
+    EagleGopQueue *q = &eagle_gop_queue;
+
+#if HAVE_THREADS
+    if (q->thread_started) {
+        pthread_mutex_lock(&q->lock);
+        q->abort_request = 1;
+        pthread_cond_broadcast(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+
+        pthread_join(q->thread, NULL);
+        q->thread_started = 0;
+        pthread_cond_destroy(&q->cond);
+        pthread_mutex_destroy(&q->lock);
+    }
+#endif
+    eagle_share_uninit();
+    for (int i = 0; i < q->nb_gops; i++)
+        eagle_frame_queue_free(&q->shared[i]);
+    av_freep(&q->shared);
+    av_freep(&q->gops);
+    q->nb_gops = 0;
+}
+
+/* number of input files on the command line */
+static int eagle_nb_inputs(int argc, char **argv)
+{
+    int nb_inputs = 0;
+
+    for (int i = 1; i < argc - 1; i++)
+        nb_inputs += !strcmp(argv[i], "-i");
+    return nb_inputs;
+}
+
+/* Filter graph sharpening the first video stream of input, then splitting
+ * it into [e0] for the main output and [r<n>] scaled to each rung. */
+static char *eagle_ladder_graph(int input)
+{
+    AVBPrint bp;
+    char *graph;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    av_bprintf(&bp, "[%d:v:0]unsharp=5:5:1.0,split=%d[e0]", input, eagle_nb_rungs + 1);
+    for (int i = 0; i < eagle_nb_rungs; i++)
+        av_bprintf(&bp, "[e%d]", i + 1);
+    for (int i = 0; i < eagle_nb_rungs; i++)
+        av_bprintf(&bp, ";[e%d]scale=%d:%d[r%d]", i + 1, eagle_rungs[i].width, eagle_rungs[i].height, i);
+    if (av_bprint_finalize(&bp, &graph) < 0)
+        return NULL;
+    return graph;
+}
+
+/* the main output name with the rung size before the extension */
+static char *eagle_rung_filename(const char *filename, const EagleRung *r)
+{
+    const char *ext = strrchr(filename, '.');
+
+    if (!ext || strchr(ext, '/'))
+        ext = filename + strlen(filename);
+    return av_asprintf("%.*s_%dx%d%s", (int)(ext - filename), filename, r->width, r->height, ext);
+}
+
+/* the encoder the analysis probed with and its settings */
+static int eagle_add_encoder_args(char **argv, int argc, const AVDictionary *opts)
+{
+    AVDictionaryEntry *opt = NULL;
+
+    argv[argc++] = av_strdup("-c:v");
+    argv[argc++] = av_strdup(eagle_encoder->name);
+    while ((opt = av_dict_get(opts, "", opt, AV_DICT_IGNORE_SUFFIX))) {
+        argv[argc++] = av_asprintf("-%s:v", opt->key);
+        argv[argc++] = av_strdup(opt->value);
+    }
+    return argc;
+}
+
 static int EagleParseParam(int argc, char **argv)
 {
 	int ret_arg = 0;
+	int has_filters = 0;
 	for (int i = 0; i < argc; i++) {
 		if (!strcmp(argv[i], "-i"))         {ret_arg = i + 1;i++;}
-		if (!strcmp(argv[i], "-preset"))    {argv[i + 1] = "medium";  i++;}
-		if (!strcmp(argv[i], "-tune"))      {argv[i + 1] = "ssim";    i++;}
-		if (!strcmp(argv[i], "-profile:v")) {argv[i + 1] = "high";    i++;}
-		if (!strcmp(argv[i], "-c:v"))		{argv[i + 1]  = "libx264"; i++;}
+		if (!strcmp(argv[i], "-eagle_lookahead") && i + 1 < argc) {eagle_lookahead = atoi(argv[i + 1]); i++;}
+		if (!strcmp(argv[i], "-eagle_threads") && i + 1 < argc) {eagle_threads = atoi(argv[i + 1]); i++;}
+		if (!strcmp(argv[i], "-eagle_search") && i + 1 < argc) {av_free(eagle_search); eagle_search = av_strdup(argv[i + 1]); i++;}
+		if (!strcmp(argv[i], "-eagle_probe_height") && i + 1 < argc) {eagle_probe_height = atoi(argv[i + 1]); i++;}
+		if (!strcmp(argv[i], "-eagle_vmaf_subsample") && i + 1 < argc) {eagle_vmaf_subsample = atoi(argv[i + 1]); i++;}
+		if (!strcmp(argv[i], "-eagle_calibrate"))   eagle_calibrate = 1;
+		if (!strcmp(argv[i], "-eagle_cache") && i + 1 < argc) {av_free(eagle_cache); eagle_cache = av_strdup(argv[i + 1]); i++;}
+		if (!strcmp(argv[i], "-eagle_share_decode") && i + 1 < argc) {eagle_share_decode = atoi(argv[i + 1]); i++;}
+		if (!strcmp(argv[i], "-eagle_scene_threshold") && i + 1 < argc) {eagle_scene_threshold = atof(argv[i + 1]); i++;}
+		if (!strcmp(argv[i], "-eagle_min_gop") && i + 1 < argc) {eagle_min_gop = atoi(argv[i + 1]); i++;}
+		if (!strcmp(argv[i], "-eagle_max_gop") && i + 1 < argc) {eagle_max_gop = atoi(argv[i + 1]); i++;}
+		if (!strcmp(argv[i], "-eagle_ladder") && i + 1 < argc) {
+			av_free(eagle_ladder);
+			eagle_ladder = av_strdup(argv[i + 1]);
+			if (eagle_ladder_parse(eagle_ladder) < 0)
+				exit(1);
+			i++;
+		}
+		//the settings of the encoder are the ones the analysis probes with
+		if (!strcmp(argv[i], "-c:v") && i + 1 < argc) {
+			if (!(eagle_encoder = eagle_encoder_find(argv[i + 1]))) {
+				printf("Eagle cannot tune the encoder %s, use one of:", argv[i + 1]);
+				for (int j = 0; j < FF_ARRAY_ELEMS(eagle_encoders); j++)
+					printf(" %s", eagle_encoders[j].name);
+				printf("\n");
+				exit(1);
+			}
+			i++;
+		}
 		if (!strcmp(argv[i], "-b:v"))		{printf("cannot set the bitrate param\n");exit(1);}
+		if (!strcmp(argv[i], "-vf") || !strcmp(argv[i], "-filter:v") || !strcmp(argv[i], "-filter_complex"))
+			has_filters = 1;
+	}
+	//the rungs are fed by a filter graph of their own
+	if (eagle_nb_rungs && has_filters) {
+		printf("cannot set filters with eagle_ladder\n");
+		exit(1);
+	}
+	//the probes of a gop take its first DECODE_FRAME_NUM_PER_GOP frames
+	if (eagle_min_gop < DECODE_FRAME_NUM_PER_GOP || eagle_max_gop < eagle_min_gop) {
+		printf("eagle_min_gop must be at least %d and eagle_max_gop at least eagle_min_gop\n",
+			   DECODE_FRAME_NUM_PER_GOP);
+		exit(1);
 	}
 
 	return ret_arg;
@@ -7312,47 +8294,48 @@ int main(int argc, char **argv)
 {
     int i, ret;
 	int eagle_argc = 0;
+	int eagle_input_idx;
+	char **eagle_argv;
+	AVDictionary *enc_opts = NULL;
     BenchmarkTimeStamps ti;
 	struct timeval start, end;
 	gettimeofday(&start, NULL);
 	//TODO:The first process is to get the target_vmaf and sharpness value for each segment
 	ret = EagleParseParam(argc, argv);
-	char **eagle_argv = (char *)malloc((argc + 10) * (sizeof(int)) * sizeof(char *));
+	if (av_dict_parse_string(&enc_opts, eagle_encoder->options, "=", ":", 0) < 0)
+		exit(1);
+	eagle_argv = (char **)malloc((argc + 8 + (eagle_nb_rungs + 1) * (5 + 2 * av_dict_count(enc_opts))) * sizeof(char *));
 	for (int i = 0; i < argc - 1; i++) {
 		eagle_argv[i] = (char *)malloc(strlen(argv[i]) + 1);
 		memcpy(eagle_argv[i], argv[i], strlen(argv[i]) + 1);
 	}
 
 	#if 1
-	eagle_argv[argc - 1] = (char *)malloc(strlen("-vf") + 1);
-	memcpy(eagle_argv[argc - 1], "-vf", strlen("-vf") + 1);
-	eagle_argv[argc - 1 + 1] = (char *)malloc(strlen("unsharp=5:5:1.0") + 1);
-	memcpy(eagle_argv[argc - 1 + 1], "unsharp=5:5:1.0", strlen("unsharp=5:5:1.0") + 1);
-
-	eagle_argv[argc - 1 + 2] = (char *)malloc(strlen("-c:v") + 1);
-	memcpy(eagle_argv[argc - 1 + 2], "-c:v", strlen("-c:v") + 1);
-	eagle_argv[argc - 1 + 3] = (char *)malloc(strlen("libx264") + 1);
-	memcpy(eagle_argv[argc - 1 + 3], "libx264", strlen("libx264") + 1);
-
-	eagle_argv[argc - 1 + 4] = (char *)malloc(strlen("-profile:v") + 1);
-	memcpy(eagle_argv[argc - 1 + 4], "-profile:v", strlen("-profile:v") + 1);
-	eagle_argv[argc - 1 + 5] = (char *)malloc(strlen("high") + 1);
-	memcpy(eagle_argv[argc - 1 + 5], "high", strlen("high") + 1);
-
-	eagle_argv[argc - 1 + 6] = (char *)malloc(strlen("-preset") + 1);
-	memcpy(eagle_argv[argc - 1 + 6], "-preset", strlen("-preset") + 1);
-	eagle_argv[argc - 1 + 7] = (char *)malloc(strlen("medium") + 1);
-	memcpy(eagle_argv[argc - 1 + 7], "medium", strlen("medium") + 1);
-
-	eagle_argv[argc - 1 + 8] = (char *)malloc(strlen("-tune") + 1);
-	memcpy(eagle_argv[argc - 1 + 8], "-tune", strlen("-tune") + 1);
-	eagle_argv[argc - 1 + 9] = (char *)malloc(strlen("ssim") + 1);
-	memcpy(eagle_argv[argc - 1 + 9], "ssim", strlen("ssim") + 1);
-
-	eagle_argv[argc - 1 + 10] = (char *)malloc(strlen(argv[argc - 1]) + 1);
-	memcpy(eagle_argv[argc - 1 + 10], argv[argc - 1], strlen(argv[argc - 1]) + 1);
-
-	eagle_argc = argc + 10;
+	eagle_argc = argc - 1;
+	if (!eagle_nb_rungs) {
+		eagle_argv[eagle_argc++] = av_strdup("-vf");
+		eagle_argv[eagle_argc++] = av_strdup("unsharp=5:5:1.0");
+	} else {
+		//the sharpened video is split between the output and the rungs
+		eagle_argv[eagle_argc++] = av_strdup("-filter_complex");
+		eagle_argv[eagle_argc++] = eagle_ladder_graph(eagle_nb_inputs(argc, argv) - 1);
+		eagle_argv[eagle_argc++] = av_strdup("-map");
+		eagle_argv[eagle_argc++] = av_strdup("[e0]");
+		eagle_argv[eagle_argc++] = av_strdup("-map");
+		eagle_argv[eagle_argc++] = av_asprintf("%d:a?", eagle_nb_inputs(argc, argv) - 1);
+	}
+
+	//encode with the settings the analysis probed with
+	eagle_argc = eagle_add_encoder_args(eagle_argv, eagle_argc, enc_opts);
+	eagle_argv[eagle_argc++] = av_strdup(argv[argc - 1]);
+
+	for (int i = 0; i < eagle_nb_rungs; i++) {
+		eagle_argv[eagle_argc++] = av_strdup("-map");
+		eagle_argv[eagle_argc++] = av_asprintf("[r%d]", i);
+		eagle_argc = eagle_add_encoder_args(eagle_argv, eagle_argc, enc_opts);
+		eagle_argv[eagle_argc++] = eagle_rung_filename(argv[argc - 1], &eagle_rungs[i]);
+	}
+	av_dict_free(&enc_opts);
 	#else
 	eagle_argv[argc - 1] = (char *)malloc(strlen("-c:v") + 1);
 	memcpy(eagle_argv[argc - 1], "-c:v", strlen("-c:v") + 1);
@@ -7385,7 +8368,9 @@ int main(int argc, char **argv)
 	}
 
 	//exit(0);
-    EaglePreProcess(argv[ret]);
+	eagle_input_idx = ret;
+	if (!eagle_lookahead)
+		eagle_start_analysis(argv[eagle_input_idx]);
 
 	gettimeofday(&end, NULL);
 	printf("interval = %ld\n", 1000000*(end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec));
@@ -7435,9 +8420,24 @@ int main(int argc, char **argv)
             want_sdp = 0;
     }
 
+    /* the rungs follow the main output */
+    for (i = 1; i < nb_output_files && i <= eagle_nb_rungs; i++) {
+        OutputFile *of = output_files[i];
+
+        for (int j = 0; j < of->ctx->nb_streams; j++)
+            output_streams[of->ost_index + j]->eagle_rung = i;
+    }
+
+    eagle_find_analysed_stream(argv[eagle_input_idx]);
+    if (eagle_lookahead > 0 && eagle_start_analysis(argv[eagle_input_idx]) < 0)
+        exit_program(1);
+    if (eagle_share_decode && eagle_share_init(argv[eagle_input_idx]) < 0)
+        exit_program(1);
+
     current_time = ti = get_benchmark_time_stamps();
     if (transcode() < 0)
         exit_program(1);
+    eagle_stop_analysis();
 
     if (do_benchmark) {
         int64_t utime, stime, rtime;
@@ -120,6 +120,7 @@ typedef struct OptionsContext {
     int rate_emu;
     int accurate_seek;
     int thread_queue_size;
+    int thread_queue_bytes;
 
     SpecifierOpt *ts_scale;
     int        nb_ts_scale;
@@ -254,6 +255,11 @@ typedef struct InputFilter {
     AVBufferRef *hw_frames_ctx;
 
     int eof;
+
+    /* Eagle per-GOP schedule */
+    int eagle_gop;                  // number of GOPs started
+    int64_t eagle_gop_end;          // pts of the first frame after the current GOP
+    float eagle_unsharp;            // amount of the current GOP
 } InputFilter;
 
 typedef struct OutputFilter {
@@ -418,6 +424,12 @@ typedef struct InputFile {
     int non_blocking;           /* reading packets from the thread should not block */
     int joined;                 /* the thread has been joined */
     int thread_queue_size;      /* maximum number of queued packets */
+    int thread_queue_bytes;     /* maximum size of the queued packets, 0 for no limit */
+    pthread_mutex_t queue_lock; /* protects queued_bytes and queue_abort */
+    pthread_cond_t queue_cond;  /* signalled when queued packets are taken */
+    int64_t queued_bytes;       /* size of the packets in in_thread_queue */
+    int queue_abort;            /* the thread must stop waiting for room */
+    int64_t demux_stall;        /* time the main thread blocked waiting for packets, in us */
 #endif
 } InputFile;
 
@@ -527,6 +539,19 @@ typedef struct OutputStream {
 
     int keep_pix_fmt;
 
+    /* Eagle per-GOP rate control */
+    AVRateControlOverride eagle_rc; // settings of the GOP starting with the next frame
+    int eagle_rc_pending;           // eagle_rc not applied yet
+    int eagle_rung;                 // 1-based rung of -eagle_ladder, 0 for the main output
+    int eagle_gop;                  // number of GOPs started
+
+#if HAVE_THREADS
+    AVThreadMessageQueue *enc_queue; // frames waiting for the encoder thread
+    pthread_t enc_thread;            // thread encoding and muxing this stream
+    int enc_thread_ret;              // error the encoder thread stopped on
+#endif
+    int muxer_failed;                // the muxer failed to write a packet of this stream
+
     /* stats */
     // combined size of all the packets written
     uint64_t data_size;
@@ -609,7 +634,23 @@ extern char *videotoolbox_pixfmt;
 
 extern int filter_nbthreads;
 extern int filter_complex_nbthreads;
+extern int filter_parallel;
+extern int demux_thread;
+extern int encode_thread;
+extern int encode_queue_size;
 extern int vstats_version;
+extern int eagle_lookahead;
+extern int eagle_threads;
+extern char *eagle_search;
+extern int eagle_probe_height;
+extern int eagle_vmaf_subsample;
+extern int eagle_calibrate;
+extern char *eagle_cache;
+extern int eagle_share_decode;
+extern float eagle_scene_threshold;
+extern int eagle_min_gop;
+extern int eagle_max_gop;
+extern char *eagle_ladder;
 
 extern const AVIOInterruptCB int_cb;
 
@@ -110,7 +110,23 @@ int frame_bits_per_raw_sample = 0;
 float max_error_rate  = 2.0/3;
 int filter_nbthreads = 0;
 int filter_complex_nbthreads = 0;
+int filter_parallel = 0;
+int demux_thread = 0;
+int encode_thread = 0;
+int encode_queue_size = 8;
 int vstats_version = 2;
+int eagle_lookahead = 0;
+int eagle_threads = 1;
+char *eagle_search;
+int eagle_probe_height = 0;
+int eagle_vmaf_subsample = 1;
+int eagle_calibrate = 0;
+char *eagle_cache;
+int eagle_share_decode = 0;
+float eagle_scene_threshold = 0.4;
+int eagle_min_gop = 300;
+int eagle_max_gop = 1200;
+char *eagle_ladder;
 
 
 static int intra_only         = 0;
@@ -1213,6 +1229,7 @@ static int open_input_file(OptionsContext *o, const char *filename)
     f->time_base = (AVRational){ 1, 1 };
 #if HAVE_THREADS
     f->thread_queue_size = o->thread_queue_size > 0 ? o->thread_queue_size : 8;
+    f->thread_queue_bytes = o->thread_queue_bytes;
 #endif
 
     /* check if all codec options have been used */
@@ -3521,6 +3538,8 @@ const OptionDef options[] = {
         "reinit filtergraph on input parameter changes", "" },
     { "filter_complex", HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_filter_complex },
         "create a complex filtergraph", "graph_description" },
+    { "filter_parallel", OPT_BOOL | OPT_EXPERT,                      { &filter_parallel },
+        "run independent filters of a graph concurrently" },
     { "filter_complex_threads", HAS_ARG | OPT_INT,                   { &filter_complex_nbthreads },
         "number of threads for -filter_complex" },
     { "lavfi",          HAS_ARG | OPT_EXPERT,                        { .func_arg = opt_filter_complex },
@@ -3541,6 +3560,30 @@ const OptionDef options[] = {
         "print timestamp debugging info" },
     { "max_error_rate",  HAS_ARG | OPT_FLOAT,                        { &max_error_rate },
         "ratio of errors (0.0: no errors, 1.0: 100% errors) above which ffmpeg returns an error instead of success.", "maximum error rate" },
+    { "eagle_lookahead", HAS_ARG | OPT_INT | OPT_EXPERT,             { &eagle_lookahead },
+        "run the Eagle analysis concurrently with the transcode, at most this many GOPs ahead of the encoder", "gops" },
+    { "eagle_threads",   HAS_ARG | OPT_INT | OPT_EXPERT,             { &eagle_threads },
+        "set the number of Eagle encode/VMAF probes run concurrently (0 for one per CPU)", "count" },
+    { "eagle_search",    HAS_ARG | OPT_STRING | OPT_EXPERT,          { &eagle_search },
+        "set the Eagle CRF search strategy (linear, bisect, secant, model)", "strategy" },
+    { "eagle_probe_height", HAS_ARG | OPT_INT | OPT_EXPERT,          { &eagle_probe_height },
+        "downscale the Eagle CRF probes to this height (0 for the source height)", "height" },
+    { "eagle_vmaf_subsample", HAS_ARG | OPT_INT | OPT_EXPERT,        { &eagle_vmaf_subsample },
+        "score every nth frame of the Eagle CRF probes", "n" },
+    { "eagle_calibrate", OPT_BOOL | OPT_EXPERT,                      { &eagle_calibrate },
+        "compare the fast Eagle CRF probes against full-fidelity ones" },
+    { "eagle_cache",     HAS_ARG | OPT_STRING | OPT_EXPERT,          { &eagle_cache },
+        "reuse and store the Eagle analysis results of each GOP in this file", "filename" },
+    { "eagle_share_decode", HAS_ARG | OPT_INT | OPT_EXPERT,          { &eagle_share_decode },
+        "let the transcode reuse the frames decoded by the Eagle analysis, keeping at most this many MiB of them", "size" },
+    { "eagle_scene_threshold", HAS_ARG | OPT_FLOAT | OPT_EXPERT,     { &eagle_scene_threshold },
+        "start a new Eagle GOP at frames whose scene change score reaches this value", "score" },
+    { "eagle_min_gop",   HAS_ARG | OPT_INT | OPT_EXPERT,             { &eagle_min_gop },
+        "set the minimum number of frames of an Eagle GOP", "frames" },
+    { "eagle_max_gop",   HAS_ARG | OPT_INT | OPT_EXPERT,             { &eagle_max_gop },
+        "set the maximum number of frames of an Eagle GOP", "frames" },
+    { "eagle_ladder",    HAS_ARG | OPT_STRING | OPT_EXPERT,          { &eagle_ladder },
+        "also encode these renditions, each with a CRF searched by the Eagle analysis", "WxH[:vmaf]|..." },
     { "discard",        OPT_STRING | HAS_ARG | OPT_SPEC |
                         OPT_INPUT,                                   { .off = OFFSET(discard) },
         "discard", "" },
@@ -3550,6 +3593,15 @@ const OptionDef options[] = {
     { "thread_queue_size", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT,
                                                                      { .off = OFFSET(thread_queue_size) },
         "set the maximum number of queued packets from the demuxer" },
+    { "thread_queue_bytes", HAS_ARG | OPT_INT | OPT_OFFSET | OPT_EXPERT | OPT_INPUT,
+                                                                     { .off = OFFSET(thread_queue_bytes) },
+        "set the maximum size of the queued packets from the demuxer" },
+    { "demux_thread",   OPT_BOOL | OPT_EXPERT,                       { &demux_thread },
+        "read every input file on its own thread, even a single one" },
+    { "encode_thread",  OPT_BOOL | OPT_EXPERT,                       { &encode_thread },
+        "encode and mux every output stream on its own thread" },
+    { "encode_queue_size", HAS_ARG | OPT_INT | OPT_EXPERT,           { &encode_queue_size },
+        "set the maximum number of frames queued for each encoder thread", "size" },
     { "find_stream_info", OPT_BOOL | OPT_PERFILE | OPT_INPUT | OPT_EXPERT, { &find_stream_info },
         "read and decode the streams to fill missing information with heuristics" },
 
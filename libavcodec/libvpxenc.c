@@ -1291,6 +1291,26 @@ static int vp8_encode_set_roi(AVCodecContext *avctx, int frame_width, int frame_
     return ret;
 }
 
+static void vpx_encode_set_rc(AVCodecContext *avctx, const AVFrameSideData *sd)
+{
+    VPxContext *ctx = avctx->priv_data;
+    const AVRateControlOverride *rc = (const AVRateControlOverride *)sd->data;
+    int crf;
+
+    if (sd->size < sizeof(*rc) || rc->self_size < sizeof(*rc)) {
+        av_log(avctx, AV_LOG_WARNING, "Invalid AVRateControlOverride.self_size.\n");
+        return;
+    }
+
+    /* only the level of the constrained and constant quality modes can be
+     * changed, there is no adaptive quantization strength */
+    if (rc->crf < 0 || ctx->crf < 0)
+        return;
+    crf = av_clip(lrintf(rc->crf), 0, 63);
+    if (crf != ctx->crf && !codecctl_int(avctx, VP8E_SET_CQ_LEVEL, crf))
+        ctx->crf = crf;
+}
+
 static int realloc_alpha_uv(AVCodecContext *avctx, int width, int height)
 {
     VPxContext *ctx = avctx->priv_data;
@@ -1331,6 +1351,7 @@ static int vpx_encode(AVCodecContext *avctx, AVPacket *pkt,
 
     if (frame) {
         const AVFrameSideData *sd = av_frame_get_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+        const AVFrameSideData *rc = av_frame_get_side_data(frame, AV_FRAME_DATA_RATE_CONTROL_OVERRIDE);
         rawimg                      = &ctx->rawimg;
         rawimg->planes[VPX_PLANE_Y] = frame->data[0];
         rawimg->planes[VPX_PLANE_U] = frame->data[1];
@@ -1373,6 +1394,9 @@ static int vpx_encode(AVCodecContext *avctx, AVPacket *pkt,
                 vp9_encode_set_roi(avctx, frame->width, frame->height, sd);
             }
         }
+
+        if (rc)
+            vpx_encode_set_rc(avctx, rc);
     }
 
     res = vpx_codec_encode(&ctx->encoder, rawimg, timestamp,
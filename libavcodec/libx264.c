@@ -188,6 +188,19 @@ static void reconfig_encoder(AVCodecContext *ctx, const AVFrame *frame)
     X264Context *x4 = ctx->priv_data;
     AVFrameSideData *side_data;
 
+    side_data = av_frame_get_side_data(frame, AV_FRAME_DATA_RATE_CONTROL_OVERRIDE);
+    if (side_data) {
+        const AVRateControlOverride *rc = (const AVRateControlOverride *)side_data->data;
+
+        if (side_data->size < sizeof(*rc) || rc->self_size < sizeof(*rc)) {
+            av_log(ctx, AV_LOG_WARNING, "Invalid AVRateControlOverride.self_size.\n");
+        } else {
+            if (rc->crf >= 0)
+                x4->crf = rc->crf;
+            if (rc->aq_strength >= 0)
+                x4->aq_strength = rc->aq_strength;
+        }
+    }
 
   if (x4->avcintra_class < 0) {
     if (x4->params.b_interlaced && x4->params.b_tff != frame->top_field_first) {
@@ -233,6 +246,12 @@ static void reconfig_encoder(AVCodecContext *ctx, const AVFrame *frame)
         x4->params.rc.f_rf_constant_max = x4->crf_max;
         x264_encoder_reconfig(x4->enc, &x4->params);
     }
+
+    if (x4->aq_strength >= 0 &&
+        x4->params.rc.f_aq_strength != x4->aq_strength) {
+        x4->params.rc.f_aq_strength = x4->aq_strength;
+        x264_encoder_reconfig(x4->enc, &x4->params);
+    }
   }
 
     side_data = av_frame_get_side_data(frame, AV_FRAME_DATA_STEREO3D);
@@ -379,6 +379,34 @@ static av_cold int libx265_encode_set_roi(libx265Context *ctx, const AVFrame *fr
     return 0;
 }
 
+static void libx265_encode_set_rc(AVCodecContext *avctx, const AVFrame *frame)
+{
+    libx265Context *ctx = avctx->priv_data;
+    AVFrameSideData *sd = av_frame_get_side_data(frame, AV_FRAME_DATA_RATE_CONTROL_OVERRIDE);
+    const AVRateControlOverride *rc;
+    int reconfig = 0;
+
+    if (!sd)
+        return;
+    rc = (const AVRateControlOverride *)sd->data;
+    if (sd->size < sizeof(*rc) || rc->self_size < sizeof(*rc)) {
+        av_log(avctx, AV_LOG_WARNING, "Invalid AVRateControlOverride.self_size.\n");
+        return;
+    }
+
+    if (rc->crf >= 0 && ctx->params->rc.rateControlMode == X265_RC_CRF &&
+        ctx->params->rc.rfConstant != rc->crf) {
+        ctx->params->rc.rfConstant = rc->crf;
+        reconfig = 1;
+    }
+    if (rc->aq_strength >= 0 && ctx->params->rc.aqStrength != rc->aq_strength) {
+        ctx->params->rc.aqStrength = rc->aq_strength;
+        reconfig = 1;
+    }
+    if (reconfig && ctx->api->encoder_reconfig(ctx->encoder, ctx->params) < 0)
+        av_log(avctx, AV_LOG_WARNING, "x265 rejected the rate control override.\n");
+}
+
 static int libx265_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
                                 const AVFrame *pic, int *got_packet)
 {
@@ -412,6 +440,8 @@ static int libx265_encode_frame(AVCodecContext *avctx, AVPacket *pkt,
         ret = libx265_encode_set_roi(ctx, pic, &x265pic);
         if (ret < 0)
             return ret;
+
+        libx265_encode_set_rc(avctx, pic);
     }
 
     ret = ctx->api->encoder_encode(ctx->encoder, &nal, &nnal,
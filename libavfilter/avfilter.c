@@ -192,7 +192,10 @@ int avfilter_link_get_channels(AVFilterLink *link)
 
 void ff_filter_set_ready(AVFilterContext *filter, unsigned priority)
 {
-    filter->ready = FFMAX(filter->ready, priority);
+    if (filter->graph)
+        ff_filter_graph_set_ready(filter->graph, filter, priority);
+    else
+        filter->ready = FFMAX(filter->ready, priority);
 }
 
 /**
@@ -203,8 +206,12 @@ static void filter_unblock(AVFilterContext *filter)
 {
     unsigned i;
 
+    if (filter->graph)
+        ff_filter_graph_lock(filter->graph);
     for (i = 0; i < filter->nb_outputs; i++)
         filter->outputs[i]->frame_blocked_in = 0;
+    if (filter->graph)
+        ff_filter_graph_unlock(filter->graph);
 }
 
 
@@ -547,11 +554,16 @@ void ff_update_link_current_pts(AVFilterLink *link, int64_t pts)
 {
     if (pts == AV_NOPTS_VALUE)
         return;
+    /* sink links are compared with each other in the age heap */
+    if (link->graph)
+        ff_filter_graph_lock(link->graph);
     link->current_pts = pts;
     link->current_pts_us = av_rescale_q(pts, link->time_base, AV_TIME_BASE_Q);
     /* TODO use duration */
     if (link->graph && link->age_index >= 0)
         ff_avfilter_graph_update_heap(link->graph, link);
+    if (link->graph)
+        ff_filter_graph_unlock(link->graph);
 }
 
 int avfilter_process_command(AVFilterContext *filter, const char *cmd, const char *arg, char *res, int res_len, int flags)
@@ -1438,7 +1450,10 @@ int ff_filter_activate(AVFilterContext *filter)
     /* Generic timeline support is not yet implemented but should be easy */
     av_assert1(!(filter->filter->flags & AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC &&
                  filter->filter->activate));
-    filter->ready = 0;
+    if (filter->graph)
+        ff_filter_graph_clear_ready(filter->graph, filter);
+    else
+        filter->ready = 0;
     ret = filter->filter->activate ? filter->filter->activate(filter) :
           ff_filter_activate_default(filter);
     if (ret == FFERROR_NOT_READY)
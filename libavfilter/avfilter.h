@@ -332,6 +332,13 @@ typedef struct AVFilter {
  */
 #define AVFILTER_THREAD_SLICE (1 << 0)
 
+/**
+ * Activate filters that do not share a link concurrently. Only used when set
+ * in AVFilterGraph.thread_type, all the filters of the graph must then be safe
+ * to run at the same time as other filter instances.
+ */
+#define AVFILTER_THREAD_GRAPH (1 << 1)
+
 typedef struct AVFilterInternal AVFilterInternal;
 
 /** An instance of a filter */
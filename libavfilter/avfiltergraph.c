@@ -50,6 +50,7 @@ static const AVOption filtergraph_options[] = {
     { "thread_type", "Allowed thread types", OFFSET(thread_type), AV_OPT_TYPE_FLAGS,
         { .i64 = AVFILTER_THREAD_SLICE }, 0, INT_MAX, F|V|A, "thread_type" },
         { "slice", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_SLICE }, .flags = F|V|A, .unit = "thread_type" },
+        { "graph", NULL, 0, AV_OPT_TYPE_CONST, { .i64 = AVFILTER_THREAD_GRAPH }, .flags = F|V|A, .unit = "thread_type" },
     { "threads",     "Maximum number of threads", OFFSET(nb_threads),
         AV_OPT_TYPE_INT,   { .i64 = 0 }, 0, INT_MAX, F|V|A },
     {"scale_sws_opts"       , "default scale filter options"        , OFFSET(scale_sws_opts)        ,
@@ -78,6 +79,17 @@ int ff_graph_thread_init(AVFilterGraph *graph)
     graph->nb_threads  = 1;
     return 0;
 }
+
+int ff_graph_parallel_init(AVFilterGraph *graph)
+{
+    graph->thread_type &= ~AVFILTER_THREAD_GRAPH;
+    return 0;
+}
+
+int ff_graph_parallel_execute(AVFilterGraph *graph, int nb_filters)
+{
+    return AVERROR_BUG;
+}
 #endif
 
 AVFilterGraph *avfilter_graph_alloc(void)
@@ -95,18 +107,106 @@ AVFilterGraph *avfilter_graph_alloc(void)
     ret->av_class = &filtergraph_class;
     av_opt_set_defaults(ret);
     ff_framequeue_global_init(&ret->internal->frame_queues);
+    ff_mutex_init(&ret->internal->lock, NULL);
 
     return ret;
 }
 
+static int ready_before(const AVFilterContext *a, const AVFilterContext *b)
+{
+    return a->ready > b->ready ||
+           (a->ready == b->ready && a->internal->graph_index < b->internal->graph_index);
+}
+
+/* Move a filter of the ready heap from index to where it belongs. */
+static void ready_heap_update(AVFilterGraphInternal *gi, AVFilterContext *filter,
+                              unsigned index)
+{
+    AVFilterContext **heap = gi->ready;
+
+    while (index) {
+        unsigned parent = (index - 1) >> 1;
+        if (!ready_before(filter, heap[parent]))
+            break;
+        heap[index] = heap[parent];
+        heap[index]->internal->ready_index = index;
+        index = parent;
+    }
+    while (1) {
+        unsigned child = 2 * index + 1;
+        if (child >= gi->nb_ready)
+            break;
+        if (child + 1 < gi->nb_ready && ready_before(heap[child + 1], heap[child]))
+            child++;
+        if (!ready_before(heap[child], filter))
+            break;
+        heap[index] = heap[child];
+        heap[index]->internal->ready_index = index;
+        index = child;
+    }
+    heap[index] = filter;
+    filter->internal->ready_index = index;
+}
+
+static void ready_heap_remove(AVFilterGraphInternal *gi, AVFilterContext *filter)
+{
+    unsigned index = filter->internal->ready_index;
+
+    if (index < --gi->nb_ready)
+        ready_heap_update(gi, gi->ready[gi->nb_ready], index);
+}
+
+void ff_filter_graph_lock(AVFilterGraph *graph)
+{
+    if (graph->internal->parallel)
+        ff_mutex_lock(&graph->internal->lock);
+}
+
+void ff_filter_graph_unlock(AVFilterGraph *graph)
+{
+    if (graph->internal->parallel)
+        ff_mutex_unlock(&graph->internal->lock);
+}
+
+void ff_filter_graph_set_ready(AVFilterGraph *graph, AVFilterContext *filter,
+                               unsigned priority)
+{
+    AVFilterGraphInternal *gi = graph->internal;
+
+    ff_filter_graph_lock(graph);
+    if (priority > filter->ready) {
+        int queued = !!filter->ready;
+        filter->ready = priority;
+        ready_heap_update(gi, filter, queued ? filter->internal->ready_index
+                                             : gi->nb_ready++);
+    }
+    ff_filter_graph_unlock(graph);
+}
+
+void ff_filter_graph_clear_ready(AVFilterGraph *graph, AVFilterContext *filter)
+{
+    ff_filter_graph_lock(graph);
+    if (filter->ready) {
+        ready_heap_remove(graph->internal, filter);
+        filter->ready = 0;
+    }
+    ff_filter_graph_unlock(graph);
+}
+
 void ff_filter_graph_remove_filter(AVFilterGraph *graph, AVFilterContext *filter)
 {
     int i, j;
     for (i = 0; i < graph->nb_filters; i++) {
         if (graph->filters[i] == filter) {
+            AVFilterContext *moved = graph->filters[graph->nb_filters - 1];
+
+            ff_filter_graph_clear_ready(graph, filter);
             FFSWAP(AVFilterContext*, graph->filters[i],
                    graph->filters[graph->nb_filters - 1]);
             graph->nb_filters--;
+            moved->internal->graph_index = i;
+            if (moved->ready)
+                ready_heap_update(graph->internal, moved, moved->internal->ready_index);
             filter->graph = NULL;
             for (j = 0; j<filter->nb_outputs; j++)
                 if (filter->outputs[j])
@@ -128,6 +228,8 @@ void avfilter_graph_free(AVFilterGraph **graph)
     ff_graph_thread_free(*graph);
 
     av_freep(&(*graph)->sink_links);
+    av_freep(&(*graph)->internal->ready);
+    ff_mutex_destroy(&(*graph)->internal->lock);
 
     av_freep(&(*graph)->scale_sws_opts);
     av_freep(&(*graph)->aresample_swr_opts);
@@ -183,12 +285,26 @@ AVFilterContext *avfilter_graph_alloc_filter(AVFilterGraph *graph,
                 return NULL;
             }
         }
+        if (graph->thread_type & AVFILTER_THREAD_GRAPH) {
+            int ret = ff_graph_parallel_init(graph);
+            if (ret < 0) {
+                av_log(graph, AV_LOG_ERROR, "Error initializing graph threading: %s.\n", av_err2str(ret));
+                return NULL;
+            }
+        }
     }
 
     s = ff_filter_alloc(filter, name);
     if (!s)
         return NULL;
 
+    filters = av_realloc_array(graph->internal->ready, graph->nb_filters + 1, sizeof(*filters));
+    if (!filters) {
+        avfilter_free(s);
+        return NULL;
+    }
+    graph->internal->ready = filters;
+
     filters = av_realloc(graph->filters, sizeof(*filters) * (graph->nb_filters + 1));
     if (!filters) {
         avfilter_free(s);
@@ -196,6 +312,7 @@ AVFilterContext *avfilter_graph_alloc_filter(AVFilterGraph *graph,
     }
 
     graph->filters = filters;
+    s->internal->graph_index = graph->nb_filters;
     graph->filters[graph->nb_filters++] = s;
 
     s->graph = graph;
@@ -1441,17 +1558,45 @@ int avfilter_graph_request_oldest(AVFilterGraph *graph)
     return 0;
 }
 
+static int filters_linked(const AVFilterContext *a, const AVFilterContext *b)
+{
+    unsigned i;
+
+    for (i = 0; i < a->nb_inputs; i++)
+        if (a->inputs[i] && a->inputs[i]->src == b)
+            return 1;
+    for (i = 0; i < a->nb_outputs; i++)
+        if (a->outputs[i] && a->outputs[i]->dst == b)
+            return 1;
+    return 0;
+}
+
 int ff_filter_graph_run_once(AVFilterGraph *graph)
 {
+    AVFilterGraphInternal *gi = graph->internal;
     AVFilterContext *filter;
     unsigned i;
+    int nb = 1, j;
 
     av_assert0(graph->nb_filters);
-    filter = graph->filters[0];
-    for (i = 1; i < graph->nb_filters; i++)
-        if (graph->filters[i]->ready > filter->ready)
-            filter = graph->filters[i];
-    if (!filter->ready)
+    if (!gi->nb_ready)
         return AVERROR(EAGAIN);
-    return ff_filter_activate(filter);
+    filter = gi->ready[0];
+    if (gi->batch_size < 2 || gi->nb_ready < 2)
+        return ff_filter_activate(filter);
+
+    /* Filters sharing no link only meet through the state of common
+     * neighbours, which is updated under the graph lock. */
+    gi->batch[0] = filter;
+    for (i = 1; i < gi->nb_ready && nb < gi->batch_size; i++) {
+        AVFilterContext *f = gi->ready[i];
+        if (f->ready != filter->ready)
+            continue;
+        for (j = 0; j < nb && !filters_linked(f, gi->batch[j]); j++);
+        if (j == nb)
+            gi->batch[nb++] = f;
+    }
+    if (nb == 1)
+        return ff_filter_activate(filter);
+    return ff_graph_parallel_execute(graph, nb);
 }
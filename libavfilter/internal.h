@@ -25,6 +25,7 @@
  */
 
 #include "libavutil/internal.h"
+#include "libavutil/thread.h"
 #include "avfilter.h"
 #include "formats.h"
 #include "framepool.h"
@@ -45,6 +46,7 @@ typedef struct AVFilterCommand {
 
 /**
  * Update the position of a link in the age heap.
+ * Must be called with the graph lock held, see ff_filter_graph_lock().
  */
 void ff_avfilter_graph_update_heap(AVFilterGraph *graph, AVFilterLink *link);
 
@@ -149,10 +151,34 @@ struct AVFilterGraphInternal {
     void *thread;
     avfilter_execute_func *thread_execute;
     FFFrameQueueGlobal frame_queues;
+
+    /**
+     * Heap of the filters with a non-zero ready status, the highest status
+     * first and the lowest index in AVFilterGraph.filters among equals.
+     */
+    AVFilterContext **ready;
+    unsigned nb_ready;
+
+    /**
+     * Pool activating independent filters for AVFILTER_THREAD_GRAPH and its
+     * batch of filters, batch_size entries long.
+     */
+    void *graph_thread;
+    AVFilterContext **batch;
+    int batch_size;
+
+    /**
+     * Protects the ready heap, the sink links heap and the state filters
+     * change on their neighbours while a batch runs.
+     */
+    AVMutex lock;
+    int parallel;
 };
 
 struct AVFilterInternal {
     avfilter_execute_func *execute;
+    unsigned graph_index;       ///< index in AVFilterGraph.filters
+    unsigned ready_index;       ///< index in the ready heap if ready is set
 };
 
 /**
@@ -389,6 +415,24 @@ void ff_filter_graph_remove_filter(AVFilterGraph *graph, AVFilterContext *filter
  */
 int ff_filter_graph_run_once(AVFilterGraph *graph);
 
+/**
+ * Raise the ready status of a filter of the graph and queue it.
+ */
+void ff_filter_graph_set_ready(AVFilterGraph *graph, AVFilterContext *filter,
+                               unsigned priority);
+
+/**
+ * Clear the ready status of a filter of the graph before activating it.
+ */
+void ff_filter_graph_clear_ready(AVFilterGraph *graph, AVFilterContext *filter);
+
+/**
+ * Serialize changes to state shared between filters while independent
+ * filters of the graph are activated concurrently; no-op otherwise.
+ */
+void ff_filter_graph_lock(AVFilterGraph *graph);
+void ff_filter_graph_unlock(AVFilterGraph *graph);
+
 /**
  * Normalize the qscale factor
  * FIXME the H264 qscale is a log based scale, mpeg1/2 is not, the code below
@@ -38,12 +38,21 @@ typedef struct ThreadContext {
     AVSliceThread *thread;
     avfilter_action_func *func;
 
+    /* serializes executes from filters activated concurrently */
+    AVMutex lock;
+
     /* per-execute parameters */
     AVFilterContext *ctx;
     void *arg;
     int   *rets;
 } ThreadContext;
 
+typedef struct GraphThreadContext {
+    AVSliceThread *thread;
+    AVFilterContext **filters;
+    int *rets;
+} GraphThreadContext;
+
 static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
 {
     ThreadContext *c = priv;
@@ -55,6 +64,7 @@ static void worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb
 static void slice_thread_uninit(ThreadContext *c)
 {
     avpriv_slicethread_free(&c->thread);
+    ff_mutex_destroy(&c->lock);
 }
 
 static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
@@ -64,12 +74,14 @@ static int thread_execute(AVFilterContext *ctx, avfilter_action_func *func,
 
     if (nb_jobs <= 0)
         return 0;
+    ff_mutex_lock(&c->lock);
     c->ctx         = ctx;
     c->arg         = arg;
     c->func        = func;
     c->rets        = ret;
 
     avpriv_slicethread_execute(c->thread, nb_jobs, 0);
+    ff_mutex_unlock(&c->lock);
     return 0;
 }
 
@@ -78,9 +90,17 @@ static int thread_init_internal(ThreadContext *c, int nb_threads)
     nb_threads = avpriv_slicethread_create(&c->thread, c, worker_func, NULL, nb_threads);
     if (nb_threads <= 1)
         avpriv_slicethread_free(&c->thread);
+    else
+        ff_mutex_init(&c->lock, NULL);
     return FFMAX(nb_threads, 1);
 }
 
+static void graph_worker_func(void *priv, int jobnr, int threadnr, int nb_jobs, int nb_threads)
+{
+    GraphThreadContext *c = priv;
+    c->rets[jobnr] = ff_filter_activate(c->filters[jobnr]);
+}
+
 int ff_graph_thread_init(AVFilterGraph *graph)
 {
     int ret;
@@ -110,7 +130,59 @@ int ff_graph_thread_init(AVFilterGraph *graph)
 
 void ff_graph_thread_free(AVFilterGraph *graph)
 {
+    GraphThreadContext *gc = graph->internal->graph_thread;
+
     if (graph->internal->thread)
         slice_thread_uninit(graph->internal->thread);
     av_freep(&graph->internal->thread);
+
+    if (gc) {
+        avpriv_slicethread_free(&gc->thread);
+        av_freep(&gc->rets);
+    }
+    av_freep(&graph->internal->graph_thread);
+    av_freep(&graph->internal->batch);
+    graph->internal->batch_size = 0;
+}
+
+int ff_graph_parallel_init(AVFilterGraph *graph)
+{
+    GraphThreadContext *gc;
+    int nb_threads;
+
+    gc = graph->internal->graph_thread = av_mallocz(sizeof(*gc));
+    if (!gc)
+        return AVERROR(ENOMEM);
+
+    nb_threads = avpriv_slicethread_create(&gc->thread, gc, graph_worker_func,
+                                           NULL, graph->nb_threads);
+    if (nb_threads <= 1) {
+        avpriv_slicethread_free(&gc->thread);
+        av_freep(&graph->internal->graph_thread);
+        graph->thread_type &= ~AVFILTER_THREAD_GRAPH;
+        return FFMIN(nb_threads, 0);
+    }
+
+    graph->internal->batch = av_malloc_array(nb_threads, sizeof(*graph->internal->batch));
+    gc->rets               = av_malloc_array(nb_threads, sizeof(*gc->rets));
+    if (!graph->internal->batch || !gc->rets)
+        return AVERROR(ENOMEM);
+    graph->internal->batch_size = nb_threads;
+    gc->filters = graph->internal->batch;
+
+    return 0;
+}
+
+int ff_graph_parallel_execute(AVFilterGraph *graph, int nb_filters)
+{
+    GraphThreadContext *gc = graph->internal->graph_thread;
+    int i, ret = 0;
+
+    graph->internal->parallel = 1;
+    avpriv_slicethread_execute(gc->thread, nb_filters, 0);
+    graph->internal->parallel = 0;
+
+    for (i = 0; i < nb_filters && !ret; i++)
+        ret = gc->rets[i];
+    return ret;
 }
@@ -0,0 +1,56 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFILTER_SHARPDETECT_H
+#define AVFILTER_SHARPDETECT_H
+
+#include <stdint.h>
+
+/**
+ * Row kernels of the sharpdetect filter. The blur is the one of the unsharp
+ * filter: a cascade of [1 1] stages, 2 * steps_x along the rows followed by
+ * 2 * steps_y down the columns.
+ *
+ * The uint32_t buffers are 32-byte aligned and padded, the kernels may
+ * process up to 15 elements past width.
+ */
+typedef struct SharpDetectDSPContext {
+    /**
+     * One horizontal stage: dst[x] = src[x] + src[x - 1].
+     * src[-1] must be readable, dst and src must not overlap.
+     */
+    void (*hblur)(uint32_t *dst, const uint32_t *src, int width);
+
+    /**
+     * Two vertical stages, sc0 and sc1 holding the previous input of each:
+     *     t = sc0[x] + row[x]; sc0[x] = row[x];
+     *     row[x] = sc1[x] + t; sc1[x] = t;
+     */
+    void (*vblur)(uint32_t *row, uint32_t *sc0, uint32_t *sc1, int width);
+
+    /**
+     * @return sum of src[x] - ((blur[x] + (1 << (scalebits - 1))) >> scalebits)
+     * width must be a multiple of 16, src needs no alignment.
+     */
+    int (*residual)(const uint8_t *src, const uint32_t *blur, int width, int scalebits);
+} SharpDetectDSPContext;
+
+void ff_sharpdetect_init(SharpDetectDSPContext *dsp);
+void ff_sharpdetect_init_x86(SharpDetectDSPContext *dsp);
+
+#endif /* AVFILTER_SHARPDETECT_H */
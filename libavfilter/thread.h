@@ -25,4 +25,16 @@ int ff_graph_thread_init(AVFilterGraph *graph);
 
 void ff_graph_thread_free(AVFilterGraph *graph);
 
+/**
+ * Create the pool activating independent filters for AVFILTER_THREAD_GRAPH.
+ */
+int ff_graph_parallel_init(AVFilterGraph *graph);
+
+/**
+ * Activate the nb_filters first filters of the graph batch concurrently.
+ *
+ * @return the first error returned by ff_filter_activate(), 0 otherwise
+ */
+int ff_graph_parallel_execute(AVFilterGraph *graph, int nb_filters);
+
 #endif /* AVFILTER_THREAD_H */
@@ -0,0 +1,263 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Measure the sharpness of the luma plane as the sum of the differences
+ * between each pixel and the unsharp filter blur ending at it.
+ */
+
+#include <inttypes.h>
+
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "avfilter.h"
+#include "formats.h"
+#include "internal.h"
+#include "sharpdetect.h"
+#include "video.h"
+
+#define PAD 16  ///< zeroed elements in front of each scratch row
+
+typedef struct SharpDetectContext {
+    const AVClass *class;
+    int msize_x, msize_y;
+    int steps_x, steps_y;
+    int scalebits;
+
+    int width;              ///< measured pixels per row
+    int nb_jobs;
+    int stride;             ///< elements per scratch row
+    uint32_t *rows;         ///< per job: 2 blur rows, then 2 * steps_y column states
+    int64_t *sums;          ///< per job result
+
+    SharpDetectDSPContext dsp;
+} SharpDetectContext;
+
+static void hblur_c(uint32_t *dst, const uint32_t *src, int width)
+{
+    for (int x = 0; x < width; x++)
+        dst[x] = src[x] + src[x - 1];
+}
+
+static void vblur_c(uint32_t *row, uint32_t *sc0, uint32_t *sc1, int width)
+{
+    for (int x = 0; x < width; x++) {
+        uint32_t t = sc0[x] + row[x];
+        sc0[x] = row[x];
+        row[x] = sc1[x] + t;
+        sc1[x] = t;
+    }
+}
+
+static int residual_c(const uint8_t *src, const uint32_t *blur, int width, int scalebits)
+{
+    const uint32_t halfscale = 1 << (scalebits - 1);
+    int sum = 0;
+
+    for (int x = 0; x < width; x++)
+        sum += src[x] - (int)((blur[x] + halfscale) >> scalebits);
+    return sum;
+}
+
+av_cold void ff_sharpdetect_init(SharpDetectDSPContext *dsp)
+{
+    dsp->hblur    = hblur_c;
+    dsp->vblur    = vblur_c;
+    dsp->residual = residual_c;
+
+    if (ARCH_X86)
+        ff_sharpdetect_init_x86(dsp);
+}
+
+static av_cold int init(AVFilterContext *ctx)
+{
+    SharpDetectContext *s = ctx->priv;
+
+    if (!(s->msize_x & s->msize_y & 1)) {
+        av_log(ctx, AV_LOG_ERROR, "Invalid even matrix size %dx%d\n", s->msize_x, s->msize_y);
+        return AVERROR(EINVAL);
+    }
+    s->steps_x   = s->msize_x / 2;
+    s->steps_y   = s->msize_y / 2;
+    s->scalebits = (s->steps_x + s->steps_y) * 2;
+    /* keep the rounded blur of a white pixel within 32 bits */
+    if (s->scalebits > 24) {
+        av_log(ctx, AV_LOG_ERROR, "Matrix size %dx%d too big\n", s->msize_x, s->msize_y);
+        return AVERROR(EINVAL);
+    }
+
+    ff_sharpdetect_init(&s->dsp);
+    return 0;
+}
+
+static int query_formats(AVFilterContext *ctx)
+{
+    static const enum AVPixelFormat pix_fmts[] = {
+        AV_PIX_FMT_YUV420P,  AV_PIX_FMT_YUV422P,  AV_PIX_FMT_YUV444P,  AV_PIX_FMT_YUV410P,
+        AV_PIX_FMT_YUV411P,  AV_PIX_FMT_YUV440P,  AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_YUVJ422P,
+        AV_PIX_FMT_YUVJ444P, AV_PIX_FMT_YUVJ440P, AV_PIX_FMT_GRAY8,    AV_PIX_FMT_NV12,
+        AV_PIX_FMT_NV21,     AV_PIX_FMT_NONE
+    };
+
+    AVFilterFormats *fmts_list = ff_make_format_list(pix_fmts);
+    if (!fmts_list)
+        return AVERROR(ENOMEM);
+    return ff_set_common_formats(ctx, fmts_list);
+}
+
+static int config_input(AVFilterLink *inlink)
+{
+    AVFilterContext *ctx = inlink->dst;
+    SharpDetectContext *s = ctx->priv;
+    int nb_rows = inlink->h - 1 - s->steps_y;
+
+    /* the blur starts at (steps_x, steps_y) and the last row and column
+     * are left out, as the analysis this comes from always did */
+    s->width = inlink->w - 1 - s->steps_x;
+    if (s->width <= 0 || nb_rows <= 0) {
+        s->nb_jobs = 0;
+        return 0;
+    }
+
+    /* every job but the first reads 2 * steps_y rows ahead of its slice */
+    s->nb_jobs = av_clip(nb_rows / (4 * s->steps_y), 1, ff_filter_get_nb_threads(ctx));
+    s->stride  = PAD + FFALIGN(s->width, 16);
+
+    av_freep(&s->rows);
+    av_freep(&s->sums);
+    s->rows = av_mallocz_array((size_t)s->stride * s->nb_jobs, (2 + 2 * s->steps_y) * sizeof(*s->rows));
+    s->sums = av_malloc_array(s->nb_jobs, sizeof(*s->sums));
+    if (!s->rows || !s->sums)
+        return AVERROR(ENOMEM);
+    return 0;
+}
+
+static int sharpdetect_slice(AVFilterContext *ctx, void *arg, int jobnr, int nb_jobs)
+{
+    SharpDetectContext *s = ctx->priv;
+    const AVFrame *in = arg;
+    const int nb_rows = ctx->inputs[0]->h - 1 - s->steps_y;
+    const int slice_start = s->steps_y + nb_rows *  jobnr      / nb_jobs;
+    const int slice_end   = s->steps_y + nb_rows * (jobnr + 1) / nb_jobs;
+    const int width16     = s->width & ~15;
+    uint32_t *rows = s->rows + (size_t)jobnr * (2 + 2 * s->steps_y) * s->stride + PAD;
+    uint32_t *a = rows, *b = rows + s->stride;
+    uint32_t *sc = rows + 2 * s->stride;
+    int64_t sum = 0;
+
+    for (int z = 0; z < 2 * s->steps_y; z++)
+        memset(sc + z * s->stride, 0, s->width * sizeof(*sc));
+
+    /* the column states only depend on the last 2 * steps_y rows, so a slice
+     * is bit-exact with a single pass once those are fed in again */
+    for (int y = FFMAX(s->steps_y, slice_start - 2 * s->steps_y); y < slice_end; y++) {
+        const uint8_t *src = in->data[0] + y * in->linesize[0] + s->steps_x;
+
+        for (int x = 0; x < s->width; x++)
+            a[x] = src[x];
+        for (int z = 0; z < 2 * s->steps_x; z++) {
+            s->dsp.hblur(b, a, s->width);
+            FFSWAP(uint32_t *, a, b);
+        }
+        for (int z = 0; z < s->steps_y; z++)
+            s->dsp.vblur(a, sc + 2 * z * s->stride, sc + (2 * z + 1) * s->stride, s->width);
+
+        if (y < slice_start)
+            continue;
+        if (width16)
+            sum += s->dsp.residual(src, a, width16, s->scalebits);
+        sum += residual_c(src + width16, a + width16, s->width - width16, s->scalebits);
+    }
+    s->sums[jobnr] = sum;
+    return 0;
+}
+
+#define SET_META(key, format, value) \
+    snprintf(buf, sizeof(buf), format, value);  \
+    av_dict_set(&in->metadata, key, buf, 0)
+
+static int filter_frame(AVFilterLink *inlink, AVFrame *in)
+{
+    AVFilterContext *ctx = inlink->dst;
+    SharpDetectContext *s = ctx->priv;
+    int64_t sum = 0;
+    char buf[32];
+
+    if (s->nb_jobs) {
+        ctx->internal->execute(ctx, sharpdetect_slice, in, NULL, s->nb_jobs);
+        for (int i = 0; i < s->nb_jobs; i++)
+            sum += s->sums[i];
+    }
+
+    SET_META("lavfi.sharpdetect.sum",  "%"PRId64, sum);
+    SET_META("lavfi.sharpdetect.mean", "%f", (double)sum / (inlink->w * inlink->h));
+    return ff_filter_frame(ctx->outputs[0], in);
+}
+
+static av_cold void uninit(AVFilterContext *ctx)
+{
+    SharpDetectContext *s = ctx->priv;
+
+    av_freep(&s->rows);
+    av_freep(&s->sums);
+}
+
+#define OFFSET(x) offsetof(SharpDetectContext, x)
+#define FLAGS AV_OPT_FLAG_FILTERING_PARAM|AV_OPT_FLAG_VIDEO_PARAM
+static const AVOption sharpdetect_options[] = {
+    { "msize_x", "set matrix horizontal size", OFFSET(msize_x), AV_OPT_TYPE_INT, { .i64 = 5 }, 3, 23, FLAGS },
+    { "x",       "set matrix horizontal size", OFFSET(msize_x), AV_OPT_TYPE_INT, { .i64 = 5 }, 3, 23, FLAGS },
+    { "msize_y", "set matrix vertical size",   OFFSET(msize_y), AV_OPT_TYPE_INT, { .i64 = 5 }, 3, 23, FLAGS },
+    { "y",       "set matrix vertical size",   OFFSET(msize_y), AV_OPT_TYPE_INT, { .i64 = 5 }, 3, 23, FLAGS },
+    { NULL }
+};
+
+AVFILTER_DEFINE_CLASS(sharpdetect);
+
+static const AVFilterPad sharpdetect_inputs[] = {
+    {
+        .name         = "default",
+        .type         = AVMEDIA_TYPE_VIDEO,
+        .config_props = config_input,
+        .filter_frame = filter_frame,
+    },
+    { NULL }
+};
+
+static const AVFilterPad sharpdetect_outputs[] = {
+    {
+        .name = "default",
+        .type = AVMEDIA_TYPE_VIDEO,
+    },
+    { NULL }
+};
+
+AVFilter ff_vf_sharpdetect = {
+    .name          = "sharpdetect",
+    .description   = NULL_IF_CONFIG_SMALL("Measure the sharpness of video frames."),
+    .priv_size     = sizeof(SharpDetectContext),
+    .priv_class    = &sharpdetect_class,
+    .init          = init,
+    .uninit        = uninit,
+    .query_formats = query_formats,
+    .inputs        = sharpdetect_inputs,
+    .outputs       = sharpdetect_outputs,
+    .flags         = AVFILTER_FLAG_SUPPORT_TIMELINE_GENERIC | AVFILTER_FLAG_SLICE_THREADS,
+};
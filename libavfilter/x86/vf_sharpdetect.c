@@ -0,0 +1,227 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavutil/attributes.h"
+#include "libavutil/common.h"
+#include "libavutil/cpu.h"
+#include "libavutil/x86/asm.h"
+#include "libavutil/x86/cpu.h"
+#include "libavfilter/sharpdetect.h"
+
+#if HAVE_SSE2_INLINE
+static void hblur_sse2(uint32_t *dst, const uint32_t *src, int width)
+{
+    x86_reg len = -4 * (x86_reg)FFALIGN(width, 4);
+
+    __asm__ volatile(
+        "1:                                 \n\t"
+        "movdqu  -4(%2, %0), %%xmm0         \n\t"
+        "movdqu    (%2, %0), %%xmm1         \n\t"
+        "paddd     %%xmm1, %%xmm0           \n\t"
+        "movdqa    %%xmm0, (%1, %0)         \n\t"
+        "add         $16, %0                \n\t"
+        " js 1b                             \n\t"
+        : "+r" (len)
+        : "r" (dst + FFALIGN(width, 4)), "r" (src + FFALIGN(width, 4))
+        : XMM_CLOBBERS("%xmm0", "%xmm1",) "memory"
+    );
+}
+
+static void vblur_sse2(uint32_t *row, uint32_t *sc0, uint32_t *sc1, int width)
+{
+    x86_reg len = -4 * (x86_reg)FFALIGN(width, 4);
+
+    __asm__ volatile(
+        "1:                                 \n\t"
+        "movdqa    (%1, %0), %%xmm0         \n\t"
+        "movdqa    (%2, %0), %%xmm1         \n\t"
+        "movdqa    (%3, %0), %%xmm2         \n\t"
+        "paddd     %%xmm0, %%xmm1           \n\t"
+        "paddd     %%xmm1, %%xmm2           \n\t"
+        "movdqa    %%xmm0, (%2, %0)         \n\t"
+        "movdqa    %%xmm1, (%3, %0)         \n\t"
+        "movdqa    %%xmm2, (%1, %0)         \n\t"
+        "add         $16, %0                \n\t"
+        " js 1b                             \n\t"
+        : "+r" (len)
+        : "r" (row + FFALIGN(width, 4)), "r" (sc0 + FFALIGN(width, 4)),
+          "r" (sc1 + FFALIGN(width, 4))
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2",) "memory"
+    );
+}
+
+static int residual_sse2(const uint8_t *src, const uint32_t *blur, int width, int scalebits)
+{
+    const uint32_t halfscale = 1 << (scalebits - 1);
+    x86_reg len = -(x86_reg)width;
+    int sum;
+
+    /* the pixels are summed with psadbw, the rounded blur separately */
+    __asm__ volatile(
+        "movd          %4, %%xmm6           \n\t"
+        "movd          %5, %%xmm4           \n\t"
+        "pshufd $0, %%xmm4, %%xmm4          \n\t"
+        "pxor      %%xmm5, %%xmm5           \n\t"
+        "pxor      %%xmm2, %%xmm2           \n\t"
+        "pxor      %%xmm7, %%xmm7           \n\t"
+        "1:                                 \n\t"
+        "movdqu    (%2, %0), %%xmm0         \n\t"
+        "psadbw    %%xmm5, %%xmm0           \n\t"
+        "paddd     %%xmm0, %%xmm7           \n\t"
+        "movdqa    (%3, %0, 4), %%xmm0      \n\t"
+        "movdqa  16(%3, %0, 4), %%xmm1      \n\t"
+        "movdqa  32(%3, %0, 4), %%xmm3      \n\t"
+        "paddd     %%xmm4, %%xmm0           \n\t"
+        "paddd     %%xmm4, %%xmm1           \n\t"
+        "paddd     %%xmm4, %%xmm3           \n\t"
+        "psrld     %%xmm6, %%xmm0           \n\t"
+        "psrld     %%xmm6, %%xmm1           \n\t"
+        "psrld     %%xmm6, %%xmm3           \n\t"
+        "paddd     %%xmm0, %%xmm2           \n\t"
+        "paddd     %%xmm1, %%xmm2           \n\t"
+        "paddd     %%xmm3, %%xmm2           \n\t"
+        "movdqa  48(%3, %0, 4), %%xmm0      \n\t"
+        "paddd     %%xmm4, %%xmm0           \n\t"
+        "psrld     %%xmm6, %%xmm0           \n\t"
+        "paddd     %%xmm0, %%xmm2           \n\t"
+        "add         $16, %0                \n\t"
+        " js 1b                             \n\t"
+        "pshufd $0x4E, %%xmm2, %%xmm0       \n\t"
+        "paddd     %%xmm0, %%xmm2           \n\t"
+        "pshufd $0x55, %%xmm2, %%xmm0       \n\t"
+        "paddd     %%xmm0, %%xmm2           \n\t"
+        "pshufd $0x4E, %%xmm7, %%xmm0       \n\t"
+        "paddd     %%xmm0, %%xmm7           \n\t"
+        "psubd     %%xmm2, %%xmm7           \n\t"
+        "movd      %%xmm7, %1               \n\t"
+        : "+r" (len), "=r" (sum)
+        : "r" (src + width), "r" (blur + width),
+          "rm" (scalebits), "rm" (halfscale)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm3",
+                       "%xmm4", "%xmm5", "%xmm6", "%xmm7",) "memory"
+    );
+    return sum;
+}
+#endif /* HAVE_SSE2_INLINE */
+
+#if HAVE_AVX2_INLINE
+static void hblur_avx2(uint32_t *dst, const uint32_t *src, int width)
+{
+    x86_reg len = -4 * (x86_reg)FFALIGN(width, 8);
+
+    __asm__ volatile(
+        "1:                                 \n\t"
+        "vmovdqu -4(%2, %0), %%ymm0         \n\t"
+        "vpaddd    (%2, %0), %%ymm0, %%ymm0 \n\t"
+        "vmovdqa   %%ymm0, (%1, %0)         \n\t"
+        "add         $32, %0                \n\t"
+        " js 1b                             \n\t"
+        "vzeroupper                         \n\t"
+        : "+r" (len)
+        : "r" (dst + FFALIGN(width, 8)), "r" (src + FFALIGN(width, 8))
+        : XMM_CLOBBERS("%xmm0",) "memory"
+    );
+}
+
+static void vblur_avx2(uint32_t *row, uint32_t *sc0, uint32_t *sc1, int width)
+{
+    x86_reg len = -4 * (x86_reg)FFALIGN(width, 8);
+
+    __asm__ volatile(
+        "1:                                 \n\t"
+        "vmovdqa   (%1, %0), %%ymm0         \n\t"
+        "vpaddd    (%2, %0), %%ymm0, %%ymm1 \n\t"
+        "vpaddd    (%3, %0), %%ymm1, %%ymm2 \n\t"
+        "vmovdqa   %%ymm0, (%2, %0)         \n\t"
+        "vmovdqa   %%ymm1, (%3, %0)         \n\t"
+        "vmovdqa   %%ymm2, (%1, %0)         \n\t"
+        "add         $32, %0                \n\t"
+        " js 1b                             \n\t"
+        "vzeroupper                         \n\t"
+        : "+r" (len)
+        : "r" (row + FFALIGN(width, 8)), "r" (sc0 + FFALIGN(width, 8)),
+          "r" (sc1 + FFALIGN(width, 8))
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2",) "memory"
+    );
+}
+
+static int residual_avx2(const uint8_t *src, const uint32_t *blur, int width, int scalebits)
+{
+    const uint32_t halfscale = 1 << (scalebits - 1);
+    x86_reg len = -(x86_reg)width;
+    int sum;
+
+    __asm__ volatile(
+        "vmovd         %4, %%xmm6                   \n\t"
+        "vmovd         %5, %%xmm4                   \n\t"
+        "vpbroadcastd %%xmm4, %%ymm4                \n\t"
+        "vpxor     %%xmm5, %%xmm5, %%xmm5           \n\t"
+        "vpxor     %%ymm2, %%ymm2, %%ymm2           \n\t"
+        "vpxor     %%xmm7, %%xmm7, %%xmm7           \n\t"
+        "1:                                         \n\t"
+        "vmovdqu   (%2, %0), %%xmm0                 \n\t"
+        "vpsadbw   %%xmm5, %%xmm0, %%xmm0           \n\t"
+        "vpaddd    %%xmm0, %%xmm7, %%xmm7           \n\t"
+        "vpaddd    (%3, %0, 4), %%ymm4, %%ymm0      \n\t"
+        "vpaddd  32(%3, %0, 4), %%ymm4, %%ymm1      \n\t"
+        "vpsrld    %%xmm6, %%ymm0, %%ymm0           \n\t"
+        "vpsrld    %%xmm6, %%ymm1, %%ymm1           \n\t"
+        "vpaddd    %%ymm0, %%ymm2, %%ymm2           \n\t"
+        "vpaddd    %%ymm1, %%ymm2, %%ymm2           \n\t"
+        "add         $16, %0                        \n\t"
+        " js 1b                                     \n\t"
+        "vextracti128 $1, %%ymm2, %%xmm0            \n\t"
+        "vpaddd    %%xmm0, %%xmm2, %%xmm2           \n\t"
+        "vpshufd $0x4E, %%xmm2, %%xmm0              \n\t"
+        "vpaddd    %%xmm0, %%xmm2, %%xmm2           \n\t"
+        "vpshufd $0x55, %%xmm2, %%xmm0              \n\t"
+        "vpaddd    %%xmm0, %%xmm2, %%xmm2           \n\t"
+        "vpshufd $0x4E, %%xmm7, %%xmm0              \n\t"
+        "vpaddd    %%xmm0, %%xmm7, %%xmm7           \n\t"
+        "vpsubd    %%xmm2, %%xmm7, %%xmm7           \n\t"
+        "vmovd     %%xmm7, %1                       \n\t"
+        "vzeroupper                                 \n\t"
+        : "+r" (len), "=r" (sum)
+        : "r" (src + width), "r" (blur + width),
+          "rm" (scalebits), "rm" (halfscale)
+        : XMM_CLOBBERS("%xmm0", "%xmm1", "%xmm2", "%xmm4",
+                       "%xmm5", "%xmm6", "%xmm7",) "memory"
+    );
+    return sum;
+}
+#endif /* HAVE_AVX2_INLINE */
+
+av_cold void ff_sharpdetect_init_x86(SharpDetectDSPContext *dsp)
+{
+    int cpu_flags = av_get_cpu_flags();
+
+#if HAVE_SSE2_INLINE
+    if (INLINE_SSE2(cpu_flags)) {
+        dsp->hblur    = hblur_sse2;
+        dsp->vblur    = vblur_sse2;
+        dsp->residual = residual_sse2;
+    }
+#endif
+#if HAVE_AVX2_INLINE
+    if (INLINE_AVX2(cpu_flags) && !(cpu_flags & AV_CPU_FLAG_AVXSLOW)) {
+        dsp->hblur    = hblur_avx2;
+        dsp->vblur    = vblur_avx2;
+        dsp->residual = residual_avx2;
+    }
+#endif
+}
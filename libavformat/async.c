@@ -29,9 +29,11 @@
 
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
+#include "libavutil/dict.h"
 #include "libavutil/error.h"
 #include "libavutil/fifo.h"
 #include "libavutil/log.h"
+#include "libavutil/mem.h"
 #include "libavutil/opt.h"
 #include "libavutil/thread.h"
 #include "url.h"
@@ -44,6 +46,7 @@
 #define BUFFER_CAPACITY         (4 * 1024 * 1024)
 #define READ_BACK_CAPACITY      (4 * 1024 * 1024)
 #define SHORT_SEEK_THRESHOLD    (256 * 1024)
+#define PREFETCH_BLOCK_SIZE     (256 * 1024)
 
 typedef struct RingBuffer
 {
@@ -53,6 +56,22 @@ typedef struct RingBuffer
     int           read_pos;
 } RingBuffer;
 
+enum PrefetchBlockState {
+    BLOCK_EMPTY,
+    BLOCK_REQUESTED,
+    BLOCK_FETCHING,
+    BLOCK_READY,
+};
+
+/* A range hinted by the demuxer, fetched with a second connection. */
+typedef struct PrefetchBlock {
+    enum PrefetchBlockState state;
+    int64_t         pos;
+    int             size;
+    unsigned        seq;            ///< last request or use, for evicting the oldest block
+    uint8_t        *data;
+} PrefetchBlock;
+
 typedef struct Context {
     AVClass        *class;
     URLContext     *inner;
@@ -69,8 +88,21 @@ typedef struct Context {
 
     int64_t         logical_pos;
     int64_t         logical_size;
+    int64_t         ring_pos;       ///< position of the ring read pointer, follows logical_pos lazily
     RingBuffer      ring;
 
+    char           *url;
+    AVDictionary   *inner_options;
+    URLContext     *prefetch_inner;
+    PrefetchBlock  *blocks;
+    int             nb_blocks;
+    unsigned        seq;
+    int             prefetch_error;
+    pthread_cond_t  cond_wakeup_prefetch;
+    pthread_t       prefetch_thread;
+    int             prefetch_thread_started;
+    int             prefetch_size;
+
     pthread_cond_t  cond_wakeup_main;
     pthread_cond_t  cond_wakeup_background;
     pthread_mutex_t mutex;
@@ -237,6 +269,77 @@ static void *async_buffer_task(void *arg)
     return NULL;
 }
 
+static PrefetchBlock *prefetch_find(Context *c, int64_t pos)
+{
+    for (int i = 0; i < c->nb_blocks; i++) {
+        PrefetchBlock *block = &c->blocks[i];
+        if (block->state == BLOCK_READY &&
+            pos >= block->pos && pos < block->pos + block->size)
+            return block;
+    }
+    return NULL;
+}
+
+static void *async_prefetch_task(void *arg)
+{
+    URLContext   *h = arg;
+    Context      *c = h->priv_data;
+    AVIOInterruptCB interrupt_callback = {.callback = async_check_interrupt, .opaque = h};
+    int64_t       inner_pos = -1;
+
+    pthread_mutex_lock(&c->mutex);
+    while (!async_check_interrupt(h)) {
+        PrefetchBlock *block = NULL;
+        int64_t pos;
+        int ret = 0;
+
+        for (int i = 0; i < c->nb_blocks; i++)
+            if (c->blocks[i].state == BLOCK_REQUESTED &&
+                (!block || (int)(c->blocks[i].seq - block->seq) < 0))
+                block = &c->blocks[i];
+        if (!block) {
+            pthread_cond_wait(&c->cond_wakeup_prefetch, &c->mutex);
+            continue;
+        }
+        block->state = BLOCK_FETCHING;
+        pos = block->pos;
+        pthread_mutex_unlock(&c->mutex);
+
+        /* the data of a fetching block is only touched by this thread */
+        if (!c->prefetch_inner) {
+            AVDictionary *options = NULL;
+            av_dict_copy(&options, c->inner_options, 0);
+            ret = ffurl_open_whitelist(&c->prefetch_inner, c->url, AVIO_FLAG_READ,
+                                       &interrupt_callback, &options,
+                                       h->protocol_whitelist, h->protocol_blacklist, h);
+            av_dict_free(&options);
+        }
+        if (ret >= 0 && inner_pos != pos)
+            ret = ffurl_seek(c->prefetch_inner, pos, SEEK_SET);
+        if (ret >= 0)
+            ret = ffurl_read_complete(c->prefetch_inner, block->data,
+                                      FFMIN(PREFETCH_BLOCK_SIZE, c->logical_size - pos));
+        inner_pos = ret > 0 ? pos + ret : -1;
+
+        pthread_mutex_lock(&c->mutex);
+        if (ret > 0) {
+            block->state = BLOCK_READY;
+            block->size  = ret;
+        } else {
+            block->state = BLOCK_EMPTY;
+            /* do not open or seek again for every hint */
+            if (ret < 0 && ret != AVERROR_EXIT) {
+                av_log(h, AV_LOG_WARNING, "prefetch failed, disabling it: %s\n", av_err2str(ret));
+                c->prefetch_error = ret;
+            }
+        }
+        pthread_cond_signal(&c->cond_wakeup_main);
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    return NULL;
+}
+
 static int async_open(URLContext *h, const char *arg, int flags, AVDictionary **options)
 {
     Context         *c = h->priv_data;
@@ -249,6 +352,14 @@ static int async_open(URLContext *h, const char *arg, int flags, AVDictionary **
     if (ret < 0)
         goto fifo_fail;
 
+    c->url = av_strdup(arg);
+    if (!c->url) {
+        ret = AVERROR(ENOMEM);
+        goto url_fail;
+    }
+    if (options)
+        av_dict_copy(&c->inner_options, *options, 0);
+
     /* wrap interrupt callback */
     c->interrupt_callback = h->interrupt_callback;
     ret = ffurl_open_whitelist(&c->inner, arg, flags, &interrupt_callback, options, h->protocol_whitelist, h->protocol_blacklist, h);
@@ -278,6 +389,12 @@ static int async_open(URLContext *h, const char *arg, int flags, AVDictionary **
         goto cond_wakeup_background_fail;
     }
 
+    ret = pthread_cond_init(&c->cond_wakeup_prefetch, NULL);
+    if (ret != 0) {
+        av_log(h, AV_LOG_ERROR, "pthread_cond_init failed : %s\n", av_err2str(ret));
+        goto cond_wakeup_prefetch_fail;
+    }
+
     ret = pthread_create(&c->async_buffer_thread, NULL, async_buffer_task, h);
     if (ret) {
         av_log(h, AV_LOG_ERROR, "pthread_create failed : %s\n", av_err2str(ret));
@@ -287,6 +404,8 @@ static int async_open(URLContext *h, const char *arg, int flags, AVDictionary **
     return 0;
 
 thread_fail:
+    pthread_cond_destroy(&c->cond_wakeup_prefetch);
+cond_wakeup_prefetch_fail:
     pthread_cond_destroy(&c->cond_wakeup_background);
 cond_wakeup_background_fail:
     pthread_cond_destroy(&c->cond_wakeup_main);
@@ -295,6 +414,8 @@ cond_wakeup_main_fail:
 mutex_fail:
     ffurl_close(c->inner);
 url_fail:
+    av_dict_free(&c->inner_options);
+    av_freep(&c->url);
     ring_destroy(&c->ring);
 fifo_fail:
     return ret;
@@ -308,18 +429,90 @@ static int async_close(URLContext *h)
     pthread_mutex_lock(&c->mutex);
     c->abort_request = 1;
     pthread_cond_signal(&c->cond_wakeup_background);
+    pthread_cond_signal(&c->cond_wakeup_prefetch);
     pthread_mutex_unlock(&c->mutex);
 
     ret = pthread_join(c->async_buffer_thread, NULL);
     if (ret != 0)
         av_log(h, AV_LOG_ERROR, "pthread_join(): %s\n", av_err2str(ret));
+    if (c->prefetch_thread_started) {
+        ret = pthread_join(c->prefetch_thread, NULL);
+        if (ret != 0)
+            av_log(h, AV_LOG_ERROR, "pthread_join(): %s\n", av_err2str(ret));
+    }
 
+    pthread_cond_destroy(&c->cond_wakeup_prefetch);
     pthread_cond_destroy(&c->cond_wakeup_background);
     pthread_cond_destroy(&c->cond_wakeup_main);
     pthread_mutex_destroy(&c->mutex);
     ffurl_close(c->inner);
+    ffurl_close(c->prefetch_inner);
     ring_destroy(&c->ring);
+    for (int i = 0; i < c->nb_blocks; i++)
+        av_free(c->blocks[i].data);
+    av_freep(&c->blocks);
+    av_dict_free(&c->inner_options);
+    av_freep(&c->url);
+
+    return 0;
+}
+
+static void fifo_do_not_copy_func(void* dest, void* src, int size) {
+    // do not copy
+}
+
+/* mutex held, makes the background reader restart at pos */
+static int64_t async_seek_ring(URLContext *h, int64_t pos)
+{
+    Context *c = h->priv_data;
+
+    c->seek_request   = 1;
+    c->seek_pos       = pos;
+    c->seek_whence    = SEEK_SET;
+    c->seek_completed = 0;
+    c->seek_ret       = 0;
+
+    while (1) {
+        if (async_check_interrupt(h))
+            return AVERROR_EXIT;
+        if (c->seek_completed) {
+            if (c->seek_ret >= 0)
+                c->ring_pos = c->seek_ret;
+            return c->seek_ret;
+        }
+        pthread_cond_signal(&c->cond_wakeup_background);
+        pthread_cond_wait(&c->cond_wakeup_main, &c->mutex);
+    }
+}
 
+/* mutex held, moves the ring read pointer towards logical_pos after reads
+ * from the prefetched blocks or seeks, waiting for data at most once */
+static int async_sync_ring(URLContext *h)
+{
+    Context    *c     = h->priv_data;
+    RingBuffer *ring  = &c->ring;
+    int64_t     delta = c->logical_pos - c->ring_pos;
+    int         fifo_size = ring_size(ring);
+    int64_t     ret;
+
+    if (delta < 0 && -delta <= ring_size_of_read_back(ring)) {
+        ring_drain(ring, delta);
+        c->ring_pos = c->logical_pos;
+    } else if (delta > 0 && delta < fifo_size + SHORT_SEEK_THRESHOLD && !c->io_eof_reached) {
+        int to_skip = FFMIN(delta, fifo_size);
+        if (to_skip > 0) {
+            ring_generic_read(ring, NULL, to_skip, fifo_do_not_copy_func);
+            c->ring_pos += to_skip;
+        } else {
+            pthread_cond_signal(&c->cond_wakeup_background);
+            pthread_cond_wait(&c->cond_wakeup_main, &c->mutex);
+        }
+    } else if (delta > 0 && delta <= fifo_size) {
+        ring_generic_read(ring, NULL, delta, fifo_do_not_copy_func);
+        c->ring_pos = c->logical_pos;
+    } else if ((ret = async_seek_ring(h, c->logical_pos)) < 0) {
+        return ret;
+    }
     return 0;
 }
 
@@ -334,11 +527,43 @@ static int async_read_internal(URLContext *h, void *dest, int size, int read_com
     pthread_mutex_lock(&c->mutex);
 
     while (to_read > 0) {
+        PrefetchBlock *block;
         int fifo_size, to_copy;
         if (async_check_interrupt(h)) {
             ret = AVERROR_EXIT;
             break;
         }
+        /* the blocks only serve hops away from the ring, which reads ahead */
+        if (c->nb_blocks && c->ring_pos != c->logical_pos &&
+            (c->logical_pos <  c->ring_pos - ring_size_of_read_back(ring) ||
+             c->logical_pos >= c->ring_pos + ring_size(ring)) &&
+            (block = prefetch_find(c, c->logical_pos))) {
+            int offset = c->logical_pos - block->pos;
+            to_copy = FFMIN(to_read, block->size - offset);
+            if (func) {
+                func(dest, block->data + offset, to_copy);
+            } else {
+                memcpy(dest, block->data + offset, to_copy);
+                dest = (uint8_t *)dest + to_copy;
+            }
+            block->seq      = ++c->seq;
+            c->logical_pos += to_copy;
+            to_read        -= to_copy;
+            ret             = size - to_read;
+
+            if (to_read <= 0 || !read_complete)
+                break;
+            continue;
+        }
+        if (c->ring_pos != c->logical_pos) {
+            int err = async_sync_ring(h);
+            if (err < 0) {
+                if (ret <= 0)
+                    ret = err;
+                break;
+            }
+            continue;
+        }
         fifo_size = ring_size(ring);
         to_copy   = FFMIN(to_read, fifo_size);
         if (to_copy > 0) {
@@ -346,6 +571,7 @@ static int async_read_internal(URLContext *h, void *dest, int size, int read_com
             if (!func)
                 dest = (uint8_t *)dest + to_copy;
             c->logical_pos += to_copy;
+            c->ring_pos    += to_copy;
             to_read        -= to_copy;
             ret             = size - to_read;
 
@@ -375,18 +601,12 @@ static int async_read(URLContext *h, unsigned char *buf, int size)
     return async_read_internal(h, buf, size, 0, NULL);
 }
 
-static void fifo_do_not_copy_func(void* dest, void* src, int size) {
-    // do not copy
-}
-
 static int64_t async_seek(URLContext *h, int64_t pos, int whence)
 {
     Context      *c    = h->priv_data;
     RingBuffer   *ring = &c->ring;
     int64_t       ret;
     int64_t       new_logical_pos;
-    int fifo_size;
-    int fifo_size_of_read_back;
 
     if (whence == AVSEEK_SIZE) {
         av_log(h, AV_LOG_TRACE, "async_seek: AVSEEK_SIZE: %"PRId64"\n", (int64_t)c->logical_size);
@@ -403,69 +623,130 @@ static int64_t async_seek(URLContext *h, int64_t pos, int whence)
     if (new_logical_pos < 0)
         return AVERROR(EINVAL);
 
-    fifo_size = ring_size(ring);
-    fifo_size_of_read_back = ring_size_of_read_back(ring);
     if (new_logical_pos == c->logical_pos) {
         /* current position */
         return c->logical_pos;
-    } else if ((new_logical_pos >= (c->logical_pos - fifo_size_of_read_back)) &&
-               (new_logical_pos < (c->logical_pos + fifo_size + SHORT_SEEK_THRESHOLD))) {
-        int pos_delta = (int)(new_logical_pos - c->logical_pos);
-        /* fast seek */
-        av_log(h, AV_LOG_TRACE, "async_seek: fask_seek %"PRId64" from %d dist:%d/%d\n",
-                new_logical_pos, (int)c->logical_pos,
-                (int)(new_logical_pos - c->logical_pos), fifo_size);
-
-        if (pos_delta > 0) {
-            // fast seek forwards
-            async_read_internal(h, NULL, pos_delta, 1, fifo_do_not_copy_func);
-        } else {
-            // fast seek backwards
-            ring_drain(ring, pos_delta);
-            c->logical_pos = new_logical_pos;
-        }
+    }
 
-        return c->logical_pos;
+    pthread_mutex_lock(&c->mutex);
+
+    if ((new_logical_pos >= (c->ring_pos - ring_size_of_read_back(ring)) &&
+         new_logical_pos < (c->ring_pos + ring_size(ring) + SHORT_SEEK_THRESHOLD)) ||
+        prefetch_find(c, new_logical_pos)) {
+        /* fast seek, the ring follows when it is read from */
+        av_log(h, AV_LOG_TRACE, "async_seek: fast_seek %"PRId64" from %"PRId64"\n",
+               new_logical_pos, c->logical_pos);
+        c->logical_pos = new_logical_pos;
+        ret = new_logical_pos;
     } else if (c->logical_size <= 0) {
         /* can not seek */
-        return AVERROR(EINVAL);
+        ret = AVERROR(EINVAL);
     } else if (new_logical_pos > c->logical_size) {
         /* beyond end */
-        return AVERROR(EINVAL);
+        ret = AVERROR(EINVAL);
+    } else {
+        ret = async_seek_ring(h, new_logical_pos);
+        if (ret >= 0)
+            c->logical_pos = ret;
     }
 
-    pthread_mutex_lock(&c->mutex);
+    pthread_mutex_unlock(&c->mutex);
 
-    c->seek_request   = 1;
-    c->seek_pos       = new_logical_pos;
-    c->seek_whence    = SEEK_SET;
-    c->seek_completed = 0;
-    c->seek_ret       = 0;
+    return ret;
+}
 
-    while (1) {
-        if (async_check_interrupt(h)) {
-            ret = AVERROR_EXIT;
-            break;
-        }
-        if (c->seek_completed) {
-            if (c->seek_ret >= 0)
-                c->logical_pos  = c->seek_ret;
-            ret = c->seek_ret;
-            break;
+/* set up on the first hint, so inputs nobody hints cost no memory
+ * and no second connection */
+static int prefetch_start(URLContext *h)
+{
+    Context *c = h->priv_data;
+    int      ret;
+
+    c->blocks = av_mallocz_array(c->prefetch_size / PREFETCH_BLOCK_SIZE, sizeof(*c->blocks));
+    if (!c->blocks)
+        return AVERROR(ENOMEM);
+    c->nb_blocks = c->prefetch_size / PREFETCH_BLOCK_SIZE;
+    for (int i = 0; i < c->nb_blocks; i++)
+        if (!(c->blocks[i].data = av_malloc(PREFETCH_BLOCK_SIZE)))
+            return AVERROR(ENOMEM);
+
+    ret = pthread_create(&c->prefetch_thread, NULL, async_prefetch_task, h);
+    if (ret)
+        return AVERROR(ret);
+    c->prefetch_thread_started = 1;
+    return 0;
+}
+
+static int async_prefetch(URLContext *h, int64_t pos, int64_t size)
+{
+    Context *c = h->priv_data;
+    int64_t  end;
+    int      ret;
+
+    if (!c->prefetch_thread_started) {
+        /* hinted ranges need random access */
+        if (c->prefetch_error || c->prefetch_size < PREFETCH_BLOCK_SIZE ||
+            c->logical_size <= 0 || h->is_streamed)
+            return AVERROR(ENOSYS);
+        if ((ret = prefetch_start(h)) < 0) {
+            av_log(h, AV_LOG_WARNING, "Failed to set up prefetching\n");
+            c->prefetch_error = ret;
+            return ret;
         }
-        pthread_cond_signal(&c->cond_wakeup_background);
-        pthread_cond_wait(&c->cond_wakeup_main, &c->mutex);
     }
 
+    pthread_mutex_lock(&c->mutex);
+    if (c->prefetch_error) {
+        pthread_mutex_unlock(&c->mutex);
+        return c->prefetch_error;
+    }
+    /* the background reader gets what is right ahead anyway, and a single
+     * hint may not take the whole cache */
+    end = FFMIN(pos + FFMIN(size, (int64_t)c->nb_blocks / 2 * PREFETCH_BLOCK_SIZE), c->logical_size);
+    if (pos >= c->ring_pos - ring_size_of_read_back(&c->ring) &&
+        end <= c->ring_pos + BUFFER_CAPACITY)
+        end = pos;
+
+    for (pos -= pos % PREFETCH_BLOCK_SIZE; pos < end; pos += PREFETCH_BLOCK_SIZE) {
+        PrefetchBlock *victim = NULL;
+        int i;
+
+        for (i = 0; i < c->nb_blocks; i++) {
+            PrefetchBlock *block = &c->blocks[i];
+            if (block->state != BLOCK_EMPTY && block->pos == pos) {
+                block->seq = ++c->seq;
+                break;
+            }
+            /* empty blocks first, then the least recently used ready one */
+            if (block->state == BLOCK_EMPTY) {
+                if (!victim || victim->state != BLOCK_EMPTY)
+                    victim = block;
+            } else if (block->state == BLOCK_READY &&
+                       (!victim || (victim->state == BLOCK_READY &&
+                                    (int)(block->seq - victim->seq) < 0))) {
+                victim = block;
+            }
+        }
+        if (i < c->nb_blocks)
+            continue;
+        if (!victim)
+            break;
+        victim->state = BLOCK_REQUESTED;
+        victim->pos   = pos;
+        victim->size  = 0;
+        victim->seq   = ++c->seq;
+    }
+    pthread_cond_signal(&c->cond_wakeup_prefetch);
     pthread_mutex_unlock(&c->mutex);
 
-    return ret;
+    return 0;
 }
 
 #define OFFSET(x) offsetof(Context, x)
 #define D AV_OPT_FLAG_DECODING_PARAM
 
 static const AVOption options[] = {
+    { "prefetch_size", "set the size of the cache for the ranges announced by the demuxer", OFFSET(prefetch_size), AV_OPT_TYPE_INT, { .i64 = 16 * 1024 * 1024 }, 0, INT_MAX, D },
     {NULL},
 };
 
@@ -485,215 +766,8 @@ const URLProtocol ff_async_protocol = {
     .url_read            = async_read,
     .url_seek            = async_seek,
     .url_close           = async_close,
+    .url_prefetch        = async_prefetch,
     .priv_data_size      = sizeof(Context),
     .priv_data_class     = &async_context_class,
 };
 
-#if 0
-
-#define TEST_SEEK_POS    (1536)
-#define TEST_STREAM_SIZE (2048)
-
-typedef struct TestContext {
-    AVClass        *class;
-    int64_t         logical_pos;
-    int64_t         logical_size;
-
-    /* options */
-    int             opt_read_error;
-} TestContext;
-
-static int async_test_open(URLContext *h, const char *arg, int flags, AVDictionary **options)
-{
-    TestContext *c = h->priv_data;
-    c->logical_pos  = 0;
-    c->logical_size = TEST_STREAM_SIZE;
-    return 0;
-}
-
-static int async_test_close(URLContext *h)
-{
-    return 0;
-}
-
-static int async_test_read(URLContext *h, unsigned char *buf, int size)
-{
-    TestContext *c = h->priv_data;
-    int          i;
-    int          read_len = 0;
-
-    if (c->opt_read_error)
-        return c->opt_read_error;
-
-    if (c->logical_pos >= c->logical_size)
-        return AVERROR_EOF;
-
-    for (i = 0; i < size; ++i) {
-        buf[i] = c->logical_pos & 0xFF;
-
-        c->logical_pos++;
-        read_len++;
-
-        if (c->logical_pos >= c->logical_size)
-            break;
-    }
-
-    return read_len;
-}
-
-static int64_t async_test_seek(URLContext *h, int64_t pos, int whence)
-{
-    TestContext *c = h->priv_data;
-    int64_t      new_logical_pos;
-
-    if (whence == AVSEEK_SIZE) {
-        return c->logical_size;
-    } else if (whence == SEEK_CUR) {
-        new_logical_pos = pos + c->logical_pos;
-    } else if (whence == SEEK_SET){
-        new_logical_pos = pos;
-    } else {
-        return AVERROR(EINVAL);
-    }
-    if (new_logical_pos < 0)
-        return AVERROR(EINVAL);
-
-    c->logical_pos = new_logical_pos;
-    return new_logical_pos;
-}
-
-#define OFFSET(x) offsetof(TestContext, x)
-#define D AV_OPT_FLAG_DECODING_PARAM
-
-static const AVOption async_test_options[] = {
-    { "async-test-read-error",      "cause read fail",
-        OFFSET(opt_read_error),     AV_OPT_TYPE_INT, { .i64 = 0 }, INT_MIN, INT_MAX, .flags = D },
-    {NULL},
-};
-
-#undef D
-#undef OFFSET
-
-static const AVClass async_test_context_class = {
-    .class_name = "Async-Test",
-    .item_name  = av_default_item_name,
-    .option     = async_test_options,
-    .version    = LIBAVUTIL_VERSION_INT,
-};
-
-const URLProtocol ff_async_test_protocol = {
-    .name                = "async-test",
-    .url_open2           = async_test_open,
-    .url_read            = async_test_read,
-    .url_seek            = async_test_seek,
-    .url_close           = async_test_close,
-    .priv_data_size      = sizeof(TestContext),
-    .priv_data_class     = &async_test_context_class,
-};
-
-int main(void)
-{
-    URLContext   *h = NULL;
-    int           i;
-    int           ret;
-    int64_t       size;
-    int64_t       pos;
-    int64_t       read_len;
-    unsigned char buf[4096];
-    AVDictionary *opts = NULL;
-
-    ffurl_register_protocol(&ff_async_protocol);
-    ffurl_register_protocol(&ff_async_test_protocol);
-
-    /*
-     * test normal read
-     */
-    ret = ffurl_open(&h, "async:async-test:", AVIO_FLAG_READ, NULL, NULL);
-    printf("open: %d\n", ret);
-
-    size = ffurl_size(h);
-    printf("size: %"PRId64"\n", size);
-
-    pos = ffurl_seek(h, 0, SEEK_CUR);
-    read_len = 0;
-    while (1) {
-        ret = ffurl_read(h, buf, sizeof(buf));
-        if (ret == AVERROR_EOF) {
-            printf("read-error: AVERROR_EOF at %"PRId64"\n", ffurl_seek(h, 0, SEEK_CUR));
-            break;
-        }
-        else if (ret == 0)
-            break;
-        else if (ret < 0) {
-            printf("read-error: %d at %"PRId64"\n", ret, ffurl_seek(h, 0, SEEK_CUR));
-            goto fail;
-        } else {
-            for (i = 0; i < ret; ++i) {
-                if (buf[i] != (pos & 0xFF)) {
-                    printf("read-mismatch: actual %d, expecting %d, at %"PRId64"\n",
-                           (int)buf[i], (int)(pos & 0xFF), pos);
-                    break;
-                }
-                pos++;
-            }
-        }
-
-        read_len += ret;
-    }
-    printf("read: %"PRId64"\n", read_len);
-
-    /*
-     * test normal seek
-     */
-    ret = ffurl_read(h, buf, 1);
-    printf("read: %d\n", ret);
-
-    pos = ffurl_seek(h, TEST_SEEK_POS, SEEK_SET);
-    printf("seek: %"PRId64"\n", pos);
-
-    read_len = 0;
-    while (1) {
-        ret = ffurl_read(h, buf, sizeof(buf));
-        if (ret == AVERROR_EOF)
-            break;
-        else if (ret == 0)
-            break;
-        else if (ret < 0) {
-            printf("read-error: %d at %"PRId64"\n", ret, ffurl_seek(h, 0, SEEK_CUR));
-            goto fail;
-        } else {
-            for (i = 0; i < ret; ++i) {
-                if (buf[i] != (pos & 0xFF)) {
-                    printf("read-mismatch: actual %d, expecting %d, at %"PRId64"\n",
-                           (int)buf[i], (int)(pos & 0xFF), pos);
-                    break;
-                }
-                pos++;
-            }
-        }
-
-        read_len += ret;
-    }
-    printf("read: %"PRId64"\n", read_len);
-
-    ret = ffurl_read(h, buf, 1);
-    printf("read: %d\n", ret);
-
-    /*
-     * test read error
-     */
-    ffurl_close(h);
-    av_dict_set_int(&opts, "async-test-read-error", -10000, 0);
-    ret = ffurl_open(&h, "async:async-test:", AVIO_FLAG_READ, NULL, &opts);
-    printf("open: %d\n", ret);
-
-    ret = ffurl_read(h, buf, 1);
-    printf("read: %d\n", ret);
-
-fail:
-    av_dict_free(&opts);
-    ffurl_close(h);
-    return 0;
-}
-
-#endif
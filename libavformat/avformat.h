@@ -1958,6 +1958,14 @@ typedef struct AVFormatContext {
      * - decoding: set by user
      */
     int max_probe_packets;
+
+    /**
+     * Directory in which avformat_find_stream_info() stores what it found
+     * for each input, so that opening the same input again skips probing.
+     * - encoding: unused
+     * - decoding: set by user
+     */
+    char *probe_cache;
 } AVFormatContext;
 
 #if FF_API_FORMAT_GET_SET
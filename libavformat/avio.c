@@ -652,6 +652,13 @@ int ffurl_get_short_seek(URLContext *h)
     return h->prot->url_get_short_seek(h);
 }
 
+int ffurl_prefetch(URLContext *h, int64_t pos, int64_t size)
+{
+    if (!h || !h->prot || !h->prot->url_prefetch)
+        return AVERROR(ENOSYS);
+    return h->prot->url_prefetch(h, pos, size);
+}
+
 int ffurl_shutdown(URLContext *h, int flags)
 {
     if (!h || !h->prot || !h->prot->url_shutdown)
@@ -53,6 +53,12 @@ int ffio_init_context(AVIOContext *s,
  */
 int ffio_read_indirect(AVIOContext *s, unsigned char *buf, int size, const unsigned char **data);
 
+/**
+ * Hint that size bytes at pos will be read soon, see ffurl_prefetch().
+ * Ranges already in the buffer are ignored.
+ */
+int ffio_prefetch(AVIOContext *s, int64_t pos, int64_t size);
+
 void ffio_fill(AVIOContext *s, int b, int count);
 
 static av_always_inline void ffio_wfourcc(AVIOContext *pb, const uint8_t *s)
@@ -1038,6 +1038,17 @@ fail:
     return AVERROR(ENOMEM);
 }
 
+int ffio_prefetch(AVIOContext *s, int64_t pos, int64_t size)
+{
+    URLContext *h = ffio_geturlcontext(s);
+
+    if (!h || s->write_flag)
+        return AVERROR(ENOSYS);
+    if (pos >= s->pos - (s->buf_end - s->buffer) && pos + size <= s->pos)
+        return 0;
+    return ffurl_prefetch(h, pos, size);
+}
+
 URLContext* ffio_geturlcontext(AVIOContext *s)
 {
     AVIOInternal *internal;
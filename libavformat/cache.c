@@ -224,6 +224,27 @@ static int cache_read(URLContext *h, unsigned char *buf, int size)
     return r;
 }
 
+static int cache_prefetch(URLContext *h, int64_t pos, int64_t size)
+{
+    Context *c= h->priv_data;
+    CacheEntry *entry, *next[2] = {NULL, NULL};
+
+    /* skip what is cached already, the inner protocol may fetch the rest */
+    while (size > 0) {
+        entry = av_tree_find(c->root, &pos, cmp, (void**)next);
+        if (!entry)
+            entry = next[0];
+        if (!entry || pos >= entry->logical_pos + entry->size)
+            break;
+        size -= entry->logical_pos + entry->size - pos;
+        pos   = entry->logical_pos + entry->size;
+        next[0] = next[1] = NULL;
+    }
+    if (size <= 0)
+        return 0;
+    return ffurl_prefetch(c->inner, pos, size);
+}
+
 static int64_t cache_seek(URLContext *h, int64_t pos, int whence)
 {
     Context *c= h->priv_data;
@@ -338,6 +359,7 @@ const URLProtocol ff_cache_protocol = {
     .url_read            = cache_read,
     .url_seek            = cache_seek,
     .url_close           = cache_close,
+    .url_prefetch        = cache_prefetch,
     .priv_data_size      = sizeof(Context),
     .priv_data_class     = &cache_context_class,
 };
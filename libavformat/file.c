@@ -19,8 +19,11 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#define _DEFAULT_SOURCE /* Needed for syscall() and MAP_POPULATE with glibc */
+
 #include "libavutil/avstring.h"
 #include "libavutil/internal.h"
+#include "libavutil/mem.h"
 #include "libavutil/opt.h"
 #include "avformat.h"
 #if HAVE_DIRENT_H
@@ -34,6 +37,16 @@
 #include <unistd.h>
 #endif
 #include <sys/stat.h>
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#if HAVE_LINUX_IO_URING_H
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
 #include <stdlib.h>
 #include "os_support.h"
 #include "url.h"
@@ -67,6 +80,11 @@
 
 /* standard file protocol */
 
+#define MMAP_READAHEAD (8 << 20)
+#define RING_BLOCK     (256 << 10)
+
+typedef struct FileRing FileRing;
+
 typedef struct FileContext {
     const AVClass *class;
     int fd;
@@ -74,6 +92,16 @@ typedef struct FileContext {
     int blocksize;
     int follow;
     int seekable;
+    int use_mmap;
+    uint8_t *map;              ///< whole file mapping, NULL when reading with read()
+    int64_t map_size;
+    int64_t pos;               ///< read position when reading from the mapping or the ring
+    int64_t readahead_start;   ///< range last requested from the kernel
+    int64_t readahead_end;
+    int use_ring;
+    int ring_depth;
+    FileRing *ring;            ///< io_uring prefetcher, NULL when reading with read()
+    int64_t file_size;         ///< size when opened, nothing is prefetched past it
 #if HAVE_DIRENT_H
     DIR *dir;
 #endif
@@ -84,6 +112,9 @@ static const AVOption file_options[] = {
     { "blocksize", "set I/O operation maximum block size", offsetof(FileContext, blocksize), AV_OPT_TYPE_INT, { .i64 = INT_MAX }, 1, INT_MAX, AV_OPT_FLAG_ENCODING_PARAM },
     { "follow", "Follow a file as it is being written", offsetof(FileContext, follow), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { "seekable", "Sets if the file is seekable", offsetof(FileContext, seekable), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, 0, AV_OPT_FLAG_DECODING_PARAM | AV_OPT_FLAG_ENCODING_PARAM },
+    { "mmap", "Read regular files through a memory mapping", offsetof(FileContext, use_mmap), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "io_uring", "Prefetch reads of regular files with io_uring", offsetof(FileContext, use_ring), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
+    { "io_uring_depth", "Set the number of 256 KiB blocks kept by the io_uring prefetcher", offsetof(FileContext, ring_depth), AV_OPT_TYPE_INT, { .i64 = 16 }, 2, 256, AV_OPT_FLAG_DECODING_PARAM },
     { NULL }
 };
 
@@ -106,11 +137,326 @@ static const AVClass pipe_class = {
     .version    = LIBAVUTIL_VERSION_INT,
 };
 
+/* ask the kernel to page in the mapping ahead of pos */
+static void file_map_readahead(FileContext *c, int64_t pos)
+{
+#if HAVE_MMAP && defined(MADV_WILLNEED)
+    int64_t start = pos & ~(int64_t)4095;
+
+    if (pos >= c->readahead_start && pos + MMAP_READAHEAD / 2 <= c->readahead_end)
+        return;
+    c->readahead_start = start;
+    c->readahead_end   = FFMIN(start + MMAP_READAHEAD, c->map_size);
+    if (c->readahead_end > start)
+        madvise(c->map + start, c->readahead_end - start, MADV_WILLNEED);
+#endif
+}
+
+#if HAVE_LINUX_IO_URING_H
+/* The file is read in aligned blocks of RING_BLOCK bytes, each kept in a slot
+ * which is filled by an asynchronous read. The read position is followed by
+ * half of the slots, the other ones serve the ranges hinted by the demuxer. */
+
+enum FileRingSlotState {
+    SLOT_FREE,
+    SLOT_BUSY,                 ///< read submitted
+    SLOT_READY,
+};
+
+typedef struct FileRingSlot {
+    enum FileRingSlotState state;
+    int consumed;              ///< read to its end, may be reused
+    int64_t pos;
+    int size;                  ///< bytes read or AVERROR
+    unsigned seq;              ///< last use, for evicting the oldest slot
+    uint8_t *buf;
+    struct iovec iov;
+} FileRingSlot;
+
+struct FileRing {
+    int fd;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    FileRingSlot *slots;
+    int nb_slots;
+    int nb_busy;
+    unsigned seq;
+};
+
+static int ring_enter(FileRing *r, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    int ret;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete, flags, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret < 0 ? AVERROR(errno) : ret;
+}
+
+static void ring_reap(FileRing *r)
+{
+    unsigned head = *r->cq_head;
+
+    while (head != atomic_load_explicit((atomic_uint *)r->cq_tail, memory_order_acquire)) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        FileRingSlot *slot = &r->slots[cqe->user_data];
+
+        slot->size  = cqe->res < 0 ? AVERROR(-cqe->res) : cqe->res;
+        slot->state = SLOT_READY;
+        r->nb_busy--;
+        head++;
+    }
+    atomic_store_explicit((atomic_uint *)r->cq_head, head, memory_order_release);
+}
+
+static int ring_submit(FileContext *c, FileRingSlot *slot, int64_t pos)
+{
+    FileRing *r  = c->ring;
+    unsigned tail = *r->sq_tail;
+    unsigned idx  = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    int ret;
+
+    slot->state    = SLOT_BUSY;
+    slot->consumed = 0;
+    slot->pos      = pos;
+    slot->seq      = ++r->seq;
+    slot->iov.iov_base = slot->buf;
+    slot->iov.iov_len  = RING_BLOCK;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_READV;
+    sqe->fd        = c->fd;
+    sqe->off       = pos;
+    sqe->addr      = (uintptr_t)&slot->iov;
+    sqe->len       = 1;
+    sqe->user_data = slot - r->slots;
+    r->sq_array[idx] = idx;
+    atomic_store_explicit((atomic_uint *)r->sq_tail, tail + 1, memory_order_release);
+    r->nb_busy++;
+
+    if ((ret = ring_enter(r, 1, 0, 0)) <= 0) {
+        /* nothing was consumed, the kernel only takes entries in enter */
+        atomic_store_explicit((atomic_uint *)r->sq_tail, tail, memory_order_release);
+        slot->state = SLOT_FREE;
+        r->nb_busy--;
+        return ret < 0 ? ret : AVERROR(EAGAIN);
+    }
+    return 0;
+}
+
+static FileRingSlot *ring_find(FileRing *r, int64_t pos)
+{
+    for (int i = 0; i < r->nb_slots; i++)
+        if (r->slots[i].state != SLOT_FREE && r->slots[i].pos == pos)
+            return &r->slots[i];
+    return NULL;
+}
+
+/* prefetches only take free or consumed slots, demand reads take the oldest */
+static FileRingSlot *ring_victim(FileRing *r, int demand)
+{
+    FileRingSlot *victim = NULL;
+
+    for (int i = 0; i < r->nb_slots; i++) {
+        FileRingSlot *slot = &r->slots[i];
+
+        if (slot->state == SLOT_FREE)
+            return slot;
+        if (slot->state == SLOT_READY && (demand || slot->consumed) &&
+            (!victim || (int)(slot->seq - victim->seq) < 0))
+            victim = slot;
+    }
+    return victim;
+}
+
+static void ring_prefetch(FileContext *c, int64_t pos)
+{
+    FileRingSlot *slot;
+
+    if (pos >= c->file_size || ring_find(c->ring, pos))
+        return;
+    if ((slot = ring_victim(c->ring, 0)))
+        ring_submit(c, slot, pos);
+}
+
+/* read what the ring cannot serve directly */
+static int ring_pread(FileContext *c, unsigned char *buf, int size)
+{
+    int ret = pread(c->fd, buf, size, c->pos);
+
+    if (ret < 0)
+        return AVERROR(errno);
+    if (!ret)
+        return AVERROR_EOF;
+    c->pos += ret;
+    return ret;
+}
+
+static int ring_read(FileContext *c, unsigned char *buf, int size)
+{
+    FileRing *r   = c->ring;
+    int64_t block = c->pos & ~(int64_t)(RING_BLOCK - 1);
+    FileRingSlot *slot;
+    int offset, ret;
+
+    ring_reap(r);
+    if (!(slot = ring_find(r, block))) {
+        while (!(slot = ring_victim(r, 1))) {
+            if ((ret = ring_enter(r, 0, 1, IORING_ENTER_GETEVENTS)) < 0)
+                return ret;
+            ring_reap(r);
+        }
+        if (ring_submit(c, slot, block) < 0)
+            return ring_pread(c, buf, size);
+    }
+    while (slot->state == SLOT_BUSY) {
+        if ((ret = ring_enter(r, 0, 1, IORING_ENTER_GETEVENTS)) < 0)
+            return ret;
+        ring_reap(r);
+    }
+
+    if (slot->size < 0) {
+        slot->state = SLOT_FREE;
+        return slot->size;
+    }
+    offset = c->pos - block;
+    if (offset >= slot->size) {
+        /* short read or end of file, which may have moved since */
+        slot->state = SLOT_FREE;
+        return ring_pread(c, buf, size);
+    }
+
+    size = FFMIN(size, slot->size - offset);
+    memcpy(buf, slot->buf + offset, size);
+    c->pos += size;
+    slot->seq = ++r->seq;
+    if (offset + size == slot->size)
+        slot->consumed = 1;
+
+    for (int i = 1; i <= r->nb_slots / 2; i++)
+        ring_prefetch(c, block + (int64_t)i * RING_BLOCK);
+    return size;
+}
+
+static void ring_free(FileRing **pr)
+{
+    FileRing *r = *pr;
+
+    if (!r)
+        return;
+    /* the kernel may still be writing to the slots */
+    while (r->nb_busy > 0) {
+        if (ring_enter(r, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+            break;
+        ring_reap(r);
+    }
+    /* if they could not be waited for, leak the buffers of the reads in
+     * flight rather than let the kernel write to freed memory */
+    if (r->slots)
+        for (int i = 0; i < r->nb_slots; i++)
+            if (r->slots[i].state != SLOT_BUSY)
+                av_free(r->slots[i].buf);
+    av_free(r->slots);
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring)
+        munmap(r->sq_ring, r->sq_ring_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    av_freep(pr);
+}
+
+static int ring_init(URLContext *h)
+{
+    FileContext *c = h->priv_data;
+    struct io_uring_params p = { 0 };
+    FileRing *r;
+    void *ptr;
+
+    if (!(r = c->ring = av_mallocz(sizeof(*r))))
+        return AVERROR(ENOMEM);
+
+    r->fd = syscall(__NR_io_uring_setup, c->ring_depth, &p);
+    if (r->fd < 0)
+        return AVERROR(errno);
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_ring_size = r->cq_ring_size = FFMAX(r->sq_ring_size, r->cq_ring_size);
+#endif
+    ptr = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               r->fd, IORING_OFF_SQ_RING);
+    if (ptr == MAP_FAILED)
+        return AVERROR(errno);
+    r->sq_ring = r->cq_ring = ptr;
+#ifdef IORING_FEAT_SINGLE_MMAP
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+#endif
+    {
+        ptr = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_CQ_RING);
+        if (ptr == MAP_FAILED) {
+            r->cq_ring = NULL;
+            return AVERROR(errno);
+        }
+        r->cq_ring = ptr;
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ptr = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               r->fd, IORING_OFF_SQES);
+    if (ptr == MAP_FAILED)
+        return AVERROR(errno);
+    r->sqes = ptr;
+
+    r->sq_head  = (unsigned *)((uint8_t *)r->sq_ring + p.sq_off.head);
+    r->sq_tail  = (unsigned *)((uint8_t *)r->sq_ring + p.sq_off.tail);
+    r->sq_mask  = (unsigned *)((uint8_t *)r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((uint8_t *)r->sq_ring + p.sq_off.array);
+    r->cq_head  = (unsigned *)((uint8_t *)r->cq_ring + p.cq_off.head);
+    r->cq_tail  = (unsigned *)((uint8_t *)r->cq_ring + p.cq_off.tail);
+    r->cq_mask  = (unsigned *)((uint8_t *)r->cq_ring + p.cq_off.ring_mask);
+    r->cqes     = (struct io_uring_cqe *)((uint8_t *)r->cq_ring + p.cq_off.cqes);
+
+    /* never more reads in flight than entries in the queues */
+    r->nb_slots = FFMIN(c->ring_depth, p.sq_entries);
+    if (!(r->slots = av_mallocz_array(r->nb_slots, sizeof(*r->slots))))
+        return AVERROR(ENOMEM);
+    for (int i = 0; i < r->nb_slots; i++)
+        if (!(r->slots[i].buf = av_malloc(RING_BLOCK)))
+            return AVERROR(ENOMEM);
+    return 0;
+}
+#endif /* HAVE_LINUX_IO_URING_H */
+
 static int file_read(URLContext *h, unsigned char *buf, int size)
 {
     FileContext *c = h->priv_data;
     int ret;
     size = FFMIN(size, c->blocksize);
+    if (c->map) {
+        if (c->pos >= c->map_size)
+            return AVERROR_EOF;
+        size = FFMIN(size, c->map_size - c->pos);
+        file_map_readahead(c, c->pos + size);
+        memcpy(buf, c->map + c->pos, size);
+        c->pos += size;
+        return size;
+    }
+#if HAVE_LINUX_IO_URING_H
+    if (c->ring)
+        return ring_read(c, buf, size);
+#endif
     ret = read(c->fd, buf, size);
     if (ret == 0 && c->follow)
         return AVERROR(EAGAIN);
@@ -205,11 +551,53 @@ static int file_move(URLContext *h_src, URLContext *h_dst)
 
 #if CONFIG_FILE_PROTOCOL
 
+static void file_map(URLContext *h, int64_t size)
+{
+#if HAVE_MMAP
+    FileContext *c = h->priv_data;
+    void *map;
+
+    if (size <= 0 || size > SIZE_MAX)
+        return;
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, c->fd, 0);
+    if (map == MAP_FAILED) {
+        av_log(h, AV_LOG_VERBOSE, "mmap failed, reading with read(): %s\n",
+               av_err2str(AVERROR(errno)));
+        return;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(map, size, MADV_SEQUENTIAL);
+#endif
+    c->map      = map;
+    c->map_size = size;
+    file_map_readahead(c, 0);
+#else
+    av_log(h, AV_LOG_VERBOSE, "mmap is not supported, reading with read()\n");
+#endif
+}
+
+static int file_prefetch(URLContext *h, int64_t pos, int64_t size)
+{
+#if HAVE_LINUX_IO_URING_H
+    FileContext *c = h->priv_data;
+    int64_t block;
+
+    if (!c->ring)
+        return AVERROR(ENOSYS);
+    ring_reap(c->ring);
+    for (block = pos & ~(int64_t)(RING_BLOCK - 1); block < pos + size; block += RING_BLOCK)
+        ring_prefetch(c, block);
+    return 0;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
 static int file_open(URLContext *h, const char *filename, int flags)
 {
     FileContext *c = h->priv_data;
     int access;
-    int fd;
+    int fd, ret;
     struct stat st;
 
     av_strstart(filename, "file:", &filename);
@@ -243,6 +631,24 @@ static int file_open(URLContext *h, const char *filename, int flags)
     if (c->seekable >= 0)
         h->is_streamed = !c->seekable;
 
+    /* a file being written may grow, or shrink under the mapping */
+    if ((c->use_mmap || c->use_ring) && !(flags & AVIO_FLAG_WRITE) && !c->follow &&
+        !fstat(fd, &st) && S_ISREG(st.st_mode)) {
+        c->file_size = st.st_size;
+        if (c->use_mmap)
+            file_map(h, st.st_size);
+#if HAVE_LINUX_IO_URING_H
+        if (c->use_ring && !c->map && (ret = ring_init(h)) < 0) {
+            av_log(h, AV_LOG_VERBOSE, "io_uring setup failed, reading with read(): %s\n",
+                   av_err2str(ret));
+            ring_free(&c->ring);
+        }
+#else
+        if (c->use_ring)
+            av_log(h, AV_LOG_VERBOSE, "io_uring is not supported, reading with read()\n");
+#endif
+    }
+
     return 0;
 }
 
@@ -254,10 +660,24 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
 
     if (whence == AVSEEK_SIZE) {
         struct stat st;
+        if (c->map || c->ring)
+            return c->file_size;
         ret = fstat(c->fd, &st);
         return ret < 0 ? AVERROR(errno) : (S_ISFIFO(st.st_mode) ? 0 : st.st_size);
     }
 
+    if (c->map || c->ring) {
+        if (whence == SEEK_CUR)
+            pos += c->pos;
+        else if (whence == SEEK_END)
+            pos += c->file_size;
+        else if (whence != SEEK_SET)
+            return AVERROR(EINVAL);
+        if (pos < 0)
+            return AVERROR(EINVAL);
+        return c->pos = pos;
+    }
+
     ret = lseek(c->fd, pos, whence);
 
     return ret < 0 ? AVERROR(errno) : ret;
@@ -266,6 +686,14 @@ static int64_t file_seek(URLContext *h, int64_t pos, int whence)
 static int file_close(URLContext *h)
 {
     FileContext *c = h->priv_data;
+#if HAVE_MMAP
+    if (c->map)
+        munmap(c->map, c->map_size);
+    c->map = NULL;
+#endif
+#if HAVE_LINUX_IO_URING_H
+    ring_free(&c->ring);
+#endif
     return close(c->fd);
 }
 
@@ -361,6 +789,7 @@ const URLProtocol ff_file_protocol = {
     .url_seek            = file_seek,
     .url_close           = file_close,
     .url_get_file_handle = file_get_handle,
+    .url_prefetch        = file_prefetch,
     .url_check           = file_check,
     .url_delete          = file_delete,
     .url_move            = file_move,
@@ -1208,6 +1208,11 @@ retry_duration:
             flv_set_audio_codec(s, st, par, flags & FLV_AUDIO_CODECID_MASK);
             sample_rate = par->sample_rate;
             avcodec_parameters_free(&par);
+            /* the stream was set up before the first packet, e.g. from the probe cache */
+            if (!flv->last_sample_rate) {
+                flv->last_sample_rate = sample_rate;
+                flv->last_channels    = channels;
+            }
         }
     } else if (stream_type == FLV_STREAM_TYPE_VIDEO) {
         int ret = flv_set_video_codec(s, st, flags & FLV_VIDEO_CODECID_MASK, 1);
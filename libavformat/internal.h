@@ -142,6 +142,15 @@ struct AVFormatInternal {
      * Prefer the codec framerate for avg_frame_rate computation.
      */
     int prefer_codec_framerate;
+
+    /**
+     * Identity of the input checked against probe cache entries, set by
+     * ff_probe_cache_hash_header().
+     */
+    int probe_cache_hashed;
+    int64_t probe_cache_size;
+    int64_t probe_cache_mtime;
+    uint8_t probe_cache_hash[16];
 };
 
 struct AVStreamInternal {
@@ -190,6 +199,13 @@ struct AVStreamInternal {
     int need_context_update;
 
     FFFrac *priv_pts;
+
+    /**
+     * Number of packets avformat_find_stream_info() would have read before it
+     * knew their duration, restored from the probe cache. Their duration is
+     * left unset too, so that a cached open returns the same packets.
+     */
+    int probe_cache_unset_durations;
 };
 
 #ifdef __GNUC__
@@ -794,6 +810,27 @@ int ff_packet_list_get(AVPacketList **head, AVPacketList **tail,
  */
 void ff_packet_list_free(AVPacketList **head, AVPacketList **tail);
 
+/**
+ * Note the size and modification time of the input and hash its leading and
+ * trailing bytes for the probe cache, leaving the position of s->pb unchanged.
+ */
+int ff_probe_cache_hash_header(AVFormatContext *s);
+
+/**
+ * Restore the stream information stored for the input in the probe cache.
+ *
+ * @return 1 if a valid entry was applied, 0 if there was none, AVERROR on failure
+ */
+int ff_probe_cache_load(AVFormatContext *s);
+
+/**
+ * Store the stream information found by avformat_find_stream_info() in the
+ * probe cache.
+ *
+ * @param nb_header_streams number of streams created by the demuxer header
+ */
+int ff_probe_cache_save(AVFormatContext *s, int nb_header_streams);
+
 void avpriv_register_devices(const AVOutputFormat * const o[], const AVInputFormat * const i[]);
 
 #endif /* AVFORMAT_INTERNAL_H */
@@ -154,6 +154,23 @@ typedef struct MOVIndexRange {
     int64_t end;
 } MOVIndexRange;
 
+/**
+ * Position in the sample tables, used to build the index entries of a
+ * lazily indexed stream.
+ */
+typedef struct MOVIndexCursor {
+    int sample;
+    unsigned int chunk;
+    unsigned int chunk_sample; ///< sample number within the chunk
+    int64_t offset;
+    unsigned int stsc_index;
+    unsigned int stts_index;
+    unsigned int stts_sample;
+    int64_t dts;
+    unsigned int stss_index;
+    unsigned int distance;
+} MOVIndexCursor;
+
 typedef struct MOVStreamContext {
     AVIOContext *pb;
     int pb_is_copied;
@@ -182,9 +199,12 @@ typedef struct MOVStreamContext {
     unsigned int stsz_sample_size; ///< always contains sample size from stsz atom
     unsigned int sample_count;
     int *sample_sizes;
+    int64_t sample_sizes_total;     ///< sum of the sample_sizes entries
+    unsigned int sample_sizes_max;  ///< largest sample_sizes entry
     int keyframe_absent;
     unsigned int keyframe_count;
     int *keyframes;
+    int keyframes_unsorted;   ///< the stss entries are not strictly increasing
     int time_scale;
     int64_t time_offset;  ///< time offset of the edit list entries
     int64_t min_corrected_pts;  ///< minimum Composition time shown by the edits excluding empty edits.
@@ -192,6 +212,10 @@ typedef struct MOVStreamContext {
     int64_t current_index;
     MOVIndexRange* index_ranges;
     MOVIndexRange* current_index_range;
+    int lazy_index;       ///< index_entries only holds a window of the samples
+    int index_base;       ///< sample number of index_entries[0]
+    int index_window;     ///< number of index entries built at once
+    MOVIndexCursor index_cursor; ///< table position of the last sample of the window
     unsigned int bytes_per_frame;
     unsigned int samples_per_frame;
     int dv_audio_container;
@@ -289,6 +313,8 @@ typedef struct MOVContext {
     uint8_t *decryption_key;
     int decryption_key_len;
     int enable_drefs;
+    int lazy_index;
+    int lazy_index_window;
     int32_t movie_display_matrix[3][3]; ///< display matrix from mvhd
 } MOVContext;
 
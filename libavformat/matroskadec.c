@@ -3626,6 +3626,32 @@ static int matroska_parse_block(MatroskaDemuxContext *matroska, AVBufferRef *buf
     return 0;
 }
 
+/* Let the protocol fetch the cluster following the one at cluster_pos, as far
+ * as the index tells where it is, assuming it is as large as this one. */
+static void matroska_prefetch_next_cluster(MatroskaDemuxContext *matroska,
+                                           int64_t cluster_pos)
+{
+    AVFormatContext *s = matroska->ctx;
+    int64_t next = INT64_MAX;
+
+    for (int i = 0; i < s->nb_streams; i++) {
+        const AVStream *st = s->streams[i];
+        int lo = 0, hi = st->nb_index_entries;
+
+        while (lo < hi) {
+            int mid = (lo + hi) >> 1;
+            if (st->index_entries[mid].pos <= cluster_pos)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo < st->nb_index_entries)
+            next = FFMIN(next, st->index_entries[lo].pos);
+    }
+    if (next != INT64_MAX)
+        ffio_prefetch(s->pb, next, next - cluster_pos);
+}
+
 static int matroska_parse_cluster(MatroskaDemuxContext *matroska)
 {
     MatroskaCluster *cluster = &matroska->current_cluster;
@@ -3640,6 +3666,7 @@ static int matroska_parse_cluster(MatroskaDemuxContext *matroska)
         if (res == 1) {
             /* Found a cluster: subtract the size of the ID already read. */
             cluster->pos = avio_tell(matroska->ctx->pb) - 4;
+            matroska_prefetch_next_cluster(matroska, cluster->pos);
 
             res = ebml_parse(matroska, matroska_cluster_enter, cluster);
             if (res < 0)
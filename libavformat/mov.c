@@ -2770,12 +2770,15 @@ static int mov_read_stss(MOVContext *c, AVIOContext *pb, MOVAtom atom)
         return AVERROR_INVALIDDATA;
     av_freep(&sc->keyframes);
     sc->keyframe_count = 0;
+    sc->keyframes_unsorted = 0;
     sc->keyframes = av_malloc_array(entries, sizeof(*sc->keyframes));
     if (!sc->keyframes)
         return AVERROR(ENOMEM);
 
     for (i = 0; i < entries && !pb->eof_reached; i++) {
         sc->keyframes[i] = avio_rb32(pb);
+        if (i && sc->keyframes[i] <= sc->keyframes[i - 1])
+            sc->keyframes_unsorted = 1;
     }
 
     sc->keyframe_count = i;
@@ -2837,6 +2840,8 @@ static int mov_read_stsz(MOVContext *c, AVIOContext *pb, MOVAtom atom)
         av_log(c->fc, AV_LOG_WARNING, "Duplicated STSZ atom\n");
     av_free(sc->sample_sizes);
     sc->sample_count = 0;
+    sc->sample_sizes_total = 0;
+    sc->sample_sizes_max   = 0;
     sc->sample_sizes = av_malloc_array(entries, sizeof(*sc->sample_sizes));
     if (!sc->sample_sizes)
         return AVERROR(ENOMEM);
@@ -2862,6 +2867,9 @@ static int mov_read_stsz(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     for (i = 0; i < entries && !pb->eof_reached; i++) {
         sc->sample_sizes[i] = get_bits_long(&gb, field_size);
         sc->data_size += sc->sample_sizes[i];
+        /* totals for the lazy index, which never walks the whole table */
+        sc->sample_sizes_total += (unsigned)sc->sample_sizes[i];
+        sc->sample_sizes_max    = FFMAX(sc->sample_sizes_max, (unsigned)sc->sample_sizes[i]);
     }
 
     sc->sample_count = i;
@@ -3745,6 +3753,356 @@ static void mov_fix_index(MOVContext *mov, AVStream *st)
     msc->current_index = msc->index_ranges[0].start;
 }
 
+static inline unsigned int mov_sample_size(const MOVStreamContext *sc, int sample)
+{
+    return sc->stsz_sample_size > 0 ? sc->stsz_sample_size : sc->sample_sizes[sample];
+}
+
+static inline int64_t mov_lazy_index_first_dts(const MOVStreamContext *sc)
+{
+    return -sc->time_offset - sc->dts_shift;
+}
+
+static inline int mov_key_off(const MOVStreamContext *sc)
+{
+    return sc->keyframe_count && sc->keyframes[0] > 0;
+}
+
+/* index of the first stss entry not below the given sample number */
+static unsigned int mov_keyframe_lower_bound(const MOVStreamContext *sc, int64_t sample)
+{
+    unsigned int a = 0, b = sc->keyframe_count;
+
+    while (a < b) {
+        unsigned int m = (a + b) >> 1;
+        if (sc->keyframes[m] < sample)
+            a = m + 1;
+        else
+            b = m;
+    }
+    return a;
+}
+
+/**
+ * Check whether mov_fix_index() would leave the index of the stream as it is,
+ * i.e. whether the edit list only delays the stream: an optional empty edit
+ * followed by an edit starting at media time 0 that covers every sample.
+ * Any other edit makes it discard or skip samples or shift the timestamps.
+ */
+static int mov_lazy_index_check_edit(MOVContext *mov, AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+    unsigned int i = sc->elst_count > 1 && sc->elst_data[0].time == -1;
+    unsigned int stts_index = 0, ctts_index = 0, stts_left, ctts_left;
+    int64_t empty = 0, duration, dts = 0;
+    int64_t cts_min = INT64_MAX, cts_max = INT64_MIN;
+
+    if (sc->elst_count > i + 1 || sc->elst_data[i].time || mov->time_scale <= 0)
+        return 0;
+    if (i)
+        empty = av_rescale(sc->elst_data[0].duration, sc->time_scale, mov->time_scale);
+    duration = av_rescale(sc->elst_data[i].duration, sc->time_scale, mov->time_scale);
+    if (empty + duration + sc->dts_shift < st->duration)
+        return 0;
+
+    /* the presentation time of every sample has to lie inside the edit */
+    stts_left = sc->stts_data[0].count;
+    ctts_left = sc->ctts_count ? sc->ctts_data[0].count : UINT_MAX;
+    while (stts_index < sc->stts_count) {
+        int64_t ctts = ctts_index < sc->ctts_count ? sc->ctts_data[ctts_index].duration : 0;
+        int64_t step = sc->stts_data[stts_index].duration;
+        unsigned int n = FFMIN(stts_left, ctts_left);
+
+        if (n) {
+            cts_min = FFMIN(cts_min, dts + ctts);
+            cts_max = FFMAX(cts_max, dts + (n - 1) * step + ctts);
+            dts    += n * step;
+        }
+        stts_left -= n;
+        ctts_left -= n;
+        if (!stts_left && ++stts_index < sc->stts_count)
+            stts_left = sc->stts_data[stts_index].count;
+        if (!ctts_left)
+            ctts_left = ++ctts_index < sc->ctts_count ? sc->ctts_data[ctts_index].count : UINT_MAX;
+    }
+
+    return !cts_min && cts_max < duration;
+}
+
+/**
+ * Check whether the index of the stream can be built on demand from its
+ * sample tables, i.e. whether mov_build_index() would create exactly one
+ * entry per sample without rewriting the tables.
+ */
+static int mov_lazy_index_check(MOVContext *mov, AVStream *st, uint64_t *stream_size)
+{
+    MOVStreamContext *sc = st->priv_data;
+    uint64_t samples = 0, size = 0;
+    unsigned int i;
+
+    if (st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO &&
+        st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+        return 0;
+    if (!sc->sample_count || sc->sample_count >= INT_MAX || st->nb_index_entries ||
+        !sc->chunk_count || !sc->stsc_count || !sc->stts_count ||
+        sc->stps_count || sc->rap_group_count)
+        return 0;
+    /* uncompressed audio chunk demuxing */
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
+        sc->stts_count == 1 && sc->stts_data[0].duration == 1)
+        return 0;
+
+    for (i = 0; i < sc->stts_count; i++) {
+        if (!sc->stts_data[i].count || sc->stts_data[i].duration < 0)
+            return 0;
+        /* only the last sample may have no duration */
+        if (!sc->stts_data[i].duration &&
+            (sc->stts_data[i].count > 1 || samples + 1 != sc->sample_count))
+            return 0;
+        samples += sc->stts_data[i].count;
+    }
+
+    if (sc->elst_count && mov->advanced_editlist && !mov->ignore_editlist &&
+        !mov_lazy_index_check_edit(mov, st))
+        return 0;
+
+    if (sc->stsc_data[0].first != 1)
+        return 0;
+    samples = 0;
+    for (i = 0; i < sc->stsc_count; i++) {
+        if (!sc->stsc_data[i].count || sc->stsc_data[i].first > sc->chunk_count ||
+            (i && sc->stsc_data[i].first <= sc->stsc_data[i - 1].first) ||
+            (sc->pseudo_stream_id != -1 && sc->stsc_data[i].id - 1 != sc->pseudo_stream_id))
+            return 0;
+        samples += mov_get_stsc_samples(sc, i);
+    }
+    if (samples != sc->sample_count)
+        return 0;
+
+    if (!sc->keyframe_absent && sc->keyframes_unsorted)
+        return 0;
+
+    if ((sc->sample_size > 0 && sc->sample_size < sc->stsz_sample_size) ||
+        (sc->stsz_sample_size > 0 && sc->stsz_sample_size < sc->sample_size))
+        return 0;
+    if (sc->stsz_sample_size > 0) {
+        if (sc->stsz_sample_size > 0x3FFFFFFF)
+            return 0;
+        size = (uint64_t)sc->stsz_sample_size * sc->sample_count;
+    } else {
+        if (!sc->sample_sizes || sc->sample_sizes_max > 0x3FFFFFFF)
+            return 0;
+        size = sc->sample_sizes_total;
+    }
+
+    *stream_size = size;
+    return 1;
+}
+
+/* Position the cursor on the given sample, walking the run-length tables. */
+static void mov_index_cursor_seek(AVStream *st, MOVIndexCursor *c, int sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int key_off = mov_key_off(sc);
+    int64_t last_key;
+    unsigned int remaining, i;
+
+    memset(c, 0, sizeof(*c));
+    c->sample = sample;
+    c->dts    = mov_lazy_index_first_dts(sc);
+
+    remaining = sample;
+    while (c->stts_index + 1 < sc->stts_count &&
+           remaining >= sc->stts_data[c->stts_index].count) {
+        remaining -= sc->stts_data[c->stts_index].count;
+        c->dts    += (int64_t)sc->stts_data[c->stts_index].count *
+                     sc->stts_data[c->stts_index].duration;
+        c->stts_index++;
+    }
+    c->stts_sample = remaining;
+    c->dts        += (int64_t)remaining * sc->stts_data[c->stts_index].duration;
+
+    remaining = sample;
+    while (mov_stsc_index_valid(c->stsc_index, sc->stsc_count) &&
+           remaining >= mov_get_stsc_samples(sc, c->stsc_index)) {
+        remaining -= mov_get_stsc_samples(sc, c->stsc_index);
+        c->stsc_index++;
+    }
+    c->chunk        = sc->stsc_data[c->stsc_index].first - 1 +
+                      remaining / sc->stsc_data[c->stsc_index].count;
+    c->chunk_sample = remaining % sc->stsc_data[c->stsc_index].count;
+    c->offset       = sc->chunk_offsets[c->chunk];
+    for (i = sample - c->chunk_sample; i < sample; i++)
+        c->offset += mov_sample_size(sc, i);
+
+    if (sc->keyframe_absent) {
+        last_key = st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO ? sample : 0;
+    } else if (!sc->keyframe_count) {
+        last_key = sample;
+    } else {
+        c->stss_index = mov_keyframe_lower_bound(sc, (int64_t)sample + key_off);
+        i = mov_keyframe_lower_bound(sc, (int64_t)sample + key_off + 1);
+        last_key = i ? sc->keyframes[i - 1] - key_off : 0;
+    }
+    c->distance = sample - last_key;
+}
+
+/* Fill the index entry of the sample at the cursor and move to the next one. */
+static void mov_index_cursor_next(AVStream *st, MOVIndexCursor *c, AVIndexEntry *e)
+{
+    MOVStreamContext *sc = st->priv_data;
+    unsigned int sample_size = mov_sample_size(sc, c->sample);
+    int keyframe = 0;
+
+    if (sc->keyframe_absent) {
+        keyframe = st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO || !c->sample;
+    } else if (!sc->keyframe_count) {
+        keyframe = 1;
+    } else if (c->stss_index < sc->keyframe_count &&
+               c->sample + mov_key_off(sc) == sc->keyframes[c->stss_index]) {
+        keyframe = 1;
+        c->stss_index++;
+    }
+    if (keyframe)
+        c->distance = 0;
+
+    e->pos          = c->offset;
+    e->timestamp    = c->dts;
+    e->size         = sample_size;
+    e->min_distance = c->distance;
+    e->flags        = keyframe ? AVINDEX_KEYFRAME : 0;
+
+    c->offset += sample_size;
+    c->dts    += sc->stts_data[c->stts_index].duration;
+    c->stts_sample++;
+    if (c->stts_index + 1 < sc->stts_count &&
+        c->stts_sample == sc->stts_data[c->stts_index].count) {
+        c->stts_sample = 0;
+        c->stts_index++;
+    }
+    c->distance++;
+    c->sample++;
+    if (++c->chunk_sample == sc->stsc_data[c->stsc_index].count &&
+        c->sample < sc->sample_count) {
+        c->chunk_sample = 0;
+        c->chunk++;
+        c->offset = sc->chunk_offsets[c->chunk];
+        if (mov_stsc_index_valid(c->stsc_index, sc->stsc_count) &&
+            c->chunk + 1 == sc->stsc_data[c->stsc_index + 1].first)
+            c->stsc_index++;
+    }
+}
+
+/**
+ * Make sure the index entries of the given sample and of the one following
+ * it are in the window of a lazily indexed stream.
+ */
+static void mov_lazy_index_load(AVStream *st, int sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVIndexCursor *c = &sc->index_cursor;
+    MOVIndexCursor last;
+    AVIndexEntry skipped;
+    int i, nb;
+
+    if (!sc->lazy_index || sample < 0 || sample >= sc->sample_count)
+        return;
+    if (sample >= sc->index_base &&
+        FFMIN(sample + 2, sc->sample_count) <= sc->index_base + st->nb_index_entries)
+        return;
+
+    if (sample < c->sample || sample - c->sample > sc->index_window)
+        mov_index_cursor_seek(st, c, sample);
+    while (c->sample < sample)
+        mov_index_cursor_next(st, c, &skipped);
+
+    nb = FFMIN(sc->index_window, sc->sample_count - sample);
+    for (i = 0; i < nb - 1; i++)
+        mov_index_cursor_next(st, c, &st->index_entries[i]);
+    /* keep the cursor on the last sample, the next window starts there */
+    last = *c;
+    mov_index_cursor_next(st, c, &st->index_entries[i]);
+    *c = last;
+    sc->index_base       = sample;
+    st->nb_index_entries = nb;
+}
+
+static void mov_lazy_index_init(MOVContext *mov, AVStream *st, uint64_t stream_size)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int i, nb = FFMIN(sc->sample_count, mov->lazy_index_window);
+
+    if (av_reallocp_array(&st->index_entries, nb, sizeof(*st->index_entries)) < 0) {
+        st->nb_index_entries = 0;
+        sc->lazy_index = 0;
+        return;
+    }
+    st->index_entries_allocated_size = nb * sizeof(*st->index_entries);
+    sc->index_window = mov->lazy_index_window;
+
+    mov_index_cursor_seek(st, &sc->index_cursor, 0);
+    mov_lazy_index_load(st, 0);
+    av_log(mov->fc, AV_LOG_DEBUG, "stream %d: indexing %u samples on demand\n",
+           st->index, sc->sample_count);
+
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+        for (i = 0; i < FFMIN(st->nb_index_entries, 99); i++)
+            ff_rfps_add_frame(mov->fc, st, st->index_entries[i].timestamp);
+    if (st->duration > 0)
+        st->codecpar->bit_rate = stream_size*8*sc->time_scale/st->duration;
+}
+
+/**
+ * Find the sample to seek to in a lazily indexed stream, with the
+ * semantics of ff_index_search_timestamp() on its full index.
+ */
+static int mov_lazy_index_search(AVStream *st, int64_t timestamp, int flags)
+{
+    MOVStreamContext *sc = st->priv_data;
+    int64_t dts = mov_lazy_index_first_dts(sc);
+    int key_off = mov_key_off(sc);
+    int sample = 0, a, b = sc->sample_count, m, exact = 0;
+    unsigned int i;
+
+    for (i = 0; i < sc->stts_count && sample < sc->sample_count; i++) {
+        int64_t count = sc->sample_count - sample;
+        int64_t duration = sc->stts_data[i].duration;
+
+        if (i + 1 < sc->stts_count)
+            count = FFMIN(count, sc->stts_data[i].count);
+        if (timestamp <= dts + (count - 1) * duration) {
+            int64_t delta = FFMAX(timestamp - dts, 0);
+            b     = sample + (duration ? (delta + duration - 1) / duration : 0);
+            exact = timestamp >= dts && (duration ? delta % duration : delta) == 0;
+            break;
+        }
+        sample += count;
+        dts    += count * duration;
+    }
+    a = exact ? b : b - 1;
+    m = (flags & AVSEEK_FLAG_BACKWARD) ? a : b;
+
+    if (!(flags & AVSEEK_FLAG_ANY) && m >= 0 && m < sc->sample_count) {
+        if (sc->keyframe_absent) {
+            if (st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+                m = (flags & AVSEEK_FLAG_BACKWARD) || !m ? 0 : sc->sample_count;
+        } else if (sc->keyframe_count) {
+            if (flags & AVSEEK_FLAG_BACKWARD) {
+                i = mov_keyframe_lower_bound(sc, (int64_t)m + key_off + 1);
+                m = i ? sc->keyframes[i - 1] - key_off : -1;
+            } else {
+                i = mov_keyframe_lower_bound(sc, (int64_t)m + key_off);
+                m = i < sc->keyframe_count ? sc->keyframes[i] - key_off : sc->sample_count;
+                m = FFMIN(m, sc->sample_count);
+            }
+        }
+    }
+
+    if (m == sc->sample_count)
+        return -1;
+    return m;
+}
+
 static void mov_build_index(MOVContext *mov, AVStream *st)
 {
     MOVStreamContext *sc = st->priv_data;
@@ -3758,6 +4116,13 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
     uint64_t stream_size = 0;
     MOVStts *ctts_data_old = sc->ctts_data;
     unsigned int ctts_count_old = sc->ctts_count;
+    int advanced_editlist = mov->advanced_editlist;
+
+    /* fragments are added to the full index */
+    if (mov->lazy_index && !mov->trex_data)
+        sc->lazy_index = mov_lazy_index_check(mov, st, &stream_size);
+    if (sc->lazy_index)
+        advanced_editlist = 0;
 
     if (sc->elst_count) {
         int i, edit_start_index = 0, multiple_edits = 0;
@@ -3789,18 +4154,20 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
                 empty_duration = av_rescale(empty_duration, sc->time_scale, mov->time_scale);
             sc->time_offset = start_time - empty_duration;
             sc->min_corrected_pts = start_time;
-            if (!mov->advanced_editlist)
+            if (!advanced_editlist)
                 current_dts = -sc->time_offset;
         }
 
-        if (!multiple_edits && !mov->advanced_editlist &&
+        if (!multiple_edits && !advanced_editlist &&
             st->codecpar->codec_id == AV_CODEC_ID_AAC && start_time > 0)
             sc->start_pad = start_time;
     }
 
     /* only use old uncompressed audio chunk demuxing when stts specifies it */
-    if (!(st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
-          sc->stts_count == 1 && sc->stts_data[0].duration == 1)) {
+    if (sc->lazy_index) {
+        mov_lazy_index_init(mov, st, stream_size);
+    } else if (!(st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
+                 sc->stts_count == 1 && sc->stts_data[0].duration == 1)) {
         unsigned int current_sample = 0;
         unsigned int stts_sample = 0;
         unsigned int sample_size;
@@ -4057,7 +4424,7 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
         }
     }
 
-    if (!mov->ignore_editlist && mov->advanced_editlist) {
+    if (!mov->ignore_editlist && advanced_editlist) {
         // Fix index according to edit lists.
         mov_fix_index(mov, st);
     }
@@ -4073,6 +4440,26 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
     mov_estimate_video_delay(mov, st);
 }
 
+/**
+ * Replace the window of a lazily indexed stream by its full index, samples
+ * from fragments are added to the latter.
+ */
+static void mov_lazy_index_expand(MOVContext *mov, AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+
+    if (!sc->lazy_index)
+        return;
+
+    sc->lazy_index = 0;
+    sc->index_base = 0;
+    av_freep(&st->index_entries);
+    st->nb_index_entries = 0;
+    st->index_entries_allocated_size = 0;
+    st->start_time = AV_NOPTS_VALUE;
+    mov_build_index(mov, st);
+}
+
 static int test_same_origin(const char *src, const char *ref) {
     char src_proto[64];
     char ref_proto[64];
@@ -4301,14 +4688,16 @@ static int mov_read_trak(MOVContext *c, AVIOContext *pb, MOVAtom atom)
         && sc->time_scale == st->codecpar->sample_rate) {
             st->need_parsing = AVSTREAM_PARSE_FULL;
     }
-    /* Do not need those anymore. */
-    av_freep(&sc->chunk_offsets);
-    av_freep(&sc->sample_sizes);
-    av_freep(&sc->keyframes);
-    av_freep(&sc->stts_data);
-    av_freep(&sc->stps_data);
-    av_freep(&sc->elst_data);
-    av_freep(&sc->rap_group);
+    /* Do not need those anymore, unless the index is built on demand. */
+    if (!sc->lazy_index) {
+        av_freep(&sc->chunk_offsets);
+        av_freep(&sc->sample_sizes);
+        av_freep(&sc->keyframes);
+        av_freep(&sc->stts_data);
+        av_freep(&sc->stps_data);
+        av_freep(&sc->elst_data);
+        av_freep(&sc->rap_group);
+    }
 
     return 0;
 }
@@ -4650,7 +5039,7 @@ static int mov_read_chap(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 static int mov_read_trex(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 {
     MOVTrackExt *trex;
-    int err;
+    int i, err;
 
     if ((uint64_t)c->trex_count+1 >= UINT_MAX / sizeof(*c->trex_data))
         return AVERROR_INVALIDDATA;
@@ -4670,6 +5059,10 @@ static int mov_read_trex(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     trex->duration = avio_rb32(pb);
     trex->size     = avio_rb32(pb);
     trex->flags    = avio_rb32(pb);
+
+    for (i = 0; i < c->fc->nb_streams; i++)
+        if (c->fc->streams[i]->id == trex->track_id)
+            mov_lazy_index_expand(c, c->fc->streams[i]);
     return 0;
 }
 
@@ -7657,6 +8050,15 @@ static int mov_read_header(AVFormatContext *s)
     return 0;
 }
 
+static AVIndexEntry *mov_get_index_entry(AVStream *st, int sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+
+    if (sample < sc->index_base || sample - sc->index_base >= st->nb_index_entries)
+        return NULL;
+    return &st->index_entries[sample - sc->index_base];
+}
+
 static AVIndexEntry *mov_find_next_sample(AVFormatContext *s, AVStream **st)
 {
     AVIndexEntry *sample = NULL;
@@ -7665,8 +8067,11 @@ static AVIndexEntry *mov_find_next_sample(AVFormatContext *s, AVStream **st)
     for (i = 0; i < s->nb_streams; i++) {
         AVStream *avst = s->streams[i];
         MOVStreamContext *msc = avst->priv_data;
-        if (msc->pb && msc->current_sample < avst->nb_index_entries) {
-            AVIndexEntry *current_sample = &avst->index_entries[msc->current_sample];
+        AVIndexEntry *current_sample;
+        /* the entry of the next sample stays loaded until this is called again */
+        mov_lazy_index_load(avst, msc->current_sample);
+        current_sample = mov_get_index_entry(avst, msc->current_sample);
+        if (msc->pb && current_sample) {
             int64_t dts = av_rescale(current_sample->timestamp, AV_TIME_BASE, msc->time_scale);
             av_log(s, AV_LOG_TRACE, "stream %d, sample %d, dts %"PRId64"\n", i, msc->current_sample, dts);
             if (!sample || (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL) && current_sample->pos < sample->pos) ||
@@ -7752,7 +8157,7 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
 {
     MOVContext *mov = s->priv_data;
     MOVStreamContext *sc;
-    AVIndexEntry *sample;
+    AVIndexEntry *sample, *next;
     AVStream *st = NULL;
     int64_t current_index;
     int ret;
@@ -7799,6 +8204,11 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
             }
             return ret;
         }
+        /* let the protocol fetch the next sample of the track meanwhile,
+         * the tracks may be far apart in the file */
+        next = mov_get_index_entry(st, sc->current_index);
+        if (next)
+            ffio_prefetch(sc->pb, next->pos, next->size);
         if (sc->has_palette) {
             uint8_t *pal;
 
@@ -7841,8 +8251,10 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
             sc->ctts_sample = 0;
         }
     } else {
-        int64_t next_dts = (sc->current_sample < st->nb_index_entries) ?
-            st->index_entries[sc->current_sample].timestamp : st->duration;
+        int64_t next_dts;
+
+        next = mov_get_index_entry(st, sc->current_sample);
+        next_dts = next ? next->timestamp : st->duration;
 
         if (next_dts >= pkt->dts)
             pkt->duration = next_dts - pkt->dts;
@@ -7912,6 +8324,7 @@ static int mov_seek_stream(AVFormatContext *s, AVStream *st, int64_t timestamp,
 {
     MOVStreamContext *sc = st->priv_data;
     int sample, time_sample, ret;
+    int64_t first_dts;
     unsigned int i;
 
     // Here we consider timestamp to be PTS, hence try to offset it so that we
@@ -7922,13 +8335,20 @@ static int mov_seek_stream(AVFormatContext *s, AVStream *st, int64_t timestamp,
     if (ret < 0)
         return ret;
 
-    sample = av_index_search_timestamp(st, timestamp, flags);
+    if (sc->lazy_index) {
+        sample = mov_lazy_index_search(st, timestamp, flags);
+        first_dts = mov_lazy_index_first_dts(sc);
+    } else {
+        sample = av_index_search_timestamp(st, timestamp, flags);
+        first_dts = st->nb_index_entries ? st->index_entries[0].timestamp : 0;
+    }
     av_log(s, AV_LOG_TRACE, "stream %d, timestamp %"PRId64", sample %d\n", st->index, timestamp, sample);
-    if (sample < 0 && st->nb_index_entries && timestamp < st->index_entries[0].timestamp)
+    if (sample < 0 && st->nb_index_entries && timestamp < first_dts)
         sample = 0;
     if (sample < 0) /* not sure what to do */
         return AVERROR_INVALIDDATA;
     mov_current_sample_set(sc, sample);
+    mov_lazy_index_load(st, sample);
     av_log(s, AV_LOG_TRACE, "stream %d, found sample %d\n", st->index, sc->current_sample);
     /* adjust ctts index */
     if (sc->ctts_data) {
@@ -7979,7 +8399,7 @@ static int mov_read_seek(AVFormatContext *s, int stream_index, int64_t sample_ti
 
     if (mc->seek_individually) {
         /* adjust seek timestamp to found sample timestamp */
-        int64_t seek_timestamp = st->index_entries[sample].timestamp;
+        int64_t seek_timestamp = mov_get_index_entry(st, sample)->timestamp;
 
         for (i = 0; i < s->nb_streams; i++) {
             int64_t timestamp;
@@ -8057,6 +8477,10 @@ static const AVOption mov_options[] = {
     { "decryption_key", "The media decryption key (hex)", OFFSET(decryption_key), AV_OPT_TYPE_BINARY, .flags = AV_OPT_FLAG_DECODING_PARAM },
     { "enable_drefs", "Enable external track support.", OFFSET(enable_drefs), AV_OPT_TYPE_BOOL,
         {.i64 = 0}, 0, 1, FLAGS },
+    { "lazy_index", "Build the index entries around the read position only", OFFSET(lazy_index), AV_OPT_TYPE_BOOL,
+        {.i64 = 0}, 0, 1, FLAGS },
+    { "lazy_index_window", "Number of index entries built at once with lazy_index", OFFSET(lazy_index_window), AV_OPT_TYPE_INT,
+        {.i64 = 4096}, 2, INT_MAX / sizeof(AVIndexEntry), FLAGS },
 
     { NULL },
 };
@@ -0,0 +1,544 @@
+/*
+ * Persistent cache of the stream information found by probing
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file
+ * Store what avformat_find_stream_info() found for an input in a file of the
+ * probe_cache directory, named after the MD5 of the URL, so that opening the
+ * same input again skips the decode-probe loop.
+ *
+ * An entry is only used if the size and modification time of the input, the
+ * MD5 of its first and last 64 KiB, the demuxer, the probing limits and the
+ * streams created by the header all match.
+ */
+
+#include <string.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "libavutil/avstring.h"
+#include "libavutil/md5.h"
+#include "libavutil/mem.h"
+#include "libavutil/random_seed.h"
+#include "avformat.h"
+#include "avio_internal.h"
+#include "internal.h"
+#include "os_support.h"
+#include "url.h"
+#include "version.h"
+
+#define PROBE_CACHE_TAG     MKBETAG('F','F','P','C')
+#define PROBE_CACHE_VERSION 2
+#define HEADER_HASH_SIZE    (64 * 1024)
+#define MAX_NAME_SIZE       128
+
+typedef struct CachedStream {
+    int id;
+    AVCodecParameters *par;
+    int pts_wrap_bits;
+    AVRational time_base;
+    int64_t start_time;
+    int64_t duration;
+    int64_t nb_frames;
+    int disposition;
+    AVRational sample_aspect_ratio;
+    AVRational r_frame_rate;
+    AVRational avg_frame_rate;
+    int codec_info_nb_frames;
+    AVRational codec_time_base;
+    int ticks_per_frame;
+    AVRational codec_framerate;
+    int coded_width;
+    int coded_height;
+    int unset_durations;
+} CachedStream;
+
+/* modification time of the input if it is a local file, 0 otherwise */
+static int64_t input_mtime(AVFormatContext *s)
+{
+    URLContext *h = ffio_geturlcontext(s->pb);
+    struct stat st;
+    int fd;
+
+    if (!h || (fd = ffurl_get_file_handle(h)) < 0 || fstat(fd, &st) < 0)
+        return 0;
+    return st.st_mtime;
+}
+
+int ff_probe_cache_hash_header(AVFormatContext *s)
+{
+    AVFormatInternal *si = s->internal;
+    int64_t pos = avio_tell(s->pb);
+    int64_t size = avio_size(s->pb);
+    struct AVMD5 *md5;
+    uint8_t *buf;
+    int ret, len;
+
+    buf = av_malloc(HEADER_HASH_SIZE);
+    md5 = av_md5_alloc();
+    if (!buf || !md5) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    av_md5_init(md5);
+
+    if ((ret = ffio_ensure_seekback(s->pb, HEADER_HASH_SIZE)) < 0)
+        goto end;
+    len = avio_read(s->pb, buf, HEADER_HASH_SIZE);
+    if (len < 0) {
+        ret = len;
+        goto end;
+    }
+    av_md5_update(md5, buf, len);
+
+    /* a file rewritten in place keeps its size and often its header */
+    if (size > 2 * HEADER_HASH_SIZE && (s->pb->seekable & AVIO_SEEKABLE_NORMAL)) {
+        if ((ret = avio_seek(s->pb, size - HEADER_HASH_SIZE, SEEK_SET)) < 0)
+            goto end;
+        len = avio_read(s->pb, buf, HEADER_HASH_SIZE);
+        if (len < 0) {
+            ret = len;
+            goto end;
+        }
+        av_md5_update(md5, buf, len);
+    }
+    if ((ret = avio_seek(s->pb, pos, SEEK_SET)) < 0)
+        goto end;
+
+    av_md5_final(md5, si->probe_cache_hash);
+    si->probe_cache_size   = size;
+    si->probe_cache_mtime  = input_mtime(s);
+    si->probe_cache_hashed = 1;
+    ret = 0;
+end:
+    av_free(md5);
+    av_free(buf);
+    return ret;
+}
+
+static char *cache_path(AVFormatContext *s)
+{
+    const char *url = s->url ? s->url : "";
+    uint8_t md5[16];
+    char hex[33];
+
+    av_md5_sum(md5, url, strlen(url));
+    ff_data_to_hex(hex, md5, sizeof(md5), 1);
+    hex[32] = 0;
+    return av_asprintf("%s/%s.probe", s->probe_cache, hex);
+}
+
+static void put_rational(AVIOContext *pb, AVRational q)
+{
+    avio_wb32(pb, q.num);
+    avio_wb32(pb, q.den);
+}
+
+static AVRational get_rational(AVIOContext *pb)
+{
+    AVRational q;
+
+    q.num = avio_rb32(pb);
+    q.den = avio_rb32(pb);
+    return q;
+}
+
+/**
+ * Count the packets of the stream read by the probing before their duration
+ * could be computed, which are at the start of the packet buffer.
+ */
+static int unset_durations(AVFormatContext *s, AVStream *st)
+{
+    AVPacketList *pktl;
+    int nb = 0;
+
+    for (pktl = s->internal->packet_buffer; pktl; pktl = pktl->next) {
+        if (pktl->pkt.stream_index != st->index)
+            continue;
+        if (pktl->pkt.duration)
+            break;
+        nb++;
+    }
+    return nb;
+}
+
+static void write_stream(AVIOContext *pb, AVFormatContext *s, AVStream *st)
+{
+    const AVCodecParameters *par = st->codecpar;
+    const AVCodecContext *avctx  = st->internal->avctx;
+
+    avio_wb32(pb, st->id);
+
+    avio_wb32(pb, par->codec_type);
+    avio_wb32(pb, par->codec_id);
+    avio_wb32(pb, par->codec_tag);
+    avio_wb32(pb, par->format);
+    avio_wb64(pb, par->bit_rate);
+    avio_wb32(pb, par->bits_per_coded_sample);
+    avio_wb32(pb, par->bits_per_raw_sample);
+    avio_wb32(pb, par->profile);
+    avio_wb32(pb, par->level);
+    avio_wb32(pb, par->width);
+    avio_wb32(pb, par->height);
+    put_rational(pb, par->sample_aspect_ratio);
+    avio_wb32(pb, par->field_order);
+    avio_wb32(pb, par->color_range);
+    avio_wb32(pb, par->color_primaries);
+    avio_wb32(pb, par->color_trc);
+    avio_wb32(pb, par->color_space);
+    avio_wb32(pb, par->chroma_location);
+    avio_wb32(pb, par->video_delay);
+    avio_wb64(pb, par->channel_layout);
+    avio_wb32(pb, par->channels);
+    avio_wb32(pb, par->sample_rate);
+    avio_wb32(pb, par->block_align);
+    avio_wb32(pb, par->frame_size);
+    avio_wb32(pb, par->initial_padding);
+    avio_wb32(pb, par->trailing_padding);
+    avio_wb32(pb, par->seek_preroll);
+    avio_wb32(pb, par->extradata_size);
+    avio_write(pb, par->extradata, par->extradata_size);
+
+    avio_wb32(pb, st->pts_wrap_bits);
+    put_rational(pb, st->time_base);
+    avio_wb64(pb, st->start_time);
+    avio_wb64(pb, st->duration);
+    avio_wb64(pb, st->nb_frames);
+    avio_wb32(pb, st->disposition);
+    put_rational(pb, st->sample_aspect_ratio);
+    put_rational(pb, st->r_frame_rate);
+    put_rational(pb, st->avg_frame_rate);
+    avio_wb32(pb, st->codec_info_nb_frames);
+
+    /* used by the timestamp guessing of the packets read afterwards */
+    put_rational(pb, avctx->time_base);
+    avio_wb32(pb, avctx->ticks_per_frame);
+    put_rational(pb, avctx->framerate);
+    avio_wb32(pb, avctx->coded_width);
+    avio_wb32(pb, avctx->coded_height);
+    avio_wb32(pb, unset_durations(s, st));
+}
+
+static int read_stream(AVFormatContext *s, AVIOContext *pb, CachedStream *cs)
+{
+    AVCodecParameters *par;
+    int size;
+
+    if (!(cs->par = par = avcodec_parameters_alloc()))
+        return AVERROR(ENOMEM);
+
+    cs->id = avio_rb32(pb);
+
+    par->codec_type            = (int)avio_rb32(pb);
+    par->codec_id              = avio_rb32(pb);
+    par->codec_tag             = avio_rb32(pb);
+    par->format                = avio_rb32(pb);
+    par->bit_rate              = avio_rb64(pb);
+    par->bits_per_coded_sample = avio_rb32(pb);
+    par->bits_per_raw_sample   = avio_rb32(pb);
+    par->profile               = avio_rb32(pb);
+    par->level                 = avio_rb32(pb);
+    par->width                 = avio_rb32(pb);
+    par->height                = avio_rb32(pb);
+    par->sample_aspect_ratio   = get_rational(pb);
+    par->field_order           = avio_rb32(pb);
+    par->color_range           = avio_rb32(pb);
+    par->color_primaries       = avio_rb32(pb);
+    par->color_trc             = avio_rb32(pb);
+    par->color_space           = avio_rb32(pb);
+    par->chroma_location       = avio_rb32(pb);
+    par->video_delay           = avio_rb32(pb);
+    par->channel_layout        = avio_rb64(pb);
+    par->channels              = avio_rb32(pb);
+    par->sample_rate           = avio_rb32(pb);
+    par->block_align           = avio_rb32(pb);
+    par->frame_size            = avio_rb32(pb);
+    par->initial_padding       = avio_rb32(pb);
+    par->trailing_padding      = avio_rb32(pb);
+    par->seek_preroll          = avio_rb32(pb);
+    size = avio_rb32(pb);
+    if (size < 0 || size > (1 << 28))
+        return AVERROR_INVALIDDATA;
+    if (size && ff_get_extradata(s, par, pb, size) < 0)
+        return AVERROR_INVALIDDATA;
+
+    cs->pts_wrap_bits        = avio_rb32(pb);
+    cs->time_base            = get_rational(pb);
+    cs->start_time           = avio_rb64(pb);
+    cs->duration             = avio_rb64(pb);
+    cs->nb_frames            = avio_rb64(pb);
+    cs->disposition          = avio_rb32(pb);
+    cs->sample_aspect_ratio  = get_rational(pb);
+    cs->r_frame_rate         = get_rational(pb);
+    cs->avg_frame_rate       = get_rational(pb);
+    cs->codec_info_nb_frames = avio_rb32(pb);
+
+    cs->codec_time_base      = get_rational(pb);
+    cs->ticks_per_frame      = avio_rb32(pb);
+    cs->codec_framerate      = get_rational(pb);
+    cs->coded_width          = avio_rb32(pb);
+    cs->coded_height         = avio_rb32(pb);
+    cs->unset_durations      = avio_rb32(pb);
+
+    if (cs->pts_wrap_bits <= 0 || cs->pts_wrap_bits > 64 ||
+        cs->time_base.num <= 0 || cs->time_base.den <= 0 || cs->unset_durations < 0 ||
+        (unsigned)par->codec_type >= AVMEDIA_TYPE_NB)
+        return AVERROR_INVALIDDATA;
+    return 0;
+}
+
+/**
+ * Write everything check_header() compares: the identity of the input, the
+ * probing limits and the number of streams before and after probing.
+ */
+static void write_header(AVIOContext *pb, AVFormatContext *s, int nb_header_streams)
+{
+    AVFormatInternal *si = s->internal;
+
+    avio_wb32(pb, PROBE_CACHE_TAG);
+    avio_wb32(pb, PROBE_CACHE_VERSION);
+    avio_wb32(pb, LIBAVFORMAT_VERSION_INT);
+    avio_put_str(pb, s->iformat->name);
+    avio_wb64(pb, si->probe_cache_size);
+    avio_wb64(pb, si->probe_cache_mtime);
+    avio_write(pb, si->probe_cache_hash, sizeof(si->probe_cache_hash));
+    avio_wb64(pb, s->probesize);
+    avio_wb64(pb, s->max_analyze_duration);
+    avio_wb32(pb, s->fps_probe_size);
+    avio_wb32(pb, nb_header_streams);
+    avio_wb32(pb, s->nb_streams);
+}
+
+static int check_header(AVIOContext *pb, AVFormatContext *s, int *nb_streams)
+{
+    AVFormatInternal *si = s->internal;
+    char name[MAX_NAME_SIZE];
+    uint8_t hash[16];
+
+    if (avio_rb32(pb) != PROBE_CACHE_TAG     ||
+        avio_rb32(pb) != PROBE_CACHE_VERSION ||
+        avio_rb32(pb) != LIBAVFORMAT_VERSION_INT)
+        return 0;
+    avio_get_str(pb, sizeof(name), name, sizeof(name));
+    if (strcmp(name, s->iformat->name))
+        return 0;
+    if ((int64_t)avio_rb64(pb) != si->probe_cache_size ||
+        (int64_t)avio_rb64(pb) != si->probe_cache_mtime)
+        return 0;
+    avio_read(pb, hash, sizeof(hash));
+    if (memcmp(hash, si->probe_cache_hash, sizeof(hash)))
+        return 0;
+    if ((int64_t)avio_rb64(pb) != s->probesize            ||
+        (int64_t)avio_rb64(pb) != s->max_analyze_duration ||
+        (int)avio_rb32(pb)     != s->fps_probe_size)
+        return 0;
+    if ((int)avio_rb32(pb) != s->nb_streams)
+        return 0;
+    *nb_streams = avio_rb32(pb);
+    return !pb->eof_reached && *nb_streams >= s->nb_streams &&
+           *nb_streams <= s->max_streams;
+}
+
+/**
+ * Streams which only show up while reading packets can be created in advance
+ * if the header announced none and the demuxer looks its streams up by type
+ * instead of creating one for each new id.
+ */
+static int can_create_streams(AVFormatContext *s, int nb_header_streams)
+{
+    return !nb_header_streams && !strcmp(s->iformat->name, "flv");
+}
+
+static int apply_stream(AVFormatContext *s, AVStream *st, const CachedStream *cs)
+{
+    AVCodecContext *avctx = st->internal->avctx;
+    int ret;
+
+    st->id = cs->id;
+    if ((ret = avcodec_parameters_copy(st->codecpar, cs->par)) < 0)
+        return ret;
+    avpriv_set_pts_info(st, cs->pts_wrap_bits, cs->time_base.num, cs->time_base.den);
+    st->start_time           = cs->start_time;
+    st->duration             = cs->duration;
+    st->nb_frames            = cs->nb_frames;
+    st->disposition          = cs->disposition;
+    st->sample_aspect_ratio  = cs->sample_aspect_ratio;
+    st->r_frame_rate         = cs->r_frame_rate;
+    st->avg_frame_rate       = cs->avg_frame_rate;
+    st->codec_info_nb_frames = cs->codec_info_nb_frames;
+    /* the cached codec id already is the result of the codec probing */
+    if (st->request_probe > 0)
+        st->request_probe = -1;
+
+    if ((ret = avcodec_parameters_to_context(avctx, st->codecpar)) < 0)
+        return ret;
+    avctx->time_base       = cs->codec_time_base;
+    avctx->ticks_per_frame = cs->ticks_per_frame;
+    avctx->framerate       = cs->codec_framerate;
+    avctx->coded_width     = cs->coded_width;
+    avctx->coded_height    = cs->coded_height;
+    st->internal->orig_codec_id        = st->codecpar->codec_id;
+    st->internal->need_context_update = 0;
+    st->internal->probe_cache_unset_durations = cs->unset_durations;
+
+#if FF_API_LAVF_AVCTX
+FF_DISABLE_DEPRECATION_WARNINGS
+    if ((ret = avcodec_parameters_to_context(st->codec, st->codecpar)) < 0)
+        return ret;
+    if (st->codec->codec_tag != MKTAG('t','m','c','d')) {
+        st->codec->time_base       = avctx->time_base;
+        st->codec->ticks_per_frame = avctx->ticks_per_frame;
+    }
+    st->codec->framerate    = st->avg_frame_rate;
+    st->codec->coded_width  = avctx->coded_width;
+    st->codec->coded_height = avctx->coded_height;
+FF_ENABLE_DEPRECATION_WARNINGS
+#endif
+    return 0;
+}
+
+int ff_probe_cache_load(AVFormatContext *s)
+{
+    CachedStream *streams = NULL;
+    AVIOContext *pb = NULL;
+    int nb_header_streams = s->nb_streams;
+    int nb_streams = 0, i, ret;
+    int64_t start_time, duration, bit_rate;
+    int duration_estimation_method;
+    char *path;
+
+    if (!s->internal->probe_cache_hashed || !(path = cache_path(s)))
+        return 0;
+    if (ffio_open_whitelist(&pb, path, AVIO_FLAG_READ, &s->interrupt_callback, NULL,
+                            s->protocol_whitelist, s->protocol_blacklist) < 0) {
+        av_log(s, AV_LOG_DEBUG, "No probe cache entry %s\n", path);
+        ret = 0;
+        goto end;
+    }
+
+    ret = 0;
+    if (!check_header(pb, s, &nb_streams) ||
+        (nb_streams > nb_header_streams && !can_create_streams(s, nb_header_streams))) {
+        av_log(s, AV_LOG_VERBOSE, "Probe cache entry %s is stale\n", path);
+        goto end;
+    }
+    start_time                 = avio_rb64(pb);
+    duration                   = avio_rb64(pb);
+    bit_rate                   = avio_rb64(pb);
+    duration_estimation_method = avio_rb32(pb);
+
+    if (!(streams = av_mallocz_array(nb_streams, sizeof(*streams)))) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    for (i = 0; i < nb_streams; i++) {
+        if ((ret = read_stream(s, pb, &streams[i])) < 0)
+            break;
+        if (i < nb_header_streams &&
+            (streams[i].id != s->streams[i]->id ||
+             (s->streams[i]->codecpar->codec_type != AVMEDIA_TYPE_UNKNOWN &&
+              s->streams[i]->codecpar->codec_type != streams[i].par->codec_type))) {
+            ret = AVERROR_INVALIDDATA;
+            break;
+        }
+    }
+    if (ret < 0 || pb->eof_reached || pb->error) {
+        av_log(s, AV_LOG_WARNING, "Ignoring invalid probe cache entry %s\n", path);
+        ret = 0;
+        goto end;
+    }
+
+    for (i = 0; i < nb_streams; i++) {
+        AVStream *st = i < nb_header_streams ? s->streams[i] : avformat_new_stream(s, NULL);
+        if (!st) {
+            ret = AVERROR(ENOMEM);
+            goto end;
+        }
+        if ((ret = apply_stream(s, st, &streams[i])) < 0)
+            goto end;
+    }
+    s->start_time                 = start_time;
+    s->duration                   = duration;
+    s->bit_rate                   = bit_rate;
+    s->duration_estimation_method = duration_estimation_method;
+
+    av_log(s, AV_LOG_VERBOSE, "Using stream info from probe cache entry %s\n", path);
+    ret = 1;
+end:
+    if (streams)
+        for (i = 0; i < nb_streams; i++)
+            avcodec_parameters_free(&streams[i].par);
+    av_free(streams);
+    avio_closep(&pb);
+    av_free(path);
+    return ret;
+}
+
+int ff_probe_cache_save(AVFormatContext *s, int nb_header_streams)
+{
+    AVIOContext *pb = NULL;
+    char *path = NULL, *tmp = NULL;
+    unsigned pid = 0;
+    int i, ret;
+
+    if (!s->internal->probe_cache_hashed ||
+        (s->nb_streams > nb_header_streams && !can_create_streams(s, nb_header_streams)))
+        return 0;
+
+#if HAVE_UNISTD_H
+    pid = getpid();
+#endif
+    /* concurrent writers of the same entry each get their own file */
+    path = cache_path(s);
+    tmp  = path ? av_asprintf("%s.%u.%08x.tmp", path, pid, av_get_random_seed()) : NULL;
+    if (!tmp) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    if ((ret = ffio_open_whitelist(&pb, tmp, AVIO_FLAG_WRITE, &s->interrupt_callback, NULL,
+                                   s->protocol_whitelist, s->protocol_blacklist)) < 0) {
+        av_log(s, AV_LOG_WARNING, "Could not create probe cache entry %s\n", tmp);
+        goto end;
+    }
+
+    write_header(pb, s, nb_header_streams);
+    avio_wb64(pb, s->start_time);
+    avio_wb64(pb, s->duration);
+    avio_wb64(pb, s->bit_rate);
+    avio_wb32(pb, s->duration_estimation_method);
+    for (i = 0; i < s->nb_streams; i++)
+        write_stream(pb, s, s->streams[i]);
+
+    /* write under a temporary name so that readers never see partial entries */
+    avio_flush(pb);
+    ret = pb->error;
+    avio_closep(&pb);
+    if (ret < 0 || (ret = ff_rename(tmp, path, s)) < 0)
+        avpriv_io_delete(tmp);
+end:
+    av_free(path);
+    av_free(tmp);
+    return ret;
+}
@@ -0,0 +1,119 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+
+#include "libavutil/error.h"
+#include "libavutil/mem.h"
+#include "libavformat/avio.h"
+#include "libavformat/avio_internal.h"
+
+#define TEST_STREAM_SIZE (24 * 1024 * 1024)
+#define TEST_HINT_POS    (12 * 1024 * 1024 + 1000)
+#define TEST_HINT_SIZE   ( 2 * 1024 * 1024)
+
+static uint8_t test_byte(int64_t pos)
+{
+    return (pos ^ pos >> 8 ^ pos >> 16) & 0xFF;
+}
+
+static int write_stream(const char *filename)
+{
+    uint8_t buf[4096];
+    FILE *f = fopen(filename, "wb");
+    int64_t pos;
+
+    if (!f)
+        return -1;
+    for (pos = 0; pos < TEST_STREAM_SIZE; pos++) {
+        buf[pos % sizeof(buf)] = test_byte(pos);
+        if (pos % sizeof(buf) == sizeof(buf) - 1 &&
+            fwrite(buf, sizeof(buf), 1, f) != 1)
+            break;
+    }
+    return fclose(f) || pos < TEST_STREAM_SIZE ? -1 : 0;
+}
+
+static void test_read(AVIOContext *pb, int64_t pos, int size)
+{
+    uint8_t *buf = av_malloc(size);
+    int64_t  seek_pos;
+    int      ret, i;
+
+    if (!buf)
+        return;
+    seek_pos = avio_seek(pb, pos, SEEK_SET);
+    ret = avio_read(pb, buf, size);
+    for (i = 0; i < ret; i++)
+        if (buf[i] != test_byte(pos + i))
+            break;
+    printf("seek: %"PRId64", read: %d, mismatch at: %d\n",
+           seek_pos, ret, i < ret ? i : -1);
+    av_free(buf);
+}
+
+static void test_async(const char *filename, const char *prefetch_size)
+{
+    AVIOContext  *pb   = NULL;
+    AVDictionary *opts = NULL;
+    char url[1024];
+    int ret;
+
+    snprintf(url, sizeof(url), "async:file:%s", filename);
+    if (prefetch_size)
+        av_dict_set(&opts, "prefetch_size", prefetch_size, 0);
+
+    printf("prefetch_size: %s\n", prefetch_size ? prefetch_size : "default");
+    ret = avio_open2(&pb, url, AVIO_FLAG_READ, NULL, &opts);
+    av_dict_free(&opts);
+    printf("open: %d\n", ret);
+    if (ret < 0)
+        return;
+    printf("size: %"PRId64"\n", avio_size(pb));
+
+    test_read(pb, 0, 65536);
+
+    /* a range far out of the read-ahead ring, served from the cache
+     * when it arrived in time and from the ring otherwise */
+    ret = ffio_prefetch(pb, TEST_HINT_POS, TEST_HINT_SIZE);
+    printf("prefetch: %s\n", ret == AVERROR(ENOSYS) ? "ENOSYS" : ret < 0 ? "error" : "ok");
+    test_read(pb, TEST_HINT_POS, TEST_HINT_SIZE);
+    test_read(pb, 1000, 65536);
+    test_read(pb, TEST_HINT_POS + 4096, 300 * 1024);
+    test_read(pb, TEST_STREAM_SIZE - 4096, 8192);
+
+    avio_closep(&pb);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <temporary file>\n", argv[0]);
+        return 1;
+    }
+    if (write_stream(argv[1]) < 0) {
+        fprintf(stderr, "failed to write %s\n", argv[1]);
+        return 1;
+    }
+
+    test_async(argv[1], NULL);
+    test_async(argv[1], "0");
+
+    remove(argv[1]);
+    return 0;
+}
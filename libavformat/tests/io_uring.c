@@ -0,0 +1,156 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "libavformat/file.c"
+
+#include <stdio.h>
+
+#define TEST_FILE_SIZE (5 * RING_BLOCK + 12345)
+
+static uint8_t test_byte(int64_t pos)
+{
+    return (pos ^ pos >> 8 ^ pos >> 16) & 0xFF;
+}
+
+static int write_file(const char *filename)
+{
+    uint8_t buf[4096];
+    FILE *f = fopen(filename, "wb");
+    int64_t pos;
+
+    if (!f)
+        return -1;
+    for (pos = 0; pos < TEST_FILE_SIZE; pos++) {
+        buf[pos % sizeof(buf)] = test_byte(pos);
+        if ((pos % sizeof(buf) == sizeof(buf) - 1 || pos == TEST_FILE_SIZE - 1) &&
+            fwrite(buf, pos % sizeof(buf) + 1, 1, f) != 1)
+            break;
+    }
+    return fclose(f) || pos < TEST_FILE_SIZE ? -1 : 0;
+}
+
+static int open_file(URLContext *h, FileContext *c, const char *filename, int depth)
+{
+    memset(h, 0, sizeof(*h));
+    memset(c, 0, sizeof(*c));
+    c->class = &file_class;
+    av_opt_set_defaults(c);
+    c->use_ring   = 1;
+    c->ring_depth = depth;
+    h->priv_data  = c;
+    return file_open(h, filename, AVIO_FLAG_READ);
+}
+
+static void test_read(URLContext *h, int64_t pos, int size)
+{
+    uint8_t *buf = av_malloc(size);
+    int64_t  seek_pos;
+    int      ret = 0, len = 0, i;
+
+    if (!buf)
+        return;
+    seek_pos = file_seek(h, pos, SEEK_SET);
+    while (len < size && (ret = file_read(h, buf + len, size - len)) > 0)
+        len += ret;
+    for (i = 0; i < len; i++)
+        if (buf[i] != test_byte(pos + i))
+            break;
+    printf("seek: %"PRId64", read: %d, mismatch at: %d%s\n", seek_pos, len,
+           i < len ? i : -1, ret == AVERROR_EOF ? ", eof" : ret < 0 ? ", error" : "");
+    av_free(buf);
+}
+
+/* wait for the reads in flight and forget the blocks read so far */
+static void ring_drop(FileRing *r)
+{
+    while (r->nb_busy > 0) {
+        if (ring_enter(r, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+            return;
+        ring_reap(r);
+    }
+    for (int i = 0; i < r->nb_slots; i++)
+        r->slots[i].state = SLOT_FREE;
+}
+
+static int ring_used(FileRing *r)
+{
+    int nb = 0;
+
+    for (int i = 0; r && i < r->nb_slots; i++)
+        nb += r->slots[i].state != SLOT_FREE;
+    return nb;
+}
+
+static void test_ring(const char *filename, int depth)
+{
+    FileContext c;
+    URLContext h;
+    int fd = -1, ret;
+
+    printf("depth: %d\n", depth);
+    ret = open_file(&h, &c, filename, depth);
+    printf("open: %d\n", ret);
+    if (ret < 0)
+        return;
+    /* without io_uring, only the read() fallback is tested */
+    if (!c.ring)
+        fprintf(stderr, "io_uring is not available\n");
+
+    test_read(&h, 0, TEST_FILE_SIZE);
+    test_read(&h, 3 * RING_BLOCK - 100, 200);
+    test_read(&h, 1000, 65536);
+    test_read(&h, 4 * RING_BLOCK + 5, 2 * RING_BLOCK);
+    test_read(&h, TEST_FILE_SIZE - 10, 100);
+
+    /* every submission fails, the reads have to fall back to pread() */
+    if (c.ring) {
+        ring_drop(c.ring);
+        fd = c.ring->fd;
+        c.ring->fd = -1;
+    }
+    printf("submit failure\n");
+    test_read(&h, RING_BLOCK + 17, 300000);
+    test_read(&h, 0, 4096);
+    printf("blocks in the ring: %d\n", ring_used(c.ring));
+    if (c.ring)
+        c.ring->fd = fd;
+    printf("submit restored\n");
+    test_read(&h, 2 * RING_BLOCK, 100000);
+
+    /* closing right after a read leaves its prefetches in flight */
+    test_read(&h, 0, 100);
+    printf("close: %d\n", file_close(&h));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <temporary file>\n", argv[0]);
+        return 1;
+    }
+    if (write_file(argv[1]) < 0) {
+        fprintf(stderr, "failed to write %s\n", argv[1]);
+        return 1;
+    }
+
+    test_ring(argv[1], 2);
+    test_ring(argv[1], 16);
+
+    remove(argv[1]);
+    return 0;
+}
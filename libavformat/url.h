@@ -86,6 +86,7 @@ typedef struct URLProtocol {
     int (*url_get_multi_file_handle)(URLContext *h, int **handles,
                                      int *numhandles);
     int (*url_get_short_seek)(URLContext *h);
+    int (*url_prefetch)(URLContext *h, int64_t pos, int64_t size);
     int (*url_shutdown)(URLContext *h, int flags);
     int priv_data_size;
     const AVClass *priv_data_class;
@@ -257,6 +258,15 @@ int ffurl_get_multi_file_handle(URLContext *h, int **handles, int *numhandles);
  */
 int ffurl_get_short_seek(URLContext *h);
 
+/**
+ * Hint that size bytes at pos will be read soon, so that the protocol can
+ * start fetching them in the background. Nothing is read if the protocol
+ * has no room left for it.
+ *
+ * @return >= 0 on success, AVERROR(ENOSYS) if the protocol ignores hints
+ */
+int ffurl_prefetch(URLContext *h, int64_t pos, int64_t size);
+
 /**
  * Signal the URLContext that we are done reading or writing the stream.
  *
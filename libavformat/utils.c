@@ -624,6 +624,9 @@ FF_ENABLE_DEPRECATION_WARNINGS
         }
     }
 
+    if (s->probe_cache && s->pb && ff_probe_cache_hash_header(s) < 0)
+        av_log(s, AV_LOG_WARNING, "Could not hash the input for the probe cache\n");
+
     /* e.g. AVFMT_NOFILE formats will not have a AVIOContext */
     if (s->pb)
         ff_id3v2_read_dict(s->pb, &s->internal->id3v2_meta, ID3v2_DEFAULT_MAGIC, &id3v2_extra_meta);
@@ -1309,7 +1312,9 @@ static void compute_pkt_fields(AVFormatContext *s, AVStream *st,
     }
 
     duration = av_mul_q((AVRational) {pkt->duration, 1}, st->time_base);
-    if (pkt->duration <= 0) {
+    if (pkt->duration <= 0 && st->internal->probe_cache_unset_durations > 0) {
+        st->internal->probe_cache_unset_durations--;
+    } else if (pkt->duration <= 0) {
         ff_compute_frame_duration(s, &num, &den, st, pc, pkt);
         if (den && num) {
             duration = (AVRational) {num, den};
@@ -1950,6 +1955,7 @@ void ff_read_frame_flush(AVFormatContext *s)
             st->cur_dts = AV_NOPTS_VALUE;
 
         st->probe_packets = s->max_probe_packets;
+        st->internal->probe_cache_unset_durations = 0;
 
         for (j = 0; j < MAX_REORDER_DELAY + 1; j++)
             st->pts_buffer[j] = AV_NOPTS_VALUE;
@@ -3614,6 +3620,7 @@ int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
     int64_t max_subtitle_analyze_duration;
     int64_t probesize = ic->probesize;
     int eof_reached = 0;
+    int complete = 1;
     int *missing_streams = av_opt_ptr(ic->iformat->priv_class, ic->priv_data, "missing_streams");
 
     flush_codecs = probesize > 0;
@@ -3636,6 +3643,12 @@ int avformat_find_stream_info(AVFormatContext *ic, AVDictionary **options)
         av_log(ic, AV_LOG_DEBUG, "Before avformat_find_stream_info() pos: %"PRId64" bytes read:%"PRId64" seeks:%d nb_streams:%d\n",
                avio_tell(ic->pb), ic->pb->bytes_read, ic->pb->seek_count, ic->nb_streams);
 
+    if (ic->probe_cache && ff_probe_cache_load(ic) > 0) {
+        compute_chapters_end(ic);
+        ret = 0;
+        goto find_stream_info_err;
+    }
+
     for (i = 0; i < ic->nb_streams; i++) {
         const AVCodec *codec;
         AVDictionary *thread_opt = NULL;
@@ -3727,6 +3740,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
         int analyzed_all_streams;
         if (ff_check_interrupt(&ic->interrupt_callback)) {
             ret = AVERROR_EXIT;
+            complete = 0;
             av_log(ic, AV_LOG_DEBUG, "interrupted\n");
             break;
         }
@@ -4115,6 +4129,7 @@ FF_ENABLE_DEPRECATION_WARNINGS
         }
         if (!has_codec_parameters(st, &errmsg)) {
             char buf[256];
+            complete = 0;
             avcodec_string(buf, sizeof(buf), st->internal->avctx, 0);
             av_log(ic, AV_LOG_WARNING,
                    "Could not find codec parameters for stream %d (%s): %s\n"
@@ -4187,6 +4202,9 @@ FF_ENABLE_DEPRECATION_WARNINGS
         st->internal->avctx_inited = 0;
     }
 
+    if (ic->probe_cache && complete)
+        ff_probe_cache_save(ic, orig_nb_streams);
+
 find_stream_info_err:
     for (i = 0; i < ic->nb_streams; i++) {
         st = ic->streams[i];
@@ -251,18 +251,30 @@ AVBufferPool *av_buffer_pool_init(int size, AVBufferRef* (*alloc)(int size))
     return pool;
 }
 
+static void pool_entry_free(BufferPoolEntry *buf)
+{
+    buf->free(buf->opaque, buf->data);
+    av_free(buf);
+}
+
 /*
  * This function gets called when the pool has been uninited and
  * all the buffers returned to it.
  */
 static void buffer_pool_free(AVBufferPool *pool)
 {
-    while (pool->pool) {
-        BufferPoolEntry *buf = pool->pool;
-        pool->pool = buf->next;
+    BufferPoolEntry *buf = (BufferPoolEntry *)atomic_load(&pool->pool);
+    int i;
 
-        buf->free(buf->opaque, buf->data);
-        av_freep(&buf);
+    while (buf) {
+        BufferPoolEntry *next = buf->next;
+        pool_entry_free(buf);
+        buf = next;
+    }
+    for (i = 0; i < BUFFER_POOL_MAGAZINES; i++) {
+        BufferPoolMagazine *m = &pool->magazines[i];
+        while (m->nb_entries)
+            pool_entry_free(m->entries[--m->nb_entries]);
     }
     ff_mutex_destroy(&pool->mutex);
 
@@ -272,6 +284,89 @@ static void buffer_pool_free(AVBufferPool *pool)
     av_freep(&pool);
 }
 
+/*
+ * Threads run on distinct stacks, so the address of a local variable picks
+ * a magazine per thread without thread local storage. A thread landing on
+ * another magazine only costs some contention.
+ */
+static int magazine_index(void)
+{
+    char local;
+    uint32_t h = (uintptr_t)&local >> 16;
+
+    return (h * 0x9E3779B1U) >> (32 - BUFFER_POOL_MAGAZINES_LOG2);
+}
+
+static BufferPoolMagazine *magazine_lock(AVBufferPool *pool, int index)
+{
+    BufferPoolMagazine *m = &pool->magazines[index & (BUFFER_POOL_MAGAZINES - 1)];
+
+    if (atomic_exchange_explicit(&m->busy, 1, memory_order_acquire))
+        return NULL;
+    return m;
+}
+
+static void magazine_unlock(BufferPoolMagazine *m)
+{
+    atomic_store_explicit(&m->busy, 0, memory_order_release);
+}
+
+static BufferPoolEntry *magazine_get(AVBufferPool *pool, int index)
+{
+    BufferPoolMagazine *m = magazine_lock(pool, index);
+    BufferPoolEntry *buf = NULL;
+
+    if (!m)
+        return NULL;
+    if (m->nb_entries) {
+        buf = m->entries[--m->nb_entries];
+        /* only the holder of the magazine writes its counter */
+        atomic_store_explicit(&m->hits,
+                              atomic_load_explicit(&m->hits, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+    }
+    magazine_unlock(m);
+    return buf;
+}
+
+static void pool_push(AVBufferPool *pool, BufferPoolEntry *buf)
+{
+    uintptr_t head = atomic_load_explicit(&pool->pool, memory_order_relaxed);
+
+    do {
+        buf->next = (BufferPoolEntry *)head;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->pool, &head, (uintptr_t)buf,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+/*
+ * Pops are serialized by the pool mutex, so the head cannot be popped and
+ * pushed back between reading its next pointer and the exchange (ABA).
+ */
+static BufferPoolEntry *pool_pop(AVBufferPool *pool)
+{
+    BufferPoolEntry *buf;
+    uintptr_t head;
+
+    if (!atomic_load_explicit(&pool->pool, memory_order_relaxed))
+        return NULL;
+
+    ff_mutex_lock(&pool->mutex);
+    head = atomic_load_explicit(&pool->pool, memory_order_acquire);
+    do {
+        buf = (BufferPoolEntry *)head;
+    } while (buf &&
+             !atomic_compare_exchange_weak_explicit(&pool->pool, &head, (uintptr_t)buf->next,
+                                                    memory_order_acquire,
+                                                    memory_order_acquire));
+    ff_mutex_unlock(&pool->mutex);
+
+    if (buf)
+        atomic_fetch_add_explicit(&pool->hits, 1, memory_order_relaxed);
+    return buf;
+}
+
 void av_buffer_pool_uninit(AVBufferPool **ppool)
 {
     AVBufferPool *pool;
@@ -290,13 +385,21 @@ static void pool_release_buffer(void *opaque, uint8_t *data)
     BufferPoolEntry *buf = opaque;
     AVBufferPool *pool = buf->pool;
 
+    BufferPoolMagazine *m;
+
     if(CONFIG_MEMORY_POISONING)
         memset(buf->data, FF_MEMORY_POISON, pool->size);
 
-    ff_mutex_lock(&pool->mutex);
-    buf->next = pool->pool;
-    pool->pool = buf;
-    ff_mutex_unlock(&pool->mutex);
+    m = magazine_lock(pool, magazine_index());
+    if (m) {
+        if (m->nb_entries < BUFFER_POOL_MAGAZINE_SIZE) {
+            m->entries[m->nb_entries++] = buf;
+            buf = NULL;
+        }
+        magazine_unlock(m);
+    }
+    if (buf)
+        pool_push(pool, buf);
 
     if (atomic_fetch_sub_explicit(&pool->refcount, 1, memory_order_acq_rel) == 1)
         buffer_pool_free(pool);
@@ -335,23 +438,51 @@ AVBufferRef *av_buffer_pool_get(AVBufferPool *pool)
 {
     AVBufferRef *ret;
     BufferPoolEntry *buf;
+    unsigned outstanding, peak;
+    int i, index = magazine_index();
+
+    /* own magazine first, then the shared stack, then the other magazines */
+    buf = magazine_get(pool, index);
+    if (!buf)
+        buf = pool_pop(pool);
+    for (i = 1; i < BUFFER_POOL_MAGAZINES && !buf; i++)
+        buf = magazine_get(pool, index + i);
 
-    ff_mutex_lock(&pool->mutex);
-    buf = pool->pool;
     if (buf) {
         ret = av_buffer_create(buf->data, pool->size, pool_release_buffer,
                                buf, 0);
-        if (ret) {
-            pool->pool = buf->next;
-            buf->next = NULL;
+        if (!ret) {
+            pool_push(pool, buf);
+            return NULL;
         }
     } else {
+        ff_mutex_lock(&pool->mutex);
         ret = pool_alloc_buffer(pool);
+        ff_mutex_unlock(&pool->mutex);
+        if (!ret)
+            return NULL;
+        atomic_fetch_add_explicit(&pool->misses, 1, memory_order_relaxed);
     }
-    ff_mutex_unlock(&pool->mutex);
 
-    if (ret)
-        atomic_fetch_add_explicit(&pool->refcount, 1, memory_order_relaxed);
+    /* the caller holds one reference, the buffers out the rest */
+    outstanding = atomic_fetch_add_explicit(&pool->refcount, 1, memory_order_relaxed);
+    peak = atomic_load_explicit(&pool->peak, memory_order_relaxed);
+    while (outstanding > peak &&
+           !atomic_compare_exchange_weak_explicit(&pool->peak, &peak, outstanding,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed));
 
     return ret;
 }
+
+void av_buffer_pool_get_stats(AVBufferPool *pool, AVBufferPoolStats *stats)
+{
+    int i;
+
+    stats->hits   = atomic_load_explicit(&pool->hits,   memory_order_relaxed);
+    stats->misses = atomic_load_explicit(&pool->misses, memory_order_relaxed);
+    for (i = 0; i < BUFFER_POOL_MAGAZINES; i++)
+        stats->hits += atomic_load_explicit(&pool->magazines[i].hits, memory_order_relaxed);
+    stats->outstanding      = atomic_load_explicit(&pool->refcount, memory_order_relaxed) - 1;
+    stats->peak_outstanding = atomic_load_explicit(&pool->peak,     memory_order_relaxed);
+}
@@ -284,6 +284,23 @@ void av_buffer_pool_uninit(AVBufferPool **pool);
  */
 AVBufferRef *av_buffer_pool_get(AVBufferPool *pool);
 
+/**
+ * Usage statistics of a buffer pool.
+ */
+typedef struct AVBufferPoolStats {
+    uint64_t hits;          ///< av_buffer_pool_get() calls that reused a buffer
+    uint64_t misses;        ///< av_buffer_pool_get() calls that allocated a buffer
+    int outstanding;        ///< buffers currently returned by the pool and not released
+    int peak_outstanding;   ///< highest value of outstanding so far
+} AVBufferPoolStats;
+
+/**
+ * Get the usage statistics of a pool. The pool must not have been uninited.
+ * This function may be called while other threads use the pool, the values
+ * are then only approximately consistent with each other.
+ */
+void av_buffer_pool_get_stats(AVBufferPool *pool, AVBufferPoolStats *stats);
+
 /**
  * @}
  */
@@ -73,9 +73,31 @@ typedef struct BufferPoolEntry {
     struct BufferPoolEntry *next;
 } BufferPoolEntry;
 
+#define BUFFER_POOL_MAGAZINES_LOG2 3
+#define BUFFER_POOL_MAGAZINES      (1 << BUFFER_POOL_MAGAZINES_LOG2)
+#define BUFFER_POOL_MAGAZINE_SIZE  8
+
+/*
+ * A small stack of free entries used mostly by a single thread, so that
+ * getting and releasing buffers does not touch state shared by all threads.
+ */
+typedef struct BufferPoolMagazine {
+    atomic_int busy;        ///< taken with a try-lock, never waited for
+    int nb_entries;
+    BufferPoolEntry *entries[BUFFER_POOL_MAGAZINE_SIZE];
+    atomic_uint_least64_t hits;
+    /* keep the magazines of different threads on different cache lines */
+    uint8_t padding[64];
+} BufferPoolMagazine;
+
 struct AVBufferPool {
+    /*
+     * Serializes the pops from the pool stack and the calls to the allocator.
+     * Pushes to the stack are lock-free.
+     */
     AVMutex mutex;
-    BufferPoolEntry *pool;
+    atomic_uintptr_t pool;  ///< BufferPoolEntry stack
+    BufferPoolMagazine magazines[BUFFER_POOL_MAGAZINES];
 
     /*
      * This is used to track when the pool is to be freed.
@@ -88,6 +110,10 @@ struct AVBufferPool {
      */
     atomic_uint refcount;
 
+    atomic_uint_least64_t hits;     ///< reuses from the pool stack
+    atomic_uint_least64_t misses;
+    atomic_uint peak;
+
     int size;
     void *opaque;
     AVBufferRef* (*alloc)(int size);
@@ -179,6 +179,12 @@ enum AVFrameSideDataType {
      * array element is implied by AVFrameSideData.size / AVRegionOfInterest.self_size.
      */
     AV_FRAME_DATA_REGIONS_OF_INTEREST,
+
+    /**
+     * Rate control settings the encoder should switch to from this frame on.
+     * The data is an AVRateControlOverride.
+     */
+    AV_FRAME_DATA_RATE_CONTROL_OVERRIDE,
 };
 
 enum AVActiveFormatDescription {
@@ -206,6 +212,29 @@ typedef struct AVFrameSideData {
     AVBufferRef *buf;
 } AVFrameSideData;
 
+/**
+ * Rate control settings to apply from the frame it is attached to onwards,
+ * e.g. to adapt the quality per scene or GOP without reopening the encoder.
+ *
+ * Encoders ignore the fields they do not support or whose value is negative,
+ * and only reconfigure when a value differs from the one in use.
+ */
+typedef struct AVRateControlOverride {
+    /**
+     * Must be set to the size of this data structure (that is,
+     * sizeof(AVRateControlOverride)).
+     */
+    uint32_t self_size;
+    /**
+     * Constant rate factor, for encoders running in CRF mode.
+     */
+    float crf;
+    /**
+     * Adaptive quantization strength.
+     */
+    float aq_strength;
+} AVRateControlOverride;
+
 /**
  * Structure describing a single Region Of Interest.
  *
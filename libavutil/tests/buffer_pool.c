@@ -0,0 +1,105 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This test program gets and releases buffers of one pool from several
+ * threads, checking that no buffer is handed out twice at the same time.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/buffer.h"
+#include "libavutil/thread.h"
+
+#define NB_THREADS  4
+#define NB_HELD     4
+#define NB_ROUNDS   20000
+
+typedef struct ThreadData {
+    AVBufferPool *pool;
+    int id;
+    int ret;
+} ThreadData;
+
+static void *thread_main(void *arg)
+{
+    ThreadData *td = arg;
+    AVBufferRef *held[NB_HELD] = { NULL };
+    int i, j;
+
+    for (i = 0; i < NB_ROUNDS; i++) {
+        AVBufferRef **buf = &held[i % NB_HELD];
+
+        if (*buf) {
+            if ((*buf)->data[0] != td->id || (*buf)->data[1] != i % NB_HELD) {
+                td->ret = 4;
+                break;
+            }
+            av_buffer_unref(buf);
+        }
+        *buf = av_buffer_pool_get(td->pool);
+        if (!*buf) {
+            td->ret = 5;
+            break;
+        }
+        (*buf)->data[0] = td->id;
+        (*buf)->data[1] = i % NB_HELD;
+    }
+    for (j = 0; j < NB_HELD; j++)
+        av_buffer_unref(&held[j]);
+    return NULL;
+}
+
+int main(void)
+{
+    ThreadData td[NB_THREADS];
+    pthread_t threads[NB_THREADS];
+    AVBufferPoolStats stats;
+    AVBufferPool *pool;
+    int i, ret;
+
+    pool = av_buffer_pool_init(16, NULL);
+    if (!pool)
+        return 1;
+
+    for (i = 0; i < NB_THREADS; i++) {
+        td[i].pool = pool;
+        td[i].id   = i + 1;
+        td[i].ret  = 0;
+        if ((ret = pthread_create(&threads[i], NULL, thread_main, &td[i]))) {
+            fprintf(stderr, "pthread_create failed: %s.\n", strerror(ret));
+            return 1;
+        }
+    }
+    for (i = 0; i < NB_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        if (td[i].ret)
+            return td[i].ret;
+    }
+
+    av_buffer_pool_get_stats(pool, &stats);
+    if (stats.hits + stats.misses != NB_THREADS * NB_ROUNDS)
+        return 2;
+    if (stats.outstanding || stats.peak_outstanding < NB_HELD ||
+        stats.peak_outstanding > NB_THREADS * NB_HELD)
+        return 3;
+
+    av_buffer_pool_uninit(&pool);
+    return 0;
+}
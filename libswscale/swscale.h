@@ -218,6 +218,39 @@ int sws_scale(struct SwsContext *c, const uint8_t *const srcSlice[],
               const int srcStride[], int srcSliceY, int srcSliceH,
               uint8_t *const dst[], const int dstStride[]);
 
+/**
+ * Scale the whole source image into the destination lines
+ * [dst_slice_y, dst_slice_y + dst_slice_h), leaving the other lines alone.
+ *
+ * Different contexts initialized with the same parameters may be called
+ * concurrently on disjoint slices of the same destination image, e.g. one
+ * context per thread. The result is identical to sws_scale() on the whole
+ * image.
+ *
+ * @param c           the scaling context
+ * @param src         the pointers to the planes of the whole source image
+ * @param srcStride   the strides of the planes of the source image
+ * @param dst         the pointers to the planes of the whole destination image
+ * @param dstStride   the strides of the planes of the destination image
+ * @param dst_slice_y first destination line to write, a multiple of
+ *                    sws_dst_slice_alignment()
+ * @param dst_slice_h number of destination lines to write, a multiple of
+ *                    sws_dst_slice_alignment() unless the slice ends the
+ *                    image
+ * @return the number of lines written, AVERROR(ENOSYS) if the conversion
+ *         done by c does not support destination slices and sws_scale() has
+ *         to be used instead, another negative error code on failure
+ */
+int sws_scale_dst_slice(struct SwsContext *c, const uint8_t *const src[],
+                        const int srcStride[], uint8_t *const dst[],
+                        const int dstStride[], int dst_slice_y, int dst_slice_h);
+
+/**
+ * @return the alignment required for the destination slices of
+ *         sws_scale_dst_slice()
+ */
+int sws_dst_slice_alignment(struct SwsContext *c);
+
 /**
  * @param dstRange flag indicating the while-black range of the output (1=jpeg / 0=mpeg)
  * @param srcRange flag indicating the while-black range of the input (1=jpeg / 0=mpeg)
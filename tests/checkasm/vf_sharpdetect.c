@@ -0,0 +1,124 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with FFmpeg; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include "checkasm.h"
+#include "libavfilter/sharpdetect.h"
+
+#define WIDTH 1024
+#define PAD   16
+#define WIDTH_PADDED (PAD + WIDTH + PAD)
+
+#define randomize_buffers(buf, size, mask) \
+    do {                                   \
+        int j;                             \
+        for (j = 0; j < size; j++)         \
+            buf[j] = rnd() & (mask);       \
+    } while (0)
+
+static void check_hblur(const SharpDetectDSPContext *dsp)
+{
+    LOCAL_ALIGNED_32(uint32_t, src,     [WIDTH_PADDED]);
+    LOCAL_ALIGNED_32(uint32_t, dst_ref, [WIDTH_PADDED]);
+    LOCAL_ALIGNED_32(uint32_t, dst_new, [WIDTH_PADDED]);
+    int w = WIDTH - (rnd() & 15);
+
+    declare_func(void, uint32_t *dst, const uint32_t *src, int width);
+
+    randomize_buffers(src, WIDTH_PADDED, 0xFFFFFF);
+    memset(dst_ref, 0, WIDTH_PADDED * sizeof(*dst_ref));
+    memset(dst_new, 0, WIDTH_PADDED * sizeof(*dst_new));
+
+    if (check_func(dsp->hblur, "hblur")) {
+        call_ref(dst_ref + PAD, src + PAD, w);
+        call_new(dst_new + PAD, src + PAD, w);
+        if (memcmp(dst_ref + PAD, dst_new + PAD, w * sizeof(*dst_ref)))
+            fail();
+        bench_new(dst_new + PAD, src + PAD, WIDTH);
+    }
+}
+
+static void check_vblur(const SharpDetectDSPContext *dsp)
+{
+    LOCAL_ALIGNED_32(uint32_t, row_ref, [WIDTH_PADDED]);
+    LOCAL_ALIGNED_32(uint32_t, row_new, [WIDTH_PADDED]);
+    LOCAL_ALIGNED_32(uint32_t, sc0_ref, [WIDTH_PADDED]);
+    LOCAL_ALIGNED_32(uint32_t, sc0_new, [WIDTH_PADDED]);
+    LOCAL_ALIGNED_32(uint32_t, sc1_ref, [WIDTH_PADDED]);
+    LOCAL_ALIGNED_32(uint32_t, sc1_new, [WIDTH_PADDED]);
+    int w = WIDTH - (rnd() & 15);
+
+    declare_func(void, uint32_t *row, uint32_t *sc0, uint32_t *sc1, int width);
+
+    randomize_buffers(row_ref, WIDTH_PADDED, 0xFFFFFF);
+    randomize_buffers(sc0_ref, WIDTH_PADDED, 0xFFFFFF);
+    randomize_buffers(sc1_ref, WIDTH_PADDED, 0xFFFFFF);
+    memcpy(row_new, row_ref, WIDTH_PADDED * sizeof(*row_ref));
+    memcpy(sc0_new, sc0_ref, WIDTH_PADDED * sizeof(*sc0_ref));
+    memcpy(sc1_new, sc1_ref, WIDTH_PADDED * sizeof(*sc1_ref));
+
+    if (check_func(dsp->vblur, "vblur")) {
+        call_ref(row_ref, sc0_ref, sc1_ref, w);
+        call_new(row_new, sc0_new, sc1_new, w);
+        if (memcmp(row_ref, row_new, w * sizeof(*row_ref)) ||
+            memcmp(sc0_ref, sc0_new, w * sizeof(*sc0_ref)) ||
+            memcmp(sc1_ref, sc1_new, w * sizeof(*sc1_ref)))
+            fail();
+        bench_new(row_new, sc0_new, sc1_new, WIDTH);
+    }
+}
+
+static void check_residual(const SharpDetectDSPContext *dsp)
+{
+    LOCAL_ALIGNED_32(uint8_t,  src,  [WIDTH_PADDED]);
+    LOCAL_ALIGNED_32(uint32_t, blur, [WIDTH_PADDED]);
+    /* the filter accepts matrices of up to 24 scale bits */
+    int scalebits = 4 + 2 * (rnd() % 11);
+    int i, res_ref, res_new;
+
+    declare_func(int, const uint8_t *src, const uint32_t *blur, int width, int scalebits);
+
+    randomize_buffers(src, WIDTH_PADDED, 0xFF);
+    for (i = 0; i < WIDTH_PADDED; i++)
+        blur[i] = rnd() % (255U << scalebits);
+
+    if (check_func(dsp->residual, "residual")) {
+        /* the source rows start at an odd offset in the filter */
+        res_ref = call_ref(src + 1, blur, WIDTH, scalebits);
+        res_new = call_new(src + 1, blur, WIDTH, scalebits);
+        if (res_ref != res_new)
+            fail();
+        bench_new(src + 1, blur, WIDTH, scalebits);
+    }
+}
+
+void checkasm_check_vf_sharpdetect(void)
+{
+    SharpDetectDSPContext dsp;
+
+    ff_sharpdetect_init(&dsp);
+
+    check_hblur(&dsp);
+    report("hblur");
+
+    check_vblur(&dsp);
+    report("vblur");
+
+    check_residual(&dsp);
+    report("residual");
+}
@@ -106,6 +106,37 @@ probechapters(){
     run ffprobe${PROGSUF}${EXECSUF} -show_chapters -v 0 "$@"
 }
 
+probecache(){
+    cachedir="${outdir}/${test}.cache"
+    uncached="${outdir}/${test}.uncached"
+    cached="${outdir}/${test}.cached"
+    cleanfiles="$uncached $cached"
+    rm -rf "$cachedir" && mkdir "$cachedir" || return
+    # the first open stores the stream info, the second one uses it
+    run ffprobe${PROGSUF}${EXECSUF} -bitexact -show_streams -show_packets -v 0 -probe_cache $(target_path $cachedir) "$@" > "$uncached" || return
+    echo "cache entries: $(ls "$cachedir" | wc -l)"
+    run ffprobe${PROGSUF}${EXECSUF} -bitexact -show_streams -show_packets -v verbose -probe_cache $(target_path $cachedir) "$@" 2> "$cached.log" > "$cached" || return
+    echo "cache hits: $(grep -c 'from probe cache' "$cached.log")"
+    rm -rf "$cachedir" "$cached.log"
+    diff -u "$uncached" "$cached"
+}
+
+lazyindex(){
+    file="${outdir}/${test}.mov"
+    full="${outdir}/${test}.full"
+    lazy="${outdir}/${test}.lazy"
+    cleanfiles="$file $full $lazy"
+    run_avconv $DEC_OPTS -f image2 -c:v pgmyuv -i $raw_src $DEC_OPTS -ar 44100 -f s16le -i $pcm_src \
+        $ENC_OPTS -t 1 -qscale:v 10 "$@" -f mov $target_path/$file || return
+    # the packets read and the packets found by the seeks have to be the same
+    run ffprobe${PROGSUF}${EXECSUF} -bitexact -show_streams -show_packets -v 0 $target_path/$file > "$full" || return
+    run libavformat/tests/seek${EXECSUF} $target_path/$file >> "$full" || return
+    echo "discarded packets: $(grep -c '^flags=.*D' "$full")"
+    run ffprobe${PROGSUF}${EXECSUF} -bitexact -show_streams -show_packets -v 0 -lazy_index 1 $target_path/$file > "$lazy" || return
+    run libavformat/tests/seek${EXECSUF} $target_path/$file -lazy_index 1 >> "$lazy" || return
+    diff -u "$full" "$lazy"
+}
+
 probegaplessinfo(){
     filename="$1"
     shift
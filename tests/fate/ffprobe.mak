@@ -29,6 +29,15 @@ FATE_FFPROBE-$(CONFIG_AVDEVICE) += fate-ffprobe_xml
 fate-ffprobe_xml: $(FFPROBE_TEST_FILE)
 fate-ffprobe_xml: CMD = run $(FFPROBE_COMMAND) -of xml
 
+# a cached open must return the streams and packets of an uncached one
+FATE_FFPROBE-$(call ENCDEC2, MPEG2VIDEO, MP2, MPEGTS) += fate-ffprobe-probe-cache-ts
+fate-ffprobe-probe-cache-ts: fate-lavf-ts
+fate-ffprobe-probe-cache-ts: CMD = probecache $(TARGET_PATH)/tests/data/lavf/lavf.ts
+
+FATE_FFPROBE-$(call ENCDEC, FLV, FLV) += fate-ffprobe-probe-cache-flv
+fate-ffprobe-probe-cache-flv: fate-lavf-flv
+fate-ffprobe-probe-cache-flv: CMD = probecache $(TARGET_PATH)/tests/data/lavf/lavf.flv
+
 FATE_FFPROBE += $(FATE_FFPROBE-yes)
 
 fate-ffprobe: $(FATE_FFPROBE)
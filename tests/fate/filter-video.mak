@@ -486,6 +486,31 @@ FATE_FILTER_VSYNTH-$(CONFIG_SCALE_FILTER) += fate-filter-scalechroma
 fate-filter-scalechroma: tests/data/vsynth1.yuv
 fate-filter-scalechroma: CMD = framecrc -flags bitexact -s 352x288 -pix_fmt yuv444p -i $(TARGET_PATH)/tests/data/vsynth1.yuv -pix_fmt yuv420p -sws_flags +bitexact -vf scale=out_v_chr_pos=33:out_h_chr_pos=151
 
+# slice threaded scaling must match the single threaded output
+FATE_FILTER_VSYNTH-$(CONFIG_SCALE_FILTER) += fate-filter-scale500-threads
+fate-filter-scale500-threads: CMD = video_filter "scale=w=500:h=500" -filter_threads 4
+
+FATE_FILTER_VSYNTH-$(CONFIG_SCALE_FILTER) += fate-filter-scalechroma-threads
+fate-filter-scalechroma-threads: tests/data/vsynth1.yuv
+fate-filter-scalechroma-threads: CMD = framecrc -flags bitexact -s 352x288 -pix_fmt yuv444p -i $(TARGET_PATH)/tests/data/vsynth1.yuv -pix_fmt yuv420p -sws_flags +bitexact -vf scale=out_v_chr_pos=33:out_h_chr_pos=151 -filter_threads 4
+fate-filter-scalechroma-threads: REF = $(SRC_PATH)/tests/ref/fate/filter-scalechroma
+
+# filters activated concurrently must give the output of the serial scheduler
+PARALLEL_DEPS = TESTSRC2_FILTER SPLIT_FILTER SCALE_FILTER UNSHARP_FILTER HSTACK_FILTER VSTACK_FILTER FRAMEMD5_MUXER
+PARALLEL_BRANCH = [$(1)]scale=176:144:flags=$(2)+bitexact,unsharp=$(3)[$(1)1]
+PARALLEL_GRAPH = testsrc2=size=352x288:rate=10:duration=2,split=4[a][b][c][d];$(call PARALLEL_BRANCH,a,bilinear,5:5:1);$(call PARALLEL_BRANCH,b,bicubic,7:7:2.5);$(call PARALLEL_BRANCH,c,neighbor,3:3:-1.5);$(call PARALLEL_BRANCH,d,lanczos,5:5:1:5:5:1);[a1][b1]hstack[top];[c1][d1]hstack[bottom];[top][bottom]vstack
+FATE_FILTER-$(call ALLYES, $(PARALLEL_DEPS)) += fate-filter-split-scale-unsharp fate-filter-split-scale-unsharp-parallel
+fate-filter-split-scale-unsharp: CMD = framemd5 -filter_complex_threads 4 -filter_complex "$(PARALLEL_GRAPH)"
+fate-filter-split-scale-unsharp-parallel: CMD = framemd5 -filter_complex_threads 4 -filter_parallel -filter_complex "$(PARALLEL_GRAPH)"
+fate-filter-split-scale-unsharp-parallel: REF = $(SRC_PATH)/tests/ref/fate/filter-split-scale-unsharp
+
+# the sums of the sharpdetect slices must match the single threaded sum
+SHARPDETECT_DEPS = TESTSRC2_FILTER SHARPDETECT_FILTER METADATA_FILTER NULL_MUXER
+FATE_FILTER-$(call ALLYES, $(SHARPDETECT_DEPS)) += fate-filter-sharpdetect fate-filter-sharpdetect-threads
+fate-filter-sharpdetect: CMD = ffmpeg -filter_complex_threads 1 -lavfi "testsrc2=size=352x288:rate=5:duration=2,sharpdetect,metadata=print:file=-" -f null /dev/null
+fate-filter-sharpdetect-threads: CMD = ffmpeg -filter_complex_threads 4 -lavfi "testsrc2=size=352x288:rate=5:duration=2,sharpdetect,metadata=print:file=-" -f null /dev/null
+fate-filter-sharpdetect-threads: REF = $(SRC_PATH)/tests/ref/fate/filter-sharpdetect
+
 FATE_FILTER_VSYNTH-$(CONFIG_VFLIP_FILTER) += fate-filter-vflip
 fate-filter-vflip: CMD = video_filter "vflip"
 
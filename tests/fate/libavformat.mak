@@ -1,6 +1,10 @@
-#FATE_LIBAVFORMAT-$(HAVE_PTHREADS) += fate-async
-#fate-async: libavformat/tests/async$(EXESUF)
-#fate-async: CMD = run libavformat/tests/async
+FATE_LIBAVFORMAT-$(call ALLYES, ASYNC_PROTOCOL FILE_PROTOCOL) += fate-async
+fate-async: libavformat/tests/async$(EXESUF)
+fate-async: CMD = run libavformat/tests/async$(EXESUF) $(TARGET_PATH)/tests/data/fate/async.bin
+
+FATE_LIBAVFORMAT-$(HAVE_LINUX_IO_URING_H) += fate-io_uring
+fate-io_uring: libavformat/tests/io_uring$(EXESUF)
+fate-io_uring: CMD = run libavformat/tests/io_uring$(EXESUF) $(TARGET_PATH)/tests/data/fate/io_uring.bin
 
 FATE_LIBAVFORMAT-$(CONFIG_NETWORK) += fate-noproxy
 fate-noproxy: libavformat/tests/noproxy$(EXESUF)
@@ -265,12 +265,42 @@ fate-seek-mkv-codec-delay:   CMD = run libavformat/tests/seek$(EXESUF) $(TARGET_
 
 FATE_SEEK_EXTRA += $(FATE_SEEK_EXTRA-yes)
 
+# the mov index built on demand has to seek like the full one
+FATE_SEEK_LAZY_INDEX-$(call ENCDEC2, MPEG4, PCM_ALAW, MOV) += fate-seek-lavf-mov-lazy-index
+fate-seek-lavf-mov-lazy-index: fate-lavf-mov
+fate-seek-lavf-mov-lazy-index: CMD = run libavformat/tests/seek$(EXESUF) $(TARGET_PATH)/tests/data/lavf/lavf.mov -lazy_index 1
+fate-seek-lavf-mov-lazy-index: REF = $(SRC_PATH)/tests/ref/seek/lavf-mov
 
-$(FATE_SEEK) $(FATE_SAMPLES_SEEK) $(FATE_SEEK_EXTRA): libavformat/tests/seek$(EXESUF)
+# a window of 2 entries has to be rebuilt for nearly every packet and seek
+FATE_SEEK_LAZY_INDEX-$(call ENCDEC2, MPEG4, PCM_ALAW, MOV) += fate-seek-lavf-mov-lazy-index-window
+fate-seek-lavf-mov-lazy-index-window: fate-lavf-mov
+fate-seek-lavf-mov-lazy-index-window: CMD = run libavformat/tests/seek$(EXESUF) $(TARGET_PATH)/tests/data/lavf/lavf.mov -lazy_index 1 -lazy_index_window 2
+fate-seek-lavf-mov-lazy-index-window: REF = $(SRC_PATH)/tests/ref/seek/lavf-mov
+
+# the aac priming edit has to discard the same packets as the full index
+FATE_SEEK_LAZY_INDEX-$(call ENCDEC2, MPEG4, AAC, MOV) += fate-seek-mov-lazy-index-priming
+fate-seek-mov-lazy-index-priming: ffprobe$(PROGSSUF)$(EXESUF) $(AREF) $(VREF)
+fate-seek-mov-lazy-index-priming: CMD = lazyindex -c:v mpeg4 -c:a aac -b:a 64k
+
+FATE_SEEK_LAZY_INDEX +=$(FATE_SEEK_LAZY_INDEX-yes)
+
+# reads and seeks served from a mapping of the file and from io_uring
+FATE_SEEK_FILE-$(call ENCDEC2, MPEG4, PCM_ALAW, MOV) += fate-seek-lavf-mov-mmap fate-seek-lavf-mov-io_uring
+fate-seek-lavf-mov-mmap: fate-lavf-mov
+fate-seek-lavf-mov-mmap: CMD = run libavformat/tests/seek$(EXESUF) $(TARGET_PATH)/tests/data/lavf/lavf.mov -mmap 1
+fate-seek-lavf-mov-mmap: REF = $(SRC_PATH)/tests/ref/seek/lavf-mov
+fate-seek-lavf-mov-io_uring: fate-lavf-mov
+fate-seek-lavf-mov-io_uring: CMD = run libavformat/tests/seek$(EXESUF) $(TARGET_PATH)/tests/data/lavf/lavf.mov -io_uring 1 -io_uring_depth 2
+fate-seek-lavf-mov-io_uring: REF = $(SRC_PATH)/tests/ref/seek/lavf-mov
+
+FATE_SEEK_FILE += $(FATE_SEEK_FILE-yes)
+
+
+$(FATE_SEEK) $(FATE_SAMPLES_SEEK) $(FATE_SEEK_EXTRA) $(FATE_SEEK_LAZY_INDEX) $(FATE_SEEK_FILE): libavformat/tests/seek$(EXESUF)
 $(FATE_SEEK) $(FATE_SAMPLES_SEEK): CMD = run libavformat/tests/seek$(EXESUF) $(TARGET_PATH)/tests/data/$(SRC)
 $(FATE_SEEK) $(FATE_SAMPLES_SEEK): fate-seek-%: fate-%
 fate-seek-%: REF = $(SRC_PATH)/tests/ref/seek/$(@:fate-seek-%=%)
 
-FATE_AVCONV += $(FATE_SEEK)
+FATE_AVCONV += $(FATE_SEEK) $(FATE_SEEK_LAZY_INDEX) $(FATE_SEEK_FILE)
 FATE_SAMPLES_AVCONV += $(FATE_SAMPLES_SEEK) $(FATE_SEEK_EXTRA)
-fate-seek:     $(FATE_SEEK) $(FATE_SAMPLES_SEEK) $(FATE_SEEK_EXTRA)
+fate-seek:     $(FATE_SEEK) $(FATE_SAMPLES_SEEK) $(FATE_SEEK_EXTRA) $(FATE_SEEK_LAZY_INDEX) $(FATE_SEEK_FILE)